@@ -0,0 +1,485 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/* Function bodies for bihash_template.h.  Included once per
+   key/value type after corresponding typed header (see bihash.c). */
+
+#ifndef BIHASH_TYPE
+#error BIHASH_TYPE not defined
+#endif
+
+static_always_inline uword
+BV (clib_bihash_page_bytes) (uword log2_pages)
+{
+  return round_pow2 (sizeof (BVT (clib_bihash_page)) << log2_pages,
+		     CLIB_CACHE_LINE_BYTES);
+}
+
+static void
+BV (clib_bihash_alloc_lock) (BVT (clib_bihash) * h)
+{
+  while (clib_smp_swap (&h->alloc_lock, 1))
+    while (h->alloc_lock)
+      clib_smp_pause ();
+}
+
+static void
+BV (clib_bihash_alloc_unlock) (BVT (clib_bihash) * h)
+{
+  CLIB_MEMORY_BARRIER ();
+  h->alloc_lock = 0;
+}
+
+/* Push pages onto free list.  Called with allocator locked. */
+static void
+BV (clib_bihash_free_pages_locked) (BVT (clib_bihash) * h, u32 offset, uword log2_pages)
+{
+  BVT (clib_bihash_page) * p = BV (clib_bihash_get_page) (h, offset);
+  p->next_free = h->free_offsets[log2_pages];
+  h->free_offsets[log2_pages] = offset;
+}
+
+/* Move retired pages whose grace period has ended to free lists.
+   Called with allocator locked. */
+static void
+BV (clib_bihash_reclaim) (BVT (clib_bihash) * h)
+{
+  clib_bihash_retired_t * r;
+  uword i, my_cpu;
+  u64 e, min_epoch;
+
+  /* We are not inside a lookup so our own CPU is quiescent. */
+  my_cpu = os_get_cpu_number ();
+
+  min_epoch = ~0ULL;
+  for (i = 0; i < h->n_readers; i++)
+    {
+      e = h->readers[i].epoch;
+      if (i != my_cpu && e != 0 && e < min_epoch)
+	min_epoch = e;
+    }
+
+  while (h->n_retired > 0)
+    {
+      r = h->retired + h->retired_head;
+      if (r->epoch > min_epoch)
+	break;
+      BV (clib_bihash_free_pages_locked) (h, r->offset, r->log2_pages);
+      h->retired_head = (h->retired_head + 1) % BIHASH_MAX_RETIRED;
+      h->n_retired -= 1;
+    }
+}
+
+/* Returns arena offset of pages or zero when arena is full. */
+static u32
+BV (clib_bihash_alloc_pages) (BVT (clib_bihash) * h, uword log2_pages)
+{
+  BVT (clib_bihash_page) * p;
+  uword n_bytes;
+  u32 offset;
+
+  BV (clib_bihash_alloc_lock) (h);
+
+  BV (clib_bihash_reclaim) (h);
+
+  offset = h->free_offsets[log2_pages];
+  if (offset != 0)
+    {
+      p = BV (clib_bihash_get_page) (h, offset);
+      h->free_offsets[log2_pages] = p->next_free;
+    }
+  else
+    {
+      n_bytes = BV (clib_bihash_page_bytes) (log2_pages);
+      if (h->arena_next_offset + n_bytes <= h->arena_n_bytes)
+	{
+	  offset = h->arena_next_offset;
+	  h->arena_next_offset += n_bytes;
+	}
+    }
+
+  BV (clib_bihash_alloc_unlock) (h);
+
+  return offset;
+}
+
+/* Free pages which were never published. */
+static void
+BV (clib_bihash_free_pages) (BVT (clib_bihash) * h, u32 offset, uword log2_pages)
+{
+  BV (clib_bihash_alloc_lock) (h);
+  BV (clib_bihash_free_pages_locked) (h, offset, log2_pages);
+  BV (clib_bihash_alloc_unlock) (h);
+}
+
+/* Queue pages replaced in a bucket for freeing after grace period. */
+static void
+BV (clib_bihash_retire_pages) (BVT (clib_bihash) * h, u32 offset, uword log2_pages)
+{
+  clib_bihash_retired_t * r;
+  uword my_cpu;
+
+  BV (clib_bihash_alloc_lock) (h);
+
+  while (1)
+    {
+      BV (clib_bihash_reclaim) (h);
+      if (h->n_retired < BIHASH_MAX_RETIRED)
+	break;
+
+      /* Wait for slow readers.  We are not inside a lookup so mark
+	 our own CPU quiescent: other writers may be waiting for us. */
+      my_cpu = os_get_cpu_number ();
+      if (h->readers[my_cpu].epoch != 0)
+	h->readers[my_cpu].epoch = h->epoch;
+      BV (clib_bihash_alloc_unlock) (h);
+      clib_smp_pause ();
+      BV (clib_bihash_alloc_lock) (h);
+    }
+
+  /* Readers seeing new epoch have also seen new bucket. */
+  h->epoch += 1;
+
+  r = h->retired + (h->retired_head + h->n_retired) % BIHASH_MAX_RETIRED;
+  r->epoch = h->epoch;
+  r->offset = offset;
+  r->log2_pages = log2_pages;
+  h->n_retired += 1;
+
+  BV (clib_bihash_alloc_unlock) (h);
+}
+
+/* Spin until bucket lock is acquired; returns bucket contents. */
+static clib_bihash_bucket_t
+BV (clib_bihash_lock_bucket) (clib_bihash_bucket_t * b)
+{
+  clib_bihash_bucket_t old, new;
+
+  while (1)
+    {
+      old.as_u64 = *(volatile u64 *) &b->as_u64;
+      if (! old.lock)
+	{
+	  new = old;
+	  new.lock = 1;
+	  if (clib_smp_compare_and_swap (&b->as_u64, new.as_u64, old.as_u64) == old.as_u64)
+	    return old;
+	}
+      clib_smp_pause ();
+    }
+}
+
+/* Insert key/value pair into unpublished pages.  Returns -1 when
+   target page is full. */
+static int
+BV (clib_bihash_insert) (BVT (clib_bihash) * h,
+			 BVT (clib_bihash_page) * pages,
+			 uword log2_pages,
+			 BVT (clib_bihash_kv) * kv)
+{
+  BVT (clib_bihash_page) * p;
+  uword i;
+
+  p = pages + BV (clib_bihash_page_index) (h, BV (clib_bihash_hash) (kv), log2_pages);
+  for (i = 0; i < BIHASH_KVP_PER_PAGE; i++)
+    if (p->kvp[i].value == BIHASH_EMPTY_VALUE)
+      {
+	p->kvp[i] = kv[0];
+	return 0;
+      }
+
+  return -1;
+}
+
+/* Copy of bucket with KV added.  Number of pages doubles each time
+   a page overflows. */
+static u32
+BV (clib_bihash_copy_and_insert) (BVT (clib_bihash) * h,
+				  clib_bihash_bucket_t old,
+				  BVT (clib_bihash_kv) * kv,
+				  uword * log2_pages_return)
+{
+  BVT (clib_bihash_page) * old_pages, * new_pages;
+  uword log2_pages, i, j;
+  u32 offset;
+
+  old_pages = old.offset ? BV (clib_bihash_get_page) (h, old.offset) : 0;
+  log2_pages = old.offset ? old.log2_pages : 0;
+
+  while (1)
+    {
+      offset = BV (clib_bihash_alloc_pages) (h, log2_pages);
+      if (offset == 0)
+	return 0;
+
+      new_pages = BV (clib_bihash_get_page) (h, offset);
+      memset (new_pages, ~0, sizeof (new_pages[0]) << log2_pages);
+
+      if (BV (clib_bihash_insert) (h, new_pages, log2_pages, kv))
+	goto overflow;
+
+      if (old_pages)
+	for (i = 0; i < (1 << old.log2_pages); i++)
+	  for (j = 0; j < BIHASH_KVP_PER_PAGE; j++)
+	    {
+	      BVT (clib_bihash_kv) * o = old_pages[i].kvp + j;
+	      if (o->value != BIHASH_EMPTY_VALUE
+		  && BV (clib_bihash_insert) (h, new_pages, log2_pages, o))
+		goto overflow;
+	    }
+
+      *log2_pages_return = log2_pages;
+      return offset;
+
+    overflow:
+      BV (clib_bihash_free_pages) (h, offset, log2_pages);
+      if (log2_pages >= BIHASH_MAX_LOG2_PAGES)
+	return 0;
+      log2_pages += 1;
+      clib_smp_atomic_add (&h->n_bucket_splits, 1);
+    }
+}
+
+int BV (clib_bihash_add_del) (BVT (clib_bihash) * h,
+			      BVT (clib_bihash_kv) * add_v,
+			      int is_add)
+{
+  clib_bihash_bucket_t * b, old, new;
+  BVT (clib_bihash_page) * old_pages, * p;
+  BVT (clib_bihash_kv) * kv;
+  uword i, n_kvp, log2_pages;
+  u64 hash;
+
+  /* Empty value is reserved. */
+  ASSERT (! is_add || add_v->value != BIHASH_EMPTY_VALUE);
+
+  hash = BV (clib_bihash_hash) (add_v);
+  b = h->buckets + (hash & pow2_mask (h->log2_n_buckets));
+
+  old = BV (clib_bihash_lock_bucket) (b);
+  new.as_u64 = 0;
+
+  kv = 0;
+  old_pages = 0;
+  if (old.offset != 0)
+    {
+      old_pages = BV (clib_bihash_get_page) (h, old.offset);
+      p = old_pages + BV (clib_bihash_page_index) (h, hash, old.log2_pages);
+      for (i = 0; i < BIHASH_KVP_PER_PAGE; i++)
+	if (p->kvp[i].value != BIHASH_EMPTY_VALUE
+	    && BV (clib_bihash_key_equal) (p->kvp + i, add_v))
+	  {
+	    kv = p->kvp + i;
+	    break;
+	  }
+    }
+
+  if (is_add)
+    {
+      if (kv)
+	{
+	  /* Readers see either old or new value. */
+	  *(volatile u64 *) &kv->value = add_v->value;
+	  goto unlock;
+	}
+
+      new.offset = BV (clib_bihash_copy_and_insert) (h, old, add_v, &log2_pages);
+      if (new.offset == 0)
+	goto fail;
+      new.log2_pages = log2_pages;
+      clib_smp_atomic_add (&h->n_elts, 1);
+    }
+  else
+    {
+      if (! kv)
+	goto fail;
+
+      n_kvp = 0;
+      for (i = 0; i < (BIHASH_KVP_PER_PAGE << old.log2_pages); i++)
+	n_kvp += old_pages->kvp[i].value != BIHASH_EMPTY_VALUE;
+
+      /* Deleting last key empties bucket; otherwise copy bucket
+	 less deleted key. */
+      if (n_kvp > 1)
+	{
+	  new.offset = BV (clib_bihash_alloc_pages) (h, old.log2_pages);
+	  if (new.offset == 0)
+	    goto fail;
+	  new.log2_pages = old.log2_pages;
+	  p = BV (clib_bihash_get_page) (h, new.offset);
+	  memcpy (p, old_pages, sizeof (p[0]) << old.log2_pages);
+	  memset (p->kvp + (kv - old_pages->kvp), ~0, sizeof (kv[0]));
+	}
+      clib_smp_atomic_add (&h->n_elts, -1);
+    }
+
+  /* Publish new pages and unlock bucket with single store. */
+  clib_smp_swap (&b->as_u64, new.as_u64);
+
+  if (old.offset != 0)
+    BV (clib_bihash_retire_pages) (h, old.offset, old.log2_pages);
+
+  return 0;
+
+ fail:
+  clib_smp_swap (&b->as_u64, old.as_u64);
+  return -1;
+
+ unlock:
+  clib_smp_swap (&b->as_u64, old.as_u64);
+  return 0;
+}
+
+void BV (clib_bihash_init) (BVT (clib_bihash) * h, char * name,
+			    u32 n_buckets, uword arena_n_bytes)
+{
+  memset (h, 0, sizeof (h[0]));
+
+  h->name = format (0, "%s", name);
+
+  h->log2_n_buckets = max_log2 (clib_max (n_buckets, 1));
+  h->buckets = clib_mem_alloc_aligned (sizeof (h->buckets[0]) << h->log2_n_buckets,
+				       CLIB_CACHE_LINE_BYTES);
+  memset (h->buckets, 0, sizeof (h->buckets[0]) << h->log2_n_buckets);
+
+  /* Pages are addressed by 32 bit offset. */
+  h->arena_n_bytes = clib_min (arena_n_bytes, (uword) (u32) ~0);
+  h->arena = clib_mem_alloc_aligned (h->arena_n_bytes, CLIB_CACHE_LINE_BYTES);
+
+  /* Offset zero marks empty bucket. */
+  h->arena_next_offset = CLIB_CACHE_LINE_BYTES;
+
+  h->retired = clib_mem_alloc (BIHASH_MAX_RETIRED * sizeof (h->retired[0]));
+
+  /* Zero epoch means CPU is not reading. */
+  h->epoch = 1;
+  h->n_readers = clib_max (clib_smp_main.n_cpus, 1);
+  h->readers = clib_mem_alloc_aligned (h->n_readers * sizeof (h->readers[0]),
+				       CLIB_CACHE_LINE_BYTES);
+  memset (h->readers, 0, h->n_readers * sizeof (h->readers[0]));
+}
+
+void BV (clib_bihash_free) (BVT (clib_bihash) * h)
+{
+  clib_mem_free (h->buckets);
+  clib_mem_free (h->arena);
+  clib_mem_free (h->retired);
+  clib_mem_free (h->readers);
+  vec_free (h->name);
+  memset (h, 0, sizeof (h[0]));
+}
+
+void BV (clib_bihash_foreach_key_value_pair) (BVT (clib_bihash) * h,
+					      void (* f) (BVT (clib_bihash_kv) * kv, void * arg),
+					      void * arg)
+{
+  BVT (clib_bihash_page) * p;
+  clib_bihash_bucket_t * b;
+  uword i, j;
+
+  for (i = 0; i < (1 << h->log2_n_buckets); i++)
+    {
+      b = h->buckets + i;
+      if (b->offset == 0)
+	continue;
+      p = BV (clib_bihash_get_page) (h, b->offset);
+      for (j = 0; j < (BIHASH_KVP_PER_PAGE << b->log2_pages); j++)
+	if (p->kvp[j].value != BIHASH_EMPTY_VALUE)
+	  f (p->kvp + j, arg);
+    }
+}
+
+clib_error_t * BV (clib_bihash_validate) (BVT (clib_bihash) * h)
+{
+  BVT (clib_bihash_page) * p;
+  BVT (clib_bihash_kv) * kv;
+  clib_bihash_bucket_t * b;
+  uword i, j, n_elts;
+  u64 hash;
+
+  n_elts = 0;
+  for (i = 0; i < (1 << h->log2_n_buckets); i++)
+    {
+      b = h->buckets + i;
+      if (b->lock)
+	return clib_error_create ("bucket %wd locked", i);
+      if (b->offset == 0)
+	continue;
+      if (b->offset % CLIB_CACHE_LINE_BYTES != 0
+	  || b->offset + BV (clib_bihash_page_bytes) (b->log2_pages) > h->arena_next_offset)
+	return clib_error_create ("bucket %wd bad offset 0x%x", i, b->offset);
+
+      p = BV (clib_bihash_get_page) (h, b->offset);
+      for (j = 0; j < (BIHASH_KVP_PER_PAGE << b->log2_pages); j++)
+	{
+	  kv = p->kvp + j;
+	  if (kv->value == BIHASH_EMPTY_VALUE)
+	    continue;
+	  hash = BV (clib_bihash_hash) (kv);
+	  if ((hash & pow2_mask (h->log2_n_buckets)) != i
+	      || BV (clib_bihash_page_index) (h, hash, b->log2_pages) != j / BIHASH_KVP_PER_PAGE)
+	    return clib_error_create ("bucket %wd slot %wd: key in wrong place", i, j);
+	  n_elts++;
+	}
+    }
+
+  if (n_elts != h->n_elts)
+    return clib_error_create ("found %wd key/value pairs expected %d", n_elts, h->n_elts);
+
+  return 0;
+}
+
+u8 * BV (format_clib_bihash) (u8 * s, va_list * args)
+{
+  BVT (clib_bihash) * h = va_arg (*args, BVT (clib_bihash) *);
+  int verbose = va_arg (*args, int);
+  uword i, n_non_empty, n_by_log2_pages[BIHASH_MAX_LOG2_PAGES + 1];
+  clib_bihash_bucket_t * b;
+
+  n_non_empty = 0;
+  memset (n_by_log2_pages, 0, sizeof (n_by_log2_pages));
+  for (i = 0; i < (1 << h->log2_n_buckets); i++)
+    {
+      b = h->buckets + i;
+      if (b->offset == 0)
+	continue;
+      n_non_empty++;
+      n_by_log2_pages[b->log2_pages]++;
+    }
+
+  s = format (s, "%v: %d key/value pairs, %d buckets, %wd non-empty, %Ld splits",
+	      h->name, h->n_elts, 1 << h->log2_n_buckets, n_non_empty,
+	      h->n_bucket_splits);
+
+  s = format (s, "\n    arena %U used of %U, %d retired, epoch %Ld",
+	      format_memory_size, h->arena_next_offset,
+	      format_memory_size, h->arena_n_bytes,
+	      h->n_retired, h->epoch);
+
+  if (verbose)
+    for (i = 0; i < ARRAY_LEN (n_by_log2_pages); i++)
+      if (n_by_log2_pages[i] > 0)
+	s = format (s, "\n    %wd buckets with %d pages", n_by_log2_pages[i], 1 << i);
+
+  return s;
+}
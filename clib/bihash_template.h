@@ -0,0 +1,304 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/* Bounded-index hash tables with fixed size key/value pairs.
+   Readers never lock: they may run on any CPU while a writer adds or
+   deletes.  Writers lock a single bucket, build a new copy of the
+   bucket's pages with the change applied and publish it with one
+   atomic store of the bucket word.  Replaced pages are retired and
+   recycled only after every reading CPU has passed a quiescent point
+   (see clib_bihash_quiescent below).
+
+   All pages live in a single arena allocated at init time so buckets
+   refer to pages by 32 bit arena offset.
+
+   This file is a template: include one of the typed headers
+   (e.g. <clib/bihash_8_8.h>) which define BIHASH_TYPE and
+   BIHASH_KEY_N_U64 and then include this file. */
+
+#ifndef included_clib_bihash_template_common_h
+#define included_clib_bihash_template_common_h
+
+#include <clib/cache.h>
+#include <clib/error.h>
+#include <clib/format.h>
+#include <clib/hash.h>
+#include <clib/smp.h>
+
+#define _clib_bihash_name(a,b) a##b
+#define clib_bihash_name(a,b) _clib_bihash_name(a,b)
+
+/* Values: BV(clib_bihash_search) => clib_bihash_search_8_8.
+   Types: BVT(clib_bihash) => clib_bihash_8_8_t. */
+#define BV(a) clib_bihash_name(a,BIHASH_TYPE)
+#define BVT(a) clib_bihash_name(clib_bihash_name(a,BIHASH_TYPE),_t)
+
+/* Key/value pairs per page. */
+#define BIHASH_KVP_PER_PAGE 4
+
+/* Buckets grow by doubling their number of pages up to this limit. */
+#define BIHASH_MAX_LOG2_PAGES 8
+
+/* Value marking an empty key/value slot. */
+#define BIHASH_EMPTY_VALUE (~0ULL)
+
+typedef union {
+  struct {
+    /* Arena offset of bucket's pages; zero for empty bucket. */
+    u32 offset;
+
+    /* Non-zero when a writer owns bucket. */
+    u8 lock;
+
+    /* Log2 number of pages in bucket. */
+    u8 log2_pages;
+
+    u16 pad;
+  };
+
+  /* Bucket is read and written atomically as a single word. */
+  u64 as_u64;
+} clib_bihash_bucket_t;
+
+/* Per CPU reader state on its own cache line. */
+typedef struct {
+  /* Last table epoch seen at a quiescent point; zero when CPU
+     is not reading table. */
+  volatile u64 epoch;
+
+  u8 pad[CLIB_CACHE_LINE_BYTES - sizeof (u64)];
+} clib_bihash_reader_t;
+
+/* Pages replaced by a writer; recycled once all readers have seen
+   an epoch at least as large as retire epoch. */
+typedef struct {
+  u64 epoch;
+  u32 offset;
+  u32 log2_pages;
+} clib_bihash_retired_t;
+
+/* Size of retired page ring.  Writers wait for readers to pass a
+   quiescent point when ring is full. */
+#define BIHASH_MAX_RETIRED 256
+
+#endif /* included_clib_bihash_template_common_h */
+
+/* Type specific part of template. */
+
+#ifndef BIHASH_TYPE
+#error BIHASH_TYPE not defined
+#endif
+
+typedef struct {
+  u64 key[BIHASH_KEY_N_U64];
+  u64 value;
+} BVT (clib_bihash_kv);
+
+typedef union {
+  BVT (clib_bihash_kv) kvp[BIHASH_KVP_PER_PAGE];
+
+  /* Free pages are linked by arena offset.  Retired pages may still
+     be read and so are never written. */
+  u32 next_free;
+} BVT (clib_bihash_page);
+
+typedef struct {
+  clib_bihash_bucket_t * buckets;
+
+  u32 log2_n_buckets;
+
+  /* Pages are allocated from a single arena. */
+  u8 * arena;
+
+  uword arena_n_bytes;
+
+  /* Allocation point for never used arena memory. */
+  uword arena_next_offset;
+
+  /* Spin lock for page allocator. */
+  volatile u32 alloc_lock;
+
+  /* Free lists indexed by log2 pages. */
+  u32 free_offsets[BIHASH_MAX_LOG2_PAGES + 1];
+
+  /* Ring of pages waiting for grace period to end. */
+  clib_bihash_retired_t * retired;
+
+  u32 retired_head, n_retired;
+
+  /* Incremented each time pages are retired. */
+  volatile u64 epoch;
+
+  /* Reader state indexed by CPU number. */
+  clib_bihash_reader_t * readers;
+
+  u32 n_readers;
+
+  /* Number of key/value pairs in table. */
+  u32 n_elts;
+
+  /* Number of times a bucket had to grow. */
+  u64 n_bucket_splits;
+
+  u8 * name;
+} BVT (clib_bihash);
+
+always_inline BVT (clib_bihash_page) *
+BV (clib_bihash_get_page) (BVT (clib_bihash) * h, u32 offset)
+{ return (void *) (h->arena + offset); }
+
+always_inline u64
+BV (clib_bihash_hash) (BVT (clib_bihash_kv) * kv)
+{
+  u64 a, b, c;
+  uword i;
+
+  a = b = 0x9e3779b97f4a7c13LL;
+  c = BIHASH_KEY_N_U64 * sizeof (u64);
+  for (i = 0; i + 3 <= BIHASH_KEY_N_U64; i += 3)
+    {
+      a += kv->key[i + 0];
+      b += kv->key[i + 1];
+      c += kv->key[i + 2];
+      hash_mix64 (a, b, c);
+    }
+
+  if (BIHASH_KEY_N_U64 % 3 != 0)
+    {
+      a += kv->key[i + 0];
+      if (BIHASH_KEY_N_U64 % 3 == 2)
+	b += kv->key[i + 1];
+      hash_mix64 (a, b, c);
+    }
+
+  return c;
+}
+
+always_inline uword
+BV (clib_bihash_key_equal) (BVT (clib_bihash_kv) * a, BVT (clib_bihash_kv) * b)
+{
+  u64 d = 0;
+  uword i;
+  for (i = 0; i < BIHASH_KEY_N_U64; i++)
+    d |= a->key[i] ^ b->key[i];
+  return d == 0;
+}
+
+/* Bucket index comes from low bits of hash; page within bucket from
+   following bits. */
+always_inline uword
+BV (clib_bihash_page_index) (BVT (clib_bihash) * h, u64 hash, uword log2_pages)
+{ return (hash >> h->log2_n_buckets) & pow2_mask (log2_pages); }
+
+/* Lookup key in SEARCH; on success copy key/value pair to RESULT
+   and return 0.  Returns -1 if key is not found.  Safe to call while
+   other CPUs add and delete keys. */
+always_inline int
+BV (clib_bihash_search) (BVT (clib_bihash) * h,
+			 BVT (clib_bihash_kv) * search,
+			 BVT (clib_bihash_kv) * result)
+{
+  clib_bihash_bucket_t b;
+  BVT (clib_bihash_page) * p;
+  BVT (clib_bihash_kv) * kv;
+  u64 hash, value;
+  uword i;
+
+  hash = BV (clib_bihash_hash) (search);
+
+  /* Single read of bucket: pages it points to are never modified
+     until grace period after they are replaced. */
+  b.as_u64 = *(volatile u64 *) &h->buckets[hash & pow2_mask (h->log2_n_buckets)].as_u64;
+  if (b.offset == 0)
+    return -1;
+
+  p = BV (clib_bihash_get_page) (h, b.offset);
+  p += BV (clib_bihash_page_index) (h, hash, b.log2_pages);
+
+  for (i = 0; i < BIHASH_KVP_PER_PAGE; i++)
+    {
+      kv = p->kvp + i;
+
+      /* Values may be replaced in place by a single atomic store. */
+      value = *(volatile u64 *) &kv->value;
+      if (value != BIHASH_EMPTY_VALUE
+	  && BV (clib_bihash_key_equal) (kv, search))
+	{
+	  memcpy (result->key, kv->key, sizeof (result->key));
+	  result->value = value;
+	  return 0;
+	}
+    }
+
+  return -1;
+}
+
+/* Reader CPUs call this between lookups (e.g. once per batch of
+   packets): it promises that no page pointers from earlier lookups
+   are still in use.  Must be called before the first lookup on each
+   reading CPU. */
+always_inline void
+BV (clib_bihash_quiescent) (BVT (clib_bihash) * h)
+{
+  uword cpu = os_get_cpu_number ();
+  ASSERT (cpu < h->n_readers);
+  CLIB_MEMORY_BARRIER ();
+  h->readers[cpu].epoch = h->epoch;
+  CLIB_MEMORY_BARRIER ();
+}
+
+/* Reader CPU stops reading table; writers no longer wait for it. */
+always_inline void
+BV (clib_bihash_offline) (BVT (clib_bihash) * h)
+{
+  uword cpu = os_get_cpu_number ();
+  ASSERT (cpu < h->n_readers);
+  CLIB_MEMORY_BARRIER ();
+  h->readers[cpu].epoch = 0;
+}
+
+/* Allocate table with given number of buckets (rounded to a power of 2)
+   and arena for pages.  Should be called on a heap all CPUs share. */
+void BV (clib_bihash_init) (BVT (clib_bihash) * h, char * name,
+			    u32 n_buckets, uword arena_n_bytes);
+
+void BV (clib_bihash_free) (BVT (clib_bihash) * h);
+
+/* Add (or replace value of) key/value pair or delete key.  Returns 0 on
+   success; -1 when key to delete is not found or arena is full. */
+int BV (clib_bihash_add_del) (BVT (clib_bihash) * h,
+			      BVT (clib_bihash_kv) * add_v,
+			      int is_add);
+
+/* Call function for each key/value pair; not safe against concurrent
+   writers. */
+void BV (clib_bihash_foreach_key_value_pair) (BVT (clib_bihash) * h,
+					      void (* f) (BVT (clib_bihash_kv) * kv, void * arg),
+					      void * arg);
+
+/* Checks consistency of buckets and page allocator; not safe against
+   concurrent writers. */
+clib_error_t * BV (clib_bihash_validate) (BVT (clib_bihash) * h);
+
+/* Format args: table pointer, verbose. */
+format_function_t BV (format_clib_bihash);
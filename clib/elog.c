@@ -22,6 +22,7 @@
 */
 
 #include <clib/elog.h>
+#include <clib/bitmap.h>
 #include <clib/cache.h>
 #include <clib/error.h>
 #include <clib/format.h>
@@ -36,46 +37,101 @@ elog_event_data (elog_main_t * em,
 		 u64 cpu_time)
 { return elog_event_data_inline (em, type, track, cpu_time); }
 
+/* Types are found by format and format args since the same format
+   may be used with different args (e.g. inline or table strings). */
+static u32 find_type_key (elog_main_t * em, char * format, char * format_args,
+			  u32 flags, uword is_add)
+{
+  u8 * key = 0;
+  u32 id;
+
+  vec_add (key, format, strlen (format) + 1);
+  vec_add (key, format_args, strlen (format_args));
+  if (flags)
+    {
+      vec_add1 (key, 0);
+      vec_add (key, (u8 *) &flags, sizeof (flags));
+    }
+  if (is_add)
+    id = clib_intern_vec (&em->event_type_keys, key);
+  else
+    id = clib_intern_find (&em->event_type_keys, key, vec_len (key));
+  vec_free (key);
+  return id;
+}
+
 static void new_event_type (elog_main_t * em, uword i)
 {
   elog_event_type_t * t = vec_elt_at_index (em->event_types, i);
+  u32 id = find_type_key (em, t->format, t->format_args, t->flags, /* is_add */ 1);
 
-  if (! em->event_type_by_format)
-    em->event_type_by_format = hash_create_vec (/* size */ 0, sizeof (u8), sizeof (uword));
+  vec_validate (em->event_type_by_key_id, id);
+  em->event_type_by_key_id[id] = i;
+}
 
-  hash_set_mem (em->event_type_by_format, t->format, i);
+/* Type index with given format, args and flags or ~0 if none. */
+static uword
+find_type (elog_main_t * em, char * format, char * format_args, u32 flags)
+{
+  u32 id = find_type_key (em, format, format_args, flags, /* is_add */ 0);
+  if (id == CLIB_INTERN_ID_INVALID)
+    return ~0;
+  return em->event_type_by_key_id[id];
 }
 
 static uword
 find_or_create_type (elog_main_t * em, elog_event_type_t * t)
 {
-  uword * p = hash_get_mem (em->event_type_by_format, t->format);
-  uword i;
+  uword i = find_type (em, t->format, t->format_args, t->flags);
 
-  if (p)
-    i = p[0];
-  else
+  if (i == ~0)
     {
+      elog_event_type_t * d;
+      uword j;
+
       i = vec_len (em->event_types);
-      vec_add1 (em->event_types, t[0]);
+      vec_add2 (em->event_types, d, 1);
+      d[0] = t[0];
+
+      /* Own copies of strings so each log can be freed separately. */
+      d->format = (char *) format (0, "%s%c", t->format, 0);
+      d->format_args = (char *) format (0, "%s%c", t->format_args, 0);
+      d->enum_strings_vector = 0;
+      for (j = 0; j < vec_len (t->enum_strings_vector); j++)
+	vec_add1 (d->enum_strings_vector,
+		  (char *) format (0, "%s%c", t->enum_strings_vector[j], 0));
+
       new_event_type (em, i);
     }
 
   return i;
 }
 
+/* Whether registered type T has same enum strings as static type S. */
+static uword
+elog_event_type_enums_equal (elog_event_type_t * t, elog_event_type_t * s)
+{
+  uword i;
+
+  if (t->n_enum_strings != s->n_enum_strings)
+    return 0;
+  for (i = 0; i < t->n_enum_strings; i++)
+    if (strcmp (t->enum_strings_vector[i], s->enum_strings[i]))
+      return 0;
+  return 1;
+}
+
 /* External function to register types. */
 word elog_event_type_register (elog_main_t * em, elog_event_type_t * t)
 {
   elog_event_type_t * static_type = t;
+  char * type_format;
   word l;
 
   clib_smp_lock (em->smp_lock);
 
   l = vec_len (em->event_types);
 
-  t->type_index_plus_one = 1 + l;
-
   ASSERT (t->format);
 
   /* If format args are not specified try to be smart about providing defaults
@@ -115,16 +171,39 @@ word elog_event_type_register (elog_main_t * em, elog_event_type_t * t)
       vec_add1 (t->format_args, 0);
     }    
 
-  vec_add1 (em->event_types, t[0]);
-
-  t = em->event_types + l;
+  {
+    uword i;
+    for (i = 0; i < t->n_enum_strings; i++)
+      if (! t->enum_strings[i])
+	t->enum_strings[i] = "MISSING";
+  }
 
   /* Make copies of strings for hashing etc. */
   if (t->function)
-    t->format = (char *) format (0, "%s %s%c", t->function, t->format, 0);
+    type_format = (char *) format (0, "%s %s%c", t->function, t->format, 0);
   else
-    t->format = (char *) format (0, "%s%c", t->format, 0);
+    type_format = (char *) format (0, "%s%c", t->format, 0);
+
+  /* Types registered more than once (e.g. same static type in
+     several places) share one type index. */
+  {
+    uword i = find_type (em, type_format, t->format_args, t->flags);
+    if (i != ~0 && elog_event_type_enums_equal (em->event_types + i, t))
+      {
+	vec_free (type_format);
+	t->type_index_plus_one = 1 + i;
+	clib_smp_unlock (em->smp_lock);
+	return i;
+      }
+  }
+
+  t->type_index_plus_one = 1 + l;
+
+  vec_add1 (em->event_types, t[0]);
 
+  t = em->event_types + l;
+
+  t->format = type_format;
   t->format_args = (char *) format (0, "%s%c", t->format_args, 0);
 
   /* Construct string table. */
@@ -132,12 +211,8 @@ word elog_event_type_register (elog_main_t * em, elog_event_type_t * t)
     uword i;
     t->n_enum_strings = static_type->n_enum_strings;
     for (i = 0; i < t->n_enum_strings; i++)
-      {
-	if (! static_type->enum_strings[i])
-	  static_type->enum_strings[i] = "MISSING";
-        vec_add1 (t->enum_strings_vector,
-                  (char *) format (0, "%s%c", static_type->enum_strings[i], 0));
-      }
+      vec_add1 (t->enum_strings_vector,
+		(char *) format (0, "%s%c", static_type->enum_strings[i], 0));
   }
 
   new_event_type (em, l);
@@ -300,7 +375,7 @@ u8 * format_elog_event (u8 * s, va_list * va)
 	      }
 	    else if (a[0] == 'T')
 	      {
-		char * e = vec_elt_at_index (em->string_table, n_bytes == 8 ? l : i);
+		char * e = (char *) vec_elt_at_index (em->string_table.arena, n_bytes == 8 ? l : i);
 		s = format (s, arg_format, e);
 	      }
 	    else if (n_bytes == 8)
@@ -392,12 +467,29 @@ elog_nsec_per_clock (elog_main_t * em)
 
 static void elog_alloc (elog_main_t * em, u32 n_events)
 {
+  elog_per_cpu_t * c;
+
   if (em->event_ring)
     vec_free (em->event_ring);
+  vec_foreach (c, em->per_cpu)
+    vec_free (c->event_ring);
+  vec_free (em->per_cpu);
   
   /* Ring size must be a power of 2. */
   em->event_ring_size = n_events = max_pow2 (n_events);
 
+  /* With more than one cpu each cpu gets its own ring. */
+  if (clib_smp_main.n_cpus > 1)
+    {
+      vec_validate_aligned (em->per_cpu, clib_smp_main.n_cpus - 1, CLIB_CACHE_LINE_BYTES);
+      vec_foreach (c, em->per_cpu)
+	{
+	  vec_resize_aligned (c->event_ring, n_events, CLIB_CACHE_LINE_BYTES);
+	  c->n_total_events_disable_limit = ~0ULL;
+	}
+      return;
+    }
+
   /* Leave an empty ievent at end so we can always speculatively write
      and event there (possibly a long form event). */
   vec_resize_aligned (em->event_ring, n_events, CLIB_CACHE_LINE_BYTES);
@@ -423,6 +515,42 @@ void elog_init (elog_main_t * em, u32 n_events)
   elog_time_now (&em->init_time);
 }
 
+void elog_free (elog_main_t * em)
+{
+  elog_event_type_t * t;
+  elog_track_t * tr;
+  elog_per_cpu_t * c;
+  uword i;
+
+  ASSERT (! em->stream);
+
+  vec_foreach (t, em->event_types)
+    {
+      vec_free (t->format);
+      vec_free (t->format_args);
+      for (i = 0; i < vec_len (t->enum_strings_vector); i++)
+	vec_free (t->enum_strings_vector[i]);
+      vec_free (t->enum_strings_vector);
+    }
+  vec_free (em->event_types);
+  clib_intern_free (&em->event_type_keys);
+  vec_free (em->event_type_by_key_id);
+  clib_intern_free (&em->string_table);
+
+  vec_foreach (tr, em->tracks)
+    vec_free (tr->name);
+  vec_free (em->tracks);
+
+  vec_free (em->event_ring);
+  vec_foreach (c, em->per_cpu)
+    vec_free (c->event_ring);
+  vec_free (em->per_cpu);
+  vec_free (em->events);
+
+  clib_smp_lock_free (&em->smp_lock);
+  memset (em, 0, sizeof (em[0]));
+}
+
 /* Returns number of events in ring and start index. */
 static uword elog_event_range (elog_main_t * em, uword * lo)
 {
@@ -442,11 +570,136 @@ static uword elog_event_range (elog_main_t * em, uword * lo)
     }
 }
 
+/* Track for default track events of given cpu. */
+static u32 elog_per_cpu_track (elog_main_t * em, uword cpu)
+{
+  elog_per_cpu_t * c = vec_elt_at_index (em->per_cpu, cpu);
+
+  if (c->track.track_index_plus_one == 0)
+    {
+      u8 * name = format (0, "cpu %d%c", cpu, 0);
+      c->track.name = (char *) name;
+      elog_track_register (em, &c->track);
+      vec_free (name);
+      c->track.name = 0;
+    }
+  return c->track.track_index_plus_one - 1;
+}
+
+/* Restores heap order (earliest time first) below heap index I.
+   Heap elements are indices into TIMES. */
+static void
+elog_heap_sift_down (f64 * times, u32 * heap, uword i)
+{
+  uword l, min, n = vec_len (heap);
+  u32 tmp;
+
+  while (1)
+    {
+      min = i;
+      l = 2*i + 1;
+      if (l < n && times[heap[l]] < times[heap[min]])
+	min = l;
+      if (l + 1 < n && times[heap[l + 1]] < times[heap[min]])
+	min = l + 1;
+      if (min == i)
+	break;
+      tmp = heap[i];
+      heap[i] = heap[min];
+      heap[min] = tmp;
+      i = min;
+    }
+}
+
+static void
+elog_heap_init (f64 * times, u32 * heap)
+{
+  word i;
+  for (i = vec_len (heap) / 2 - 1; i >= 0; i--)
+    elog_heap_sift_down (times, heap, i);
+}
+
+/* Seconds from start of log of ring event. */
+always_inline f64
+elog_event_time (elog_main_t * em, elog_event_t * e)
+{ return (e->time_cycles - em->init_time.cpu) * em->cpu_timer.seconds_per_clock; }
+
+/* Merges per cpu rings by time stamp.  Events on default track go
+   to a track for each cpu. */
+static elog_event_t * elog_peek_per_cpu_events (elog_main_t * em)
+{
+  elog_event_t * e, * f, * es = 0;
+  elog_per_cpu_t * c;
+  uword * next = 0, * n_left = 0;
+  uword i, n_cpus = vec_len (em->per_cpu);
+  u32 * cpu_tracks = 0, * heap = 0;
+  f64 * times = 0;
+
+  vec_validate (next, n_cpus - 1);
+  vec_validate (n_left, n_cpus - 1);
+  vec_validate (cpu_tracks, n_cpus - 1);
+  vec_validate (times, n_cpus - 1);
+  for (i = 0; i < n_cpus; i++)
+    {
+      u64 n;
+
+      c = vec_elt_at_index (em->per_cpu, i);
+      n = c->n_total_events;
+
+      /* Ring never wrapped? */
+      n_left[i] = clib_min (n, (u64) em->event_ring_size);
+      next[i] = n <= em->event_ring_size ? 0 : n & (em->event_ring_size - 1);
+
+      if (n_left[i] > 0)
+	{
+	  cpu_tracks[i] = elog_per_cpu_track (em, i);
+	  times[i] = elog_event_time (em, c->event_ring + next[i]);
+	  vec_add1 (heap, i);
+	}
+    }
+
+  /* Heap of cpus by time of oldest remaining event. */
+  elog_heap_init (times, heap);
+  while (vec_len (heap) > 0)
+    {
+      i = heap[0];
+      f = vec_elt_at_index (em->per_cpu[i].event_ring, next[i]);
+
+      vec_add2 (es, e, 1);
+      e[0] = f[0];
+      if (e->track == 0)
+	e->track = cpu_tracks[i];
+      e->time = times[i];
+
+      next[i] = (next[i] + 1) & (em->event_ring_size - 1);
+      n_left[i] -= 1;
+      if (n_left[i] > 0)
+	times[i] = elog_event_time (em, em->per_cpu[i].event_ring + next[i]);
+      else
+	{
+	  heap[0] = heap[vec_len (heap) - 1];
+	  _vec_len (heap) -= 1;
+	}
+      elog_heap_sift_down (times, heap, 0);
+    }
+
+  vec_free (next);
+  vec_free (n_left);
+  vec_free (cpu_tracks);
+  vec_free (heap);
+  vec_free (times);
+
+  return es;
+}
+
 elog_event_t * elog_peek_events (elog_main_t * em)
 {
   elog_event_t * e, * f, * es = 0;
   uword i, j, n;
 
+  if (em->per_cpu)
+    return elog_peek_per_cpu_events (em);
+
   n = elog_event_range (em, &j);
   for (i = 0; i < n; i++)
     {
@@ -463,22 +716,28 @@ elog_event_t * elog_peek_events (elog_main_t * em)
   return es;
 }
 
-/* Add a formatted string to the string table. */
+/* Add a formatted string to the string table.  Returns byte offset
+   of string; same string always gives same offset. */
 u32 elog_string (elog_main_t * em, char * fmt, ...)
 {
-  u32 offset;
+  u8 * s;
+  uword n;
+  u32 id;
   va_list va;
 
   va_start (va, fmt);
-  offset = vec_len (em->string_table);
-  em->string_table = (char *) va_format ((u8 *) em->string_table, fmt, &va);
+  s = va_format (0, fmt, &va);
   va_end (va);
 
-  /* Null terminate string if it is not already. */
-  if (vec_end (em->string_table)[-1] != 0)
-    vec_add1 (em->string_table, 0);
+  /* String table adds null terminator. */
+  n = vec_len (s);
+  if (n > 0 && s[n - 1] == 0)
+    n--;
+
+  id = clib_intern (&em->string_table, s, n);
+  vec_free (s);
 
-  return offset;
+  return clib_intern_offset (&em->string_table, id);
 }
 
 elog_event_t * elog_get_events (elog_main_t * em)
@@ -488,14 +747,54 @@ elog_event_t * elog_get_events (elog_main_t * em)
   return em->events;
 }
 
+elog_span_t * elog_get_spans (elog_main_t * em, elog_event_t * es)
+{
+  elog_span_t * spans = 0, * s;
+  u32 ** open_by_track = 0, * o;
+  uword i;
+
+  for (i = 0; i < vec_len (es); i++)
+    {
+      elog_event_t * e = es + i;
+      elog_event_type_t * t = vec_elt_at_index (em->event_types, e->type);
+
+      if (! (t->flags & (ELOG_EVENT_TYPE_FLAG_SPAN_BEGIN | ELOG_EVENT_TYPE_FLAG_SPAN_END)))
+	continue;
+
+      vec_validate (open_by_track, e->track);
+      o = open_by_track[e->track];
+
+      if (t->flags & ELOG_EVENT_TYPE_FLAG_SPAN_BEGIN)
+	vec_add1 (o, i);
+      else if (vec_len (o) > 0)
+	{
+	  vec_add2 (spans, s, 1);
+	  s->begin = o[vec_len (o) - 1];
+	  s->end = i;
+	  _vec_len (o) -= 1;
+	  s->depth = vec_len (o);
+	}
+
+      open_by_track[e->track] = o;
+    }
+
+  for (i = 0; i < vec_len (open_by_track); i++)
+    vec_free (open_by_track[i]);
+  vec_free (open_by_track);
+
+  return spans;
+}
+
+/* Maps src string table offsets of 'T' format args to dst offsets. */
 static void maybe_fix_string_table_offset (elog_event_t * e, 
                                            elog_event_type_t * t,
-                                           u32 offset)
+                                           clib_intern_t * src_strings,
+                                           u32 * dst_offset_by_src_id)
 {
   void * d = (u8 *) e->data;
   char * a;
 
-  if (offset == 0)
+  if (vec_len (dst_offset_by_src_id) == 0)
     return;
 
   a = t->format_args;
@@ -515,7 +814,11 @@ static void maybe_fix_string_table_offset (elog_event_t * e,
 	{
 	case 'T':
             ASSERT (n_bytes == 4);
-            clib_mem_unaligned (d, u32) += offset;
+            {
+              u32 id = clib_intern_id_for_offset (src_strings, clib_mem_unaligned (d, u32));
+              if (id != CLIB_INTERN_ID_INVALID)
+                clib_mem_unaligned (d, u32) = dst_offset_by_src_id[id];
+            }
             break;
 
 	case 'i':
@@ -535,25 +838,157 @@ static void maybe_fix_string_table_offset (elog_event_t * e,
     }
 }
 
+/* Makes event ring from collected events (e.g. after merge) so they can
+   be serialized. */
+static void elog_events_to_ring (elog_main_t * em)
+{
+  elog_per_cpu_t * c;
+  uword i;
+
+  ASSERT (em->cpu_timer.seconds_per_clock);
+
+  /* Single ring holds all events regardless of number of cpus. */
+  vec_foreach (c, em->per_cpu)
+    vec_free (c->event_ring);
+  vec_free (em->per_cpu);
+  vec_free (em->event_ring);
+  /* Keep at least original ring size so more events can be logged. */
+  em->event_ring_size = max_pow2 (clib_max (vec_len (em->events),
+					    clib_max (em->event_ring_size, 2)));
+  vec_resize_aligned (em->event_ring, em->event_ring_size, CLIB_CACHE_LINE_BYTES);
+
+  for (i = 0; i < vec_len (em->events); i++)
+    {
+      elog_event_t * es, * ed;
+
+      es = em->events + i;
+      ed = em->event_ring + i;
+
+      ed[0] = es[0];
+
+      /* Invert elog_peek_events calculation */
+      ed->time_cycles = 
+	(es->time/em->cpu_timer.seconds_per_clock) + em->init_time.cpu;
+    }
+  em->n_total_events = vec_len (em->events);
+}
+
+/* Maps types, tracks and strings of a merge input to merge output. */
+typedef struct {
+  /* Output type index for each input type. */
+  u32 * dst_type_by_src_type;
+
+  /* Output string table offset for each input string. */
+  u32 * dst_string_offset_by_src_id;
+
+  /* Bitmap of input types with string table ('T') args. */
+  uword * src_types_with_strings;
+
+  /* Output track index of input track 0. */
+  u32 dst_track_offset;
+
+  /* Seconds added to input event times to align clocks. */
+  f64 dt;
+} elog_merge_map_t;
+
+/* Adds types, tracks and strings of SRC to DST.  Tag (if any) prefixes
+   track names. */
+static void
+elog_merge_map_init (elog_merge_map_t * map, elog_main_t * dst,
+		     elog_main_t * src, u8 * src_tag)
+{
+  elog_event_type_t * t;
+  elog_track_t newt;
+  uword i;
+
+  memset (map, 0, sizeof (map[0]));
+
+  /* Strings already in dst are shared. */
+  for (i = 0; i < clib_intern_elts (&src->string_table); i++)
+    {
+      u32 id = clib_intern (&dst->string_table,
+			    clib_intern_string (&src->string_table, i),
+			    clib_intern_length (&src->string_table, i));
+      vec_add1 (map->dst_string_offset_by_src_id,
+		clib_intern_offset (&dst->string_table, id));
+    }
+
+  vec_foreach (t, src->event_types)
+    {
+      vec_add1 (map->dst_type_by_src_type, find_or_create_type (dst, t));
+      if (strchr (t->format_args, 'T'))
+	map->src_types_with_strings
+	  = clib_bitmap_ori (map->src_types_with_strings, t - src->event_types);
+    }
+
+  map->dst_track_offset = vec_len (dst->tracks);
+  for (i = 0; i < vec_len (src->tracks); i++)
+    {
+      elog_track_t * t = vec_elt_at_index (src->tracks, i);
+      if (src_tag)
+        newt.name = (char *) format (0, "%s:%s%c", src_tag, t->name, 0);
+      else
+        newt.name = (char *) format (0, "%s%c", t->name, 0);
+      (void) elog_track_register (dst, &newt);
+      vec_free (newt.name);
+    }
+}
+
+static void elog_merge_map_free (elog_merge_map_t * map)
+{
+  vec_free (map->dst_type_by_src_type);
+  vec_free (map->dst_string_offset_by_src_id);
+  clib_bitmap_free (map->src_types_with_strings);
+}
+
+static void
+elog_merge_map_event (elog_merge_map_t * map, elog_main_t * src,
+		      elog_event_t * e)
+{
+  if (clib_bitmap_get (map->src_types_with_strings, e->type))
+    maybe_fix_string_table_offset (e, vec_elt_at_index (src->event_types, e->type),
+				   &src->string_table,
+				   map->dst_string_offset_by_src_id);
+  e->type = map->dst_type_by_src_type[e->type];
+  e->track += map->dst_track_offset;
+  e->time += map->dt;
+}
+
+/* Seconds from DST to SRC init time. */
+static f64
+elog_merge_time_offset (elog_main_t * dst, elog_main_t * src)
+{
+  f64 dt_event, dt_os_nsec, dt_clock_nsec;
+
+  dt_os_nsec = elog_time_stamp_diff_os_nsec (&src->init_time, &dst->init_time);
+
+  dt_event = dt_os_nsec;
+  dt_clock_nsec = (elog_time_stamp_diff_cpu (&src->init_time, &dst->init_time)
+		   * .5*(dst->nsec_per_cpu_clock + src->nsec_per_cpu_clock));
+
+  /* Heuristic to see if src/dst came from same time source.
+     If frequencies are "the same" and os clock and cpu clock agree
+     to within 100e-9 secs about time difference between src/dst
+     init_time, then we use cpu clock.  Otherwise we use OS clock. */
+  if (fabs (src->nsec_per_cpu_clock - dst->nsec_per_cpu_clock) < 1e-2
+      && fabs (dt_os_nsec - dt_clock_nsec) < 100)
+    dt_event = dt_clock_nsec;
+
+  /* Convert to seconds. */
+  return dt_event * 1e-9;
+}
+
 void elog_merge (elog_main_t * dst, u8 * dst_tag, 
                  elog_main_t * src, u8 * src_tag)
 {
-  elog_event_t * e;
-  uword l;
-  u32 string_table_offset_for_src_events;
-  u32 track_offset_for_src_tracks;
-  elog_track_t newt;
-  int i;
+  elog_merge_map_t map;
+  elog_event_t * es = 0;
+  uword i, j, k, n_dst, n_src;
+  f64 dt_dst;
 
   elog_get_events (src);
   elog_get_events (dst);
 
-  string_table_offset_for_src_events = vec_len (dst->string_table);
-  vec_append (dst->string_table, src->string_table);
-
-  l = vec_len (dst->events);
-  vec_add (dst->events, src->events, vec_len (src->events));
-
   /* Prepend the supplied tag (if any) to all dst track names */
   if (dst_tag)
     {
@@ -567,268 +1002,284 @@ void elog_merge (elog_main_t * dst, u8 * dst_tag,
           t->name = new_name;
         }
     }
-  
-  track_offset_for_src_tracks = vec_len (dst->tracks);
-  
-  /* Copy / tag source tracks */
-  for (i = 0; i < vec_len (src->tracks); i++)
+
+  elog_merge_map_init (&map, dst, src, src_tag);
+
+  /* Set clock parameters if dst was not generated by unserialize. */
+  if (dst->serialize_time.cpu == 0)
     {
-      elog_track_t * t = vec_elt_at_index (src->tracks, i);
-      if (src_tag)
-        newt.name = (char *) format (0, "%s:%s%c", src_tag, t->name, 0);
-      else
-        newt.name = (char *) format (0, "%s%c", t->name, 0);
-      (void) elog_track_register (dst, &newt);
-      vec_free (newt.name);
+      dst->init_time = src->init_time;
+      dst->serialize_time = src->serialize_time;
+      dst->nsec_per_cpu_clock = src->nsec_per_cpu_clock;
     }
-  
-  /* Across all (copied) src events... */
-  for (e = dst->events + l; e < vec_end (dst->events); e++)
+
+  /* Events of log started later are shifted; when that is dst, dst
+     start moves back to src start. */
+  map.dt = elog_merge_time_offset (dst, src);
+  dt_dst = 0;
+  if (map.dt < 0)
     {
-      elog_event_type_t * t = vec_elt_at_index (src->event_types, e->type);
-      
-      /* Remap type from src -> dst. */
-      e->type = find_or_create_type (dst, t);
+      dt_dst = -map.dt;
+      map.dt = 0;
+      dst->init_time.os_nsec -= (u64) (dt_dst * 1e9);
+      dst->init_time.cpu -= (u64) (dt_dst * dst->cpu_timer.clocks_per_second);
+    }
 
-      /* Remap string table offsets for 'T' format args */
-      maybe_fix_string_table_offset (e, t, string_table_offset_for_src_events);
-      
-      /* Remap track */
-      e->track += track_offset_for_src_tracks;
+  /* Both logs are in time order: merge them in one pass. */
+  n_dst = vec_len (dst->events);
+  n_src = vec_len (src->events);
+  vec_resize (es, n_dst + n_src);
+  for (i = j = k = 0; k < n_dst + n_src; k++)
+    {
+      if (j >= n_src
+	  || (i < n_dst
+	      && dst->events[i].time + dt_dst <= src->events[j].time + map.dt))
+	{
+	  es[k] = dst->events[i++];
+	  es[k].time += dt_dst;
+	}
+      else
+	{
+	  es[k] = src->events[j++];
+	  elog_merge_map_event (&map, src, es + k);
+	}
     }
 
-  /* Adjust event times for relative starting times of event streams. */
-  {
-    f64 dt_event, dt_os_nsec, dt_clock_nsec;
+  elog_merge_map_free (&map);
+  vec_free (dst->events);
+  dst->events = es;
 
-    /* Set clock parameters if dst was not generated by unserialize. */
-    if (dst->serialize_time.cpu == 0)
-      {
-	dst->init_time = src->init_time;
-	dst->serialize_time = src->serialize_time;
-	dst->nsec_per_cpu_clock = src->nsec_per_cpu_clock;
-      }
+  /* Recreate the event ring or the results won't serialize */
+  elog_events_to_ring (dst);
+}
 
-    dt_os_nsec = elog_time_stamp_diff_os_nsec (&src->init_time, &dst->init_time);
+/* State for compact event encoding and decoding. */
+typedef struct {
+  /* Event data layout of each type as (kind, n_bytes) pairs ending
+     with kind 0; saves parsing format_args for every event.  Kind is
+     'i' for integers (including enum and string table indices), 's'
+     and 'f'.  LAYOUTS has offset in OPS for each type. */
+  u32 * layouts;
+  u8 * ops;
 
-    dt_event = dt_os_nsec;
-    dt_clock_nsec = (elog_time_stamp_diff_cpu (&src->init_time, &dst->init_time)
-		     * .5*(dst->nsec_per_cpu_clock + src->nsec_per_cpu_clock));
+  /* Number of types and tracks known to decoder. */
+  uword n_types, n_tracks;
 
-    /* Heuristic to see if src/dst came from same time source.
-       If frequencies are "the same" and os clock and cpu clock agree
-       to within 100e-9 secs about time difference between src/dst
-       init_time, then we use cpu clock.  Otherwise we use OS clock. */
-    if (fabs (src->nsec_per_cpu_clock - dst->nsec_per_cpu_clock) < 1e-2
-	&& fabs (dt_os_nsec - dt_clock_nsec) < 100)
-      dt_event = dt_clock_nsec;
+  f64 clocks_per_second, seconds_per_clock;
 
-    /* Convert to seconds. */
-    dt_event *= 1e-9;
+  /* Time of previous event in clock cycles. */
+  i64 time;
+} elog_event_codec_t;
 
-    if (dt_event > 0)
-      {
-	/* Src started after dst. */
-	for (e = dst->events + l; e < vec_end (dst->events); e++)
-	  e->time += dt_event;
-      }
-    else
-      {
-	/* Dst started after src. */
-	for (e = dst->events + 0; e < dst->events + l; e++)
-	  e->time += dt_event;
-      }
-  }
+static void elog_event_codec_init (elog_event_codec_t * c, elog_main_t * em)
+{
+  elog_event_type_t * t;
 
-  /* Sort events by increasing time. */
-  vec_sort (dst->events, e1, e2, e1->time < e2->time ? -1 : (e1->time > e2->time ? +1 : 0));
+  memset (c, 0, sizeof (c[0]));
+  vec_foreach (t, em->event_types)
+    {
+      char * p = t->format_args;
 
-  /* Recreate the event ring or the results won't serialize */
-  {
-    int i;
+      vec_add1 (c->layouts, vec_len (c->ops));
+      while (*p)
+	{
+	  uword n_digits, n_bytes = 0;
+	  u8 kind = p[0];
+
+	  n_digits = parse_2digit_decimal (p + 1, &n_bytes);
+	  if (kind == 't' || kind == 'T')
+	    kind = 'i';
+	  ASSERT (kind == 'i' || kind == 's' || kind == 'f');
+	  ASSERT (kind == 's' || n_bytes > 0);
+
+	  vec_add1 (c->ops, kind);
+	  vec_add1 (c->ops, n_bytes);
+	  p += 1 + n_digits;
+	}
+      vec_add1 (c->ops, 0);
+    }
 
-    ASSERT (dst->cpu_timer.seconds_per_clock);
+  c->n_types = vec_len (em->event_types);
+  c->n_tracks = vec_len (em->tracks);
+  c->seconds_per_clock = em->cpu_timer.seconds_per_clock;
+  c->clocks_per_second = 1 / c->seconds_per_clock;
+}
 
-    elog_alloc (dst, vec_len (dst->events));
-    for (i = 0; i < vec_len(dst->events); i++)
-      {
-        elog_event_t *es, *ed;
-        
-        es = dst->events + i;
-        ed = dst->event_ring + i;
-        
-        ed[0] = es[0];
-        
-        /* Invert elog_peek_events calculation */
-        ed->time_cycles = 
-          (es->time/dst->cpu_timer.seconds_per_clock) + dst->init_time.cpu;
-      }
-    dst->n_total_events = vec_len (dst->events);
-  }
+static void elog_event_codec_free (elog_event_codec_t * c)
+{
+  vec_free (c->layouts);
+  vec_free (c->ops);
 }
 
+/* Writes one event: type and track are varints; time is signed varint
+   of clock cycles since previous event; data has only bytes named by
+   format_args with integers as varints and strings without padding. */
 static void
-serialize_elog_event (serialize_main_t * m, va_list * va)
+serialize_elog_event_compact (serialize_main_t * m, elog_event_codec_t * c,
+			      elog_event_t * e)
 {
-  elog_main_t * em = va_arg (*va, elog_main_t *);
-  elog_event_t * e = va_arg (*va, elog_event_t *);
-  elog_event_type_t * t = vec_elt_at_index (em->event_types, e->type);
-  u8 * d = e->data;
-  u8 * p = (u8 *) t->format_args;
+  u8 * d = e->data, * o;
+  f64 x;
+  i64 t;
 
-  serialize_integer (m, e->type, sizeof (e->type));
-  serialize_integer (m, e->track, sizeof (e->track));
-  serialize (m, serialize_f64, e->time);
+  serialize_likely_small_unsigned_integer (m, e->type);
+  serialize_likely_small_unsigned_integer (m, e->track);
 
-  while (*p)
-    {
-      uword n_digits, n_bytes = 0;
+  x = e->time * c->clocks_per_second;
+  t = x + (x >= 0 ? .5 : -.5);
+  serialize_likely_small_signed_integer (m, t - c->time);
+  c->time = t;
 
-      n_digits = parse_2digit_decimal ((char *) p + 1, &n_bytes);
+  for (o = c->ops + c->layouts[e->type]; o[0]; o += 2)
+    {
+      uword n_bytes = o[1], l;
 
-      switch (p[0])
+      switch (o[0])
 	{
 	case 'i':
-	case 't':
-	case 'T':
 	  if (n_bytes == 1)
 	    serialize_integer (m, d[0], sizeof (u8));
 	  else if (n_bytes == 2)
-	    serialize_integer (m, clib_mem_unaligned (d, u16), sizeof (u16));
+	    serialize_likely_small_unsigned_integer (m, clib_mem_unaligned (d, u16));
 	  else if (n_bytes == 4)
-	    serialize_integer (m, clib_mem_unaligned (d, u32), sizeof (u32));
-	  else if (n_bytes == 8)
-	    serialize (m, serialize_64, clib_mem_unaligned (d, u64));
+	    serialize_likely_small_unsigned_integer (m, clib_mem_unaligned (d, u32));
 	  else
-	    ASSERT (0);
+	    serialize_likely_small_unsigned_integer (m, clib_mem_unaligned (d, u64));
 	  break;
 
 	case 's':
-	  serialize_cstring (m, (char *) d);
+	  l = strnlen ((char *) d, n_bytes > 0 ? n_bytes : e->data + sizeof (e->data) - d);
+	  serialize_likely_small_unsigned_integer (m, l);
+	  if (l > 0)
+	    memcpy (serialize_get (m, l), d, l);
 	  if (n_bytes == 0)
-	    n_bytes = strlen ((char *) d) + 1;
+	    n_bytes = l + 1;
 	  break;
 
 	case 'f':
 	  if (n_bytes == 4)
-	    serialize (m, serialize_f32, clib_mem_unaligned (d, f32));
-	  else if (n_bytes == 8)
-	    serialize (m, serialize_f64, clib_mem_unaligned (d, f64));
+	    serialize_integer (m, clib_mem_unaligned (d, u32), sizeof (u32));
 	  else
-	    ASSERT (0);
-	  break;
-
-	default:
-	  ASSERT (0);
+	    serialize_integer (m, clib_mem_unaligned (d, u64), sizeof (u64));
 	  break;
 	}
 
-      p += 1 + n_digits;
       d += n_bytes;
     }
 }
 
-static void
-unserialize_elog_event (serialize_main_t * m, va_list * va)
+/* Reads event written above.  Returns 0 for bad type, track or
+   string length. */
+static uword
+unserialize_elog_event_compact (serialize_main_t * m, elog_event_codec_t * c,
+				elog_event_t * e)
 {
-  elog_main_t * em = va_arg (*va, elog_main_t *);
-  elog_event_t * e = va_arg (*va, elog_event_t *);
-  elog_event_type_t * t;
-  u8 * p, * d;
-
-  {
-    u16 tmp[2];
+  u8 * d = e->data, * o;
+  uword type, track;
 
-    unserialize_integer (m, &tmp[0], sizeof (e->type));
-    unserialize_integer (m, &tmp[1], sizeof (e->track));
-
-    e->type = tmp[0];
-    e->track = tmp[1];
-
-    /* Make sure it fits. */
-    ASSERT (e->type == tmp[0]);
-    ASSERT (e->track == tmp[1]);
-  }
-
-  t = vec_elt_at_index (em->event_types, e->type);
-
-  unserialize (m, unserialize_f64, &e->time);
+  type = unserialize_likely_small_unsigned_integer (m);
+  track = unserialize_likely_small_unsigned_integer (m);
+  if (type >= c->n_types || track >= c->n_tracks)
+    return 0;
+  e->type = type;
+  e->track = track;
 
-  d = e->data;
-  p = (u8 *) t->format_args;
+  c->time += unserialize_likely_small_signed_integer (m);
+  e->time = c->time * c->seconds_per_clock;
 
-  while (*p)
+  memset (e->data, 0, sizeof (e->data));
+  for (o = c->ops + c->layouts[type]; o[0]; o += 2)
     {
-      uword n_digits, n_bytes = 0;
-      u32 tmp;
-
-      n_digits = parse_2digit_decimal ((char *) p + 1, &n_bytes);
+      uword n_bytes = o[1], l;
+      u64 x;
 
-      switch (p[0])
+      switch (o[0])
 	{
 	case 'i':
-	case 't':
-	case 'T':
 	  if (n_bytes == 1)
 	    {
-	      unserialize_integer (m, &tmp, sizeof (u8));
-	      d[0] = tmp;
-	    }
-	  else if (n_bytes == 2)
-	    {
-	      unserialize_integer (m, &tmp, sizeof (u16));
-	      clib_mem_unaligned (d, u16) = tmp;
+	      d[0] = *(u8 *) unserialize_get (m, sizeof (u8));
+	      break;
 	    }
+	  x = unserialize_likely_small_unsigned_integer (m);
+	  if (n_bytes == 2)
+	    clib_mem_unaligned (d, u16) = x;
 	  else if (n_bytes == 4)
-	    {
-	      unserialize_integer (m, &tmp, sizeof (u32));
-	      clib_mem_unaligned (d, u32) = tmp;
-	    }
-	  else if (n_bytes == 8)
-	    {
-	      u64 x;
-	      unserialize (m, unserialize_64, &x);
-	      clib_mem_unaligned (d, u64) = x;
-	    }
+	    clib_mem_unaligned (d, u32) = x;
 	  else
-	    ASSERT (0);
+	    clib_mem_unaligned (d, u64) = x;
 	  break;
 
-	case 's': {
-	  char * t;
-	  unserialize_cstring (m, &t);
+	case 's':
+	  l = unserialize_likely_small_unsigned_integer (m);
+	  if (d + l + (n_bytes == 0) > e->data + sizeof (e->data)
+	      || (n_bytes > 0 && l > n_bytes))
+	    return 0;
+	  if (l > 0)
+	    memcpy (d, unserialize_get (m, l), l);
 	  if (n_bytes == 0)
-	    n_bytes = strlen (t) + 1;
-	  memcpy (d, t, clib_min (n_bytes, vec_len (t)));
-	  vec_free (t);
+	    n_bytes = l + 1;
 	  break;
-	}
 
 	case 'f':
 	  if (n_bytes == 4)
 	    {
-	      f32 x;
-	      unserialize (m, unserialize_f32, &x);
-	      clib_mem_unaligned (d, f32) = x;
+	      u32 y;
+	      unserialize_integer (m, &y, sizeof (y));
+	      clib_mem_unaligned (d, u32) = y;
 	    }
-	  else if (n_bytes == 8)
+	  else
 	    {
-	      f64 x;
-	      unserialize (m, unserialize_f64, &x);
-	      clib_mem_unaligned (d, f64) = x;
+	      unserialize_integer (m, &x, sizeof (x));
+	      clib_mem_unaligned (d, u64) = x;
 	    }
-	  else
-	    ASSERT (0);
-	  break;
-
-	default:
-	  ASSERT (0);
 	  break;
 	}
 
-      p += 1 + n_digits;
       d += n_bytes;
     }
+
+  return 1;
+}
+
+/* Writes number of events followed by events. */
+static void
+serialize_elog_events (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+  elog_event_t * es = va_arg (*va, elog_event_t *);
+  uword n_events = va_arg (*va, uword);
+  elog_event_codec_t c;
+  uword i;
+
+  elog_event_codec_init (&c, em);
+  serialize_likely_small_unsigned_integer (m, n_events);
+  for (i = 0; i < n_events; i++)
+    serialize_elog_event_compact (m, &c, es + i);
+  elog_event_codec_free (&c);
+}
+
+/* Bulk decoder for serialize_elog_events: adds events to vector. */
+static void
+unserialize_elog_events (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+  elog_event_t ** es_return = va_arg (*va, elog_event_t **);
+  elog_event_t * e;
+  elog_event_codec_t c;
+  uword i, n_events;
+
+  n_events = unserialize_likely_small_unsigned_integer (m);
+  vec_add2 (es_return[0], e, n_events);
+
+  elog_event_codec_init (&c, em);
+  for (i = 0; i < n_events; i++)
+    if (! unserialize_elog_event_compact (m, &c, e + i))
+      {
+	elog_event_codec_free (&c);
+	serialize_error_return (m, "bad elog event %d", i);
+      }
+  elog_event_codec_free (&c);
 }
 
 static void
@@ -841,6 +1292,7 @@ serialize_elog_event_type (serialize_main_t * m, va_list * va)
     {
       serialize_cstring (m, t[i].format);
       serialize_cstring (m, t[i].format_args);
+      serialize_likely_small_unsigned_integer (m, t[i].flags);
       serialize_integer (m, t[i].type_index_plus_one, sizeof (t->type_index_plus_one));
       serialize_integer (m, t[i].n_enum_strings, sizeof (t[i].n_enum_strings));
       for (j = 0; j < t[i].n_enum_strings; j++)
@@ -858,6 +1310,10 @@ unserialize_elog_event_type (serialize_main_t * m, va_list * va)
     {
       unserialize_cstring (m, &t[i].format);
       unserialize_cstring (m, &t[i].format_args);
+      /* Types with no args. */
+      if (! t[i].format_args)
+	t[i].format_args = (char *) format (0, "%c", 0);
+      t[i].flags = unserialize_likely_small_unsigned_integer (m);
       unserialize_integer (m, &t[i].type_index_plus_one, sizeof (t->type_index_plus_one));
       unserialize_integer (m, &t[i].n_enum_strings, sizeof (t[i].n_enum_strings));
       vec_resize (t[i].enum_strings_vector, t[i].n_enum_strings);
@@ -906,67 +1362,687 @@ unserialize_elog_time_stamp (serialize_main_t * m, va_list * va)
   unserialize (m, unserialize_64, &st->cpu);
 }
 
-static char * elog_serialize_magic = "elog v0";
+/* Event times are written in clock cycles; reader converts them to
+   seconds with writer's clock rate. */
+static void
+serialize_elog_clock (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+  serialize (m, serialize_f64, em->cpu_timer.seconds_per_clock);
+}
 
-void
-serialize_elog_main (serialize_main_t * m, va_list * va)
+static void
+unserialize_elog_clock (serialize_main_t * m, va_list * va)
 {
   elog_main_t * em = va_arg (*va, elog_main_t *);
-  elog_event_t * e;
+  f64 x;
+
+  unserialize (m, unserialize_f64, &x);
+  if (! (x > 0))
+    serialize_error_return (m, "bad elog clock rate %.9e", x);
+  em->cpu_timer.seconds_per_clock = x;
+  em->cpu_timer.clocks_per_second = 1 / x;
+}
 
-  serialize_cstring (m, elog_serialize_magic);
+static char * elog_serialize_magic = "elog v2";
+
+/* Everything but events. */
+static void
+serialize_elog_main_header (serialize_main_t * m, elog_main_t * em)
+{
+  serialize_magic (m, elog_serialize_magic, strlen (elog_serialize_magic));
 
   serialize_integer (m, em->event_ring_size, sizeof (u32));
 
-  elog_time_now (&em->serialize_time);
   serialize (m, serialize_elog_time_stamp, &em->serialize_time);
   serialize (m, serialize_elog_time_stamp, &em->init_time);
+  serialize (m, serialize_elog_clock, em);
 
   vec_serialize (m, em->event_types, serialize_elog_event_type);
   vec_serialize (m, em->tracks, serialize_elog_track);
-  vec_serialize (m, em->string_table, serialize_vec_8);
-
-  /* Free old events (cached) in case they have changed. */
-  vec_free (em->events);
-  elog_get_events (em);
-
-  serialize_integer (m, vec_len (em->events), sizeof (u32));
-  vec_foreach (e, em->events)
-    serialize (m, serialize_elog_event, em, e);
+  vec_serialize (m, em->string_table.arena, serialize_vec_8);
 }
 
-void
-unserialize_elog_main (serialize_main_t * m, va_list * va)
+static void
+unserialize_elog_main_header (serialize_main_t * m, elog_main_t * em)
 {
-  elog_main_t * em = va_arg (*va, elog_main_t *);
   uword i;
   u32 rs;
 
   unserialize_check_magic (m, elog_serialize_magic,
 			   strlen (elog_serialize_magic));
 
+  /* Ring is made when events are known. */
   unserialize_integer (m, &rs, sizeof (u32));
+  elog_init (em, 0);
   em->event_ring_size = rs;
-  elog_init (em, em->event_ring_size);
 
   unserialize (m, unserialize_elog_time_stamp, &em->serialize_time);
   unserialize (m, unserialize_elog_time_stamp, &em->init_time);
   em->nsec_per_cpu_clock = elog_nsec_per_clock (em);
+  unserialize (m, unserialize_elog_clock, em);
 
   vec_unserialize (m, &em->event_types, unserialize_elog_event_type);
   for (i = 0; i < vec_len (em->event_types); i++)
     new_event_type (em, i);
 
   vec_unserialize (m, &em->tracks, unserialize_elog_track);
-  vec_unserialize (m, &em->string_table, unserialize_vec_8);
+  vec_unserialize (m, &em->string_table.arena, unserialize_vec_8);
+  clib_intern_rebuild (&em->string_table);
+}
 
-  {
-    u32 ne;
-    elog_event_t * e;
+void
+serialize_elog_main (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
 
-    unserialize_integer (m, &ne, sizeof (u32));
-    vec_resize (em->events, ne);
-    vec_foreach (e, em->events)
-      unserialize (m, unserialize_elog_event, em, e);
-  }
+  elog_time_now (&em->serialize_time);
+  serialize_elog_main_header (m, em);
+
+  /* Free old events (cached) in case they have changed. */
+  vec_free (em->events);
+  elog_get_events (em);
+
+  serialize (m, serialize_elog_events, em, em->events, vec_len (em->events));
+}
+
+void
+unserialize_elog_main (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+
+  unserialize_elog_main_header (m, em);
+  unserialize (m, unserialize_elog_events, em, &em->events);
+
+  /* So events can be serialized again. */
+  elog_events_to_ring (em);
+}
+
+/* Vector as JSON string contents. */
+static u8 * format_elog_json_string (u8 * s, va_list * va)
+{
+  u8 * v = va_arg (*va, u8 *);
+  uword i;
+
+  for (i = 0; i < vec_len (v); i++)
+    {
+      u8 c = v[i];
+
+      if (c == 0)
+	continue;
+      if (c == '"' || c == '\\')
+	s = format (s, "\\%c", c);
+      else if (c < ' ')
+	s = format (s, "\\u%04x", c);
+      else
+	vec_add1 (s, c);
+    }
+
+  return s;
+}
+
+/* Moves formatted JSON to stream. */
+always_inline u8 *
+elog_chrome_trace_write (serialize_main_t * m, u8 * s)
+{
+  if (vec_len (s) > 0)
+    memcpy (serialize_get (m, vec_len (s)), s, vec_len (s));
+  vec_reset_length (s);
+  return s;
+}
+
+void
+serialize_elog_chrome_trace (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+  elog_event_t * e, * es;
+  u32 * n_open_by_track = 0;
+  u8 * s = 0, * name = 0;
+  uword i;
+
+  es = elog_get_events (em);
+
+  s = format (s, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+	      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"elog\"}}");
+
+  for (i = 0; i < vec_len (em->tracks); i++)
+    {
+      vec_reset_length (name);
+      name = format (name, "%s", em->tracks[i].name);
+      s = format (s, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+		  "\"args\":{\"name\":\"%U\"}}",
+		  i, format_elog_json_string, name);
+    }
+  vec_validate (n_open_by_track, vec_len (em->tracks));
+
+  vec_foreach (e, es)
+    {
+      elog_event_type_t * t = vec_elt_at_index (em->event_types, e->type);
+      u8 ph = 'i';
+      i64 ns;
+
+      if (t->flags & ELOG_EVENT_TYPE_FLAG_SPAN_BEGIN)
+	{
+	  ph = 'B';
+	  n_open_by_track[e->track] += 1;
+	}
+      else if (t->flags & ELOG_EVENT_TYPE_FLAG_SPAN_END)
+	{
+	  /* Viewers would close wrong span: begin was not logged
+	     (e.g. overwritten in ring). */
+	  if (n_open_by_track[e->track] == 0)
+	    continue;
+	  ph = 'E';
+	  n_open_by_track[e->track] -= 1;
+	}
+
+      vec_reset_length (name);
+      name = format (name, "%U", format_elog_event, em, e);
+
+      /* Time stamps are micro seconds. */
+      ns = e->time * 1e9;
+      s = format (s, ",\n{\"name\":\"%U\",\"ph\":\"%c\",\"ts\":%s%Ld.%03Ld,\"pid\":0,\"tid\":%d%s}",
+		  format_elog_json_string, name, ph,
+		  ns < 0 ? "-" : "", (ns < 0 ? -ns : ns) / 1000, (ns < 0 ? -ns : ns) % 1000,
+		  e->track, ph == 'i' ? ",\"s\":\"t\"" : "");
+
+      if (vec_len (s) >= 4096)
+	s = elog_chrome_trace_write (m, s);
+    }
+
+  s = format (s, "\n]}\n");
+  s = elog_chrome_trace_write (m, s);
+
+  vec_free (s);
+  vec_free (name);
+  vec_free (n_open_by_track);
+}
+
+/* One input of elog_merge_serialized. */
+typedef struct {
+  serialize_main_t * serialize_main;
+
+  /* Types, tracks and strings of input; events are read as needed. */
+  elog_main_t em;
+
+  elog_event_codec_t codec;
+
+  elog_merge_map_t map;
+
+  /* Events not yet read. */
+  u64 n_events_left;
+
+  /* Events read (and mapped to output) but not yet merged. */
+  elog_event_t * events;
+  uword next_event;
+} elog_merge_input_t;
+
+/* Events read from an input at a time; bounds memory of merge. */
+#define ELOG_MERGE_EVENTS_PER_READ 256
+
+static void
+unserialize_elog_merge_input_header (serialize_main_t * m, va_list * va)
+{
+  elog_merge_input_t * in = va_arg (*va, elog_merge_input_t *);
+
+  unserialize_elog_main_header (m, &in->em);
+  in->n_events_left = unserialize_likely_small_unsigned_integer (m);
+}
+
+static void
+unserialize_elog_merge_input_events (serialize_main_t * m, va_list * va)
+{
+  elog_merge_input_t * in = va_arg (*va, elog_merge_input_t *);
+  uword i, n = clib_min (in->n_events_left, ELOG_MERGE_EVENTS_PER_READ);
+
+  vec_validate (in->events, n - 1);
+  _vec_len (in->events) = n;
+  in->next_event = 0;
+
+  for (i = 0; i < n; i++)
+    {
+      if (! unserialize_elog_event_compact (m, &in->codec, in->events + i))
+	serialize_error_return (m, "bad elog event");
+      elog_merge_map_event (&in->map, &in->em, in->events + i);
+    }
+
+  in->n_events_left -= n;
+}
+
+always_inline f64
+elog_merge_input_time (elog_merge_input_t * in)
+{ return in->events[in->next_event].time; }
+
+static void
+serialize_elog_merge (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * dst = va_arg (*va, elog_main_t *);
+  elog_merge_input_t * ins = va_arg (*va, elog_merge_input_t *);
+  u64 n_events = va_arg (*va, u64);
+  elog_merge_input_t * in;
+  elog_event_codec_t c;
+  clib_error_t * error;
+  u32 * heap = 0;
+  f64 * times = 0;
+
+  serialize_elog_main_header (m, dst);
+  serialize_likely_small_unsigned_integer (m, n_events);
+
+  /* Heap of inputs by time of next event. */
+  vec_validate (times, vec_len (ins));
+  vec_foreach (in, ins)
+    if (vec_len (in->events) > 0)
+      {
+	times[in - ins] = elog_merge_input_time (in);
+	vec_add1 (heap, in - ins);
+      }
+  elog_heap_init (times, heap);
+
+  elog_event_codec_init (&c, dst);
+  while (vec_len (heap) > 0)
+    {
+      in = ins + heap[0];
+      serialize_elog_event_compact (m, &c, in->events + in->next_event);
+
+      if (++in->next_event >= vec_len (in->events))
+	{
+	  if (in->n_events_left == 0)
+	    {
+	      heap[0] = heap[vec_len (heap) - 1];
+	      _vec_len (heap) -= 1;
+	    }
+	  else if ((error = unserialize (in->serialize_main,
+					 unserialize_elog_merge_input_events, in)))
+	    {
+	      elog_event_codec_free (&c);
+	      vec_free (heap);
+	      vec_free (times);
+	      serialize_error (&m->header, error);
+	    }
+	}
+      if (in->next_event < vec_len (in->events))
+	times[in - ins] = elog_merge_input_time (in);
+
+      elog_heap_sift_down (times, heap, 0);
+    }
+
+  elog_event_codec_free (&c);
+  vec_free (heap);
+  vec_free (times);
+}
+
+clib_error_t *
+elog_merge_serialized (serialize_main_t * dst, serialize_main_t * srcs, u8 ** src_tags)
+{
+  elog_main_t _em, * em = &_em;
+  elog_merge_input_t * ins = 0, * in, * first;
+  clib_error_t * error = 0;
+  u64 n_events = 0;
+  uword i;
+
+  /* Nothing to free on early error. */
+  memset (em, 0, sizeof (em[0]));
+
+  vec_resize (ins, vec_len (srcs));
+  for (i = 0; i < vec_len (srcs); i++)
+    {
+      in = vec_elt_at_index (ins, i);
+      in->serialize_main = srcs + i;
+      if ((error = unserialize (in->serialize_main,
+				unserialize_elog_merge_input_header, in)))
+	goto done;
+      n_events += in->n_events_left;
+    }
+
+  elog_init (em, 0);
+  vec_reset_length (em->tracks);
+
+  /* Output time starts with earliest input. */
+  first = ins;
+  vec_foreach (in, ins)
+    if (elog_merge_time_offset (&first->em, &in->em) < 0)
+      first = in;
+  if (first)
+    {
+      em->init_time = first->em.init_time;
+      em->serialize_time = first->em.serialize_time;
+      em->nsec_per_cpu_clock = first->em.nsec_per_cpu_clock;
+      em->cpu_timer.seconds_per_clock = first->em.cpu_timer.seconds_per_clock;
+      em->cpu_timer.clocks_per_second = first->em.cpu_timer.clocks_per_second;
+    }
+
+  /* Output types, tracks and strings are known before any events. */
+  vec_foreach (in, ins)
+    {
+      i = in - ins;
+      elog_merge_map_init (&in->map, em, &in->em,
+			   i < vec_len (src_tags) ? src_tags[i] : 0);
+      in->map.dt = elog_merge_time_offset (&first->em, &in->em);
+      elog_event_codec_init (&in->codec, &in->em);
+      em->event_ring_size = clib_max (em->event_ring_size, in->em.event_ring_size);
+
+      if (in->n_events_left > 0
+	  && (error = unserialize (in->serialize_main,
+				   unserialize_elog_merge_input_events, in)))
+	goto done;
+    }
+
+  error = serialize (dst, serialize_elog_merge, em, ins, n_events);
+
+ done:
+  vec_foreach (in, ins)
+    {
+      elog_event_codec_free (&in->codec);
+      elog_merge_map_free (&in->map);
+      vec_free (in->events);
+      elog_free (&in->em);
+    }
+  vec_free (ins);
+  elog_free (em);
+  return error;
+}
+
+#ifdef CLIB_UNIX
+clib_error_t *
+elog_merge_files (char * dst_file, char ** src_files, u8 ** src_tags)
+{
+  serialize_main_t m, * ms = 0;
+  clib_error_t * error;
+  uword i, n_open;
+
+  vec_resize (ms, vec_len (src_files));
+  for (n_open = 0; n_open < vec_len (src_files); n_open++)
+    if ((error = unserialize_open_unix_file (ms + n_open, src_files[n_open])))
+      goto done;
+
+  if ((error = serialize_open_unix_file (&m, dst_file)))
+    goto done;
+  error = elog_merge_serialized (&m, ms, src_tags);
+  if (! error)
+    serialize_close (&m);
+
+ done:
+  for (i = 0; i < n_open; i++)
+    unserialize_close (ms + i);
+  vec_free (ms);
+  return error;
+}
+#endif /* CLIB_UNIX */
+
+
+static char * elog_stream_magic = "elog stream v2";
+
+/* Each flush writes one record: new types, tracks and strings followed
+   by events.  Stream ends with end record. */
+#define ELOG_STREAM_RECORD_END 0
+#define ELOG_STREAM_RECORD_EVENTS 1
+
+static void
+serialize_elog_stream_header (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+
+  serialize_magic (m, elog_stream_magic, strlen (elog_stream_magic));
+  serialize_integer (m, em->event_ring_size, sizeof (u32));
+  serialize (m, serialize_elog_time_stamp, &em->init_time);
+  serialize (m, serialize_elog_clock, em);
+}
+
+clib_error_t * elog_stream_start (elog_main_t * em, serialize_main_t * m)
+{
+  elog_stream_t * s;
+
+  ASSERT (! em->stream);
+  ASSERT (em->event_ring_size >= 2);
+
+  s = clib_mem_alloc_aligned (sizeof (s[0]), CLIB_CACHE_LINE_BYTES);
+  memset (s, 0, sizeof (s[0]));
+  s->serialize_main = m[0];
+  vec_validate (s->n_events_written, clib_max (vec_len (em->per_cpu), 1) - 1);
+  em->stream = s;
+
+  /* Events already in rings are written by first flush. */
+  return serialize (&s->serialize_main, serialize_elog_stream_header, em);
+}
+
+/* Copies events of one ring not yet written to stream.  Only completed
+   ring halves are copied unless IS_FINAL.  Returns number of events
+   lost because logging overwrote them. */
+static u64
+elog_stream_copy_ring (elog_main_t * em, elog_event_t * ring,
+		       volatile u64 * n_total_events, u64 * n_written,
+		       u32 cpu_track, uword is_final)
+{
+  elog_stream_t * s = em->stream;
+  u64 n, first, last, min_first, n_lost, half, i;
+  uword l;
+
+  half = em->event_ring_size / 2;
+  n = *n_total_events;
+
+  /* Event N - 1 may be claimed but not yet written (e.g. by another
+     cpu), so a half is only complete once an event past it is claimed. */
+  if (is_final || n == 0)
+    last = n;
+  else
+    last = (n - 1) &~ (half - 1);
+
+  /* Logging may be writing half starting at LAST which overwrites
+     oldest events in ring. */
+  min_first = is_final ? n : last + half;
+  min_first = min_first > em->event_ring_size ? min_first - em->event_ring_size : 0;
+
+  first = *n_written;
+  n_lost = 0;
+  if (first < min_first)
+    {
+      n_lost += min_first - first;
+      first = min_first;
+    }
+  if (first >= last)
+    {
+      *n_written = clib_max (*n_written, last);
+      return n_lost;
+    }
+
+  l = vec_len (s->events);
+  for (i = first; i < last; i++)
+    {
+      elog_event_t * e;
+
+      vec_add2 (s->events, e, 1);
+      e[0] = ring[i & (em->event_ring_size - 1)];
+
+      e->time = (e->time_cycles - em->init_time.cpu) * em->cpu_timer.seconds_per_clock;
+      if (e->track == 0 && cpu_track != ~0)
+	e->track = cpu_track;
+    }
+
+  /* Drop events overwritten while we were copying. */
+  CLIB_MEMORY_BARRIER ();
+  n = *n_total_events;
+  if (n > first + em->event_ring_size)
+    {
+      u64 n_bad = clib_min (n - em->event_ring_size - first, last - first);
+      vec_delete (s->events, n_bad, l);
+      n_lost += n_bad;
+    }
+
+  *n_written = last;
+  return n_lost;
+}
+
+static void
+serialize_elog_stream_record (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+  u64 n_lost = va_arg (*va, u64);
+  elog_stream_t * s = em->stream;
+  uword n;
+
+  serialize_likely_small_unsigned_integer (m, ELOG_STREAM_RECORD_EVENTS);
+
+  /* Types, tracks and strings may be added by other cpus. */
+  clib_smp_lock (em->smp_lock);
+
+  n = vec_len (em->event_types) - s->n_event_types_written;
+  serialize_likely_small_unsigned_integer (m, n);
+  serialize (m, serialize_elog_event_type, em->event_types + s->n_event_types_written, (u32) n);
+  s->n_event_types_written += n;
+
+  n = vec_len (em->tracks) - s->n_tracks_written;
+  serialize_likely_small_unsigned_integer (m, n);
+  serialize (m, serialize_elog_track, em->tracks + s->n_tracks_written, (u32) n);
+  s->n_tracks_written += n;
+
+  n = vec_len (em->string_table.arena) - s->n_string_table_bytes_written;
+  serialize_likely_small_unsigned_integer (m, n);
+  if (n > 0)
+    memcpy (serialize_get (m, n),
+	    em->string_table.arena + s->n_string_table_bytes_written, n);
+  s->n_string_table_bytes_written += n;
+
+  clib_smp_unlock (em->smp_lock);
+
+  serialize_likely_small_unsigned_integer (m, n_lost);
+  serialize (m, serialize_elog_events, em, s->events, vec_len (s->events));
+}
+
+uword elog_stream_flush_is_needed (elog_main_t * em)
+{
+  elog_stream_t * s = em->stream;
+  u64 half = em->event_ring_size / 2;
+  uword i;
+
+  if (! s)
+    return 0;
+  if (! em->per_cpu)
+    return em->n_total_events >= s->n_events_written[0] + half;
+  for (i = 0; i < vec_len (em->per_cpu); i++)
+    if (em->per_cpu[i].n_total_events >= s->n_events_written[i] + half)
+      return 1;
+  return 0;
+}
+
+static clib_error_t * elog_stream_write (elog_main_t * em, uword is_final)
+{
+  elog_stream_t * s = em->stream;
+  u64 n_lost = 0;
+  uword i;
+
+  vec_reset_length (s->events);
+
+  if (em->per_cpu)
+    for (i = 0; i < vec_len (em->per_cpu); i++)
+      {
+	elog_per_cpu_t * c = vec_elt_at_index (em->per_cpu, i);
+	n_lost += elog_stream_copy_ring (em, c->event_ring, &c->n_total_events,
+					 &s->n_events_written[i],
+					 elog_per_cpu_track (em, i),
+					 is_final);
+      }
+  else
+    n_lost += elog_stream_copy_ring (em, em->event_ring, &em->n_total_events,
+				     &s->n_events_written[0],
+				     ~0, is_final);
+
+  if (vec_len (s->events) == 0 && n_lost == 0)
+    return 0;
+
+  s->n_events_lost += n_lost;
+  return serialize (&s->serialize_main, serialize_elog_stream_record, em, n_lost);
+}
+
+clib_error_t * elog_stream_flush (elog_main_t * em)
+{
+  if (! em->stream)
+    return 0;
+  return elog_stream_write (em, /* is_final */ 0);
+}
+
+static void
+serialize_elog_stream_end (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+
+  serialize_likely_small_unsigned_integer (m, ELOG_STREAM_RECORD_END);
+  elog_time_now (&em->serialize_time);
+  serialize (m, serialize_elog_time_stamp, &em->serialize_time);
+}
+
+clib_error_t * elog_stream_close (elog_main_t * em)
+{
+  elog_stream_t * s = em->stream;
+  clib_error_t * error;
+
+  if (! s)
+    return 0;
+
+  error = elog_stream_write (em, /* is_final */ 1);
+  if (! error)
+    error = serialize (&s->serialize_main, serialize_elog_stream_end, em);
+  if (! error)
+    serialize_close (&s->serialize_main);
+
+  vec_free (s->n_events_written);
+  vec_free (s->events);
+  clib_mem_free (s);
+  em->stream = 0;
+
+  return error;
+}
+
+void
+unserialize_elog_stream (serialize_main_t * m, va_list * va)
+{
+  elog_main_t * em = va_arg (*va, elog_main_t *);
+  uword i, n, record;
+  u32 rs;
+
+  unserialize_check_magic (m, elog_stream_magic,
+			   strlen (elog_stream_magic));
+
+  /* Events are read into events vector; no need for ring. */
+  unserialize_integer (m, &rs, sizeof (u32));
+  elog_init (em, 0);
+  vec_reset_length (em->tracks);
+
+  unserialize (m, unserialize_elog_time_stamp, &em->init_time);
+  unserialize (m, unserialize_elog_clock, em);
+
+  while ((record = unserialize_likely_small_unsigned_integer (m)) != ELOG_STREAM_RECORD_END)
+    {
+      if (record != ELOG_STREAM_RECORD_EVENTS)
+	serialize_error_return (m, "unknown elog stream record %d", record);
+
+      n = unserialize_likely_small_unsigned_integer (m);
+      i = vec_len (em->event_types);
+      vec_resize (em->event_types, n);
+      unserialize (m, unserialize_elog_event_type, em->event_types + i, (u32) n);
+      for (; i < vec_len (em->event_types); i++)
+	new_event_type (em, i);
+
+      n = unserialize_likely_small_unsigned_integer (m);
+      i = vec_len (em->tracks);
+      vec_resize (em->tracks, n);
+      unserialize (m, unserialize_elog_track, em->tracks + i, (u32) n);
+
+      n = unserialize_likely_small_unsigned_integer (m);
+      if (n > 0)
+	vec_add (em->string_table.arena, unserialize_get (m, n), n);
+
+      /* Lost events. */
+      (void) unserialize_likely_small_unsigned_integer (m);
+
+      unserialize (m, unserialize_elog_events, em, &em->events);
+    }
+
+  unserialize (m, unserialize_elog_time_stamp, &em->serialize_time);
+  em->nsec_per_cpu_clock = elog_nsec_per_clock (em);
+  clib_intern_rebuild (&em->string_table);
+
+  /* Records have events of each cpu in time order. */
+  vec_sort (em->events, e1, e2, e1->time < e2->time ? -1 : (e1->time > e2->time ? +1 : 0));
+
+  elog_events_to_ring (em);
 }
@@ -28,6 +28,7 @@
 
 #include <clib/cache.h>
 #include <clib/error.h>		/* for ASSERT */
+#include <clib/intern.h>
 #include <clib/serialize.h>
 #include <clib/time.h>		/* for clib_cpu_time_now */
 #include <clib/mhash.h>
@@ -76,6 +77,12 @@ typedef struct {
   /* Function name generating event. */
   char * function;
 
+  /* Span events: end event closes latest open begin event on same
+     track (see elog_get_spans). */
+  u32 flags;
+#define ELOG_EVENT_TYPE_FLAG_SPAN_BEGIN (1 << 0)
+#define ELOG_EVENT_TYPE_FLAG_SPAN_END (1 << 1)
+
   /* Number of elements in string enum table. */
   u32 n_enum_strings;
 
@@ -100,13 +107,58 @@ typedef struct {
   u64 os_nsec;
 } elog_time_stamp_t;
 
+/* Event ring of a single cpu.  With more than one cpu each cpu logs
+   into its own ring with no atomic operations or locks; rings are
+   merged by time stamp when events are collected. */
+typedef struct {
+  /* Number of events logged by this cpu. */
+  u64 n_total_events;
+
+  /* Logging is disabled when count reaches limit. */
+  u64 n_total_events_disable_limit;
+
+  /* Power of 2 ring of event_ring_size events. */
+  elog_event_t * event_ring;
+
+  /* Track for events on default track logged by this cpu.
+     Registered when events are collected. */
+  elog_track_t track;
+
+  u8 pad[CLIB_CACHE_LINE_BYTES
+	 - 2 * sizeof (u64)
+	 - sizeof (elog_event_t *)
+	 - sizeof (elog_track_t)];
+} elog_per_cpu_t;
+
+/* Streaming of events to a serialize stream.  Logging continues in one
+   half of each event ring while elog_stream_flush writes the other,
+   completed half; traces are then limited only by stream size. */
+typedef struct {
+  serialize_main_t serialize_main;
+
+  /* Number of events of each ring (one for each cpu with per cpu
+     rings) already written to stream. */
+  u64 * n_events_written;
+
+  /* Number of types, tracks and string table bytes already written. */
+  u32 n_event_types_written;
+  u32 n_tracks_written;
+  u32 n_string_table_bytes_written;
+
+  /* Events overwritten by logging before they could be written. */
+  u64 n_events_lost;
+
+  /* Events of a record being written. */
+  elog_event_t * events;
+} elog_stream_t;
+
 typedef struct {
   /* Total number of events in buffer. */
-  u32 n_total_events;
+  u64 n_total_events;
 
   /* When count reaches limit logging is disabled.  This is
      used for event triggers. */
-  u32 n_total_events_disable_limit;
+  u64 n_total_events_disable_limit;
 
   /* Dummy event to use when logger is disabled. */
   elog_event_t dummy_event;
@@ -118,14 +170,20 @@ typedef struct {
      Used when events are being collected. */
   elog_event_t * event_ring;
 
+  /* Per cpu event rings used instead of event_ring when there is more
+     than one cpu.  Each has event_ring_size events. */
+  elog_per_cpu_t * per_cpu;
+
   /* Vector of event types. */
   elog_event_type_t * event_types;
 
-  /* Hash table mapping type format to type index. */
-  uword * event_type_by_format;
+  /* Interned type format and format args; type index for each. */
+  clib_intern_t event_type_keys;
+  u32 * event_type_by_key_id;
 
-  /* Events may refer to strings in string table. */
-  char * string_table;
+  /* Events may refer to strings in string table by byte offset.
+     Each distinct string is stored once. */
+  clib_intern_t string_table;
 
   /* Vector of tracks. */
   elog_track_t * tracks;
@@ -146,28 +204,59 @@ typedef struct {
 
   /* Vector of events converted to generic form after collection. */
   elog_event_t * events;
+
+  /* Non-zero when events are being streamed. */
+  elog_stream_t * stream;
 } elog_main_t;
 
 always_inline uword
 elog_n_events_in_buffer (elog_main_t * em)
-{ return clib_min (em->n_total_events, em->event_ring_size); }
+{
+  elog_per_cpu_t * c;
+  uword n = clib_min (em->n_total_events, em->event_ring_size);
+  vec_foreach (c, em->per_cpu)
+    n += clib_min (c->n_total_events, em->event_ring_size);
+  return n;
+}
 
 always_inline uword
 elog_buffer_capacity (elog_main_t * em)
-{ return em->event_ring_size; }
+{ return em->event_ring_size * clib_max (vec_len (em->per_cpu), 1); }
+
+/* Per cpu rings count events of each cpu separately: limits are
+   relative to count of each cpu. */
+always_inline void
+elog_per_cpu_set_limit (elog_main_t * em, uword is_reset, u64 n)
+{
+  elog_per_cpu_t * c;
+  vec_foreach (c, em->per_cpu)
+    {
+      if (is_reset)
+	c->n_total_events = 0;
+      c->n_total_events_disable_limit = n == ~0ULL ? n : c->n_total_events + n;
+    }
+}
 
+/* Streams know which events were written by count: while streaming
+   counts are kept and events already logged still go to stream. */
 always_inline void
 elog_reset_buffer (elog_main_t * em)
 {
-  em->n_total_events = 0;
+  uword is_reset = ! em->stream;
+  if (is_reset)
+    em->n_total_events = 0;
   em->n_total_events_disable_limit = ~0;
+  elog_per_cpu_set_limit (em, is_reset, ~0ULL);
 }
 
 always_inline void
 elog_enable_disable (elog_main_t * em, int is_enabled)
 {
-  em->n_total_events = 0;
-  em->n_total_events_disable_limit = is_enabled ? ~0ULL : 0ULL;
+  uword is_reset = ! em->stream;
+  if (is_reset)
+    em->n_total_events = 0;
+  em->n_total_events_disable_limit = is_enabled ? ~0ULL : em->n_total_events;
+  elog_per_cpu_set_limit (em, is_reset, ~0ULL);
 }
 
 /* Disable logging after specified number of ievents have been logged.
@@ -176,13 +265,16 @@ elog_enable_disable (elog_main_t * em, int is_enabled)
    event will not be lost as long as N < RING_SIZE. */
 always_inline void
 elog_disable_after_events (elog_main_t * em, uword n)
-{ em->n_total_events_disable_limit = em->n_total_events + n; }
+{
+  em->n_total_events_disable_limit = em->n_total_events + n;
+  elog_per_cpu_set_limit (em, /* is_reset */ 0, n);
+}
 
 /* Signal a trigger.  We do this when we encounter an event that we want to save
    context around (before and after). */
 always_inline void
 elog_disable_trigger (elog_main_t * em)
-{ em->n_total_events_disable_limit = em->n_total_events + vec_len (em->event_ring) / 2; }
+{ elog_disable_after_events (em, em->event_ring_size / 2); }
 
 /* External function to register types/tracks. */
 word elog_event_type_register (elog_main_t * em, elog_event_type_t * t);
@@ -220,15 +312,26 @@ elog_event_data_inline (elog_main_t * em,
 
   ASSERT (type_index < vec_len (em->event_types));
   ASSERT (track_index < vec_len (em->tracks));
-  ASSERT (is_pow2 (vec_len (em->event_ring)));
 
-  if (em->smp_lock)
-    ei = clib_smp_atomic_add (&em->n_total_events, 1);
-  else
-    ei = em->n_total_events++;
+  if (em->per_cpu)
+    {
+      elog_per_cpu_t * c = vec_elt_at_index (em->per_cpu, os_get_cpu_number ());
+      u64 n = c->n_total_events;
 
-  ei &= em->event_ring_size - 1;
-  e = vec_elt_at_index (em->event_ring, ei);
+      if (PREDICT_FALSE (n >= c->n_total_events_disable_limit))
+	return em->dummy_event.data;
+
+      /* Only this cpu writes its ring: no atomic operations needed. */
+      c->n_total_events = n + 1;
+      e = c->event_ring + (n & (em->event_ring_size - 1));
+    }
+  else
+    {
+      ASSERT (is_pow2 (vec_len (em->event_ring)));
+      ei = em->n_total_events++;
+      ei &= em->event_ring_size - 1;
+      e = vec_elt_at_index (em->event_ring, ei);
+    }
 
   e->time_cycles = cpu_time;
   e->type = type_index;
@@ -330,6 +433,14 @@ elog_data_inline (elog_main_t * em, elog_event_type_t * type, elog_track_t * tra
 #define ELOG_TYPE_FD(f) ELOG_TYPE_DECLARE_FORMAT_AND_FUNCTION (f, #f " %d")
 #define ELOG_TYPE_FX(f) ELOG_TYPE_DECLARE_FORMAT_AND_FUNCTION (f, #f " 0x%x")
 
+/* Span begin and end types. */
+#define ELOG_TYPE_SPAN_BEGIN(f,fmt)					\
+  static elog_event_type_t __ELOG_TYPE_VAR(f) =				\
+    { .format = fmt, .flags = ELOG_EVENT_TYPE_FLAG_SPAN_BEGIN, }
+#define ELOG_TYPE_SPAN_END(f,fmt)					\
+  static elog_event_type_t __ELOG_TYPE_VAR(f) =				\
+    { .format = fmt, .flags = ELOG_EVENT_TYPE_FLAG_SPAN_END, }
+
 #define ELOG_TRACK_DECLARE(f) static elog_track_t __ELOG_TRACK_VAR(f)
 #define ELOG_TRACK(f) ELOG_TRACK_DECLARE(f) = { .name = #f, }
 
@@ -354,13 +465,35 @@ void elog_time_now (elog_time_stamp_t * et);
    Sets em->events to resulting vector. */
 elog_event_t * elog_get_events (elog_main_t * em);
 
-/* Convert ievents to events and return them as a vector with no side effects. */
+/* Convert ievents to events and return them as a vector; em->events
+   is left alone.  With per cpu rings this registers a "cpu N" track
+   for each cpu with events (once per cpu). */
 elog_event_t * elog_peek_events (elog_main_t * em);
 
+typedef struct {
+  /* Indices of begin and end events in events vector. */
+  u32 begin, end;
+
+  /* Number of spans still open on track when this one began. */
+  u32 depth;
+} elog_span_t;
+
+/* Pairs span begin and end events of time ordered events (e.g. from
+   elog_get_events).  Ends with no open begin on their track and begins
+   never ended are ignored.  Spans are in order of end. */
+elog_span_t * elog_get_spans (elog_main_t * em, elog_event_t * es);
+
 /* Merge two logs, add supplied track tags. */
 void elog_merge (elog_main_t * dst, u8 * dst_tag, 
                  elog_main_t * src, u8 * src_tag);
 
+/* Merges serialized logs (as written by serialize_elog_main) into DST
+   using a heap of inputs ordered by time of next event.  Events are
+   read and written a few at a time so memory does not grow with number
+   of events.  SRC_TAGS (may be 0) prefix track names of each input. */
+clib_error_t *
+elog_merge_serialized (serialize_main_t * dst, serialize_main_t * srcs, u8 ** src_tags);
+
 /* 2 arguments elog_main_t and elog_event_t to format event or track name. */
 u8 * format_elog_event (u8 * s, va_list * va);
 u8 * format_elog_track (u8 * s, va_list * va);
@@ -368,9 +501,40 @@ u8 * format_elog_track (u8 * s, va_list * va);
 void serialize_elog_main (serialize_main_t * m, va_list * va);
 void unserialize_elog_main (serialize_main_t * m, va_list * va);
 
+/* Writes events as Chrome trace event JSON (chrome://tracing, Perfetto)
+   a few at a time.  Tracks are threads; spans are begin/end events and
+   other events are instants. */
+void serialize_elog_chrome_trace (serialize_main_t * m, va_list * va);
+
 void elog_init (elog_main_t * em, u32 n_events);
 
+/* Frees event rings, types, tracks and strings of given log.  Stream
+   (if any) must already be closed. */
+void elog_free (elog_main_t * em);
+
+/* Start streaming events to given open serialize stream. */
+clib_error_t * elog_stream_start (elog_main_t * em, serialize_main_t * m);
+
+/* Write completed ring halves to stream.  Call often enough (e.g. from
+   another cpu or timer) that logging never laps writer; events lapped
+   are counted in n_events_lost.  Only one caller at a time. */
+clib_error_t * elog_stream_flush (elog_main_t * em);
+
+/* Non-zero when a ring half is waiting to be written. */
+uword elog_stream_flush_is_needed (elog_main_t * em);
+
+/* Write all remaining events and close stream.  Logging should be
+   stopped first. */
+clib_error_t * elog_stream_close (elog_main_t * em);
+
+/* Reads stream as written above; events are sorted by time. */
+void unserialize_elog_stream (serialize_main_t * m, va_list * va);
+
 #ifdef CLIB_UNIX
+/* As above for files. */
+clib_error_t *
+elog_merge_files (char * dst_file, char ** src_files, u8 ** src_tags);
+
 always_inline clib_error_t *
 elog_write_file (elog_main_t * em, char * unix_file)
 {
@@ -386,6 +550,21 @@ elog_write_file (elog_main_t * em, char * unix_file)
   return error;
 }
 
+always_inline clib_error_t *
+elog_write_chrome_trace_file (elog_main_t * em, char * unix_file)
+{
+  serialize_main_t m;
+  clib_error_t * error;
+
+  error = serialize_open_unix_file (&m, unix_file);
+  if (error)
+    return error;
+  error = serialize (&m, serialize_elog_chrome_trace, em);
+  if (! error)
+    serialize_close (&m);
+  return error;
+}
+
 always_inline clib_error_t *
 elog_read_file (elog_main_t * em, char * unix_file)
 {
@@ -401,6 +580,33 @@ elog_read_file (elog_main_t * em, char * unix_file)
   return error;
 }
 
+always_inline clib_error_t *
+elog_stream_file (elog_main_t * em, char * unix_file)
+{
+  serialize_main_t m;
+  clib_error_t * error;
+
+  error = serialize_open_unix_file (&m, unix_file);
+  if (error)
+    return error;
+  return elog_stream_start (em, &m);
+}
+
+always_inline clib_error_t *
+elog_read_stream_file (elog_main_t * em, char * unix_file)
+{
+  serialize_main_t m;
+  clib_error_t * error;
+
+  error = unserialize_open_unix_file (&m, unix_file);
+  if (error)
+    return error;
+  error = unserialize (&m, unserialize_elog_stream, em);
+  if (! error)
+    unserialize_close (&m);
+  return error;
+}
+
 #endif /* CLIB_UNIX */
 
 #endif /* included_clib_elog_h */
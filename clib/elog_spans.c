@@ -0,0 +1,155 @@
+/*
+  Copyright (c) 2005 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/* Span duration statistics for saved event logs.
+   Usage: elog_spans FILE [FILE ...] [tag TAG ...] [chrome FILE] */
+
+#include <clib/elog.h>
+#include <clib/error.h>
+#include <clib/format.h>
+#include <clib/unix.h>
+
+/* Nearest rank percentile of sorted durations: rank is
+   ceil (per_mille * n / 1000), in integers so that e.g. 99.9% of
+   1000 durations is the 999th and not the largest. */
+static f64 percentile (f64 * sorted, u32 per_mille)
+{
+  uword n = vec_len (sorted);
+  uword r = ((u64) per_mille * n + 999) / 1000;
+
+  if (r > 0)
+    r--;
+  return sorted[clib_min (r, n - 1)];
+}
+
+int elog_spans_main (unformat_input_t * input)
+{
+  clib_error_t * error = 0;
+  elog_main_t _em, * em = &_em;
+  elog_event_t * es;
+  elog_span_t * spans, * s;
+  f64 ** durations_by_type = 0, * d;
+  char * file, ** files = 0, * chrome_file = 0;
+  u8 * tag, ** tags = 0, * merge_file = 0;
+  uword i;
+
+  memset (em, 0, sizeof (em[0]));
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "chrome %s", &chrome_file))
+	;
+      else if (unformat (input, "tag %s", &tag))
+	vec_add1 (tags, tag);
+      else if (unformat (input, "%s", &file))
+	vec_add1 (files, file);
+      else
+	{
+	  error = clib_error_create ("unknown input `%U'\n",
+				     format_unformat_error, input);
+	  goto done;
+	}
+    }
+
+  if (vec_len (files) == 0)
+    {
+      error = clib_error_create ("no event log files given");
+      goto done;
+    }
+  vec_validate (tags, vec_len (files) - 1);
+
+  /* Several files are merged a few events at a time into a temporary
+     file rather than all being read into memory. */
+  if (vec_len (files) > 1)
+    {
+      merge_file = format (0, "/tmp/elog_spans.%d%c", getpid (), 0);
+      if ((error = elog_merge_files ((char *) merge_file, files, tags)))
+	goto done;
+      file = (char *) merge_file;
+    }
+  else
+    file = files[0];
+  if ((error = elog_read_file (em, file)))
+    goto done;
+
+  es = elog_get_events (em);
+  spans = elog_get_spans (em, es);
+
+  vec_foreach (s, spans)
+    {
+      u32 t = es[s->begin].type;
+      vec_validate (durations_by_type, t);
+      vec_add1 (durations_by_type[t], es[s->end].time - es[s->begin].time);
+    }
+
+  fformat (stdout, "%-40s%10s%12s%12s%12s%12s%12s%12s\n",
+	   "Span (usec)", "Count", "Min", "50%", "90%", "99%", "99.9%", "Max");
+  for (i = 0; i < vec_len (durations_by_type); i++)
+    {
+      elog_event_type_t * t = vec_elt_at_index (em->event_types, i);
+
+      d = durations_by_type[i];
+      if (vec_len (d) == 0)
+	continue;
+
+      vec_sort (d, d0, d1, (d0[0] > d1[0]) - (d0[0] < d1[0]));
+      fformat (stdout, "%-40s%10d%12.3f%12.3f%12.3f%12.3f%12.3f%12.3f\n",
+	       t->format, vec_len (d),
+	       1e6 * d[0],
+	       1e6 * percentile (d, 500),
+	       1e6 * percentile (d, 900),
+	       1e6 * percentile (d, 990),
+	       1e6 * percentile (d, 999),
+	       1e6 * d[vec_len (d) - 1]);
+    }
+
+  if (chrome_file)
+    error = elog_write_chrome_trace_file (em, chrome_file);
+
+  for (i = 0; i < vec_len (durations_by_type); i++)
+    vec_free (durations_by_type[i]);
+  vec_free (durations_by_type);
+  vec_free (spans);
+
+ done:
+  if (merge_file)
+    unlink ((char *) merge_file);
+  vec_free (merge_file);
+  elog_free (em);
+  if (error)
+    clib_error_report (error);
+  return error ? 1 : 0;
+}
+
+#ifdef CLIB_UNIX
+int main (int argc, char * argv [])
+{
+  unformat_input_t i;
+  int r;
+
+  unformat_init_command_line (&i, argv);
+  r = elog_spans_main (&i);
+  unformat_free (&i);
+  return r;
+}
+#endif
@@ -0,0 +1,197 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <clib/filter.h>
+
+void clib_filter_init (clib_filter_t * f, uword n_keys)
+{
+  uword n_blocks;
+
+  memset (f, 0, sizeof (f[0]));
+
+  n_blocks = n_keys / CLIB_FILTER_KEYS_PER_BLOCK;
+  f->log2_n_blocks = max_log2 (clib_max (n_blocks, 1));
+  vec_validate_aligned (f->counters,
+			(CLIB_CACHE_LINE_BYTES << f->log2_n_blocks) - 1,
+			CLIB_CACHE_LINE_BYTES);
+
+  f->hash_seeds[0] = 0x9e3779b9;
+  f->hash_seeds[1] = 0x85ebca6b;
+  f->hash_seeds[2] = 0xc2b2ae35;
+}
+
+void clib_filter_free (clib_filter_t * f)
+{
+  vec_free (f->counters);
+  memset (f, 0, sizeof (f[0]));
+}
+
+void clib_filter_copy (clib_filter_t * dst, clib_filter_t * src)
+{
+  dst[0] = src[0];
+  dst->counters = 0;
+  vec_validate_aligned (dst->counters, vec_len (src->counters) - 1,
+			CLIB_CACHE_LINE_BYTES);
+  memcpy (dst->counters, src->counters, vec_len (src->counters));
+}
+
+void clib_filter_add (clib_filter_t * f, uword key_hash)
+{
+  u32 block, probes;
+  uword i, j, c;
+  u8 * b;
+
+  block = clib_filter_hash (f, key_hash, &probes);
+  b = clib_filter_get_block (f, block);
+  for (i = 0; i < CLIB_FILTER_N_PROBES; i++)
+    {
+      j = clib_filter_counter_index (probes, i);
+      c = clib_filter_get_counter (b, j);
+      if (c < CLIB_FILTER_COUNTER_MAX)
+	{
+	  b[j / 2] += 1 << (4 * (j % 2));
+	  f->n_saturated += c + 1 == CLIB_FILTER_COUNTER_MAX;
+	}
+    }
+
+  f->n_elts += 1;
+}
+
+void clib_filter_del (clib_filter_t * f, uword key_hash)
+{
+  u32 block, probes;
+  uword i, j, c;
+  u8 * b;
+
+  block = clib_filter_hash (f, key_hash, &probes);
+  b = clib_filter_get_block (f, block);
+  for (i = 0; i < CLIB_FILTER_N_PROBES; i++)
+    {
+      j = clib_filter_counter_index (probes, i);
+      c = clib_filter_get_counter (b, j);
+
+      /* Saturated counters no longer know how many keys they count. */
+      if (c < CLIB_FILTER_COUNTER_MAX)
+	{
+	  ASSERT (c > 0);
+	  b[j / 2] -= 1 << (4 * (j % 2));
+	}
+    }
+
+  ASSERT (f->n_elts > 0);
+  f->n_elts -= 1;
+}
+
+uword clib_filter_may_contain_multiple (clib_filter_t * f, uword * key_hashes, uword n_keys)
+{
+  u32 blocks[BITS (uword)], probes[BITS (uword)];
+  uword i, result;
+
+  ASSERT (n_keys <= BITS (uword));
+
+  i = 0;
+
+#if CLIB_VECTOR_WORD_BITS >= 128
+  {
+    u32x_union_t a, b, c, seeds[3], mask;
+    uword j, n = CLIB_VECTOR_WORD_LEN (u32);
+
+    for (j = 0; j < n; j++)
+      {
+	seeds[0].as_u32[j] = f->hash_seeds[0];
+	seeds[1].as_u32[j] = f->hash_seeds[1];
+	seeds[2].as_u32[j] = f->hash_seeds[2];
+	mask.as_u32[j] = pow2_mask (f->log2_n_blocks);
+      }
+
+    /* Same as clib_filter_hash for a vector of keys at a time. */
+    for (; i + n <= n_keys; i += n)
+      {
+	for (j = 0; j < n; j++)
+	  {
+	    a.as_u32[j] = key_hashes[i + j];
+#if uword_bits == 64
+	    b.as_u32[j] = key_hashes[i + j] >> 32;
+#else
+	    b.as_u32[j] = 0;
+#endif
+	  }
+
+	a.as_u32x ^= seeds[0].as_u32x;
+	b.as_u32x ^= seeds[1].as_u32x;
+	c.as_u32x = seeds[2].as_u32x;
+
+	hash_mix32 (a.as_u32x, b.as_u32x, c.as_u32x);
+
+	c.as_u32x &= mask.as_u32x;
+
+	for (j = 0; j < n; j++)
+	  {
+	    blocks[i + j] = c.as_u32[j];
+	    probes[i + j] = b.as_u32[j];
+	  }
+      }
+  }
+#endif
+
+  for (; i < n_keys; i++)
+    blocks[i] = clib_filter_hash (f, key_hashes[i], &probes[i]);
+
+  /* Start all cache misses before testing any block. */
+  for (i = 0; i < n_keys; i++)
+    CLIB_PREFETCH (clib_filter_get_block (f, blocks[i]), CLIB_CACHE_LINE_BYTES, LOAD);
+
+  result = 0;
+  for (i = 0; i < n_keys; i++)
+    result |= ((uword) clib_filter_block_may_contain (clib_filter_get_block (f, blocks[i]),
+						      probes[i])) << i;
+
+  return result;
+}
+
+uword clib_filter_bytes (clib_filter_t * f)
+{ return vec_capacity (f->counters, 0); }
+
+u8 * format_clib_filter (u8 * s, va_list * va)
+{
+  clib_filter_t * f = va_arg (*va, clib_filter_t *);
+  uword i, n_counters, n_non_zero;
+  f64 fill, false_positive;
+
+  n_counters = 2 * vec_len (f->counters);
+  n_non_zero = 0;
+  for (i = 0; i < n_counters; i++)
+    n_non_zero += clib_filter_get_counter (f->counters, i) != 0;
+
+  /* Chance that all probes of a missing key hit non-zero counters. */
+  fill = n_counters > 0 ? (f64) n_non_zero / n_counters : 0;
+  false_positive = 1;
+  for (i = 0; i < CLIB_FILTER_N_PROBES; i++)
+    false_positive *= fill;
+
+  s = format (s, "filter: %d keys, %d blocks, %d saturated counters, est. false positives %.2f%%",
+	      f->n_elts, 1 << f->log2_n_blocks, f->n_saturated,
+	      100 * false_positive);
+
+  return s;
+}
@@ -0,0 +1,145 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef included_clib_filter_h
+#define included_clib_filter_h
+
+/* Counting blocked Bloom filter for answering most negative lookups
+   into large tables without touching the table.
+
+   Each key maps to one cache line block of 4 bit counters.  Adding a
+   key increments CLIB_FILTER_N_PROBES counters in its block; deleting
+   decrements them so keys can be removed.  A key may be present only if
+   all its counters are non-zero, so a miss costs a single cache line.
+   Counters which reach maximum stick there and are never decremented.
+
+   Filter works on key hashes (e.g. hash_t key sums) which are
+   remixed with Jenkins hash_mix32 and per filter seeds. */
+
+#include <clib/cache.h>
+#include <clib/format.h>
+#include <clib/hash.h>
+#include <clib/vec.h>
+
+#define CLIB_FILTER_N_PROBES 4
+
+/* One probe in each quarter of block. */
+#define CLIB_FILTER_LOG2_COUNTERS_PER_PROBE (CLIB_LOG2_CACHE_LINE_BYTES + 1 - 2)
+
+#define CLIB_FILTER_COUNTER_MAX 0xf
+
+/* Sizing: gives about 2% false positives. */
+#define CLIB_FILTER_KEYS_PER_BLOCK 16
+
+typedef struct clib_filter {
+  /* Vector of counter blocks; 2 counters per byte. */
+  u8 * counters;
+
+  u32 log2_n_blocks;
+
+  /* Number of keys added less number deleted. */
+  u32 n_elts;
+
+  /* Number of counters stuck at maximum. */
+  u32 n_saturated;
+
+  u32 hash_seeds[3];
+} clib_filter_t;
+
+always_inline uword
+clib_filter_capacity (clib_filter_t * f)
+{ return CLIB_FILTER_KEYS_PER_BLOCK << f->log2_n_blocks; }
+
+always_inline u8 *
+clib_filter_get_block (clib_filter_t * f, u32 block)
+{ return f->counters + (block << CLIB_LOG2_CACHE_LINE_BYTES); }
+
+/* Hash gives block index and (in PROBES) bits selecting counters
+   in block. */
+always_inline u32
+clib_filter_hash (clib_filter_t * f, uword key_hash, u32 * probes)
+{
+  u32 a, b, c;
+
+  a = f->hash_seeds[0] ^ key_hash;
+  b = f->hash_seeds[1];
+  c = f->hash_seeds[2];
+#if uword_bits == 64
+  b ^= key_hash >> 32;
+#endif
+
+  hash_mix32 (a, b, c);
+
+  *probes = b;
+  return c & pow2_mask (f->log2_n_blocks);
+}
+
+always_inline uword
+clib_filter_counter_index (u32 probes, uword i)
+{
+  uword n = CLIB_FILTER_LOG2_COUNTERS_PER_PROBE;
+  return (i << n) + ((probes >> (i * n)) & pow2_mask (n));
+}
+
+always_inline uword
+clib_filter_get_counter (u8 * block, uword i)
+{ return (block[i / 2] >> (4 * (i % 2))) & 0xf; }
+
+always_inline uword
+clib_filter_block_may_contain (u8 * block, u32 probes)
+{
+  uword i, is_zero = 0;
+  for (i = 0; i < CLIB_FILTER_N_PROBES; i++)
+    is_zero |= clib_filter_get_counter (block, clib_filter_counter_index (probes, i)) == 0;
+  return ! is_zero;
+}
+
+/* Returns zero if key is definitely not present; non-zero if it
+   may be present. */
+always_inline uword
+clib_filter_may_contain (clib_filter_t * f, uword key_hash)
+{
+  u32 block, probes;
+  block = clib_filter_hash (f, key_hash, &probes);
+  return clib_filter_block_may_contain (clib_filter_get_block (f, block), probes);
+}
+
+/* Size filter for given number of keys. */
+void clib_filter_init (clib_filter_t * f, uword n_keys);
+void clib_filter_free (clib_filter_t * f);
+void clib_filter_copy (clib_filter_t * dst, clib_filter_t * src);
+
+void clib_filter_add (clib_filter_t * f, uword key_hash);
+void clib_filter_del (clib_filter_t * f, uword key_hash);
+
+/* Probe up to BITS (uword) key hashes: hashing is vectorized and all
+   blocks are prefetched before any is tested.  Returns bitmap with
+   bit I set if key I may be present. */
+uword clib_filter_may_contain_multiple (clib_filter_t * f, uword * key_hashes, uword n_keys);
+
+uword clib_filter_bytes (clib_filter_t * f);
+
+/* Format args: filter pointer. */
+format_function_t format_clib_filter;
+
+#endif /* included_clib_filter_h */
@@ -22,6 +22,8 @@
 */
 
 #include <clib/hash.h>
+#include <clib/filter.h>
+#include <clib/pipeline.h>
 #include <clib/error.h>
 #include <clib/mem.h>
 #include <clib/byte_order.h>	/* for clib_arch_is_big_endian */
@@ -30,7 +32,7 @@ always_inline void zero_pair (hash_t * h, hash_pair_t * p)
 { memset (p, 0, hash_pair_bytes (h)); }
 
 always_inline void init_pair (hash_t * h, hash_pair_t * p)
-{ memset (p->value, ~0, hash_value_bytes (h)); }
+{ memset (hash_pair_value (h, p), ~0, hash_value_bytes (h)); }
 
 always_inline hash_pair_union_t *
 get_pair (void * v, uword i)
@@ -191,16 +193,129 @@ u32 hash_memory32 (void * p, word n_bytes, u32 state)
 }
 #endif
 
-uword hash_memory (void * p, word n_bytes, uword state)
+#ifdef HASH_MEMORY_X86_KERNELS
+
+/* CRC32C of 8 byte words.  Two independent streams hide latency of
+   crc32 instruction; final mix spreads 2 x 32 bits of CRC over 64 bits. */
+__attribute__ ((target ("sse4.2")))
+u64 hash_memory64_crc32c (void * p, word n_bytes, u64 state)
 {
-  uword * q = p;
+  u64 * q = p;
+  u64 a, b, c, n;
 
-#if uword_bits == 64
-  return hash_memory64 (q, n_bytes, state);
+  a = state;
+  b = state ^ 0x9e3779b97f4a7c13LL;
+  c = state + n_bytes;
+  n = n_bytes;
+
+  while (n >= 2 * sizeof (u64))
+    {
+      a = __builtin_ia32_crc32di (a, clib_mem_unaligned (q + 0, u64));
+      b = __builtin_ia32_crc32di (b, clib_mem_unaligned (q + 1, u64));
+      n -= 2 * sizeof (u64);
+      q += 2;
+    }
+
+  if (n >= sizeof (u64))
+    {
+      a = __builtin_ia32_crc32di (a, clib_mem_unaligned (q + 0, u64));
+      n -= sizeof (u64);
+      q += 1;
+    }
+
+  if (n > 0)
+    b = __builtin_ia32_crc32di (b, zap64 (clib_mem_unaligned (q + 0, u64), n));
+
+  hash_mix64 (a, b, c);
+
+  return c;
+}
+
+/* Signed as expected by vpmuludq builtin. */
+typedef i32 hash_i32x8 __attribute__ ((vector_size (32)));
+typedef u64 hash_u64x4 __attribute__ ((vector_size (32)));
+
+/* Long keys: 4 lanes of 32 x 32 -> 64 bit multiply accumulate
+   (as in xxhash3) in 4 independent accumulators consume 128 bytes per
+   round.  Shorter keys and tail are hashed with crc32c kernel. */
+__attribute__ ((target ("avx2,sse4.2")))
+u64 hash_memory64_avx2 (void * p, word n_bytes, u64 state)
+{
+  u8 * q = p;
+  hash_u64x4 acc[4], x, k, swap = { 1, 0, 3, 2, };
+  u64 a, b, c;
+  word i, n;
+
+  /* Crc32c is faster up to around 2k bytes. */
+  if (n_bytes < 2048)
+    return hash_memory64_crc32c (p, n_bytes, state);
+
+  for (i = 0; i < ARRAY_LEN (acc); i++)
+    acc[i] = (hash_u64x4) { state, state, state, state, };
+
+  k = (hash_u64x4) { 0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL,
+		     0x94d049bb133111ebULL, 0xc2b2ae3d27d4eb4fULL, };
+
+#define _(i)							\
+  do {								\
+    memcpy (&x, q + (i) * sizeof (x), sizeof (x));		\
+    acc[i] += __builtin_shuffle (x, swap);			\
+    x ^= k;							\
+    acc[i] += (hash_u64x4)					\
+      __builtin_ia32_pmuludq256 ((hash_i32x8) x,		\
+				 (hash_i32x8) (x >> 32));	\
+  } while (0)
+
+  for (n = n_bytes; n >= sizeof (acc); n -= sizeof (acc))
+    {
+      _ (0); _ (1); _ (2); _ (3);
+      q += sizeof (acc);
+    }
+
+  for (; n >= sizeof (x); n -= sizeof (x))
+    {
+      _ (0);
+      q += sizeof (x);
+    }
+
+#undef _
+
+  a = b = 0x9e3779b97f4a7c13LL;
+  c = state + n_bytes;
+  for (i = 0; i < ARRAY_LEN (acc); i++)
+    {
+      a += acc[i][0] ^ acc[i][2];
+      b += acc[i][1] ^ acc[i][3];
+      hash_mix64 (a, b, c);
+    }
+
+  return hash_memory64_crc32c (q, n, c);
+}
+
+static uword hash_memory_select (void * p, word n_bytes, uword state)
+{
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse4.2") && __builtin_cpu_supports ("avx2"))
+    hash_memory_function = hash_memory64_avx2;
+  else if (__builtin_cpu_supports ("sse4.2"))
+    hash_memory_function = hash_memory64_crc32c;
+  else
+    hash_memory_function = hash_memory64;
+  return hash_memory_function (p, n_bytes, state);
+}
+
+/* Kernel is chosen on first call, before any key has been hashed,
+   so that all tables see the same hash function. */
+hash_memory_function_t * hash_memory_function = hash_memory_select;
+
+#elif uword_bits == 64
+hash_memory_function_t * hash_memory_function = hash_memory64;
 #else
-  return hash_memory32 (q, n_bytes, state);
+hash_memory_function_t * hash_memory_function = hash_memory32;
 #endif
-}
+
+uword hash_memory (void * p, word n_bytes, uword state)
+{ return hash_memory_function (p, n_bytes, state); }
 
 #if uword_bits == 64
 always_inline uword hash_uword (uword x)
@@ -287,6 +402,8 @@ always_inline uword key_equal1 (hash_t * h, uword key1, uword key2, uword e)
 always_inline uword key_equal (hash_t * h, uword key1, uword key2)
 {
   uword e = key1 == key2;
+  if (PREDICT_FALSE (h->flags & HASH_FLAG_STATS))
+    h->n_key_compares += 1;
   if (CLIB_DEBUG > 0 && key1 == key2)
     ASSERT (key_equal1 (h, key1, key2, e));
   if (! e)
@@ -447,8 +564,145 @@ enum lookup_opcode {
   UNSET = 3,
 };
 
-static hash_pair_t * lookup (void * v, uword key, enum lookup_opcode op,
-			     void * new_value, void * old_value)
+/* Open addressing.  Pairs are grouped into groups of 16; each pair
+   has a control byte.  Keys are looked up by comparing 7 bits of key
+   sum against a whole group of control bytes at once. */
+#define OPEN_GROUP_SIZE 16
+#define OPEN_CONTROL_EMPTY 0x80
+#define OPEN_CONTROL_DELETED 0xfe
+
+#if defined (__SSE2__) && __GNUC__ >= 4
+#define OPEN_GROUP_VECTOR
+#endif
+
+/* Returns bitmask of control bytes in group matching given byte. */
+always_inline uword
+open_group_match (u8 * c, u8 x)
+{
+#ifdef OPEN_GROUP_VECTOR
+  u8x16 g = *(u8x16 *) c;
+  return u8x16_compare_byte_mask (u8x16_is_equal (g, u8x16_splat (x)));
+#else
+  uword i, m = 0;
+  for (i = 0; i < OPEN_GROUP_SIZE; i++)
+    m |= (uword) (c[i] == x) << i;
+  return m;
+#endif
+}
+
+/* Bitmask of empty or deleted control bytes in group. */
+always_inline uword
+open_group_match_free (u8 * c)
+{
+#ifdef OPEN_GROUP_VECTOR
+  u8x16 g = *(u8x16 *) c;
+  return u8x16_compare_byte_mask (g);
+#else
+  uword i, m = 0;
+  for (i = 0; i < OPEN_GROUP_SIZE; i++)
+    m |= (uword) (c[i] >> 7) << i;
+  return m;
+#endif
+}
+
+always_inline void
+open_control_init (hash_t * h, uword n_pairs)
+{
+  h->open_control = 0;
+  h->open_n_deleted = 0;
+  vec_validate_aligned (h->open_control, n_pairs - 1, OPEN_GROUP_SIZE);
+  memset (h->open_control, OPEN_CONTROL_EMPTY, n_pairs);
+}
+
+static hash_pair_t * lookup_open (void * v, uword key, uword sum,
+				  enum lookup_opcode op,
+				  void * new_value, void * old_value)
+{
+  hash_t * h = hash_header (v);
+  hash_pair_union_t * p;
+  uword group, group_mask, probe, match, i, free_index;
+  u8 * c, tag;
+
+  tag = sum & 0x7f;
+  group_mask = vec_len (v) / OPEN_GROUP_SIZE - 1;
+  group = (sum >> 7) & group_mask;
+  free_index = ~0;
+
+  /* Triangular probing visits each group exactly once. */
+  for (probe = 0; probe <= group_mask; probe++)
+    {
+      c = h->open_control + group * OPEN_GROUP_SIZE;
+
+      match = open_group_match (c, tag);
+      while (match != 0)
+	{
+	  i = group * OPEN_GROUP_SIZE + log2_first_set (match);
+	  p = get_pair (v, i);
+	  if (key_equal (h, hash_pair_key (h, &p->direct), key))
+	    goto found;
+	  match &= match - 1;
+	}
+
+      match = open_group_match_free (c);
+      if (op == SET && free_index == ~0 && match != 0)
+	free_index = group * OPEN_GROUP_SIZE + log2_first_set (match);
+
+      /* An empty slot in group means key cannot be further along. */
+      if (open_group_match (c, OPEN_CONTROL_EMPTY))
+	break;
+
+      group = (group + probe + 1) & group_mask;
+    }
+
+  if (op != SET)
+    return 0;
+
+  /* Caller makes sure table is never completely full. */
+  ASSERT (free_index != ~0);
+  i = free_index;
+  c = h->open_control;
+  h->open_n_deleted -= c[i] == OPEN_CONTROL_DELETED;
+  c[i] = tag;
+  set_is_user (v, i, 1);
+
+  p = get_pair (v, i);
+  hash_pair_set_key (h, &p->direct, key);
+  init_pair (h, &p->direct);
+  memcpy (hash_pair_value (h, &p->direct), new_value, hash_value_bytes (h));
+  h->elts += 1;
+  return &p->direct;
+
+ found:
+  if (op == GET)
+    return &p->direct;
+
+  if (old_value)
+    memcpy (old_value, hash_pair_value (h, &p->direct), hash_value_bytes (h));
+
+  if (op == SET)
+    {
+      memcpy (hash_pair_value (h, &p->direct), new_value, hash_value_bytes (h));
+      return &p->direct;
+    }
+
+  /* Unset.  If the group has an empty slot no probe sequence has ever
+     passed through it, so slot can be marked empty instead of deleted. */
+  if (open_group_match (c, OPEN_CONTROL_EMPTY))
+    c[i % OPEN_GROUP_SIZE] = OPEN_CONTROL_EMPTY;
+  else
+    {
+      c[i % OPEN_GROUP_SIZE] = OPEN_CONTROL_DELETED;
+      h->open_n_deleted += 1;
+    }
+  set_is_user (v, i, 0);
+  zero_pair (h, &p->direct);
+  h->elts -= 1;
+  return 0;
+}
+
+static hash_pair_t * lookup_table (void * v, uword key, uword sum,
+				   enum lookup_opcode op,
+				   void * new_value, void * old_value)
 {
   hash_t * h = hash_header (v);
   hash_pair_union_t * p = 0;
@@ -458,7 +712,10 @@ static hash_pair_t * lookup (void * v, uword key, enum lookup_opcode op,
   if (! v)
     return 0;
 
-  i = key_sum (h, key) & (_vec_len (v) - 1);
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    return lookup_open (v, key, sum, op, new_value, old_value);
+
+  i = sum & (_vec_len (v) - 1);
   p = get_pair (v, i);
 
   if (hash_is_user (v, i))
@@ -530,6 +787,209 @@ static hash_pair_t * lookup (void * v, uword key, enum lookup_opcode op,
   return &p->direct;
 }
 
+/* Lookup during incremental resize.  A key is present in at most one
+   of the two tables; sets always go to the new table. */
+static hash_pair_t * lookup_resize (void * v, uword key, uword sum,
+				    enum lookup_opcode op,
+				    void * new_value, void * old_value)
+{
+  hash_t * h = hash_header (v);
+  void * old = h->resize_old;
+  hash_t * ho = hash_header (old);
+  hash_pair_t * p;
+  uword n_old_elts;
+
+  if (op == GET)
+    {
+      p = lookup_table (v, key, sum, GET, 0, 0);
+      if (! p && ho->elts > 0)
+	p = lookup_table (old, key, sum, GET, 0, 0);
+      return p;
+    }
+
+  n_old_elts = ho->elts;
+  if (n_old_elts > 0)
+    (void) lookup_table (old, key, sum, UNSET, 0, old_value);
+
+  if (ho->elts < n_old_elts)
+    {
+      h->elts -= 1;
+      if (op == UNSET)
+	return 0;
+      old_value = 0;
+    }
+
+  return lookup_table (v, key, sum, op, new_value, old_value);
+}
+
+/* Key compares made in table and in table being migrated from. */
+always_inline u64
+hash_n_key_compares (hash_t * h)
+{
+  u64 n = h->n_key_compares;
+  if (h->resize_old)
+    n += hash_header (h->resize_old)->n_key_compares;
+  return n;
+}
+
+/* Count a get as hit or miss along with compares it made. */
+always_inline void
+hash_count_get (hash_t * h, hash_pair_t * p, u64 n_compares_start)
+{
+  u64 n = hash_n_key_compares (h) - n_compares_start;
+  if (p)
+    {
+      h->n_get_hits += 1;
+      h->n_get_hit_compares += n;
+    }
+  else
+    {
+      h->n_get_misses += 1;
+      h->n_get_miss_compares += n;
+    }
+}
+
+static hash_pair_t * lookup_with_sum (void * v, uword key, uword sum,
+				      enum lookup_opcode op,
+				      void * new_value, void * old_value)
+{
+  hash_t * h = hash_header (v);
+  hash_pair_t * p;
+  uword n_elts;
+  u64 n_compares = 0;
+
+  if (PREDICT_FALSE (h->flags & HASH_FLAG_STATS))
+    n_compares = hash_n_key_compares (h);
+
+  /* Most misses are answered by filter without touching table. */
+  if (h->filter && op == GET && ! clib_filter_may_contain (h->filter, sum))
+    p = 0;
+  else
+    {
+      n_elts = h->elts;
+
+      if (h->resize_old)
+	p = lookup_resize (v, key, sum, op, new_value, old_value);
+      else
+	p = lookup_table (v, key, sum, op, new_value, old_value);
+
+      if (h->filter && h->elts != n_elts)
+	{
+	  if (h->elts > n_elts)
+	    clib_filter_add (h->filter, sum);
+	  else
+	    clib_filter_del (h->filter, sum);
+	}
+    }
+
+  if (PREDICT_FALSE (h->flags & HASH_FLAG_STATS) && op == GET)
+    hash_count_get (h, p, n_compares);
+
+  return p;
+}
+
+static hash_pair_t * lookup (void * v, uword key, enum lookup_opcode op,
+			     void * new_value, void * old_value)
+{
+  if (! v)
+    return 0;
+  return lookup_with_sum (v, key, key_sum (hash_header (v), key),
+			  op, new_value, old_value);
+}
+
+/* Move all pairs in bucket I of old table into new table V. */
+static void hash_resize_migrate_bucket (void * v, void * old, uword i)
+{
+  hash_t * h = hash_header (v);
+  hash_t * ho = hash_header (old);
+  hash_pair_union_t * p = get_pair (old, i);
+  hash_pair_t * q;
+  uword key, sum;
+
+  while (1)
+    {
+      if (hash_is_user (old, i))
+	q = &p->direct;
+      else if (! (ho->flags & HASH_FLAG_OPEN_ADDRESSING) && p->indirect.pairs)
+	q = p->indirect.pairs;
+      else
+	break;
+
+      key = hash_pair_key (ho, q);
+      sum = key_sum (h, key);
+      (void) lookup_table (v, key, sum, SET, hash_pair_value (ho, q), 0);
+      (void) lookup_table (old, key, sum, UNSET, 0, 0);
+
+      /* Pair was already counted in total. */
+      h->elts -= 1;
+    }
+}
+
+/* Migrate up to N_BUCKETS buckets of old table; free it when done. */
+static void hash_resize_step (void * v, uword n_buckets)
+{
+  hash_t * h = hash_header (v);
+  void * old = h->resize_old;
+  uword i, n;
+
+  i = h->resize_index;
+  n = vec_len (old) - i;
+  n = clib_min (n, n_buckets);
+
+  /* Old table may have been emptied by unsets. */
+  if (hash_header (old)->elts == 0)
+    n = 0, i = vec_len (old);
+
+  while (n-- > 0)
+    hash_resize_migrate_bucket (v, old, i++);
+
+  h->resize_index = i;
+  if (i >= vec_len (old))
+    {
+      ASSERT (hash_header (old)->elts == 0);
+      hash_free (old);
+      h->resize_old = 0;
+      h->resize_index = 0;
+    }
+}
+
+/* Auto grow/shrink.  Incremental mode starts migration to new table
+   and returns immediately; further set/unset calls migrate
+   HASH_RESIZE_STEP_BUCKETS buckets each. */
+#define HASH_RESIZE_STEP_BUCKETS 8
+
+static void * hash_resize_auto (void * v, uword new_size)
+{
+  hash_t * h = hash_header (v);
+  hash_t * hn;
+  void * new;
+
+  if (! (h->flags & HASH_FLAG_INCREMENTAL_RESIZE))
+    return hash_resize (v, new_size);
+
+  /* Only one resize in progress at a time. */
+  if (h->resize_old)
+    hash_resize_step (v, ~0);
+
+  new = _hash_create (new_size, h);
+  hn = hash_header (new);
+  hn->elts = h->elts;
+  hn->resize_old = v;
+  hn->resize_index = 0;
+  hn->filter = h->filter;
+  hn->n_resizes += 1;
+  h->filter = 0;
+  return new;
+}
+
+static_always_inline void
+hash_resize_maybe_step (void * v)
+{
+  hash_t * h = hash_header (v);
+  if (h->resize_old && ! (h->flags & HASH_FLAG_HASH_NEXT_IN_PROGRESS))
+    hash_resize_step (v, HASH_RESIZE_STEP_BUCKETS);
+}
+
 /* Fetch value of key. */
 uword * _hash_get (void * v, uword key)
 {
@@ -543,19 +1003,240 @@ uword * _hash_get (void * v, uword key)
   p = lookup (v, key, GET, 0, 0);
   if (! p)
     return 0;
-  if (h->log2_pair_size == 0)
+  if (h->log2_pair_size == 0 && ! hash_is_compact (h))
     return &p->key;
   else
-    return &p->value[0];
+    return hash_pair_value (h, p);
 }
 
 hash_pair_t * _hash_get_pair (void * v, uword key)
 { return lookup (v, key, GET, 0, 0); }
 
+/* Batch lookup.  Software pipeline overlaps cache misses of
+   independent keys: stage 0 computes key sum and prefetches bucket,
+   stage 1 prefetches indirect pairs (or matching open addressed pair),
+   stage 2 compares keys.  Key sums are kept in pairs[] between stages. */
+typedef struct {
+  void * v;
+  uword * keys;
+  hash_pair_t ** pairs;
+} hash_get_multiple_main_t;
+
+always_inline uword
+hash_get_multiple_index (void * v, uword sum)
+{
+  hash_t * h = hash_header (v);
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    return ((sum >> 7) & (vec_len (v) / OPEN_GROUP_SIZE - 1)) * OPEN_GROUP_SIZE;
+  else
+    return sum & (_vec_len (v) - 1);
+}
+
+static_always_inline void
+hash_get_multiple_prefetch_bucket (void * v, uword sum)
+{
+  hash_t * h = hash_header (v);
+  uword j;
+
+  j = hash_get_multiple_index (v, sum);
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    CLIB_PREFETCH (h->open_control + j, OPEN_GROUP_SIZE, LOAD);
+  else
+    {
+      CLIB_PREFETCH (get_pair (v, j), sizeof (hash_pair_union_t), LOAD);
+      CLIB_PREFETCH (&h->is_user[j / BITS (h->is_user[0])],
+		     sizeof (h->is_user[0]), LOAD);
+    }
+}
+
+static_always_inline void
+hash_get_multiple_sum (hash_get_multiple_main_t * hm, uword i)
+{
+  void * v = hm->v;
+  uword sum;
+
+  sum = key_sum (hash_header (v), hm->keys[i]);
+  hm->pairs[i] = uword_to_pointer (sum, hash_pair_t *);
+  hash_get_multiple_prefetch_bucket (v, sum);
+}
+
+clib_pipeline_stage_static
+(hash_get_multiple_sum_stage,
+ hash_get_multiple_main_t *, hm, i,
+ { hash_get_multiple_sum (hm, i); })
+
+static_always_inline void
+hash_get_multiple_prefetch (hash_get_multiple_main_t * hm, uword i)
+{
+  void * v = hm->v;
+  hash_t * h = hash_header (v);
+  uword sum, j, match;
+
+  sum = pointer_to_uword (hm->pairs[i]);
+  j = hash_get_multiple_index (v, sum);
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    {
+      match = open_group_match (h->open_control + j, sum & 0x7f);
+      if (match != 0)
+	CLIB_PREFETCH (get_pair (v, j + log2_first_set (match)),
+		       hash_pair_bytes (h), LOAD);
+    }
+  else if (! hash_is_user (v, j))
+    {
+      hash_pair_indirect_t * pi = &get_pair (v, j)->indirect;
+      if (pi->pairs)
+	CLIB_PREFETCH (pi->pairs, CLIB_CACHE_LINE_BYTES, LOAD);
+    }
+}
+
+clib_pipeline_stage_static
+(hash_get_multiple_prefetch_stage,
+ hash_get_multiple_main_t *, hm, i,
+ { hash_get_multiple_prefetch (hm, i); })
+
+static_always_inline void
+hash_get_multiple_compare (hash_get_multiple_main_t * hm, uword i)
+{
+  void * v = hm->v;
+  hash_t * h = hash_header (v);
+  hash_pair_union_t * p;
+  uword key, sum, j;
+  u64 n_compares = h->n_key_compares;
+
+  key = hm->keys[i];
+  sum = pointer_to_uword (hm->pairs[i]);
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    hm->pairs[i] = lookup_open (v, key, sum, GET, 0, 0);
+  else
+    {
+      j = hash_get_multiple_index (v, sum);
+      p = get_pair (v, j);
+      if (hash_is_user (v, j))
+	p = key_equal (h, p->direct.key, key) ? p : 0;
+      else
+	p = get_indirect (v, &p->indirect, key);
+      hm->pairs[i] = &p->direct;
+    }
+
+  if (PREDICT_FALSE (h->flags & HASH_FLAG_STATS))
+    hash_count_get (h, hm->pairs[i], n_compares);
+}
+
+clib_pipeline_stage_static
+(hash_get_multiple_compare_stage,
+ hash_get_multiple_main_t *, hm, i,
+ { hash_get_multiple_compare (hm, i); })
+
+/* Batch lookup with filter: filter is probed for a word's worth of
+   keys at a time and only keys which may be present search table. */
+static void hash_get_multiple_filtered (void * v, uword * keys, uword n_keys,
+					hash_pair_t ** pairs)
+{
+  hash_t * h = hash_header (v);
+  uword sums[BITS (uword)];
+  uword i, j, n, may_contain;
+
+  for (i = 0; i < n_keys; i += n)
+    {
+      n = clib_min (n_keys - i, BITS (uword));
+      for (j = 0; j < n; j++)
+	sums[j] = key_sum (h, keys[i + j]);
+
+      may_contain = clib_filter_may_contain_multiple (h->filter, sums, n);
+
+      for (j = 0; j < n; j++)
+	if (may_contain & ((uword) 1 << j))
+	  hash_get_multiple_prefetch_bucket (v, sums[j]);
+
+      for (j = 0; j < n; j++)
+	{
+	  u64 n_compares = hash_n_key_compares (h);
+
+	  if (! (may_contain & ((uword) 1 << j)))
+	    pairs[i + j] = 0;
+	  else if (h->resize_old)
+	    pairs[i + j] = lookup_resize (v, keys[i + j], sums[j], GET, 0, 0);
+	  else
+	    pairs[i + j] = lookup_table (v, keys[i + j], sums[j], GET, 0, 0);
+
+	  if (PREDICT_FALSE (h->flags & HASH_FLAG_STATS))
+	    hash_count_get (h, pairs[i + j], n_compares);
+	}
+    }
+}
+
+void _hash_get_pair_multiple (void * v, uword * keys, uword n_keys,
+			      hash_pair_t ** pairs)
+{
+  hash_get_multiple_main_t _hm, * hm = &_hm;
+  hash_t * h;
+  void * old;
+  uword i;
+
+  if (! v || hash_elts (v) == 0)
+    {
+      memset (pairs, 0, n_keys * sizeof (pairs[0]));
+      return;
+    }
+
+  h = hash_header (v);
+  if (h->filter)
+    {
+      hash_get_multiple_filtered (v, keys, n_keys, pairs);
+      return;
+    }
+
+  /* Pipeline counts keys only found in old table as misses. */
+  if (PREDICT_FALSE ((h->flags & HASH_FLAG_STATS) && h->resize_old))
+    {
+      for (i = 0; i < n_keys; i++)
+	pairs[i] = lookup (v, keys[i], GET, 0, 0);
+      return;
+    }
+
+  hm->v = v;
+  hm->keys = keys;
+  hm->pairs = pairs;
+  clib_pipeline_run_3_stage (n_keys, hm,
+			     hash_get_multiple_sum_stage,
+			     hash_get_multiple_prefetch_stage,
+			     hash_get_multiple_compare_stage);
+
+  /* Keys not yet migrated by incremental resize. */
+  old = hash_header (v)->resize_old;
+  if (old)
+    for (i = 0; i < n_keys; i++)
+      if (! pairs[i])
+	pairs[i] = lookup_table (old, keys[i], key_sum (hash_header (v), keys[i]),
+				 GET, 0, 0);
+}
+
+void _hash_get_multiple (void * v, uword * keys, uword n_keys,
+			 uword ** results)
+{
+  hash_pair_t ** pairs = (hash_pair_t **) results;
+  hash_t * h;
+  uword i, is_set;
+
+  _hash_get_pair_multiple (v, keys, n_keys, pairs);
+
+  if (! v)
+    return;
+
+  /* Same return value as _hash_get. */
+  h = hash_header (v);
+  is_set = h->log2_pair_size == 0 && ! hash_is_compact (h);
+  for (i = 0; i < n_keys; i++)
+    if (pairs[i])
+      results[i] = is_set ? &pairs[i]->key : hash_pair_value (h, pairs[i]);
+}
+
 hash_pair_t * hash_next (void * v, hash_next_t * hn)
 {
   hash_t * h = hash_header (v);
   hash_pair_t * p;
+  void * t;
+  uword i;
 
   while (1)
     {
@@ -570,7 +1251,7 @@ hash_pair_t * hash_next (void * v, hash_next_t * hn)
 	       | HASH_FLAG_NO_AUTO_SHRINK
 	       | HASH_FLAG_HASH_NEXT_IN_PROGRESS);
 	}
-      else if (hn->i >= hash_capacity (v))
+      else if (hn->i >= hash_capacity (v) + hash_capacity (h->resize_old))
 	{
 	  /* Restore flags. */
 	  h->flags = hn->f;
@@ -578,8 +1259,17 @@ hash_pair_t * hash_next (void * v, hash_next_t * hn)
 	  return 0;
 	}
 
-      p = hash_forward (h, v, hn->i);
-      if (hash_is_user (v, hn->i))
+      /* Buckets of table being resized follow buckets of V. */
+      t = v;
+      i = hn->i;
+      if (i >= hash_capacity (v))
+	{
+	  t = h->resize_old;
+	  i -= hash_capacity (v);
+	}
+
+      p = hash_forward (h, t, i);
+      if (hash_is_user (t, i))
 	{
 	  hn->i++;
 	  return p;
@@ -613,6 +1303,8 @@ void * _hash_unset (void * v, uword key, void * old_value)
   if (! v)
     return v;
 
+  hash_resize_maybe_step (v);
+
   (void) lookup (v, key, UNSET, 0, old_value);
 
   h = hash_header (v);
@@ -620,7 +1312,7 @@ void * _hash_unset (void * v, uword key, void * old_value)
     {
       /* Resize when 1/4 full. */
       if (h->elts > 32 && 4 * (h->elts + 1) < vec_len (v))
-	v = hash_resize (v, vec_len (v) / 2);
+	v = hash_resize_auto (v, vec_len (v) / 2);
     }
 
   return v;
@@ -641,6 +1333,11 @@ void * _hash_create (uword elts, hash_t * h_user)
   if (h_user)
     log2_pair_size = h_user->log2_pair_size;
 
+  /* Compact pair is a single word; buckets can never hold an
+     indirect array of pairs so table must be open addressed. */
+  if (h_user && hash_is_compact (h_user))
+    log2_pair_size = 0;
+
   v = _vec_resize (0,
 		   /* vec len: */      elts,
 		   /* data bytes: */   (elts << log2_pair_size) * sizeof (hash_pair_t),
@@ -659,12 +1356,30 @@ void * _hash_create (uword elts, hash_t * h_user)
   if (! h_user)
       h->flags = HASH_FLAG_NO_AUTO_SHRINK;
 
+  if (h->flags & HASH_FLAG_COMPACT_U32)
+    {
+      if (uword_bits == 64)
+	h->flags |= HASH_FLAG_OPEN_ADDRESSING;
+      else
+	h->flags &= ~HASH_FLAG_COMPACT_U32;
+    }
+
   if (! h->format_pair)
     {
       h->format_pair = hash_format_pair_default;
       h->format_pair_arg = 0;
     }
 
+  /* Never share control bytes or resize state with table we were
+     copied from. */
+  h->open_control = 0;
+  h->open_n_deleted = 0;
+  h->resize_old = 0;
+  h->resize_index = 0;
+  h->filter = 0;
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    open_control_init (h, elts);
+
   return v;
 }
 
@@ -689,6 +1404,13 @@ void * _hash_free (void * v)
 	clib_mem_free (p->indirect.pairs);
     }
 
+  vec_free (h->open_control);
+  _hash_free (h->resize_old);
+  if (h->filter)
+    {
+      clib_filter_free (h->filter);
+      clib_mem_free (h->filter);
+    }
   vec_free_header (h);
 
   return 0;
@@ -705,8 +1427,24 @@ static void * hash_resize_internal (void * old, uword new_size, uword free_old)
       hash_t * h = old ? hash_header (old) : 0;
       new = _hash_create (new_size, h);
       hash_foreach_pair (p, old, {
-	new = _hash_set3 (new, p->key, &p->value[0], 0);
+	new = _hash_set3 (new, hash_pair_key (h, p), hash_pair_value (h, p), 0);
       });
+
+      /* Filter depends only on keys: move it to new table. */
+      if (h && h->filter)
+	{
+	  hash_t * hn = hash_header (new);
+	  if (free_old)
+	    {
+	      hn->filter = h->filter;
+	      h->filter = 0;
+	    }
+	  else
+	    {
+	      hn->filter = clib_mem_alloc (sizeof (hn->filter[0]));
+	      clib_filter_copy (hn->filter, h->filter);
+	    }
+	}
     }
 
   if (free_old)
@@ -715,11 +1453,63 @@ static void * hash_resize_internal (void * old, uword new_size, uword free_old)
 }
 
 void * hash_resize (void * old, uword new_size)
-{ return hash_resize_internal (old, new_size, 1); }
+{
+  void * new = hash_resize_internal (old, new_size, 1);
+  if (new)
+    hash_header (new)->n_resizes += 1;
+  return new;
+}
 
 void * hash_dup (void * old)
 { return hash_resize_internal (old, vec_len (old), 0); }
 
+/* Rebuild filter from keys in table sized for given number of keys. */
+static void hash_filter_rebuild (void * v, uword n_keys)
+{
+  hash_t * h = hash_header (v);
+  hash_pair_t * p;
+
+  clib_filter_free (h->filter);
+  clib_filter_init (h->filter, n_keys);
+  hash_foreach_pair (p, v, ({
+    clib_filter_add (h->filter, key_sum (h, hash_pair_key (h, p)));
+  }));
+}
+
+void hash_enable_filter (void * v)
+{
+  hash_t * h = hash_header (v);
+
+  if (h->filter)
+    return;
+
+  h->filter = clib_mem_alloc (sizeof (h->filter[0]));
+  memset (h->filter, 0, sizeof (h->filter[0]));
+  hash_filter_rebuild (v, clib_max (2 * h->elts, hash_capacity (v)));
+}
+
+void hash_disable_filter (void * v)
+{
+  hash_t * h = hash_header (v);
+
+  if (! h->filter)
+    return;
+
+  clib_filter_free (h->filter);
+  clib_mem_free (h->filter);
+  h->filter = 0;
+}
+
+/* Filter false positive rate goes up quickly once it holds more keys
+   than it was sized for. */
+static_always_inline void
+hash_filter_maybe_grow (void * v)
+{
+  hash_t * h = hash_header (v);
+  if (h->filter && h->elts > clib_filter_capacity (h->filter))
+    hash_filter_rebuild (v, 2 * h->elts);
+}
+
 void * _hash_set3 (void * v, uword key, void * value, void * old_value)
 {
   hash_t * h;
@@ -727,16 +1517,43 @@ void * _hash_set3 (void * v, uword key, void * value, void * old_value)
   if (! v)
     v = hash_create (0, sizeof (uword));
 
+  hash_resize_maybe_step (v);
+
   h = hash_header (v);
+
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    {
+      uword n_used = h->elts + h->open_n_deleted + 1;
+
+      /* Resize before inserting when 7/8 full counting deleted slots.
+	 If most used slots are deleted just rehash at the same size.
+	 A completely full table must grow regardless of flags. */
+      if ((! (h->flags & HASH_FLAG_NO_AUTO_GROW) && 8 * n_used > 7 * vec_len (v))
+	  || n_used >= vec_len (v))
+	{
+	  uword n = vec_len (v);
+	  if (2 * (h->elts + 1) > n)
+	    n *= 2;
+	  v = hash_resize_auto (v, n);
+	  h = hash_header (v);
+	}
+
+      (void) lookup (v, key, SET, value, old_value);
+      hash_filter_maybe_grow (v);
+      return v;
+    }
+
   (void) lookup (v, key, SET, value, old_value);
 
   if (! (h->flags & HASH_FLAG_NO_AUTO_GROW))
     {
       /* Resize when 3/4 full. */
       if (4 * (h->elts + 1) > 3 * vec_len (v))
-	v = hash_resize (v, 2 * vec_len (v));
+	v = hash_resize_auto (v, 2 * vec_len (v));
     }
 
+  hash_filter_maybe_grow (v);
+
   return v;
 }
 
@@ -853,9 +1670,9 @@ static u8 * hash_format_pair_default (u8 * s, va_list * args)
   hash_pair_t * p = va_arg (*args, hash_pair_t *);
   hash_t * h = hash_header (v);
 
-  s = format (s, "0x%08x", p->key);
+  s = format (s, "0x%08x", hash_pair_key (h, p));
   if (hash_value_bytes (h) > 0)
-    s = format (s, " -> 0x%8U", format_hex_bytes, &p->value[0], hash_value_bytes (h));
+    s = format (s, " -> 0x%8U", format_hex_bytes, hash_pair_value (h, p), hash_value_bytes (h));
   return s;
 }
 
@@ -868,6 +1685,13 @@ uword hash_bytes (void * v)
     return 0;
 
   bytes = vec_capacity (v, hash_header_bytes (v));
+  bytes += hash_bytes (h->resize_old);
+
+  if (h->filter)
+    bytes += sizeof (h->filter[0]) + clib_filter_bytes (h->filter);
+
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    return bytes + vec_capacity (h->open_control, 0);
 
   for (i = 0; i < hash_capacity (v); i++)
     {
@@ -883,55 +1707,212 @@ uword hash_bytes (void * v)
   return bytes;
 }
 
+void hash_get_stats (void * v, hash_stats_t * s)
+{
+  hash_t * h = hash_header (v);
+  hash_pair_union_t * p;
+  uword i, l, n, n_hits;
+  f64 sum;
+
+  memset (s, 0, sizeof (s[0]));
+  if (! v)
+    return;
+
+  s->n_elts = hash_elts (v);
+  s->n_buckets = hash_capacity (v);
+  s->n_bytes = hash_bytes (v);
+  s->n_resizes = h->n_resizes;
+  s->n_get_hits = h->n_get_hits;
+  s->n_get_hit_compares = h->n_get_hit_compares;
+  s->n_get_misses = h->n_get_misses;
+  s->n_get_miss_compares = h->n_get_miss_compares;
+
+  sum = 0;
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    {
+      uword g, group_mask = vec_len (v) / OPEN_GROUP_SIZE - 1;
+      u8 * c = h->open_control;
+
+      for (i = 0; i < vec_len (v); i++)
+	{
+	  l = c[i] < OPEN_CONTROL_EMPTY;
+	  vec_validate (s->bucket_length_counts, l);
+	  s->bucket_length_counts[l] += 1;
+	  if (c[i] == OPEN_CONTROL_EMPTY)
+	    {
+	      s->n_empty_buckets += 1;
+	      continue;
+	    }
+	  if (c[i] == OPEN_CONTROL_DELETED)
+	    {
+	      s->n_deleted_buckets += 1;
+	      continue;
+	    }
+
+	  /* Follow pair's probe sequence to the group holding it. */
+	  s->n_user_buckets += 1;
+	  p = get_pair (v, i);
+	  g = (key_sum (h, hash_pair_key (h, &p->direct)) >> 7) & group_mask;
+	  for (n = 0; g != i / OPEN_GROUP_SIZE; n++)
+	    g = (g + n + 1) & group_mask;
+	  vec_validate (s->probe_length_counts, n + 1);
+	  s->probe_length_counts[n + 1] += 1;
+	}
+
+      /* Misses probe until a group with an empty slot. */
+      for (i = 0; i <= group_mask; i++)
+	{
+	  g = i;
+	  for (n = 0; n <= group_mask; n++)
+	    {
+	      if (open_group_match (c + g * OPEN_GROUP_SIZE, OPEN_CONTROL_EMPTY))
+		break;
+	      g = (g + n + 1) & group_mask;
+	    }
+	  sum += clib_min (n + 1, group_mask + 1);
+	}
+      s->average_miss_probes = sum / (group_mask + 1);
+    }
+  else
+    {
+      for (i = 0; i < hash_capacity (v); i++)
+	{
+	  if (hash_is_user (v, i))
+	    {
+	      l = 1;
+	      s->n_user_buckets += 1;
+	    }
+	  else
+	    {
+	      p = get_pair (v, i);
+	      if (h->log2_pair_size > 0)
+		l = indirect_pair_get_len (&p->indirect);
+	      else
+		l = vec_len (p->indirect.pairs);
+	      s->n_indirect_buckets += l > 0;
+	      s->n_empty_buckets += l == 0;
+	    }
+
+	  vec_validate (s->bucket_length_counts, l);
+	  s->bucket_length_counts[l] += 1;
+
+	  /* Pair N of a bucket is found after N + 1 compares;
+	     a miss compares against all pairs in bucket. */
+	  if (l > 0)
+	    vec_validate (s->probe_length_counts, l);
+	  for (n = 1; n <= l; n++)
+	    s->probe_length_counts[n] += 1;
+	  sum += l;
+	}
+      s->average_miss_probes = sum / hash_capacity (v);
+    }
+
+  sum = 0;
+  n_hits = 0;
+  for (i = 0; i < vec_len (s->probe_length_counts); i++)
+    {
+      sum += i * s->probe_length_counts[i];
+      n_hits += s->probe_length_counts[i];
+    }
+  s->average_hit_probes = n_hits > 0 ? sum / n_hits : 0;
+}
+
+void hash_free_stats (hash_stats_t * s)
+{
+  vec_free (s->bucket_length_counts);
+  vec_free (s->probe_length_counts);
+}
+
+void hash_clear_stats (void * v)
+{
+  hash_t * h = hash_header (v);
+
+  if (! v)
+    return;
+
+  h->n_key_compares = 0;
+  h->n_get_hits = h->n_get_hit_compares = 0;
+  h->n_get_misses = h->n_get_miss_compares = 0;
+  hash_clear_stats (h->resize_old);
+}
+
+u8 * format_hash_counts (u8 * s, va_list * va)
+{
+  uword * counts = va_arg (*va, uword *);
+  uword i, first = 1;
+
+  for (i = 0; i < vec_len (counts); i++)
+    {
+      if (counts[i] == 0)
+	continue;
+      s = format (s, "%s%wd: %wd", first ? "" : ", ", i, counts[i]);
+      first = 0;
+    }
+  return s;
+}
+
+u8 * format_hash_stats (u8 * s, va_list * va)
+{
+  hash_stats_t * st = va_arg (*va, hash_stats_t *);
+  uword indent = format_get_indent (s);
+
+  s = format (s, "%wd buckets: %wd user, %wd indirect, %wd empty",
+	      st->n_buckets, st->n_user_buckets, st->n_indirect_buckets,
+	      st->n_empty_buckets);
+  if (st->n_deleted_buckets > 0)
+    s = format (s, ", %wd deleted", st->n_deleted_buckets);
+  s = format (s, ", %.2f bytes/elt, %wd resizes",
+	      st->n_elts > 0 ? (f64) st->n_bytes / st->n_elts : 0.,
+	      st->n_resizes);
+
+  s = format (s, "\n%Ubucket lengths: %U",
+	      format_white_space, indent,
+	      format_hash_counts, st->bucket_length_counts);
+  s = format (s, "\n%Uprobe lengths: %U",
+	      format_white_space, indent,
+	      format_hash_counts, st->probe_length_counts);
+  s = format (s, "\n%Uexpected probes: hit %.2f, miss %.2f",
+	      format_white_space, indent,
+	      st->average_hit_probes, st->average_miss_probes);
+
+  if (st->n_get_hits + st->n_get_misses > 0)
+    s = format (s, "\n%Ugets: %Ld hits %.2f compares/hit, %Ld misses %.2f compares/miss",
+		format_white_space, indent,
+		st->n_get_hits,
+		(st->n_get_hits > 0
+		 ? (f64) st->n_get_hit_compares / (f64) st->n_get_hits
+		 : 0.),
+		st->n_get_misses,
+		(st->n_get_misses > 0
+		 ? (f64) st->n_get_miss_compares / (f64) st->n_get_misses
+		 : 0.));
+
+  return s;
+}
+
 u8 * format_hash (u8 * s, va_list * va)
 {
   void * v = va_arg (*va, void *);
   int verbose = va_arg (*va, int);
   hash_pair_t * p;
   hash_t * h = hash_header (v);
-  uword i;
 
   s = format (s, "hash %p, %wd elts, capacity %wd, %wd bytes used,\n",
 	      v, hash_elts (v), hash_capacity (v),
 	      hash_bytes (v));
 
+  if (h->resize_old)
+    s = format (s, "  resizing from capacity %wd, %wd buckets migrated\n",
+		hash_capacity (h->resize_old), h->resize_index);
+
+  if (h->filter)
+    s = format (s, "  %U\n", format_clib_filter, h->filter);
+
   {
-    uword * occupancy = 0;
-
-    /* Count number of buckets with each occupancy. */
-    for (i = 0; i < hash_capacity (v); i++)
-      {
-	uword j;
-
-	if (hash_is_user (v, i))
-	  {
-	    j = 1;
-	  }
-	else
-	  {
-	    hash_pair_union_t * p = get_pair (v, i);
-	    if (h->log2_pair_size > 0)
-	      j = indirect_pair_get_len (&p->indirect);
-	    else
-	      j = vec_len (p->indirect.pairs);
-	  }
-
-	vec_validate (occupancy, j);
-	occupancy[j]++;
-      }
-
-    s = format (s, "  profile ");
-    for (i = 0; i < vec_len (occupancy); i++)
-      s = format (s, "%wd%c", occupancy[i],
-		  i + 1 == vec_len (occupancy) ? '\n' : ' ');
-
-    s = format (s, "  lookup # of compares: ");
-    for (i = 1; i < vec_len (occupancy); i++)
-      s = format (s, "%wd: .%03d%c", i,
-		  (1000 * i * occupancy[i]) / hash_elts (v),
-		  i + 1 == vec_len (occupancy) ? '\n' : ' ');
-
-    vec_free (occupancy);
+    hash_stats_t stats;
+    hash_get_stats (v, &stats);
+    s = format (s, "  %U\n", format_hash_stats, &stats);
+    hash_free_stats (&stats);
   }
 
   if (verbose)
@@ -976,7 +1957,7 @@ unformat_hash_string (unformat_input_t * input, va_list * va)
 clib_error_t * hash_validate (void * v)
 {
   hash_t * h = hash_header (v);
-  uword i, j;
+  uword i, j, n_deleted = 0;
   uword * keys = 0;
   clib_error_t * error = 0;
 
@@ -986,10 +1967,20 @@ clib_error_t * hash_validate (void * v)
     {
       hash_pair_union_t * pu = get_pair (v, i);
 
+      if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+	{
+	  u8 c = h->open_control[i];
+	  CHECK (hash_is_user (v, i) == ((c & 0x80) == 0));
+	  if (c == OPEN_CONTROL_DELETED)
+	    n_deleted++;
+	  else
+	    CHECK (hash_is_user (v, i) || c == OPEN_CONTROL_EMPTY);
+	}
+
       if (hash_is_user (v, i))
 	{
-	  CHECK (pu->direct.key != 0);
-	  vec_add1 (keys, pu->direct.key);
+	  CHECK (hash_pair_key (h, &pu->direct) != 0);
+	  vec_add1 (keys, hash_pair_key (h, &pu->direct));
 	}
       else
 	{
@@ -1011,7 +2002,31 @@ clib_error_t * hash_validate (void * v)
 	}
     }
 
-  CHECK (vec_len (keys) == h->elts);
+  if (h->resize_old)
+    {
+      hash_t * ho = hash_header (h->resize_old);
+      if ((error = hash_validate (h->resize_old)))
+	goto done;
+      CHECK (ho->resize_old == 0);
+      CHECK (vec_len (keys) + ho->elts == h->elts);
+    }
+  else
+    CHECK (vec_len (keys) == h->elts);
+  if (h->flags & HASH_FLAG_OPEN_ADDRESSING)
+    CHECK (n_deleted == h->open_n_deleted);
+
+  /* Filter must never reject a key in table. */
+  if (h->filter)
+    {
+      hash_pair_t * p;
+      uword n_rejected = 0;
+
+      CHECK (h->filter->n_elts == h->elts);
+      hash_foreach_pair (p, v, ({
+	n_rejected += ! clib_filter_may_contain (h->filter, key_sum (h, hash_pair_key (h, p)));
+      }));
+      CHECK (n_rejected == 0);
+    }
 
   vec_free (keys);
  done:
@@ -24,12 +24,14 @@
 #ifndef included_hash_h
 #define included_hash_h
 
+#include <clib/byte_order.h>
 #include <clib/error.h>
 #include <clib/format.h>
 #include <clib/vec.h>
 #include <clib/vector.h>
 
 struct hash_header;
+struct clib_filter;
 
 typedef uword (hash_key_sum_function_t)
   (struct hash_header *, uword key);
@@ -50,6 +52,17 @@ typedef struct hash_header {
 #define HASH_FLAG_NO_AUTO_SHRINK	(1 << 1)
   /* Set when hash_next is in the process of iterating through this hash table. */
 #define HASH_FLAG_HASH_NEXT_IN_PROGRESS (1 << 2)
+  /* Set for open addressed tables: each pair is always direct and
+     collisions probe groups of control bytes instead of chaining. */
+#define HASH_FLAG_OPEN_ADDRESSING	(1 << 3)
+  /* Set if auto-resize should migrate pairs to new table a few buckets at
+     a time instead of all at once. */
+#define HASH_FLAG_INCREMENTAL_RESIZE	(1 << 4)
+  /* Set to count lookups and key compares in header (see hash_get_stats). */
+#define HASH_FLAG_STATS			(1 << 5)
+  /* Set for tables of u32 keys and u32 values packed into one word
+     per pair (see hash_create_compact_u32).  Implies open addressing. */
+#define HASH_FLAG_COMPACT_U32		(1 << 6)
 
   u32 log2_pair_size;
 
@@ -76,6 +89,33 @@ typedef struct hash_header {
   /* Format function arg */
   void * format_pair_arg;
 
+  /* Open addressing: one control byte for each pair.  High bit set
+     means empty or deleted; otherwise 7 bits of key sum. */
+  u8 * open_control;
+
+  /* Open addressing: number of deleted control bytes. */
+  uword open_n_deleted;
+
+  /* Incremental resize: table whose pairs are being migrated into this
+     one or zero when no resize is in progress.  Buckets before
+     resize_index have been migrated.  Element count includes
+     pairs of old table. */
+  void * resize_old;
+  uword resize_index;
+
+  /* Optional filter in front of table maintained by set and unset;
+     lookups of keys it rejects never touch table. */
+  struct clib_filter * filter;
+
+  /* Number of times table has been resized. */
+  uword n_resizes;
+
+  /* Counters maintained when HASH_FLAG_STATS is set: hash_get hits
+     and misses and number of key compares each needed. */
+  u64 n_key_compares;
+  u64 n_get_hits, n_get_hit_compares;
+  u64 n_get_misses, n_get_miss_compares;
+
   /* Bit i is set if pair i is a user object (as opposed to being
      either zero or an indirect array of pairs). */
   uword is_user[0];
@@ -191,6 +231,11 @@ uword * _hash_get (void * v, uword key);
 /* internal routine to fetch value (key, value) pair for given key */
 hash_pair_t * _hash_get_pair (void * v, uword key);
 
+/* internal routines to fetch values (pairs) for a batch of keys.
+   Missing keys give null results. */
+void _hash_get_multiple (void * v, uword * keys, uword n_keys, uword ** results);
+void _hash_get_pair_multiple (void * v, uword * keys, uword n_keys, hash_pair_t ** pairs);
+
 /* internal routine to unset a (key, value) pair */
 void *  _hash_unset (void * v, uword key, void * old_value);
 
@@ -203,6 +248,12 @@ void * hash_resize (void * old, uword new_size);
 /* duplicate a hash table */
 void * hash_dup (void * old);
 
+/* Put a counting Bloom filter (see filter.h) in front of table so
+   that most lookups of missing keys only touch one filter cache line.
+   Table must already exist. */
+void hash_enable_filter (void * v);
+void hash_disable_filter (void * v);
+
 /* Returns the number of bytes used by a hash table */
 uword hash_bytes (void * v);
 
@@ -210,7 +261,8 @@ uword hash_bytes (void * v);
 #define hash_set3(h,key,value,old_value)				\
 ({									\
   uword _v = (uword) (value);						\
-  (h) = _hash_set3 ((h), (uword) (key), (void *) &_v, (old_value));	\
+  (h) = _hash_set3 ((h), (uword) (key), hash_word_value ((h), &_v),	\
+		    (old_value));					\
 })
 
 /* Public macro to fetch value for given key */
@@ -219,9 +271,23 @@ uword hash_bytes (void * v);
 /* Public macro to fetch value (key, value) pair for given key */
 #define hash_get_pair(h,key)	_hash_get_pair ((h), (uword) (key))
 
+/* Public macro to fetch values for N_KEYS keys; lookups are pipelined
+   so that cache misses for different keys overlap. */
+#define hash_get_multiple(h,keys,n_keys,results) \
+  _hash_get_multiple ((h), (keys), (n_keys), (results))
+
 /* Public macro to set a (key, value) pair */
 #define hash_set(h,key,value)	hash_set3(h,key,value,0)
 
+/* Get/set for tables with u32 values (e.g. hash_create_compact_u32). */
+#define hash_get_u32(h,key)	((u32 *) _hash_get ((h), (uword) (key)))
+
+#define hash_set_u32(h,key,value)					\
+({									\
+  u32 _v = (value);							\
+  (h) = _hash_set3 ((h), (uword) (key), (void *) &_v, 0);		\
+})
+
 /* Public macro to set (key, 0) pair */
 #define hash_set1(h,key)	(h) = _hash_set3(h,(uword) (key),0,0)
 
@@ -236,6 +302,10 @@ uword hash_bytes (void * v);
 /* Public macro to fetch value for given pointer key */
 #define hash_get_mem(h,key)	_hash_get ((h), pointer_to_uword (key))
 
+/* Public macro to fetch values for a batch of pointer keys */
+#define hash_get_mem_multiple(h,keys,n_keys,results) \
+  _hash_get_multiple ((h), (uword *) (keys), (n_keys), (results))
+
 /* Public macro to fetch (key, value) for given pointer key */
 #define hash_get_pair_mem(h,key) _hash_get_pair ((h), pointer_to_uword (key))
 
@@ -256,10 +326,27 @@ extern void * _hash_free (void * v);
 
 clib_error_t * hash_validate (void * v);
 
+/* Compact pairs are only needed on 64 bit hosts: on 32 bit hosts
+   word pairs are already 8 bytes and flag is ignored. */
+always_inline uword hash_is_compact (hash_t * h)
+{ return uword_bits == 64 && (h->flags & HASH_FLAG_COMPACT_U32); }
+
+/* Value bytes of word W for setting in table V.  Compact tables hold
+   u32 values: the low order half of the word (last half on big
+   endian hosts). */
+always_inline void * hash_word_value (void * v, uword * w)
+{
+  if (CLIB_ARCH_IS_BIG_ENDIAN && v && hash_is_compact (hash_header (v)))
+    return (u32 *) w + 1;
+  return w;
+}
+
 /* Public inline funcion to get the number of value bytes for a hash table */
 always_inline uword hash_value_bytes (hash_t * h)
 {
   hash_pair_t * p;
+  if (hash_is_compact (h))
+    return sizeof (u32);
   return (sizeof (p->value[0]) << h->log2_pair_size) - sizeof (p->key);
 }
 
@@ -288,6 +375,42 @@ always_inline void * hash_forward1 (hash_t * h, void * v)
 always_inline void * hash_forward (hash_t * h, void * v, uword n)
 { return (u8 *) v + ((n * sizeof (hash_pair_t)) << h->log2_pair_size); }
 
+/* Key of a pair.  Compact pairs hold u32 key in first half of word
+   and u32 value in second half. */
+always_inline uword hash_pair_key (hash_t * h, hash_pair_t * p)
+{
+  if (hash_is_compact (h))
+    return ((u32 *) p)[0];
+  return p->key;
+}
+
+always_inline void hash_pair_set_key (hash_t * h, hash_pair_t * p, uword key)
+{
+  if (hash_is_compact (h))
+    {
+      ASSERT (key == (u32) key);
+      ((u32 *) p)[0] = key;
+    }
+  else
+    p->key = key;
+}
+
+/* Pointer to value of a pair. */
+always_inline void * hash_pair_value (hash_t * h, hash_pair_t * p)
+{
+  if (hash_is_compact (h))
+    return (u32 *) p + 1;
+  return &p->value[0];
+}
+
+/* First value word of a pair. */
+always_inline uword hash_pair_value0 (hash_t * h, hash_pair_t * p)
+{
+  if (hash_is_compact (h))
+    return ((u32 *) p)[1];
+  return p->value[0];
+}
+
 /* Iterate over hash pairs
     @param p the current (key,value) pair
     @param v the hash table to iterate
@@ -297,56 +420,61 @@ always_inline void * hash_forward (hash_t * h, void * v, uword n)
 #define hash_foreach_pair(p,v,body)                                         \
 do {                                                                        \
  __label__ _hash_foreach_done;                                              \
-  hash_t * _h = hash_header (v);                                            \
+  void * _hash_foreach_v = (v);                                             \
+  hash_t * _h;                                                              \
   hash_pair_union_t * _p;                                                   \
   hash_pair_t * _q, * _q_end;                                               \
   uword _i, _i1, _id, _pair_increment;                                      \
                                                                             \
-  _p = (hash_pair_union_t *) (v);                                           \
-  _i = 0;                                                                   \
-  _pair_increment = 1;                                                      \
-  if ((v))                                                                  \
-      _pair_increment = 1 << _h->log2_pair_size;                            \
-  while (_i < hash_capacity (v))                                            \
+  /* During incremental resize pairs live in two tables. */                 \
+  while (_hash_foreach_v)                                                   \
     {                                                                       \
-      _id = _h->is_user[_i / BITS (_h->is_user[0])];                        \
-      _i1 = _i + BITS (_h->is_user[0]);                                     \
+      _h = hash_header (_hash_foreach_v);                                   \
+      _p = (hash_pair_union_t *) (_hash_foreach_v);                         \
+      _i = 0;                                                               \
+      _pair_increment = 1 << _h->log2_pair_size;                            \
+      while (_i < hash_capacity (_hash_foreach_v))                          \
+        {                                                                   \
+          _id = _h->is_user[_i / BITS (_h->is_user[0])];                    \
+          _i1 = _i + BITS (_h->is_user[0]);                                 \
                                                                             \
-      do {                                                                  \
-        if (_id & 1)                                                        \
-          {                                                                 \
-            _q = &_p->direct;                                               \
-            _q_end = _q + _pair_increment;                                  \
-          }                                                                 \
-        else                                                                \
-          {                                                                 \
-            hash_pair_indirect_t * _pi = &_p->indirect;                     \
-            _q = _pi->pairs;                                                \
-            if (_h->log2_pair_size > 0)                                     \
-              _q_end = hash_forward (_h, _q, indirect_pair_get_len (_pi));  \
+          do {                                                              \
+            if (_id & 1)                                                    \
+              {                                                             \
+                _q = &_p->direct;                                           \
+                _q_end = _q + _pair_increment;                              \
+              }                                                             \
             else                                                            \
-              _q_end = vec_end (_q);                                        \
-          }                                                                 \
+              {                                                             \
+                hash_pair_indirect_t * _pi = &_p->indirect;                 \
+                _q = _pi->pairs;                                            \
+                if (_h->log2_pair_size > 0)                                 \
+                  _q_end = hash_forward (_h, _q, indirect_pair_get_len (_pi)); \
+                else                                                        \
+                  _q_end = vec_end (_q);                                    \
+              }                                                             \
                                                                             \
-        /* Loop through all elements in bucket.                             \
-           Bucket may have 0 1 or more (indirect case) pairs. */            \
-        while (_q < _q_end)                                                 \
-          {                                                                 \
-            uword _break_in_body = 1;                                       \
-            (p) = _q;                                                       \
-            do {                                                            \
-              body;                                                         \
-              _break_in_body = 0;                                           \
-            } while (0);                                                    \
-            if (_break_in_body)                                             \
-              goto _hash_foreach_done;                                      \
-            _q += _pair_increment;                                          \
-          }                                                                 \
+            /* Loop through all elements in bucket.                         \
+               Bucket may have 0 1 or more (indirect case) pairs. */        \
+            while (_q < _q_end)                                             \
+              {                                                             \
+                uword _break_in_body = 1;                                   \
+                (p) = _q;                                                   \
+                do {                                                        \
+                  body;                                                     \
+                  _break_in_body = 0;                                       \
+                } while (0);                                                \
+                if (_break_in_body)                                         \
+                  goto _hash_foreach_done;                                  \
+                _q += _pair_increment;                                      \
+              }                                                             \
                                                                             \
-        _p = (hash_pair_union_t *) (&_p->direct + _pair_increment);         \
-        _id = _id / 2;                                                      \
-        _i++;                                                               \
-      } while (_i < _i1);                                                   \
+            _p = (hash_pair_union_t *) (&_p->direct + _pair_increment);     \
+            _id = _id / 2;                                                  \
+            _i++;                                                           \
+          } while (_i < _i1);                                               \
+        }                                                                   \
+      _hash_foreach_v = _h->resize_old;                                     \
     }                                                                       \
   _hash_foreach_done:                                                       \
   /* Be silent Mr. Compiler-Warning. */                                     \
@@ -367,8 +495,8 @@ do {                                                                        \
 do {								\
   hash_pair_t * _r;						\
   hash_foreach_pair (_r, (h), {					\
-    (key_var) = (__typeof__ (key_var)) _r->key;			\
-    (value_var) = (__typeof__ (value_var)) _r->value[0];	\
+    (key_var) = (__typeof__ (key_var)) hash_pair_key (_h, _r);	\
+    (value_var) = (__typeof__ (value_var)) hash_pair_value0 (_h, _r); \
     do { body; } while (0);					\
   });								\
 } while (0)
@@ -412,9 +540,9 @@ always_inline void hash_set_value_bytes (hash_t * h, uword value_bytes)
       max_log2 ((sizeof (p->key) + value_bytes + sizeof (p->key) - 1) / sizeof (p->key));
 }
 
-#define hash_create2(_elts,_user,_value_bytes,               \
+#define hash_create3(_elts,_user,_value_bytes,               \
                      _key_sum,_key_equal,                    \
-                     _format_pair,_format_pair_arg)          \
+                     _format_pair,_format_pair_arg,_flags)   \
 ({							     \
   hash_t _h;						     \
   memset (&_h, 0, sizeof (_h));				     \
@@ -424,9 +552,17 @@ always_inline void hash_set_value_bytes (hash_t * h, uword value_bytes)
   hash_set_value_bytes (&_h, (_value_bytes));		     \
   _h.format_pair = (format_function_t *) (_format_pair);     \
   _h.format_pair_arg = (_format_pair_arg);                   \
+  _h.flags = (_flags);					     \
   _hash_create ((_elts), &_h);				     \
 })
 
+#define hash_create2(_elts,_user,_value_bytes,               \
+                     _key_sum,_key_equal,                    \
+                     _format_pair,_format_pair_arg)          \
+  hash_create3 ((_elts), (_user), (_value_bytes),	     \
+		(_key_sum), (_key_equal),		     \
+		(_format_pair), (_format_pair_arg), 0)
+
 /* Hash function based on that of Bob Jenkins (bob_jenkins@compuserve.com).
    Thanks, Bob. */
 #define hash_mix_step(a,b,c,s0,s1,s2)		\
@@ -580,6 +716,19 @@ extern u64 hash_memory64 (void * p, word n_bytes, u64 state);
 extern u32 hash_memory32 (void * p, word n_bytes, u32 state);
 extern uword hash_memory (void * p, word n_bytes, uword state);
 
+/* Hardware assisted kernels for hash_memory on x86_64. */
+#if uword_bits == 64 && defined (__x86_64__) \
+  && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HASH_MEMORY_X86_KERNELS
+extern u64 hash_memory64_crc32c (void * p, word n_bytes, u64 state);
+extern u64 hash_memory64_avx2 (void * p, word n_bytes, u64 state);
+#endif
+
+/* Kernel used by hash_memory: best of above supported by CPU or
+   hash_memory64/32.  Must not change once tables have been built. */
+typedef uword (hash_memory_function_t) (void * p, word n_bytes, uword state);
+extern hash_memory_function_t * hash_memory_function;
+
 extern uword mem_key_sum (hash_t * h, uword key);
 extern uword mem_key_equal (hash_t * h, uword key1, uword key2);
 
@@ -610,6 +759,17 @@ extern u8 * string_key_format_pair (u8 * s, va_list * args);
                (hash_key_equal_function_t *) KEY_FUNC_NONE,	\
                0,0)
 
+/* Open addressed version of hash_create. */
+#define hash_create_open(elts,value_bytes)				\
+  hash_create3((elts),0,(value_bytes),					\
+               (hash_key_sum_function_t *) KEY_FUNC_NONE,		\
+               (hash_key_equal_function_t *) KEY_FUNC_NONE,		\
+               0,0,HASH_FLAG_OPEN_ADDRESSING)
+
+#define hash_create_mem_open(elts,key_bytes,value_bytes)		\
+  hash_create3((elts),(key_bytes),(value_bytes),mem_key_sum,mem_key_equal,0,0, \
+	       HASH_FLAG_OPEN_ADDRESSING)
+
 #define hash_create_uword(elts,value_bytes)				\
   hash_create2((elts),0,(value_bytes),					\
                (hash_key_sum_function_t *) KEY_FUNC_POINTER_UWORD,	\
@@ -622,8 +782,55 @@ extern u8 * string_key_format_pair (u8 * s, va_list * args);
                (hash_key_equal_function_t *) KEY_FUNC_POINTER_U32,	\
                0,0)
 
+/* u32 key -> u32 value table using 8 bytes per pair.  Use
+   hash_get_u32/hash_set_u32 to access values and hash_pair_key/
+   hash_pair_value (or hash_foreach) to access pairs. */
+#define hash_create_compact_u32(elts)					\
+  hash_create3((elts),0,sizeof (u32),					\
+               (hash_key_sum_function_t *) KEY_FUNC_NONE,		\
+               (hash_key_equal_function_t *) KEY_FUNC_NONE,		\
+               0,0,HASH_FLAG_COMPACT_U32 | HASH_FLAG_OPEN_ADDRESSING)
+
 u8 * format_hash (u8 * s, va_list * va);
 
+/* Health of a hash table as computed by hash_get_stats. */
+typedef struct {
+  uword n_elts, n_buckets, n_bytes;
+
+  /* Buckets holding a single user pair, an indirect array of pairs
+     or nothing.  For open addressed tables buckets are slots and
+     deleted slots are counted separately. */
+  uword n_user_buckets, n_indirect_buckets, n_empty_buckets;
+  uword n_deleted_buckets;
+
+  /* bucket_length_counts[i] is number of buckets holding i pairs. */
+  uword * bucket_length_counts;
+
+  /* probe_length_counts[i] is number of keys found after i probes:
+     key compares for chained tables, groups of control bytes for
+     open addressing. */
+  uword * probe_length_counts;
+
+  /* Average probes for lookups of random present and absent keys. */
+  f64 average_hit_probes, average_miss_probes;
+
+  /* Copied from header. */
+  uword n_resizes;
+  u64 n_get_hits, n_get_hit_compares;
+  u64 n_get_misses, n_get_miss_compares;
+} hash_stats_t;
+
+/* Walks table filling in stats; free with hash_free_stats. */
+void hash_get_stats (void * v, hash_stats_t * s);
+void hash_free_stats (hash_stats_t * s);
+u8 * format_hash_stats (u8 * s, va_list * va);
+
+/* Formats vector of counts as "i: counts[i]" skipping zero counts. */
+u8 * format_hash_counts (u8 * s, va_list * va);
+
+/* Zero lookup counters. */
+void hash_clear_stats (void * v);
+
 /* Looks up input in hash table indexed by either vec string or
    c string (null terminated). */
 unformat_function_t unformat_hash_vec_string;
@@ -0,0 +1,219 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <clib/intern.h>
+
+always_inline uword
+clib_intern_key_is_lookup (clib_intern_t * ci, uword key)
+{ return key >= vec_len (ci->offset_by_id); }
+
+always_inline u8 *
+clib_intern_key_string (clib_intern_t * ci, uword key, u32 * n_bytes)
+{
+  if (clib_intern_key_is_lookup (ci, key))
+    {
+      uword i = ~0 - key;
+      *n_bytes = ci->lookup_lengths[i];
+      return ci->lookup_strings[i];
+    }
+  *n_bytes = clib_intern_length (ci, key);
+  return clib_intern_string (ci, key);
+}
+
+static uword
+clib_intern_key_sum (hash_t * h, uword key)
+{
+  clib_intern_t * ci = uword_to_pointer (h->user, clib_intern_t *);
+  u32 n_bytes;
+  u8 * s = clib_intern_key_string (ci, key, &n_bytes);
+  return hash_memory (s, n_bytes, 0);
+}
+
+static uword
+clib_intern_key_equal (hash_t * h, uword key1, uword key2)
+{
+  clib_intern_t * ci = uword_to_pointer (h->user, clib_intern_t *);
+  u32 n1, n2;
+  u8 * s1 = clib_intern_key_string (ci, key1, &n1);
+  u8 * s2 = clib_intern_key_string (ci, key2, &n2);
+  return n1 == n2 && ! memcmp (s1, s2, n1);
+}
+
+/* As with mhash, hash user pointer must point to intern table which
+   may have moved since last call. */
+static void
+clib_intern_sanitize_hash_user (clib_intern_t * ci)
+{
+  if (! ci->id_by_string)
+    ci->id_by_string = hash_create2 (/* elts */ 0,
+				     /* user */ 0,
+				     /* value_bytes */ 0,
+				     clib_intern_key_sum,
+				     clib_intern_key_equal,
+				     /* format pair/arg */
+				     0, 0);
+  hash_header (ci->id_by_string)->user = pointer_to_uword (ci);
+}
+
+static u32
+clib_intern_add (clib_intern_t * ci, void * string, uword n_bytes)
+{
+  u32 id = vec_len (ci->offset_by_id);
+
+  ASSERT (n_bytes < (u32) ~0);
+  vec_add1 (ci->offset_by_id, vec_len (ci->arena));
+  vec_add (ci->arena, string, n_bytes);
+  vec_add1 (ci->arena, 0);
+
+  /* Key sum reads new string from arena. */
+  hash_set1 (ci->id_by_string, id);
+
+  return id;
+}
+
+u32 clib_intern_find (clib_intern_t * ci, void * string, uword n_bytes)
+{
+  hash_pair_t * p;
+
+  clib_intern_sanitize_hash_user (ci);
+
+  vec_validate (ci->lookup_strings, 0);
+  vec_validate (ci->lookup_lengths, 0);
+  ci->lookup_strings[0] = string;
+  ci->lookup_lengths[0] = n_bytes;
+
+  p = hash_get_pair (ci->id_by_string, ~0);
+  return p ? p->key : CLIB_INTERN_ID_INVALID;
+}
+
+u32 clib_intern (clib_intern_t * ci, void * string, uword n_bytes)
+{
+  u32 id = clib_intern_find (ci, string, n_bytes);
+  if (id == CLIB_INTERN_ID_INVALID)
+    id = clib_intern_add (ci, string, n_bytes);
+  return id;
+}
+
+void clib_intern_multiple (clib_intern_t * ci, u8 ** strings, uword n_strings, u32 * ids)
+{
+  hash_pair_t ** pairs = 0;
+  uword i;
+
+  if (n_strings == 0)
+    return;
+
+  clib_intern_sanitize_hash_user (ci);
+
+  vec_validate (ci->lookup_strings, n_strings - 1);
+  vec_validate (ci->lookup_lengths, n_strings - 1);
+  vec_validate (ci->lookup_keys, n_strings - 1);
+  vec_validate (pairs, n_strings - 1);
+  for (i = 0; i < n_strings; i++)
+    {
+      ci->lookup_strings[i] = strings[i];
+      ci->lookup_lengths[i] = vec_len (strings[i]);
+      ci->lookup_keys[i] = ~0 - i;
+    }
+
+  _hash_get_pair_multiple (ci->id_by_string, ci->lookup_keys, n_strings, pairs);
+
+  /* Take ids of hits before adding any miss: adds may resize hash
+     and move the pairs. */
+  for (i = 0; i < n_strings; i++)
+    ids[i] = pairs[i] ? pairs[i]->key : CLIB_INTERN_ID_INVALID;
+
+  /* Misses are added one by one since batch may contain same new
+     string more than once. */
+  for (i = 0; i < n_strings; i++)
+    if (! pairs[i])
+      ids[i] = clib_intern (ci, strings[i], vec_len (strings[i]));
+
+  vec_free (pairs);
+}
+
+u32 clib_intern_id_for_offset (clib_intern_t * ci, u32 offset)
+{
+  word lo, hi, mid;
+
+  lo = 0;
+  hi = vec_len (ci->offset_by_id) - 1;
+  while (lo <= hi)
+    {
+      mid = (lo + hi) / 2;
+      if (ci->offset_by_id[mid] == offset)
+	return mid;
+      if (ci->offset_by_id[mid] < offset)
+	lo = mid + 1;
+      else
+	hi = mid - 1;
+    }
+  return CLIB_INTERN_ID_INVALID;
+}
+
+void clib_intern_rebuild (clib_intern_t * ci)
+{
+  uword i, l, n = vec_len (ci->arena);
+
+  vec_reset_length (ci->offset_by_id);
+  hash_free (ci->id_by_string);
+  clib_intern_sanitize_hash_user (ci);
+
+  /* Find all strings first: length of each comes from next offset. */
+  for (i = 0; i < n; i += l + 1)
+    {
+      u8 * z = memchr (ci->arena + i, 0, n - i);
+      l = z ? z - (ci->arena + i) : n - i;
+      vec_add1 (ci->offset_by_id, i);
+    }
+
+  /* Missing terminator for last string. */
+  if (n > 0 && ci->arena[n - 1] != 0)
+    vec_add1 (ci->arena, 0);
+
+  /* Each string keeps its id; lookups find first copy. */
+  for (i = 0; i < vec_len (ci->offset_by_id); i++)
+    if (clib_intern_find (ci, clib_intern_string (ci, i),
+			  clib_intern_length (ci, i)) == CLIB_INTERN_ID_INVALID)
+      hash_set1 (ci->id_by_string, i);
+}
+
+void clib_intern_free (clib_intern_t * ci)
+{
+  vec_free (ci->arena);
+  vec_free (ci->offset_by_id);
+  hash_free (ci->id_by_string);
+  vec_free (ci->lookup_strings);
+  vec_free (ci->lookup_lengths);
+  vec_free (ci->lookup_keys);
+}
+
+u8 * format_clib_intern (u8 * s, va_list * va)
+{
+  clib_intern_t * ci = va_arg (*va, clib_intern_t *);
+  uword n = clib_intern_elts (ci);
+
+  s = format (s, "%d strings, %d arena bytes, %d bytes per string",
+	      n, vec_len (ci->arena),
+	      n > 0 ? vec_len (ci->arena) / n : 0);
+  return s;
+}
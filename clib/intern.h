@@ -0,0 +1,110 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef included_clib_intern_h
+#define included_clib_intern_h
+
+/* String interning: maps byte strings to dense u32 ids which stay valid
+   for the life of the table.  Each distinct string is stored once in an
+   append only arena, followed by a null byte so interned strings may
+   be used as C strings.  Hash table keys are ids; key sum and equal
+   functions look at arena bytes so strings are not copied twice. */
+
+#include <clib/format.h>
+#include <clib/hash.h>
+#include <clib/vec.h>
+
+typedef struct {
+  /* Bytes of all strings; each string is followed by a 0 byte. */
+  u8 * arena;
+
+  /* Arena byte offset of each string indexed by id.  Increasing since
+     arena only grows. */
+  u32 * offset_by_id;
+
+  /* Hash of ids keyed by string contents. */
+  uword * id_by_string;
+
+  /* Strings being looked up.  Hash key ~0 - i refers to lookup_strings[i]
+     whose length is lookup_lengths[i]; lookup_keys[i] holds hash key. */
+  u8 ** lookup_strings;
+  u32 * lookup_lengths;
+  uword * lookup_keys;
+} clib_intern_t;
+
+#define CLIB_INTERN_ID_INVALID (~0)
+
+always_inline uword
+clib_intern_elts (clib_intern_t * ci)
+{ return vec_len (ci->offset_by_id); }
+
+always_inline u32
+clib_intern_offset (clib_intern_t * ci, u32 id)
+{ return vec_elt (ci->offset_by_id, id); }
+
+/* Length of string not counting null terminator. */
+always_inline u32
+clib_intern_length (clib_intern_t * ci, u32 id)
+{
+  u32 end = (id + 1 < vec_len (ci->offset_by_id)
+	     ? ci->offset_by_id[id + 1]
+	     : vec_len (ci->arena));
+  return end - clib_intern_offset (ci, id) - 1;
+}
+
+/* Null terminated string with given id.  Pointer is valid until arena
+   grows; ids and offsets are stable. */
+always_inline u8 *
+clib_intern_string (clib_intern_t * ci, u32 id)
+{ return ci->arena + clib_intern_offset (ci, id); }
+
+/* Id of string at given arena offset or CLIB_INTERN_ID_INVALID. */
+u32 clib_intern_id_for_offset (clib_intern_t * ci, u32 offset);
+
+/* Id of string, adding it if not already present. */
+u32 clib_intern (clib_intern_t * ci, void * string, uword n_bytes);
+
+/* Id of string or CLIB_INTERN_ID_INVALID if not present. */
+u32 clib_intern_find (clib_intern_t * ci, void * string, uword n_bytes);
+
+always_inline u32
+clib_intern_c_string (clib_intern_t * ci, char * s)
+{ return clib_intern (ci, s, strlen (s)); }
+
+always_inline u32
+clib_intern_vec (clib_intern_t * ci, u8 * v)
+{ return clib_intern (ci, v, vec_len (v)); }
+
+/* Interns N_STRINGS vector strings at once.  Lookups of all strings
+   are pipelined; only strings not found are added. */
+void clib_intern_multiple (clib_intern_t * ci, u8 ** strings, uword n_strings, u32 * ids);
+
+/* Rebuilds ids and hash from arena of null terminated strings (e.g.
+   after unserializing arena).  Duplicate strings keep first id. */
+void clib_intern_rebuild (clib_intern_t * ci);
+
+void clib_intern_free (clib_intern_t * ci);
+
+format_function_t format_clib_intern;
+
+#endif /* included_clib_intern_h */
@@ -0,0 +1,133 @@
+/*
+  Copyright (c) 2010 by cisco systems, inc.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef included_clib_kelog_h
+#define included_clib_kelog_h
+
+/* Kernel scheduler events (sched_switch, sched_wakeup) as elog events.
+   Unix only. */
+
+#include <clib/elog.h>
+
+typedef enum {
+  KELOG_SCHED_RUNNING = 0,
+  KELOG_SCHED_WAKEUP,
+} kelog_sched_event_type_t;
+
+/* Text path: parses formatted output of given kernel tracer. */
+void kelog_init (elog_main_t * em, char * kernel_tracer, u32 n_events);
+void kelog_collect_sched_switch_trace (elog_main_t * em);
+
+/* Binary path: reads per cpu ring buffer pages from
+   per_cpu/cpuN/trace_pipe_raw.  Kernel events go into their own
+   elog (one "kernel cpu N" track per cpu); combine with application
+   events using elog_merge. */
+
+typedef struct {
+  /* Event id from format file. */
+  u32 id;
+
+  /* Byte offsets in record of task pid and name and of cpu
+     (~0 when record has no cpu: use cpu of ring buffer). */
+  u32 pid_offset, comm_offset, cpu_offset;
+
+  /* Size of task name (not always null terminated). */
+  u32 comm_bytes;
+
+  /* Minimum record size to contain all fields. */
+  u32 min_bytes;
+
+  kelog_sched_event_type_t type;
+} kelog_raw_event_format_t;
+
+typedef struct {
+  /* Time in trace clock units. */
+  u64 time;
+
+  /* Cpu where event happened and cpu of task. */
+  u32 cpu, task_cpu;
+
+  u32 string_table_offset;
+
+  kelog_sched_event_type_t type;
+} kelog_raw_event_t;
+
+typedef struct {
+  u8 * tracing_dir;
+
+  /* Trace pipe file descriptor for each cpu; -1 if not open. */
+  int * fd_by_cpu;
+
+  /* Kernel events go into one track per cpu. */
+  elog_track_t * track_by_cpu;
+
+  /* Page read buffer and page header layout from events/header_page. */
+  u8 * page;
+  u32 commit_offset, commit_bytes, data_offset;
+
+  kelog_raw_event_format_t * event_formats;
+
+  /* Decoded events not yet known to be in time order with events
+     still in kernel buffers of other cpus. */
+  kelog_raw_event_t * pending_events;
+
+  /* Non-zero when trace clock counts cpu clocks; otherwise it is
+     CLOCK_MONOTONIC nanoseconds which are converted to cpu clocks
+     relative to init_cpu_time/init_trace_time. */
+  u32 trace_clock_is_cpu_clock;
+  u64 init_cpu_time, init_trace_time;
+
+  /* Trace clock in use before init; restored by close. */
+  u8 * saved_trace_clock;
+
+  u64 n_events_lost;
+} kelog_raw_main_t;
+
+/* Ring buffer page header commit flags. */
+#define KELOG_RAW_MISSED_EVENTS (1ULL << 31)
+#define KELOG_RAW_MISSED_STORED (1ULL << 30)
+
+/* Ring buffer event header type_len values (5 bits) and shift of
+   time delta extension. */
+#define KELOG_RAW_TYPE_PADDING 29
+#define KELOG_RAW_TYPE_TIME_EXTEND 30
+#define KELOG_RAW_TYPE_TIME_STAMP 31
+#define KELOG_RAW_TIME_SHIFT 27
+
+/* Starts binary kernel tracing of scheduler events for all cpus. */
+clib_error_t * kelog_raw_init (elog_main_t * em, u32 n_events);
+
+/* Reads all available pages from kernel buffers.  Call often enough
+   that kernel buffers do not fill (else events are lost). */
+clib_error_t * kelog_raw_collect (elog_main_t * em);
+
+/* Stops kernel tracing, adds all remaining events to log and
+   restores trace clock. */
+clib_error_t * kelog_raw_close (elog_main_t * em);
+
+/* Decodes one ring buffer page of given cpu into KM pending events.
+   Page header layout and event formats come from KM. */
+void kelog_raw_decode_page (elog_main_t * em, kelog_raw_main_t * km,
+			    u32 cpu, u8 * page, uword n_page_bytes);
+
+#endif /* included_clib_kelog_h */
@@ -27,17 +27,19 @@ always_inline u32
 load_partial_u32 (void * d, uword n)
 {
   if (n == 4)
-    return ((u32 *) d)[0];
+    return clib_mem_unaligned (d, u32);
   if (n == 3)
-    return ((u16 *) d)[0] | (((u8 *) d)[2] << 16);
+    return clib_mem_unaligned (d, u16) | (((u8 *) d)[2] << 16);
   if (n == 2)
-    return ((u16 *) d)[0];
+    return clib_mem_unaligned (d, u16);
   if (n == 1)
     return ((u8 *) d)[0];
   ASSERT (0);
   return 0;
 }
 
+/* Fixed size keys: size is a compile time constant so mix is unrolled
+   and reads never go past end of key. */
 always_inline u32
 mhash_key_sum_inline (void * data, uword n_data_bytes, u32 seed)
 {
@@ -50,9 +52,9 @@ mhash_key_sum_inline (void * data, uword n_data_bytes, u32 seed)
 
   while (n_left > 12)
     {
-      a += d32[0];
-      b += d32[1];
-      c += d32[2];
+      a += clib_mem_unaligned (d32 + 0, u32);
+      b += clib_mem_unaligned (d32 + 1, u32);
+      c += clib_mem_unaligned (d32 + 2, u32);
       hash_v3_mix32 (a, b, c);
       n_left -= 12;
       d32 += 3;
@@ -111,7 +113,7 @@ mhash_key_sum_c_string (hash_t * h, uword key)
 {
   mhash_t * hv = uword_to_pointer (h->user, mhash_t *);
   void * k = mhash_key_to_mem (hv, key);
-  return mhash_key_sum_inline (k, strlen (k), hv->hash_seed);
+  return hash_memory (k, strlen (k), hv->hash_seed);
 }
 
 static uword
@@ -128,7 +130,7 @@ mhash_key_sum_vec_string (hash_t * h, uword key)
 {
   mhash_t * hv = uword_to_pointer (h->user, mhash_t *);
   void * k = mhash_key_to_mem (hv, key);
-  return mhash_key_sum_inline (k, vec_len (k), hv->hash_seed);
+  return hash_memory (k, vec_len (k), hv->hash_seed);
 }
 
 static uword
@@ -184,11 +186,20 @@ void mhash_init (mhash_t * h, uword n_value_bytes, uword n_key_bytes)
   else
     vec_free (h->key_vector_or_heap);
   vec_free (h->key_vector_free_indices);
+  vec_free (h->key_tmps);
+  vec_free (h->key_tmp_hash_keys);
   hash_free (h->hash);
 
   memset (h, 0, sizeof (h[0]));
   h->n_key_bytes = n_key_bytes;
 
+  /* Small keys are the hash key itself. */
+  if (mhash_key_is_inline (h))
+    {
+      h->hash = hash_create (/* elts */ 0, n_value_bytes);
+      return;
+    }
+
   ASSERT (n_key_bytes < ARRAY_LEN (t));
   h->hash = hash_create2 (/* elts */ 0,
 			  /* user */ pointer_to_uword (h),
@@ -221,11 +232,56 @@ static uword mhash_set_tmp_key (mhash_t * h, void * key)
 hash_pair_t * mhash_get_pair (mhash_t * h, void * key)
 {
   uword ikey;
+
+  if (mhash_key_is_inline (h))
+    return hash_get_pair (h->hash, mhash_key_to_inline (h, key));
+
   mhash_sanitize_hash_user (h);
   ikey = mhash_set_tmp_key (h, key);
   return hash_get_pair (h->hash, ikey);
 }
 
+void mhash_get_multiple (mhash_t * h, void ** keys, uword n_keys, uword ** results)
+{
+  hash_pair_t ** pairs = (hash_pair_t **) results;
+  uword i;
+
+  if (n_keys == 0)
+    return;
+
+  vec_validate (h->key_tmp_hash_keys, n_keys - 1);
+
+  if (mhash_key_is_inline (h))
+    {
+      for (i = 0; i < n_keys; i++)
+	h->key_tmp_hash_keys[i] = mhash_key_to_inline (h, keys[i]);
+      _hash_get_pair_multiple (h->hash, h->key_tmp_hash_keys, n_keys, pairs);
+      for (i = 0; i < n_keys; i++)
+	if (pairs[i])
+	  results[i] = &pairs[i]->value[0];
+      return;
+    }
+
+  mhash_sanitize_hash_user (h);
+
+  /* Lookup keys are used in place; no need to copy them to key_tmp. */
+  vec_validate (h->key_tmps, n_keys - 1);
+  for (i = 0; i < n_keys; i++)
+    {
+      h->key_tmps[i] = keys[i];
+      h->key_tmp_hash_keys[i] = ~0 - 1 - i;
+    }
+
+  _hash_get_pair_multiple (h->hash, h->key_tmp_hash_keys, n_keys, pairs);
+
+  for (i = 0; i < n_keys; i++)
+    if (pairs[i])
+      results[i] = &pairs[i]->value[0];
+
+  /* Batch keys are only valid during lookup. */
+  _vec_len (h->key_tmps) = 0;
+}
+
 typedef struct {
   u32 heap_handle;
 
@@ -238,6 +294,13 @@ uword mhash_set_mem (mhash_t * h, void * key, uword * new_value, uword * old_val
   u8 * k;
   uword ikey, i, l, n_key_bytes, old_n_elts, key_alloc_from_free_list = 0;
 
+  if (mhash_key_is_inline (h))
+    {
+      ikey = mhash_key_to_inline (h, key);
+      h->hash = _hash_set3 (h->hash, ikey, new_value, old_value);
+      return ikey;
+    }
+
   mhash_sanitize_hash_user (h);
 
   if (mhash_key_vector_is_heap (h))
@@ -253,6 +316,7 @@ uword mhash_set_mem (mhash_t * h, void * key, uword * new_value, uword * old_val
       sk->heap_handle = handle;
       sk->vec.len = n_key_bytes;
       memcpy (sk->vec.vector_data, key, n_key_bytes);
+      h->n_key_heap_bytes_in_use += n_key_bytes + sizeof (sk[0]);
 
       /* Advance key past vector header. */
       i += sizeof (sk[0]);
@@ -295,6 +359,7 @@ uword mhash_set_mem (mhash_t * h, void * key, uword * new_value, uword * old_val
 	  mhash_string_key_t * sk;
 	  sk = (void *) (h->key_vector_or_heap + i - sizeof (sk[0]));
 	  heap_dealloc (h->key_vector_or_heap, sk->heap_handle);
+	  h->n_key_heap_bytes_in_use -= n_key_bytes + sizeof (sk[0]);
 	}
       else
 	{
@@ -311,11 +376,81 @@ uword mhash_set_mem (mhash_t * h, void * key, uword * new_value, uword * old_val
   return ikey;
 }
 
+/* Compaction is worth it when more than half of key space is free. */
+#define MHASH_MIN_COMPACT_BYTES 4096
+
+uword mhash_key_space_is_mostly_free (mhash_t * h)
+{
+  uword n_bytes = vec_len (h->key_vector_or_heap);
+  uword n_free;
+
+  if (n_bytes < MHASH_MIN_COMPACT_BYTES)
+    return 0;
+
+  if (mhash_key_vector_is_heap (h))
+    n_free = n_bytes - h->n_key_heap_bytes_in_use;
+  else
+    n_free = vec_len (h->key_vector_free_indices) * h->n_key_bytes;
+
+  return 2 * n_free > n_bytes;
+}
+
+void mhash_compact_keys (mhash_t * h)
+{
+  hash_pair_t * p;
+  u8 * old = h->key_vector_or_heap;
+  u8 * new = 0;
+
+  if (mhash_key_is_inline (h))
+    return;
+
+  /* Keys are hashed by content so hash pairs only need new offsets. */
+  if (mhash_key_vector_is_heap (h))
+    {
+      hash_foreach_pair (p, h->hash, ({
+	mhash_string_key_t * sk_old, * sk;
+	uword i, handle, n_bytes;
+
+	sk_old = (void *) (old + p->key) - sizeof (sk[0]);
+	n_bytes = sk_old->vec.len + sizeof (sk[0]);
+
+	i = heap_alloc (new, n_bytes, handle);
+	sk = (void *) (new + i);
+	memcpy (sk, sk_old, n_bytes);
+	sk->heap_handle = handle;
+	p->key = i + sizeof (sk[0]);
+      }));
+      heap_free (old);
+    }
+  else
+    {
+      hash_foreach_pair (p, h->hash, ({
+	u8 * k;
+	vec_add2 (new, k, h->n_key_bytes);
+	memcpy (k, old + p->key, h->n_key_bytes);
+	p->key = k - new;
+      }));
+      vec_free (old);
+      vec_reset_length (h->key_vector_free_indices);
+    }
+
+  h->key_vector_or_heap = new;
+}
+
 uword mhash_unset (mhash_t * h, void * key, uword * old_value)
 {
   hash_pair_t * p;
   uword i;
 
+  if (mhash_key_is_inline (h))
+    {
+      i = mhash_key_to_inline (h, key);
+      if (! hash_get_pair (h->hash, i))
+	return 0;
+      hash_unset3 (h->hash, i, old_value);
+      return 1;
+    }
+
   mhash_sanitize_hash_user (h);
   i = mhash_set_tmp_key (h, key);
 
@@ -330,19 +465,21 @@ uword mhash_unset (mhash_t * h, void * key, uword * old_value)
     {
       mhash_string_key_t * sk;
       sk = (void *) (h->key_vector_or_heap + i) - sizeof (sk[0]);
+      h->n_key_heap_bytes_in_use -= sk->vec.len + sizeof (sk[0]);
       heap_dealloc (h->key_vector_or_heap, sk->heap_handle);
     }
   else
     vec_add1 (h->key_vector_free_indices, i);
 
   hash_unset3 (h->hash, i, old_value);
+
   return 1;
 }
 
 u8 * format_mhash_key (u8 * s, va_list * va)
 {
   mhash_t * h = va_arg (*va, mhash_t *);
-  u32 ki = va_arg (*va, u32);
+  uword ki = va_arg (*va, uword);
   void * k = mhash_key_to_mem (h, ki);
 
   if (mhash_key_vector_is_heap (h))
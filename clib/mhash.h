@@ -28,18 +28,28 @@
 #include <clib/hash.h>
 #include <clib/heap.h>
 
-/* Hash table plus vector of keys. */
+/* Hash table plus vector of keys.  Keys of at most sizeof (uword) bytes
+   are stored directly in hash pairs instead. */
 typedef struct {
   /* Vector or heap used to store keys.  Hash table stores keys as byte
      offsets into this vector. */
   u8 * key_vector_or_heap;
 
+  /* Bytes of string keys (plus headers) allocated in heap.  Used by
+     mhash_key_space_is_mostly_free to decide when compaction pays. */
+  uword n_key_heap_bytes_in_use;
+
   /* Byte offsets of free keys in vector (used to store free keys when
      n_key_bytes > 1). */
   u32 * key_vector_free_indices;
 
   u8 * key_tmp;
 
+  /* Keys for mhash_get_multiple.  Hash key ~0 - 1 - i refers to
+     key_tmps[i]; hash_keys[i] holds this hash key. */
+  void ** key_tmps;
+  uword * key_tmp_hash_keys;
+
   /* Possibly fixed size of key.
      0 means keys are vectors of u8's.
      1 means keys are null terminated c strings. */
@@ -47,7 +57,7 @@ typedef struct {
 #define MHASH_C_STRING_KEY 1
   u32 n_key_bytes;
 
-  /* Seed value for Jenkins hash. */
+  /* Seed value for hash_memory. */
   u32 hash_seed;
 
   /* Hash table mapping key -> value. */
@@ -67,15 +77,50 @@ always_inline void
 mhash_init_vec_string (mhash_t * h, uword n_value_bytes)
 { mhash_init (h, n_value_bytes, MHASH_VEC_STRING_KEY); }
 
+/* See hash_enable_filter. */
+always_inline void
+mhash_enable_filter (mhash_t * h)
+{ hash_enable_filter (h->hash); }
+
+always_inline uword
+mhash_key_vector_is_heap (mhash_t * h)
+{ return h->n_key_bytes <= 1; }
+
+/* Fixed size keys that fit in a word live in hash pair key. */
+always_inline uword
+mhash_key_is_inline (mhash_t * h)
+{ return h->n_key_bytes > 1 && h->n_key_bytes <= sizeof (uword); }
+
+always_inline uword
+mhash_key_to_inline (mhash_t * h, void * key)
+{
+  uword k = 0;
+  memcpy (&k, key, h->n_key_bytes);
+  return k;
+}
+
+/* Memory of key with given hash key.  Inline keys are copied to
+   key_tmp, so pointer is valid only until next call. */
 always_inline void *
 mhash_key_to_mem (mhash_t * h, uword key)
 {
-  return (key == ~0
-	  ? h->key_tmp
-	  : vec_elt_at_index (h->key_vector_or_heap, key));
+  if (mhash_key_is_inline (h))
+    {
+      vec_validate (h->key_tmp, sizeof (uword) - 1);
+      memcpy (h->key_tmp, &key, sizeof (key));
+      return h->key_tmp;
+    }
+  if (key == ~0)
+    return h->key_tmp;
+  if (PREDICT_FALSE (key >= ~0 - vec_len (h->key_tmps)))
+    return h->key_tmps[~0 - 1 - key];
+  return vec_elt_at_index (h->key_vector_or_heap, key);
 }
 
 hash_pair_t * mhash_get_pair (mhash_t * h, void * key);
+
+/* Pipelined lookup of N_KEYS keys.  RESULTS[i] is set as for mhash_get. */
+void mhash_get_multiple (mhash_t * h, void ** keys, uword n_keys, uword ** results);
 uword mhash_set_mem (mhash_t * h, void * key, uword * new_value, uword * old_value);
 uword mhash_unset (mhash_t * h, void * key, uword * old_value);
 
@@ -108,9 +153,24 @@ always_inline uword
 mhash_elts (mhash_t * m)
 { return hash_elts (m->hash); }
 
-always_inline uword
-mhash_key_vector_is_heap (mhash_t * h)
-{ return h->n_key_bytes <= 1; }
+/* Memory of key of given pair; stable for inline keys. */
+always_inline void *
+mhash_pair_key_to_mem (mhash_t * h, hash_pair_t * p)
+{
+  if (mhash_key_is_inline (h))
+    return &p->key;
+  return mhash_key_to_mem (h, p->key);
+}
+
+/* Rewrites key vector or heap densely, dropping space of deleted keys.
+   Never called implicitly.  Moves keys: hash keys returned by previous
+   mhash_set calls (and key pointers from mhash_foreach) are invalid
+   after compaction.  No-op for inline keys. */
+void mhash_compact_keys (mhash_t * h);
+
+/* True when over half of at least 4K bytes of key space is free;
+   callers which do not hold hash keys may then call mhash_compact_keys. */
+uword mhash_key_space_is_mostly_free (mhash_t * h);
 
 always_inline void
 mhash_free (mhash_t * h)
@@ -120,6 +180,9 @@ mhash_free (mhash_t * h)
   else
     vec_free (h->key_vector_or_heap);
   vec_free (h->key_vector_free_indices);
+  vec_free (h->key_tmp);
+  vec_free (h->key_tmps);
+  vec_free (h->key_tmp_hash_keys);
   hash_free (h->hash);
 }
 
@@ -127,12 +190,14 @@ mhash_free (mhash_t * h)
 do {								\
   hash_pair_t * _mhash_foreach_p;				\
   hash_foreach_pair (_mhash_foreach_p, (mh)->hash, ({		\
-    (k) = mhash_key_to_mem ((mh), _mhash_foreach_p->key);	\
+    (k) = mhash_pair_key_to_mem ((mh), _mhash_foreach_p);	\
     (v) = &_mhash_foreach_p->value[0];				\
     body;							\
   }));								\
 } while (0)
 
+/* Arguments: mhash_t * and hash key as uword (as returned by mhash_set)
+   for all key types. */
 format_function_t format_mhash_key;
 
 #endif /* included_clib_mhash_h */
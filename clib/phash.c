@@ -73,6 +73,7 @@ determined a perfect hash for the whole set of keys.
 */
 
 #include <clib/bitmap.h>
+#include <clib/cache.h>
 #include <clib/format.h>
 #include <clib/phash.h>
 #include <clib/random.h>
@@ -317,12 +318,8 @@ static void init_keys_indirect_u64 (phash_main_t * pm)
  * insert keys into table according to key->b
  * check if the initial hash might work 
  */
-static int init_tabb (phash_main_t * pm)
+static void init_keys (phash_main_t * pm)
 {
-  int no_collisions;
-  phash_tabb_t * tb;
-  phash_key_t * k, * l;
-
   if (pm->key_seed1)
     {
       if (pm->flags & PHASH_FLAG_MIX64)
@@ -337,6 +334,15 @@ static int init_tabb (phash_main_t * pm)
       else
 	init_keys_direct_u32 (pm);
     }
+}
+
+static int init_tabb (phash_main_t * pm)
+{
+  int no_collisions;
+  phash_tabb_t * tb;
+  phash_key_t * k, * l;
+
+  init_keys (pm);
 
   if (! pm->tabb)
     vec_resize (pm->tabb, 1 << pm->b_bits);
@@ -373,6 +379,57 @@ static int init_tabb (phash_main_t * pm)
   return no_collisions;
 }
 
+/* Same as init_tabb for hash and displace: keys are counting sorted
+   by B into one vector instead of one vector per B. */
+static int init_tabb_displace (phash_main_t * pm)
+{
+  phash_key_t * k, * l;
+  u32 b, i, j, n_b, * offsets;
+
+  init_keys (pm);
+
+  n_b = 1 << pm->b_bits;
+  vec_validate (pm->b_key_offsets, n_b);
+  vec_validate (pm->b_keys, vec_len (pm->keys) - 1);
+  offsets = pm->b_key_offsets;
+  memset (offsets, 0, vec_bytes (offsets));
+
+  /* Count keys for each B and convert counts to start offsets. */
+  vec_foreach (k, pm->keys)
+    offsets[k->b] += 1;
+  for (b = 0, i = 0; b <= n_b; b++)
+    {
+      j = offsets[b];
+      offsets[b] = i;
+      i += j;
+    }
+
+  /* Filling advances offsets[b] to start of B + 1; shift back. */
+  vec_foreach (k, pm->keys)
+    pm->b_keys[offsets[k->b]++] = k - pm->keys;
+  for (b = n_b; b > 0; b--)
+    offsets[b] = offsets[b - 1];
+  offsets[0] = 0;
+
+  /* Two keys with the same (a,b) guarantees a collision */
+  for (b = 0; b < n_b; b++)
+    for (i = offsets[b]; i < offsets[b + 1]; i++)
+      for (j = i + 1; j < offsets[b + 1]; j++)
+	{
+	  k = pm->keys + pm->b_keys[i];
+	  l = pm->keys + pm->b_keys[j];
+	  if (k->a == l->a)
+	    {
+	      if (pm->key_is_equal
+		  && pm->key_is_equal (pm->private, l->key, k->key))
+		clib_error ("duplicate keys");
+	      return 0;
+	    }
+	}
+
+  return 1;
+}
+
 /* Try to apply an augmenting list */
 static int apply (phash_main_t * pm, u32 tail, u32 rollback)
 {
@@ -549,6 +606,47 @@ static int augment (phash_main_t * pm, u32 b_root, u32 high_water)
 }
 
 
+always_inline u32
+tabb_n_keys (phash_main_t * pm, u32 b)
+{
+  if (pm->b_key_offsets)
+    return pm->b_key_offsets[b + 1] - pm->b_key_offsets[b];
+  else
+    return vec_len (pm->tabb[b].keys);
+}
+
+/* Sort B in descending order by number of keys.  Counting sort since
+   there are only a few distinct key counts. */
+static void sort_tabb (phash_main_t * pm)
+{
+  u32 * offsets = 0;
+  u32 b, n, o, max_n, n_b;
+
+  n_b = 1 << pm->b_bits;
+  max_n = 0;
+  for (b = 0; b < n_b; b++)
+    max_n = clib_max (max_n, tabb_n_keys (pm, b));
+
+  vec_validate (offsets, max_n);
+  for (b = 0; b < n_b; b++)
+    offsets[tabb_n_keys (pm, b)] += 1;
+
+  /* Largest counts first. */
+  o = 0;
+  for (n = max_n + 1; n > 0; n--)
+    {
+      u32 c = offsets[n - 1];
+      offsets[n - 1] = o;
+      o += c;
+    }
+
+  vec_validate (pm->tabb_sort, n_b - 1);
+  for (b = 0; b < n_b; b++)
+    pm->tabb_sort[offsets[tabb_n_keys (pm, b)]++] = b;
+
+  vec_free (offsets);
+}
+
 /* find a mapping that makes this a perfect hash */
 static int perfect (phash_main_t * pm)
 {
@@ -557,14 +655,7 @@ static int perfect (phash_main_t * pm)
   /* clear any state from previous attempts */
   memset (pm->tabh, ~0, vec_bytes (pm->tabh));
 
-  vec_validate (pm->tabb_sort, vec_len (pm->tabb) - 1);
-  for (i = 0; i < vec_len (pm->tabb_sort); i++)
-    pm->tabb_sort[i] = i;
-  vec_sort (pm->tabb_sort, b1, b2, ({
-    phash_tabb_t * tb1 = pm->tabb + b1[0];
-    phash_tabb_t * tb2 = pm->tabb + b2[0];
-    (int) vec_len (tb2->keys) - (int) vec_len (tb1->keys);
-  }));
+  sort_tabb (pm);
 
   /* In descending order by number of keys, map all *b*s */
   for (i = 0; i < vec_len (pm->tabb_sort); i++)
@@ -578,6 +669,84 @@ static int perfect (phash_main_t * pm)
 }
 
 
+/* Hash and displace: in descending order by number of keys give each
+   b the first tab[b] value that maps all its keys to unused hashes.
+   Fills in tab directly (already scrambled).
+   Keys of a given b have distinct a so they never collide with each
+   other.  Values are tried in scramble order so that successive tries
+   land far apart. */
+static int displace (phash_main_t * pm)
+{
+  u32 b, i, j, v, v_limit, hash, stabb, * keys, n_keys;
+
+  memset (pm->tabh, ~0, vec_bytes (pm->tabh));
+
+  sort_tabb (pm);
+
+  v_limit = 1 << pm->s_bits;
+
+  vec_validate (pm->tab, vec_len (pm->tabb_sort) - 1);
+
+  for (i = 0; i < vec_len (pm->tabb_sort); i++)
+    {
+      b = pm->tabb_sort[i];
+      keys = pm->b_keys + pm->b_key_offsets[b];
+      n_keys = tabb_n_keys (pm, b);
+
+      /* Remaining b have no keys. */
+      if (n_keys == 0)
+	break;
+
+      for (v = 0; v < v_limit; v++)
+	{
+	  stabb = pm->scramble[v];
+	  for (j = 0; j < n_keys; j++)
+	    {
+	      hash = pm->keys[keys[j]].a ^ stabb;
+	      if (pm->tabh[hash] != ~0)
+		break;
+	    }
+	  if (j >= n_keys)
+	    break;
+	}
+
+      pm->n_displace_trials += v + 1;
+
+      /* No value works for this b: try again with new seed. */
+      if (v >= v_limit)
+	return 0;
+
+      pm->tab[b] = stabb;
+      for (j = 0; j < n_keys; j++)
+	{
+	  hash = pm->keys[keys[j]].a ^ stabb;
+	  pm->tabh[hash] = keys[j];
+	}
+    }
+
+  return 1;
+}
+
+/* Hash and displace needs a to cover all hash values and about 2 keys
+   per b.  No scramble at lookup time: tab holds scrambled values.
+   Tables are never minimal (see phash_find_perfect_hash). */
+static void guess_initial_parameters_displace (phash_main_t * pm)
+{
+  u32 n_keys, s_bits;
+
+  n_keys = vec_len (pm->keys);
+  s_bits = max_log2 (n_keys);
+
+  /* Keep tables at most 80% full. */
+  if (n_keys > (1 << s_bits) * 0.8)
+    s_bits += 1;
+
+  pm->s_bits = s_bits;
+  pm->a_bits = s_bits;
+  pm->b_bits = s_bits > 0 ? s_bits - 1 : 0;
+  pm->flags &= ~PHASH_FLAG_USE_SCRAMBLE;
+}
+
 /*
  * Find initial a_bits = log2 (a_max), b_bits = log2 (b_max).
  * Initial a_max and b_max values were found empirically.  Some factors:
@@ -744,14 +913,20 @@ static void scramble_init (phash_main_t * pm)
 }
 
 /* Try to find a perfect hash function. */
-clib_error_t *
-phash_find_perfect_hash (phash_main_t * pm)
+static clib_error_t *
+find_perfect_hash (phash_main_t * pm)
 {
   clib_error_t * error = 0;
-  u32 max_a_bits, n_tries_this_a_b, want_minimal;
+  u32 max_a_bits, n_tries_this_a_b, n_displace_failures;
+  u32 want_minimal, is_displace;
+
+  is_displace = (pm->flags & PHASH_FLAG_HASH_AND_DISPLACE) != 0;
 
   /* guess initial values for s_max, a_max and b_max */
-  guess_initial_parameters (pm);
+  if (is_displace)
+    guess_initial_parameters_displace (pm);
+  else
+    guess_initial_parameters (pm);
 
   want_minimal = pm->flags & PHASH_FLAG_MINIMAL;
 
@@ -763,6 +938,10 @@ phash_find_perfect_hash (phash_main_t * pm)
   if (max_a_bits < 1)
     max_a_bits = 1;
 
+  /* Hash and displace keeps a covering all hashes. */
+  if (is_displace)
+    max_a_bits = pm->a_bits;
+
   pm->hash_max = want_minimal ? vec_len (pm->keys) : (1 << pm->s_bits);
 
   scramble_init (pm);
@@ -771,16 +950,18 @@ phash_find_perfect_hash (phash_main_t * pm)
   vec_free (pm->tabh);
   vec_validate_init_empty (pm->tabh, pm->hash_max - 1, ~0);
   vec_free (pm->tabq);
-  vec_validate (pm->tabq, 1 << pm->b_bits);
+  if (! is_displace)
+    vec_validate (pm->tabq, 1 << pm->b_bits);
   
   /* Actually find the perfect hash */
   n_tries_this_a_b = 0;
+  n_displace_failures = 0;
   while (1)
     {
       /* Choose random hash seeds until keys become unique. */
       pm->hash_seed = random_u64 (&pm->random_seed);
       pm->n_seed_trials++;
-      if (init_tabb (pm))
+      if (is_displace ? init_tabb_displace (pm) : init_tabb (pm))
 	{
 	  /* Found unique (A, B). */
 
@@ -789,14 +970,37 @@ phash_find_perfect_hash (phash_main_t * pm)
 	    goto done;
 
 	  pm->n_perfect_calls++;
-	  if (perfect (pm))
+	  if (is_displace ? displace (pm) : perfect (pm))
 	    goto done;
 
-	  goto increase_b;
+	  if (! is_displace)
+	    goto increase_b;
+
+	  /* Hash and displace rarely fails: new seed is enough.
+	     Otherwise more b means fewer keys per b. */
+	  if (++n_displace_failures < 16)
+	    continue;
+	  n_displace_failures = 0;
+	  n_tries_this_a_b = 0;
+	  if (pm->b_bits < pm->s_bits)
+	    goto increase_b;
+	  goto increase_s;
 	}
 
       /* Keep trying with different seed value. */
       n_tries_this_a_b++;
+
+      /* A and B overlap in 32 bit hash so more bits cannot help:
+	 beyond ~2^16 keys some pair collides for almost every seed. */
+      if (is_displace
+	  && ! (pm->flags & PHASH_FLAG_MIX64)
+	  && n_tries_this_a_b >= 64)
+	{
+	  error = clib_error_return (0, "%d keys collide in 32 bit hash; use 64 bit hash",
+				     vec_len (pm->keys));
+	  goto done;
+	}
+
       if (n_tries_this_a_b < 2048)
 	continue;
 
@@ -812,7 +1016,15 @@ phash_find_perfect_hash (phash_main_t * pm)
 	}
       else
 	{
+	increase_s:
 	  /* Can't increase (A, B) any more, so try increasing S. */
+	  if (is_displace)
+	    {
+	      pm->s_bits++;
+	      pm->a_bits = pm->s_bits;
+	      pm->b_bits = pm->s_bits - 1;
+	      n_tries_this_a_b = 0;
+	    }
 	  goto new_s;
 	}
     }
@@ -826,16 +1038,22 @@ phash_find_perfect_hash (phash_main_t * pm)
       pm->a_shift = ((pm->flags & PHASH_FLAG_MIX64) ? 64 : 32) - pm->a_bits;
       pm->b_mask = (1 << pm->b_bits) - 1;
 
-      vec_resize (pm->tab, vec_len (pm->tabb));
-      for (b = 0; b < vec_len (pm->tabb); b++)
+      /* Hash and displace fills in tab directly. */
+      if (is_displace)
+	vec_validate (pm->tab, pm->b_mask);
+      else
 	{
-	  v = pm->tabb[b].val_b;
+	  vec_resize (pm->tab, vec_len (pm->tabb));
+	  for (b = 0; b < vec_len (pm->tabb); b++)
+	    {
+	      v = pm->tabb[b].val_b;
 
-	  /* Apply scramble now for small enough value of b_bits. */
-	  if (! (pm->flags & PHASH_FLAG_USE_SCRAMBLE))
-	    v = pm->scramble[v];
+	      /* Apply scramble now for small enough value of b_bits. */
+	      if (! (pm->flags & PHASH_FLAG_USE_SCRAMBLE))
+		v = pm->scramble[v];
 
-	  pm->tab[b] = v;
+	      pm->tab[b] = v;
+	    }
 	}
     }
 
@@ -845,6 +1063,184 @@ phash_find_perfect_hash (phash_main_t * pm)
   return error;
 }
 
+#ifdef CLIB_UNIX
+
+#include <clib/serialize.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Everything lookups need. */
+static void serialize_phash_result (serialize_main_t * m, va_list * va)
+{
+  phash_main_t * pm = va_arg (*va, phash_main_t *);
+
+  serialize_integer (m, pm->a_bits, sizeof (pm->a_bits));
+  serialize_integer (m, pm->b_bits, sizeof (pm->b_bits));
+  serialize_integer (m, pm->s_bits, sizeof (pm->s_bits));
+  serialize_integer (m, pm->a_shift, sizeof (pm->a_shift));
+  serialize_integer (m, pm->b_mask, sizeof (pm->b_mask));
+  serialize_integer (m, pm->hash_seed, sizeof (pm->hash_seed));
+  serialize_integer (m, pm->flags, sizeof (pm->flags));
+  serialize_integer (m, pm->hash_max, sizeof (pm->hash_max));
+  serialize_integer (m, pm->n_seed_trials, sizeof (pm->n_seed_trials));
+  serialize_integer (m, pm->n_perfect_calls, sizeof (pm->n_perfect_calls));
+  serialize_integer (m, pm->n_displace_trials, sizeof (pm->n_displace_trials));
+  vec_serialize (m, pm->tab, serialize_vec_32);
+  vec_serialize (m, pm->scramble, serialize_vec_32);
+}
+
+static void unserialize_phash_result (serialize_main_t * m, va_list * va)
+{
+  phash_main_t * pm = va_arg (*va, phash_main_t *);
+
+  unserialize_integer (m, &pm->a_bits, sizeof (pm->a_bits));
+  unserialize_integer (m, &pm->b_bits, sizeof (pm->b_bits));
+  unserialize_integer (m, &pm->s_bits, sizeof (pm->s_bits));
+  unserialize_integer (m, &pm->a_shift, sizeof (pm->a_shift));
+  unserialize_integer (m, &pm->b_mask, sizeof (pm->b_mask));
+  unserialize_integer (m, &pm->hash_seed, sizeof (pm->hash_seed));
+  unserialize_integer (m, &pm->flags, sizeof (pm->flags));
+  unserialize_integer (m, &pm->hash_max, sizeof (pm->hash_max));
+  unserialize_integer (m, &pm->n_seed_trials, sizeof (pm->n_seed_trials));
+  unserialize_integer (m, &pm->n_perfect_calls, sizeof (pm->n_perfect_calls));
+  unserialize_integer (m, &pm->n_displace_trials, sizeof (pm->n_displace_trials));
+  vec_unserialize (m, &pm->tab, unserialize_vec_32);
+  vec_unserialize (m, &pm->scramble, unserialize_vec_32);
+}
+
+/* Forks N_CPUS searches with different random seeds; first one to
+   finish wins.  Children have copy on write memory so no locking is
+   needed. */
+static clib_error_t *
+find_perfect_hash_parallel (phash_main_t * pm)
+{
+  clib_error_t * error = 0;
+  pid_t * pids = 0;
+  int * fds = 0;
+  uword i, n_left;
+
+  for (i = 0; i < pm->n_cpus; i++)
+    {
+      int p[2];
+      pid_t pid;
+
+      if (pipe (p) < 0)
+	{
+	  error = clib_error_return_unix (0, "pipe");
+	  goto done;
+	}
+
+      pid = fork ();
+      if (pid < 0)
+	{
+	  close (p[0]);
+	  close (p[1]);
+	  error = clib_error_return_unix (0, "fork");
+	  goto done;
+	}
+
+      if (pid == 0)
+	{
+	  serialize_main_t m;
+
+	  close (p[0]);
+	  pm->random_seed += i * 0x9e3779b9;
+	  error = find_perfect_hash (pm);
+	  if (! error)
+	    {
+	      serialize_open_unix_file_descriptor (&m, p[1]);
+	      error = serialize (&m, serialize_phash_result, pm);
+	      serialize_close (&m);
+	    }
+	  _exit (error ? 1 : 0);
+	}
+
+      close (p[1]);
+      vec_add1 (pids, pid);
+      vec_add1 (fds, p[0]);
+    }
+
+  /* Take result from first child to finish. */
+  n_left = vec_len (fds);
+  while (n_left > 0)
+    {
+      fd_set read_fds;
+      int max_fd = -1;
+
+      FD_ZERO (&read_fds);
+      for (i = 0; i < vec_len (fds); i++)
+	if (fds[i] >= 0)
+	  {
+	    FD_SET (fds[i], &read_fds);
+	    max_fd = clib_max (max_fd, fds[i]);
+	  }
+
+      if (select (max_fd + 1, &read_fds, 0, 0, 0) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  error = clib_error_return_unix (0, "select");
+	  goto done;
+	}
+
+      for (i = 0; i < vec_len (fds); i++)
+	if (fds[i] >= 0 && FD_ISSET (fds[i], &read_fds))
+	  {
+	    serialize_main_t m;
+	    clib_error_t * e;
+
+	    unserialize_open_unix_file_descriptor (&m, fds[i]);
+	    e = unserialize (&m, unserialize_phash_result, pm);
+	    unserialize_close (&m);
+	    close (fds[i]);
+	    fds[i] = -1;
+	    n_left--;
+
+	    if (! e)
+	      goto done;
+
+	    /* Child failed: wait for others. */
+	    clib_error_free (e);
+	  }
+    }
+
+  error = clib_error_return (0, "no child found perfect hash");
+
+ done:
+  for (i = 0; i < vec_len (pids); i++)
+    {
+      if (fds[i] >= 0)
+	{
+	  kill (pids[i], SIGKILL);
+	  close (fds[i]);
+	}
+      waitpid (pids[i], 0, 0);
+    }
+  vec_free (pids);
+  vec_free (fds);
+  phash_main_free_working_memory (pm);
+  return error;
+}
+
+#endif /* CLIB_UNIX */
+
+clib_error_t *
+phash_find_perfect_hash (phash_main_t * pm)
+{
+  /* Slots a ^ tab[b] cover all of 0..s_max-1. */
+  if ((pm->flags & PHASH_FLAG_HASH_AND_DISPLACE)
+      && (pm->flags & PHASH_FLAG_MINIMAL))
+    return clib_error_return (0, "hash and displace cannot build minimal hash");
+
+#ifdef CLIB_UNIX
+  if (pm->n_cpus > 1)
+    return find_perfect_hash_parallel (pm);
+#endif
+  return find_perfect_hash (pm);
+}
+
 /* Slow hash computation for general keys. */
 uword phash_hash_slow (phash_main_t * pm, uword key)
 {
@@ -867,7 +1263,7 @@ uword phash_hash_slow (phash_main_t * pm, uword key)
 
       hash_mix64 (x0, y0, z0);
 
-      a = z0 >> pm->a_shift;
+      a = pm->a_shift >= BITS (z0) ? 0 : z0 >> pm->a_shift;
       b = z0 & pm->b_mask;
     }
   else
@@ -887,7 +1283,7 @@ uword phash_hash_slow (phash_main_t * pm, uword key)
 
       hash_mix32 (x0, y0, z0);
 
-      a = z0 >> pm->a_shift;
+      a = pm->a_shift >= BITS (z0) ? 0 : z0 >> pm->a_shift;
       b = z0 & pm->b_mask;
     }
 
@@ -928,3 +1324,459 @@ phash_validate (phash_main_t * pm)
   clib_bitmap_free (unique_bitmap);
   return error;
 }
+
+/* Lays out image header for given hash.  Everything 64 bit aligned. */
+static void phash_image_layout (phash_main_t * pm, uword value_bytes,
+				phash_image_t * im)
+{
+  u64 o;
+
+  memset (im, 0, sizeof (im[0]));
+
+  im->magic = PHASH_IMAGE_MAGIC;
+  im->flags = pm->flags;
+  im->a_bits = pm->a_bits;
+  im->b_bits = pm->b_bits;
+  im->s_bits = pm->s_bits;
+  im->a_shift = pm->a_shift;
+  im->b_mask = pm->b_mask;
+  im->hash_seed = pm->hash_seed;
+  im->hash_max = pm->hash_max;
+  im->n_keys = vec_len (pm->keys);
+  im->n_scramble = (pm->flags & PHASH_FLAG_USE_SCRAMBLE) ? vec_len (pm->scramble) : 0;
+  im->value_bytes = value_bytes;
+
+  o = round_pow2 (sizeof (im[0]), sizeof (u64));
+#define _(f,n) im->f = o; o = round_pow2 (o + (n), sizeof (u64));
+  _ (tab_offset, vec_bytes (pm->tab));
+  _ (scramble_offset, (u64) im->n_scramble * sizeof (u32));
+  _ (keys_offset, (u64) im->hash_max * sizeof (u64));
+  _ (slot_bitmap_offset, (u64) round_pow2 (im->hash_max, 64) / 8);
+  _ (values_offset, (u64) im->hash_max * value_bytes);
+#undef _
+
+  im->n_bytes = o;
+}
+
+/* Fills in zeroed image memory given layout header. */
+static void phash_image_fill (phash_main_t * pm, void * values,
+			      phash_image_t * layout, phash_image_t * im)
+{
+  phash_key_t * k;
+  u64 * keys, * used;
+
+  im[0] = layout[0];
+
+  memcpy (phash_image_data (im, im->tab_offset), pm->tab, vec_bytes (pm->tab));
+  if (im->n_scramble > 0)
+    memcpy (phash_image_data (im, im->scramble_offset), pm->scramble,
+	    im->n_scramble * sizeof (u32));
+
+  /* Keys and values go in their hash slot. */
+  keys = phash_image_data (im, im->keys_offset);
+  used = phash_image_data (im, im->slot_bitmap_offset);
+  vec_foreach (k, pm->keys)
+    {
+      uword h = phash_hash_slow (pm, k->key);
+
+      ASSERT (h < pm->hash_max);
+      keys[h] = k->key;
+      used[h / 64] |= (u64) 1 << (h % 64);
+      if (values)
+	memcpy (phash_image_value (im, h),
+		(u8 *) values + (k - pm->keys) * im->value_bytes,
+		im->value_bytes);
+    }
+}
+
+u8 * phash_image_create (phash_main_t * pm, void * values, uword value_bytes)
+{
+  phash_image_t layout;
+  u8 * result = 0;
+
+  /* Image keys are compared as is: no images of indirect keys. */
+  if (pm->key_seed1)
+    return 0;
+
+  phash_image_layout (pm, value_bytes, &layout);
+  vec_validate_aligned (result, layout.n_bytes - 1, CLIB_CACHE_LINE_BYTES);
+  phash_image_fill (pm, values, &layout, (phash_image_t *) result);
+
+  return result;
+}
+
+/* Checks that N_ELTS of ELT_BYTES each at OFFSET fit in N_BYTES
+   without overflow. */
+static uword
+phash_image_range_is_valid (u64 offset, u64 n_elts, u64 elt_bytes, u64 n_bytes)
+{
+  if (offset > n_bytes)
+    return 0;
+  return elt_bytes == 0 || n_elts <= (n_bytes - offset) / elt_bytes;
+}
+
+clib_error_t * phash_image_validate (phash_image_t * im, uword n_bytes)
+{
+  u32 * tab;
+  u64 i, n_tab;
+
+  if (n_bytes < sizeof (im[0]))
+    return clib_error_return (0, "image too short");
+
+  if (im->magic != PHASH_IMAGE_MAGIC)
+    return clib_error_return (0, "bad magic 0x%x", im->magic);
+
+  if (im->n_bytes != n_bytes)
+    return clib_error_return (0, "size %Ld does not match image size %wd",
+			      im->n_bytes, n_bytes);
+
+  if (im->b_bits >= 32)
+    return clib_error_return (0, "corrupt image: b_bits %d", im->b_bits);
+
+  n_tab = (u64) 1 << im->b_bits;
+  if (im->b_mask != n_tab - 1
+      || ! phash_image_range_is_valid (im->tab_offset, n_tab, sizeof (u32), n_bytes)
+      || ! phash_image_range_is_valid (im->scramble_offset, im->n_scramble, sizeof (u32), n_bytes)
+      || ((im->flags & PHASH_FLAG_USE_SCRAMBLE) && im->n_scramble == 0)
+      || ! phash_image_range_is_valid (im->keys_offset, im->hash_max, sizeof (u64), n_bytes)
+      || ! phash_image_range_is_valid (im->slot_bitmap_offset, round_pow2_u64 (im->hash_max, 64) / 8, 1, n_bytes)
+      || ! phash_image_range_is_valid (im->values_offset, im->hash_max, im->value_bytes, n_bytes))
+    return clib_error_return (0, "corrupt image");
+
+  /* Lookups index scramble with tab values. */
+  if (im->flags & PHASH_FLAG_USE_SCRAMBLE)
+    {
+      tab = phash_image_data (im, im->tab_offset);
+      for (i = 0; i < n_tab; i++)
+	if (tab[i] >= im->n_scramble)
+	  return clib_error_return (0, "corrupt image: tab[%Ld] %d >= %d scramble entries",
+				    i, tab[i], im->n_scramble);
+    }
+
+  return 0;
+}
+
+/* Lookup parameters common to phash_main_t and images. */
+typedef struct {
+  u64 hash_seed;
+  u32 flags, a_shift, b_mask;
+  u32 * tab, * scramble;
+} phash_lookup_t;
+
+/* A and B halves of phash_hash_slow for 4 direct keys.  Jenkins
+   mixing is done 4 keys at a time for 32 bit hashes and 2 x 2 at a
+   time for 64 bit. */
+always_inline void
+phash_mix_x4 (phash_lookup_t * l, u64 * keys, u32 * a, u32 * b)
+{
+  u32 i;
+
+#if CLIB_VECTOR_WORD_BITS >= 128
+  if (l->flags & PHASH_FLAG_MIX64)
+    {
+      u64x2_union_t z[2];
+      u64x2 x0, y0, z0, x1, y1, z1, mask;
+
+      x0 = y0 = z0 = u64x2_splat (l->hash_seed);
+      x1 = y1 = z1 = x0;
+
+      z[0].as_i64[0] = keys[0];
+      z[0].as_i64[1] = keys[1];
+      z[1].as_i64[0] = keys[2];
+      z[1].as_i64[1] = keys[3];
+      x0 += z[0].as_u64x2;
+      x1 += z[1].as_u64x2;
+
+      hash_mix64 (x0, y0, z0);
+      hash_mix64 (x1, y1, z1);
+
+      mask = u64x2_splat (l->b_mask);
+      z[0].as_u64x2 = z0 & mask;
+      z[1].as_u64x2 = z1 & mask;
+      for (i = 0; i < 4; i++)
+	b[i] = z[i / 2].as_i64[i % 2];
+
+      z[0].as_u64x2 = z0 >> l->a_shift;
+      z[1].as_u64x2 = z1 >> l->a_shift;
+      for (i = 0; i < 4; i++)
+	a[i] = z[i / 2].as_i64[i % 2];
+    }
+  else
+    {
+      u32x4_union_t z;
+      u32x4 x0, y0, z0;
+
+      x0 = y0 = z0 = u32x4_splat (l->hash_seed);
+
+      for (i = 0; i < 4; i++)
+	z.as_u32[i] = keys[i];
+      x0 += z.as_u32x4;
+
+      hash_mix32 (x0, y0, z0);
+
+      z.as_u32x4 = z0 & u32x4_splat (l->b_mask);
+      for (i = 0; i < 4; i++)
+	b[i] = z.as_u32[i];
+
+      z.as_u32x4 = z0 >> l->a_shift;
+      for (i = 0; i < 4; i++)
+	a[i] = z.as_u32[i];
+    }
+#else /* CLIB_VECTOR_WORD_BITS >= 128 */
+  for (i = 0; i < 4; i++)
+    {
+      if (l->flags & PHASH_FLAG_MIX64)
+	{
+	  u64 x0, y0, z0;
+	  x0 = y0 = z0 = l->hash_seed;
+	  x0 += keys[i];
+	  hash_mix64 (x0, y0, z0);
+	  a[i] = z0 >> l->a_shift;
+	  b[i] = z0 & l->b_mask;
+	}
+      else
+	{
+	  u32 x0, y0, z0;
+	  x0 = y0 = z0 = l->hash_seed;
+	  x0 += keys[i];
+	  hash_mix32 (x0, y0, z0);
+	  a[i] = z0 >> l->a_shift;
+	  b[i] = z0 & l->b_mask;
+	}
+    }
+#endif /* CLIB_VECTOR_WORD_BITS >= 128 */
+}
+
+/* Keys hashed per chunk: all tab (then scramble) lines of a chunk are
+   prefetched before any is loaded so misses overlap. */
+#define PHASH_LOOKUP_CHUNK 64
+
+/* Hashes keys 4 at a time; left over keys and tables with a_bits
+   of zero (shift by full word) go one at a time. */
+static void
+phash_lookup_multiple (phash_lookup_t * l, u64 * keys, u32 * hashes, uword n_keys,
+		       uword (* hash1) (void * arg, u64 key), void * hash1_arg)
+{
+  u32 a[PHASH_LOOKUP_CHUNK], b[PHASH_LOOKUP_CHUNK];
+  uword i = 0, j, n;
+
+  if (l->a_shift < ((l->flags & PHASH_FLAG_MIX64) ? 64 : 32))
+    for (; i + 4 <= n_keys; i += n)
+      {
+	n = clib_min (n_keys - i, PHASH_LOOKUP_CHUNK) &~ 3;
+
+	for (j = 0; j < n; j += 4)
+	  phash_mix_x4 (l, keys + i + j, a + j, b + j);
+	for (j = 0; j < n; j++)
+	  CLIB_PREFETCH (l->tab + b[j], sizeof (l->tab[0]), READ);
+
+	if (l->flags & PHASH_FLAG_USE_SCRAMBLE)
+	  {
+	    for (j = 0; j < n; j++)
+	      {
+		b[j] = l->tab[b[j]];
+		CLIB_PREFETCH (l->scramble + b[j], sizeof (l->scramble[0]), READ);
+	      }
+	    for (j = 0; j < n; j++)
+	      hashes[i + j] = a[j] ^ l->scramble[b[j]];
+	  }
+	else
+	  for (j = 0; j < n; j++)
+	    hashes[i + j] = a[j] ^ l->tab[b[j]];
+      }
+
+  for (; i < n_keys; i++)
+    hashes[i] = hash1 (hash1_arg, keys[i]);
+}
+
+static uword phash_hash1 (void * arg, u64 key)
+{ return phash_hash_slow (arg, key); }
+
+clib_error_t *
+phash_hash_multiple (phash_main_t * pm, u64 * keys, u32 * hashes, uword n_keys)
+{
+  phash_lookup_t l;
+
+  if (pm->key_seed1)
+    return clib_error_return (0, "batch hash needs direct keys (no key_seed1)");
+
+  l.hash_seed = pm->hash_seed;
+  l.flags = pm->flags;
+  l.a_shift = pm->a_shift;
+  l.b_mask = pm->b_mask;
+  l.tab = pm->tab;
+  l.scramble = pm->scramble;
+
+  phash_lookup_multiple (&l, keys, hashes, n_keys, phash_hash1, pm);
+  return 0;
+}
+
+static uword phash_image_hash1 (void * arg, u64 key)
+{ return phash_image_hash (arg, key); }
+
+void phash_image_get_multiple (phash_image_t * im, u64 * keys, u32 * slots, uword n_keys)
+{
+  phash_lookup_t l;
+  u64 * im_keys, * used;
+  uword i, h;
+
+  l.hash_seed = im->hash_seed;
+  l.flags = im->flags;
+  l.a_shift = im->a_shift;
+  l.b_mask = im->b_mask;
+  l.tab = phash_image_data (im, im->tab_offset);
+  l.scramble = phash_image_data (im, im->scramble_offset);
+
+  phash_lookup_multiple (&l, keys, slots, n_keys, phash_image_hash1, im);
+
+  im_keys = phash_image_data (im, im->keys_offset);
+  used = phash_image_data (im, im->slot_bitmap_offset);
+
+  /* Prefetch all slots before looking at any. */
+  for (i = 0; i < n_keys; i++)
+    {
+      h = slots[i];
+      if (h < im->hash_max)
+	{
+	  CLIB_PREFETCH (im_keys + h, sizeof (im_keys[0]), READ);
+	  if (im->value_bytes > 0)
+	    CLIB_PREFETCH (phash_image_value (im, h),
+			   clib_min (im->value_bytes, CLIB_CACHE_LINE_BYTES), READ);
+	}
+    }
+
+  for (i = 0; i < n_keys; i++)
+    {
+      h = slots[i];
+      if (h >= im->hash_max
+	  || ! ((used[h / 64] >> (h % 64)) & 1)
+	  || im_keys[h] != keys[i])
+	slots[i] = ~0;
+    }
+}
+
+#ifdef CLIB_UNIX
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+/* Image is built in mapped file so large tables need no heap.  Image
+   is written to FILE_NAME.tmp and renamed over FILE_NAME so readers
+   which have old image mapped never see it change. */
+clib_error_t * phash_image_write (phash_main_t * pm, void * values, uword value_bytes,
+				  char * file_name)
+{
+  clib_error_t * error = 0;
+  phash_image_t layout;
+  void * data = 0;
+  u8 * tmp_name;
+  int fd;
+
+  if (pm->key_seed1)
+    return clib_error_return (0, "`%s': no image for tables with key_seed1", file_name);
+
+  phash_image_layout (pm, value_bytes, &layout);
+
+  tmp_name = format (0, "%s.tmp%c", file_name, 0);
+  fd = open ((char *) tmp_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+      error = clib_error_return_unix (0, "open `%s'", tmp_name);
+      vec_free (tmp_name);
+      return error;
+    }
+
+  if (ftruncate (fd, layout.n_bytes) < 0)
+    {
+      error = clib_error_return_unix (0, "ftruncate `%s'", tmp_name);
+      goto done;
+    }
+
+  data = mmap (0, layout.n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, /* offset */ 0);
+  if (data == MAP_FAILED)
+    {
+      data = 0;
+      error = clib_error_return_unix (0, "mmap `%s'", tmp_name);
+      goto done;
+    }
+
+  phash_image_fill (pm, values, &layout, data);
+
+  if (msync (data, layout.n_bytes, MS_SYNC) < 0)
+    {
+      error = clib_error_return_unix (0, "msync `%s'", tmp_name);
+      goto done;
+    }
+
+  if (fsync (fd) < 0)
+    {
+      error = clib_error_return_unix (0, "fsync `%s'", tmp_name);
+      goto done;
+    }
+
+  if (rename ((char *) tmp_name, file_name) < 0)
+    error = clib_error_return_unix (0, "rename `%s' to `%s'", tmp_name, file_name);
+
+ done:
+  if (data)
+    munmap (data, layout.n_bytes);
+  close (fd);
+  if (error)
+    unlink ((char *) tmp_name);
+  vec_free (tmp_name);
+  return error;
+}
+
+clib_error_t * phash_image_map (char * file_name, phash_image_t ** result)
+{
+  clib_error_t * error = 0;
+  struct stat fd_stat;
+  void * data = 0;
+  uword n_bytes = 0;
+  int fd;
+
+  *result = 0;
+
+  fd = open (file_name, O_RDONLY);
+  if (fd < 0)
+    return clib_error_return_unix (0, "open `%s'", file_name);
+
+  if (fstat (fd, &fd_stat) < 0)
+    {
+      error = clib_error_return_unix (0, "fstat `%s'", file_name);
+      goto done;
+    }
+  n_bytes = fd_stat.st_size;
+
+  data = mmap (0, n_bytes, PROT_READ, MAP_SHARED, fd, /* offset */ 0);
+  if (data == MAP_FAILED)
+    {
+      data = 0;
+      error = clib_error_return_unix (0, "mmap `%s'", file_name);
+      goto done;
+    }
+
+  error = phash_image_validate (data, n_bytes);
+  if (error)
+    {
+      error = clib_error_return (error, "`%s'", file_name);
+      munmap (data, n_bytes);
+      goto done;
+    }
+
+  *result = data;
+
+ done:
+  close (fd);
+  return error;
+}
+
+void phash_image_unmap (phash_image_t * im)
+{
+  if (im)
+    munmap (im, im->n_bytes);
+}
+
+#endif /* CLIB_UNIX */
@@ -95,6 +95,13 @@ typedef struct {
 #define PHASH_FLAG_NON_MINIMAL		(0 << 3)
 #define PHASH_FLAG_MINIMAL		(1 << 3)
 
+  /* Build table by hash and displace (as in CHD or PTHash) instead of
+     augmenting paths: largest B first, each B gets first value whose
+     keys all land in unused hashes.  Expected linear time; tab has one
+     entry per 2 keys.  Lookup is unchanged.  Never minimal: combining
+     with PHASH_FLAG_MINIMAL is an error. */
+#define PHASH_FLAG_HASH_AND_DISPLACE	(1 << 4)
+
   /* vec_len (keys) for minimal hash;
      1 << s_bits for non-minimal hash. */
   u32 hash_max;
@@ -117,12 +124,22 @@ typedef struct {
   /* Stuff used to compute perfect hash. */
   u32 random_seed;
 
+  /* Number of processes searching for hash seeds in parallel
+     (Unix only).  0 or 1 searches in calling process only. */
+  u32 n_cpus;
+
   /* Stuff indexed by B. */
   phash_tabb_t * tabb;
 
   /* Table of B ordered by number of keys in tabb[b]. */
   u32 * tabb_sort;
 
+  /* Hash and displace keeps keys of all B in one vector ordered by B:
+     keys of b are b_keys[b_key_offsets[b] .. b_key_offsets[b+1]-1].
+     Avoids one small vector per B. */
+  u32 * b_keys;
+  u32 * b_key_offsets;
+
   /* Unique key (or ~0 if none) for a given hash
      H = A ^ scramble[tab[B].val_b]. */
   u32 * tabh;
@@ -132,6 +149,9 @@ typedef struct {
 
   /* Stats. */
   u32 n_seed_trials, n_perfect_calls;
+
+  /* Values of tab[b] tried by hash and displace. */
+  u64 n_displace_trials;
 } phash_main_t;
 
 always_inline void
@@ -141,6 +161,8 @@ phash_main_free_working_memory (phash_main_t * pm)
   vec_free (pm->tabq);
   vec_free (pm->tabh);
   vec_free (pm->tabb_sort);
+  vec_free (pm->b_keys);
+  vec_free (pm->b_key_offsets);
   if (! (pm->flags & PHASH_FLAG_USE_SCRAMBLE))
     vec_free (pm->scramble);
 }
@@ -163,6 +185,138 @@ clib_error_t * phash_find_perfect_hash (phash_main_t * pm);
 /* Validates that hash is indeed perfect. */
 clib_error_t * phash_validate (phash_main_t * pm);
 
+/* Hashes N_KEYS direct keys at once using vector Jenkins mixing;
+   same result as phash_hash_slow for each key.  Tab and scramble
+   entries of up to 64 keys are prefetched before any is loaded.
+   Returns error for tables with key_seed1 (indirect keys). */
+clib_error_t *
+phash_hash_multiple (phash_main_t * pm, u64 * keys, u32 * hashes, uword n_keys);
+
+/* Flat image of a finished perfect hash with its keys and values.
+   All references are byte offsets from start of image so an image
+   file can be mmap'ed and used for lookups as is.  Native byte order. */
+typedef struct {
+  /* PHASH_IMAGE_MAGIC; also catches byte order mismatch. */
+  u32 magic;
+
+  /* Copy of phash_main_t flags. */
+  u32 flags;
+
+  u8 a_bits, b_bits, s_bits, a_shift;
+  u32 b_mask;
+
+  u64 hash_seed;
+
+  /* Hash values are in 0 .. hash_max - 1; one slot for each. */
+  u32 hash_max;
+
+  u32 n_keys;
+
+  u32 n_scramble;
+
+  /* Bytes of user data for each slot. */
+  u32 value_bytes;
+
+  /* Size of whole image. */
+  u64 n_bytes;
+
+  /* u32 tab[1 << b_bits], u32 scramble[n_scramble],
+     u64 keys[hash_max], u64 bitmap of used slots and
+     u8 values[hash_max * value_bytes]. */
+  u64 tab_offset;
+  u64 scramble_offset;
+  u64 keys_offset;
+  u64 slot_bitmap_offset;
+  u64 values_offset;
+} phash_image_t;
+
+#define PHASH_IMAGE_MAGIC 0x70686931	/* "phi1" */
+
+always_inline void *
+phash_image_data (phash_image_t * im, u64 offset)
+{ return (u8 *) im + offset; }
+
+/* Same as phash_hash_slow (images never have key_seed1 callback). */
+always_inline uword
+phash_image_hash (phash_image_t * im, u64 key)
+{
+  u32 a, b, v, * tab, * scramble;
+
+  if (im->flags & PHASH_FLAG_MIX64)
+    {
+      u64 x0, y0, z0;
+
+      x0 = y0 = z0 = im->hash_seed;
+      x0 += key;
+
+      hash_mix64 (x0, y0, z0);
+
+      a = im->a_shift >= BITS (z0) ? 0 : z0 >> im->a_shift;
+      b = z0 & im->b_mask;
+    }
+  else
+    {
+      u32 x0, y0, z0;
+
+      x0 = y0 = z0 = im->hash_seed;
+      x0 += key;
+
+      hash_mix32 (x0, y0, z0);
+
+      a = im->a_shift >= BITS (z0) ? 0 : z0 >> im->a_shift;
+      b = z0 & im->b_mask;
+    }
+
+  tab = phash_image_data (im, im->tab_offset);
+  v = tab[b];
+  if (im->flags & PHASH_FLAG_USE_SCRAMBLE)
+    {
+      scramble = phash_image_data (im, im->scramble_offset);
+      v = scramble[v];
+    }
+  return a ^ v;
+}
+
+/* Slot holding given key or ~0 if key is not in table. */
+always_inline uword
+phash_image_get (phash_image_t * im, u64 key)
+{
+  uword h = phash_image_hash (im, key);
+  u64 * keys = phash_image_data (im, im->keys_offset);
+  u64 * used = phash_image_data (im, im->slot_bitmap_offset);
+
+  if (h >= im->hash_max
+      || ! ((used[h / 64] >> (h % 64)) & 1)
+      || keys[h] != key)
+    return ~0;
+  return h;
+}
+
+always_inline void *
+phash_image_value (phash_image_t * im, uword slot)
+{ return phash_image_data (im, im->values_offset + (u64) slot * im->value_bytes); }
+
+/* Batch version of phash_image_get: slots of N_KEYS keys (~0 for keys
+   not in table).  Hashes as phash_hash_multiple, then prefetches all
+   key and value slots before any are compared so misses overlap. */
+void phash_image_get_multiple (phash_image_t * im, u64 * keys, u32 * slots, uword n_keys);
+
+/* Builds image vector from finished hash.  VALUES has VALUE_BYTES
+   of user data for each key in the order of pm->keys (may be 0).
+   Lookups compare image keys directly, so tables with key_seed1
+   (indirect keys) have no image: returns 0 for them. */
+u8 * phash_image_create (phash_main_t * pm, void * values, uword value_bytes);
+
+/* Checks header and table of image of given size. */
+clib_error_t * phash_image_validate (phash_image_t * im, uword n_bytes);
+
+/* Writes image to file (atomically replacing any old file) and maps
+   image file read only. */
+clib_error_t * phash_image_write (phash_main_t * pm, void * values, uword value_bytes,
+				  char * file_name);
+clib_error_t * phash_image_map (char * file_name, phash_image_t ** result);
+void phash_image_unmap (phash_image_t * im);
+
 /* Unit test. */
 int phash_test_main (unformat_input_t * input);
 
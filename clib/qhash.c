@@ -21,17 +21,23 @@
   WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include <clib/bitops.h>
 #include <clib/qhash.h>
 
-#define QHASH_ALL_VALID ((1 << QHASH_KEYS_PER_BUCKET) - 1)
-
 void *
-_qhash_resize (void * v, uword length, uword elt_bytes)
+_qhash_resize_keys_per_bucket (void * v, uword length, uword elt_bytes,
+			       uword keys_per_bucket)
 {
   qhash_t * h;
-  uword l;
+  uword l, lk;
+
+  lk = max_log2 (keys_per_bucket);
+  ASSERT (lk >= QHASH_LOG2_KEYS_PER_BUCKET
+	  && lk <= QHASH_MAX_LOG2_KEYS_PER_BUCKET);
+  lk = clib_max (lk, QHASH_LOG2_KEYS_PER_BUCKET);
+  lk = clib_min (lk, QHASH_MAX_LOG2_KEYS_PER_BUCKET);
 
-  l = clib_max (max_log2 (length), 2 + QHASH_LOG2_KEYS_PER_BUCKET);
+  l = clib_max (max_log2 (length), 2 + lk);
 
   /* Round up if less than 1/2 full. */
   l += ((f64) length / (f64) (1 << l)) < .5;
@@ -44,330 +50,20 @@ _qhash_resize (void * v, uword length, uword elt_bytes)
   h = qhash_header (v);
   h->n_elts = 0;
   h->log2_hash_size = l;
+  h->log2_keys_per_bucket = lk;
   h->hash_keys = clib_mem_alloc_aligned_no_fail (sizeof (h->hash_keys[0]) << l,
 						 CLIB_CACHE_LINE_BYTES);
-  vec_resize (h->hash_key_valid_bitmap,
-	      1 << (l - QHASH_LOG2_KEYS_PER_BUCKET));
+  vec_resize (h->hash_key_valid_bitmap, 1 << (l - lk));
   memset (v, ~0, elt_bytes << l);
 
   return v;
 }
 
-static u8 min_log2_table[256];
-
-static inline uword
-qhash_min_log2 (uword x)
-{
-  ASSERT (is_pow2 (x));
-  ASSERT (x < 256);
-  return min_log2_table[x];
-}
-
-static void qhash_min_log2_init ()
-{
-  int i;
-  for (i = 0; i < 256; i++)
-    min_log2_table[i] = min_log2 (i);
-}
-
-always_inline uword
-qhash_get_valid_elt_mask (qhash_t * h, uword i)
-{ return h->hash_key_valid_bitmap[i / QHASH_KEYS_PER_BUCKET]; }
-
-always_inline void
-qhash_set_valid_elt_mask (qhash_t * h, uword i, uword mask)
-{ h->hash_key_valid_bitmap[i / QHASH_KEYS_PER_BUCKET] = mask; }
-
-always_inline uword
-qhash_search_bucket (uword * hash_keys, uword search_key,
-		     uword m)
-{
-  uword t;
-#define _(i) ((hash_keys[i] == search_key) << i)
-  t = (_ (0) | _ (1) | _ (2) | _ (3));
-  if (QHASH_KEYS_PER_BUCKET > 4)
-    t |= (_ (4) | _ (5) | _ (6) | _ (7));
-  if (QHASH_KEYS_PER_BUCKET > 8)
-    t |= (_ (8) | _ (9) | _ (10) | _ (11)
-	  | _ (12) | _ (13) | _ (14) | _ (15));
-#undef _
-  return m & t;
-}
-
-/* Lookup multiple keys in the same hash table. */
-void
-qhash_get_multiple (void * v,
-		    uword * search_keys,
-		    uword n_search_keys,
-		    u32 * result_indices)
-{
-  qhash_t * h = qhash_header (v);
-  uword * k, * hash_keys;
-  uword n_left, bucket_mask;
-  u32 * r;
-
-  if (! v)
-    {
-      memset (result_indices, ~0, sizeof (result_indices[0]) * n_search_keys);
-      return;
-    }
-
-  bucket_mask = pow2_mask (h->log2_hash_size) &~ (QHASH_KEYS_PER_BUCKET - 1);
-
-  k = search_keys;
-  n_left = n_search_keys;
-  hash_keys = h->hash_keys;
-  r = result_indices;
-
-  while (n_left >= 2)
-    {
-      u32 a0, b0, c0, bi0, valid0, match0;
-      u32 a1, b1, c1, bi1, valid1, match1;
-      uword k0, k1, * h0, * h1;
-
-      k0 = k[0];
-      k1 = k[1];
-      n_left -= 2;
-      k += 2;
-
-      a0 = a1 = h->hash_seeds[0];
-      b0 = b1 = h->hash_seeds[1];
-      c0 = c1 = h->hash_seeds[2];
-      a0 ^= k0;
-      a1 ^= k1;
-#if uword_bits == 64
-      b0 ^= k0 >> 32;
-      b1 ^= k1 >> 32;
-#endif
-      
-      hash_mix32_step_1 (a0, b0, c0);
-      hash_mix32_step_1 (a1, b1, c1);
-      hash_mix32_step_2 (a0, b0, c0);
-      hash_mix32_step_2 (a1, b1, c1);
-      hash_mix32_step_3 (a0, b0, c0);
-      hash_mix32_step_3 (a1, b1, c1);
-
-      bi0 = c0 & bucket_mask;
-      bi1 = c1 & bucket_mask;
-
-      h0 = hash_keys + bi0;
-      h1 = hash_keys + bi1;
-
-      /* Search two buckets. */
-      valid0 = qhash_get_valid_elt_mask (h, bi0);
-      valid1 = qhash_get_valid_elt_mask (h, bi1);
-
-      match0 = qhash_search_bucket (h0, k0, valid0);
-      match1 = qhash_search_bucket (h1, k1, valid1);
-
-      bi0 += qhash_min_log2 (match0);
-      bi1 += qhash_min_log2 (match1);
-
-      r[0] = match0 ? bi0 : ~0;
-      r[1] = match1 ? bi1 : ~0;
-      r += 2;
-
-      /* Full buckets trigger search of overflow hash. */
-      if (PREDICT_FALSE (! match0 && valid0 == QHASH_ALL_VALID))
-	{
-	  uword * p = hash_get (h->overflow_hash, k0);
-	  r[-2] = p ? p[0] : ~0;
-	}
-
-      /* Full buckets trigger search of overflow hash. */
-      if (PREDICT_FALSE (! match1 && valid1 == QHASH_ALL_VALID))
-	{
-	  uword * p = hash_get (h->overflow_hash, k1);
-	  r[-1] = p ? p[0] : ~0;
-	}
-    }
-
-  while (n_left >= 1)
-    {
-      u32 a0, b0, c0, bi0, valid0, match0;
-      uword k0, * h0;
-
-      k0 = k[0];
-      n_left -= 1;
-      k += 1;
-
-      a0 = h->hash_seeds[0];
-      b0 = h->hash_seeds[1];
-      c0 = h->hash_seeds[2];
-      a0 ^= k0;
-#if uword_bits == 64
-      b0 ^= k0 >> 32;
-#endif
-
-      hash_mix32 (a0, b0, c0);
-
-      bi0 = c0 & bucket_mask;
-
-      h0 = hash_keys + bi0;
-
-      /* Search one bucket. */
-      valid0 = qhash_get_valid_elt_mask (h, bi0);
-      match0 = qhash_search_bucket (h0, k0, valid0);
-
-      bi0 += qhash_min_log2 (match0);
-
-      r[0] = match0 ? bi0 : ~0;
-      r += 1;
-
-      /* Full buckets trigger search of overflow hash. */
-      if (PREDICT_FALSE (! match0 && valid0 == QHASH_ALL_VALID))
-	{
-	  uword * p = hash_get (h->overflow_hash, k0);
-	  r[-1] = p ? p[0] : ~0;
-	}
-    }
-}
-
-/* Lookup multiple keys in the same hash table.
-   Returns index of first matching key. */
-u32
-qhash_get_first_match (void * v,
-		       uword * search_keys,
-		       uword n_search_keys,
-		       uword * matching_key)
+void *
+_qhash_resize (void * v, uword length, uword elt_bytes)
 {
-  qhash_t * h = qhash_header (v);
-  uword * k, * hash_keys;
-  uword n_left, match_mask, bucket_mask;
-
-  if (! v)
-    return ~0;
-
-  match_mask = 0;
-  bucket_mask = pow2_mask (h->log2_hash_size) &~ (QHASH_KEYS_PER_BUCKET - 1);
-
-  k = search_keys;
-  n_left = n_search_keys;
-  hash_keys = h->hash_keys;
-  while (n_left >= 2)
-    {
-      u32 a0, b0, c0, bi0, valid0;
-      u32 a1, b1, c1, bi1, valid1;
-      uword k0, k1, * h0, * h1;
-
-      k0 = k[0];
-      k1 = k[1];
-      n_left -= 2;
-      k += 2;
-
-      a0 = a1 = h->hash_seeds[0];
-      b0 = b1 = h->hash_seeds[1];
-      c0 = c1 = h->hash_seeds[2];
-      a0 ^= k0;
-      a1 ^= k1;
-#if uword_bits == 64
-      b0 ^= k0 >> 32;
-      b1 ^= k1 >> 32;
-#endif
-      
-      hash_mix32_step_1 (a0, b0, c0);
-      hash_mix32_step_1 (a1, b1, c1);
-      hash_mix32_step_2 (a0, b0, c0);
-      hash_mix32_step_2 (a1, b1, c1);
-      hash_mix32_step_3 (a0, b0, c0);
-      hash_mix32_step_3 (a1, b1, c1);
-
-      bi0 = c0 & bucket_mask;
-      bi1 = c1 & bucket_mask;
-
-      h0 = hash_keys + bi0;
-      h1 = hash_keys + bi1;
-
-      /* Search two buckets. */
-      valid0 = qhash_get_valid_elt_mask (h, bi0);
-      valid1 = qhash_get_valid_elt_mask (h, bi1);
-      match_mask = qhash_search_bucket (h0, k0, valid0);
-      match_mask |= (qhash_search_bucket (h1, k1, valid1)
-		     << QHASH_KEYS_PER_BUCKET);
-      if (match_mask)
-	{
-	  uword bi, is_match1;
-
-	  bi = qhash_min_log2 (match_mask);
-	  is_match1 = bi >= QHASH_KEYS_PER_BUCKET;
-
-	  bi += ((is_match1 ? bi1 : bi0)
-		 - (is_match1 << QHASH_LOG2_KEYS_PER_BUCKET));
-	  *matching_key = (k - 2 - search_keys) + is_match1;
-	  return bi;
-	}
-
-      /* Full buckets trigger search of overflow hash. */
-      if (PREDICT_FALSE (valid0 == QHASH_ALL_VALID
-			 || valid1 == QHASH_ALL_VALID))
-	{
-	  uword * p = 0;
-	  uword ki = k - 2 - search_keys;
-
-	  if (valid0 == QHASH_ALL_VALID)
-	    p = hash_get (h->overflow_hash, k0);
-
-	  if (! p && valid1 == QHASH_ALL_VALID)
-	    {
-	      p = hash_get (h->overflow_hash, k1);
-	      ki++;
-	    }
-
-	  if (p)
-	    {
-	      *matching_key = ki;
-	      return p[0];
-	    }
-	}
-    }
-
-  while (n_left >= 1)
-    {
-      u32 a0, b0, c0, bi0, valid0;
-      uword k0, * h0;
-
-      k0 = k[0];
-      n_left -= 1;
-      k += 1;
-
-      a0 = h->hash_seeds[0];
-      b0 = h->hash_seeds[1];
-      c0 = h->hash_seeds[2];
-      a0 ^= k0;
-#if uword_bits == 64
-      b0 ^= k0 >> 32;
-#endif
-
-      hash_mix32 (a0, b0, c0);
-
-      bi0 = c0 & bucket_mask;
-
-      h0 = hash_keys + bi0;
-
-      /* Search one bucket. */
-      valid0 = qhash_get_valid_elt_mask (h, bi0);
-      match_mask = qhash_search_bucket (h0, k0, valid0);
-      if (match_mask)
-	{
-	  uword bi;
-	  bi = bi0 + qhash_min_log2 (match_mask);
-	  *matching_key = (k - 1 - search_keys);
-	  return bi;
-	}
-
-      /* Full buckets trigger search of overflow hash. */
-      if (PREDICT_FALSE (valid0 == QHASH_ALL_VALID))
-	{
-	  uword * p = hash_get (h->overflow_hash, k0);
-	  if (p)
-	    {
-	      *matching_key = (k - 1 - search_keys);
-	      return p[0];
-	    }
-	}
-    }
-
-  return ~0;
+  uword k = v ? qhash_keys_per_bucket (qhash_header (v)) : QHASH_KEYS_PER_BUCKET;
+  return _qhash_resize_keys_per_bucket (v, length, elt_bytes, k);
 }
 
 static void *
@@ -380,7 +76,7 @@ qhash_set_overflow (void * v, uword elt_bytes,
   uword * p = hash_get (h->overflow_hash, key);
   uword i;
 
-  bi /= QHASH_KEYS_PER_BUCKET;
+  bi >>= h->log2_keys_per_bucket;
 
   if (p)
     i = p[0];
@@ -423,7 +119,7 @@ qhash_unset_overflow (void * v, uword key, uword bi, uword * n_elts)
   uword * p = hash_get (h->overflow_hash, key);
   uword result;
 
-  bi /= QHASH_KEYS_PER_BUCKET;
+  bi >>= h->log2_keys_per_bucket;
 
   if (p)
     {
@@ -442,201 +138,9 @@ qhash_unset_overflow (void * v, uword key, uword bi, uword * n_elts)
   return result;
 }
 
-always_inline uword
-qhash_find_free (uword i, uword valid_mask)
-{ return first_set (~valid_mask & pow2_mask (QHASH_KEYS_PER_BUCKET)); }
-
-void *
-_qhash_set_multiple (void * v,
-		     uword elt_bytes,
-		     uword * search_keys,
-		     uword n_search_keys,
-		     u32 * result_indices)
-{
-  qhash_t * h = qhash_header (v);
-  uword * k, * hash_keys;
-  uword n_left, n_elts, bucket_mask;
-  u32 * r;
-
-  if (vec_len (v) < n_search_keys)
-    v = _qhash_resize (v, n_search_keys, elt_bytes);
-
-  if (qhash_min_log2 (2) != 1)
-    {
-      qhash_min_log2_init ();
-      ASSERT (qhash_min_log2 (2) == 1);
-    }
-
-  ASSERT (v != 0);
-
-  bucket_mask = pow2_mask (h->log2_hash_size) &~ (QHASH_KEYS_PER_BUCKET - 1);
-
-  hash_keys = h->hash_keys;
-  k = search_keys;
-  r = result_indices;
-  n_left = n_search_keys;
-  n_elts = h->n_elts;
-
-  while (n_left >= 2)
-    {
-      u32 a0, b0, c0, bi0, match0, valid0, free0;
-      u32 a1, b1, c1, bi1, match1, valid1, free1;
-      uword k0, * h0;
-      uword k1, * h1;
-
-      k0 = k[0];
-      k1 = k[1];
-
-      /* Keys must be unique. */
-      ASSERT (k0 != k1);
-
-      n_left -= 2;
-      k += 2;
-      
-      a0 = a1 = h->hash_seeds[0];
-      b0 = b1 = h->hash_seeds[1];
-      c0 = c1 = h->hash_seeds[2];
-      a0 ^= k0;
-      a1 ^= k1;
-#if uword_bits == 64
-      b0 ^= k0 >> 32;
-      b1 ^= k1 >> 32;
-#endif
-
-      hash_mix32_step_1 (a0, b0, c0);
-      hash_mix32_step_1 (a1, b1, c1);
-      hash_mix32_step_2 (a0, b0, c0);
-      hash_mix32_step_2 (a1, b1, c1);
-      hash_mix32_step_3 (a0, b0, c0);
-      hash_mix32_step_3 (a1, b1, c1);
-
-      bi0 = c0 & bucket_mask;
-      bi1 = c1 & bucket_mask;
-
-      h0 = hash_keys + bi0;
-      h1 = hash_keys + bi1;
-
-      /* Search two buckets. */
-      valid0 = qhash_get_valid_elt_mask (h, bi0);
-      valid1 = qhash_get_valid_elt_mask (h, bi1);
-
-      match0 = qhash_search_bucket (h0, k0, valid0);
-      match1 = qhash_search_bucket (h1, k1, valid1);
-
-      /* Find first free element starting at hash offset into bucket. */
-      free0 = qhash_find_free (c0 & (QHASH_KEYS_PER_BUCKET - 1), valid0);
-
-      valid1 = valid1 | (bi0 == bi1 ? free0 : 0);
-      free1 = qhash_find_free (c1 & (QHASH_KEYS_PER_BUCKET - 1), valid1);
-
-      n_elts += (match0 == 0) + (match1 == 0);
-
-      match0 = match0 ? match0 : free0;
-      match1 = match1 ? match1 : free1;
-
-      valid0 |= match0;
-      valid1 |= match1;
-
-      h0 += qhash_min_log2 (match0);
-      h1 += qhash_min_log2 (match1);
-
-      if (PREDICT_FALSE (! match0 || ! match1))
-	goto slow_path2;
-
-      h0[0] = k0;
-      h1[0] = k1;
-      r[0] = h0 - hash_keys;
-      r[1] = h1 - hash_keys;
-      r += 2;
-      qhash_set_valid_elt_mask (h, bi0, valid0);
-      qhash_set_valid_elt_mask (h, bi1, valid1);
-      continue;
-
-    slow_path2:
-      if (! match0)
-	{
-	  n_elts -= 1;
-	  v = qhash_set_overflow (v, elt_bytes, k0, bi0, &n_elts, &r[0]);
-	}
-      else
-	{
-	  h0[0] = k0;
-	  r[0] = h0 - hash_keys;
-	  qhash_set_valid_elt_mask (h, bi0, valid0);
-	}
-      if (! match1)
-	{
-	  n_elts -= 1;
-	  v = qhash_set_overflow (v, elt_bytes, k1, bi1, &n_elts, &r[1]);
-	}
-      else
-	{
-	  h1[0] = k1;
-	  r[1] = h1 - hash_keys;
-	  qhash_set_valid_elt_mask (h, bi1, valid1);
-	}
-      r += 2;
-    }
-
-  while (n_left >= 1)
-    {
-      u32 a0, b0, c0, bi0, match0, valid0, free0;
-      uword k0, * h0;
-
-      k0 = k[0];
-      n_left -= 1;
-      k += 1;
-      
-      a0 = h->hash_seeds[0];
-      b0 = h->hash_seeds[1];
-      c0 = h->hash_seeds[2];
-      a0 ^= k0;
-#if uword_bits == 64
-      b0 ^= k0 >> 32;
-#endif
-
-      hash_mix32 (a0, b0, c0);
-
-      bi0 = c0 & bucket_mask;
-
-      h0 = hash_keys + bi0;
-
-      valid0 = qhash_get_valid_elt_mask (h, bi0);
-
-      /* Find first free element starting at hash offset into bucket. */
-      free0 = qhash_find_free (c0 & (QHASH_KEYS_PER_BUCKET - 1), valid0);
-
-      match0 = qhash_search_bucket (h0, k0, valid0);
-
-      n_elts += (match0 == 0);
-
-      match0 = match0 ? match0 : free0;
-
-      valid0 |= match0;
-
-      h0 += qhash_min_log2 (match0);
-
-      if (PREDICT_FALSE (! match0))
-	goto slow_path1;
-
-      h0[0] = k0;
-      r[0] = h0 - hash_keys;
-      r += 1;
-      qhash_set_valid_elt_mask (h, bi0, valid0);
-      continue;
-
-    slow_path1:
-      n_elts -= 1;
-      v = qhash_set_overflow (v, elt_bytes, k0, bi0, &n_elts, &r[0]);
-      r += 1;
-    }
-
-  h = qhash_header (v);
-  h->n_elts = n_elts;
-
-  return v;
-}
-
+/* Unset in full bucket: key is either in overflow hash or, when found
+   in bucket, its slot is refilled from overflow hash if possible.
+   Returns index of element to be freed by caller. */
 static uword
 unset_slow_path (void * v, uword elt_bytes,
 		 uword k0, uword bi0, uword valid0, uword match0,
@@ -648,21 +152,21 @@ unset_slow_path (void * v, uword elt_bytes,
 
   if (! match0)
     {
-      if (valid0 == QHASH_ALL_VALID)
+      if (valid0 == pow2_mask (qhash_keys_per_bucket (h)))
 	t = qhash_unset_overflow (v, k0, bi0, n_elts);
       return t;
     }
 
-  i = bi0 / QHASH_KEYS_PER_BUCKET;
-  t = bi0 + qhash_min_log2 (match0);
+  i = bi0 >> h->log2_keys_per_bucket;
+  t = bi0 + log2_first_set (match0);
 
-  if (valid0 == QHASH_ALL_VALID
+  if (valid0 == pow2_mask (qhash_keys_per_bucket (h))
       && i < vec_len (h->overflow_counts)
       && h->overflow_counts[i] > 0)
     {
       found = 0;
       hash_foreach_pair (p, h->overflow_hash, ({
-	j = qhash_hash_mix (h, p->key) / QHASH_KEYS_PER_BUCKET;
+	j = qhash_bucket_index (h, p->key);
 	if (j == i)
 	  {
 	    found = p;
@@ -678,7 +182,7 @@ unset_slow_path (void * v, uword elt_bytes,
       vec_add1 (h->overflow_free_indices, j);
       h->overflow_counts[i] -= 1;
 
-      qhash_set_valid_elt_mask (h, bi0, valid0);
+      h->hash_key_valid_bitmap[i] = valid0;
 
       h->hash_keys[t] = k;
       clib_memswap (v + t*elt_bytes,
@@ -687,157 +191,394 @@ unset_slow_path (void * v, uword elt_bytes,
       t = l;
     }
   else
-    qhash_set_valid_elt_mask (h, bi0, valid0 ^ match0);
+    h->hash_key_valid_bitmap[i] = valid0 ^ match0;
 
   return t;
 }
 
-void
-_qhash_unset_multiple (void * v,
-		       uword elt_bytes,
-		       uword * search_keys,
-		       uword n_search_keys,
-		       u32 * result_indices)
+/* Splits lower half bucket B: keys whose hash selects upper half of
+   table move to partner bucket in upper half along with their
+   elements.  OVERFLOW_KEYS are overflow hash keys of bucket B (when
+   zero overflow hash is searched); they are moved into either bucket
+   when there is room. */
+static void
+qhash_split_bucket (void * v, uword elt_bytes, uword b,
+		    uword * overflow_keys, uword n_overflow_keys)
 {
   qhash_t * h = qhash_header (v);
-  uword * k, * hash_keys;
-  uword n_left, n_elts, bucket_mask;
-  u32 * r;
+  uword lk, half, lo, hi, all_valid, valid[2], m, i, j, d, key;
+  uword * found_keys = 0;
 
-  if (! v)
+  ASSERT (h->n_unsplit_buckets > 0);
+  ASSERT (! clib_bitmap_get_no_check (h->split_bitmap, b));
+
+  /* Bucket overflowed after resize started. */
+  if (n_overflow_keys == 0
+      && b < vec_len (h->overflow_counts)
+      && h->overflow_counts[b] > 0)
     {
-      uword i;
-      for (i = 0; i < n_search_keys; i++)
-	result_indices[i] = ~0;
+      hash_pair_t * p;
+      hash_foreach_pair (p, h->overflow_hash, ({
+	if (qhash_bucket_index (h, p->key) == b)
+	  vec_add1 (found_keys, p->key);
+      }));
+      ASSERT (vec_len (found_keys) == h->overflow_counts[b]);
+      overflow_keys = found_keys;
+      n_overflow_keys = vec_len (found_keys);
     }
 
-  bucket_mask = pow2_mask (h->log2_hash_size) &~ (QHASH_KEYS_PER_BUCKET - 1);
+  /* Once bucket is marked split qhash_hash_mix gives new index. */
+  clib_bitmap_set_no_check (h->split_bitmap, b, 1);
+  h->n_unsplit_buckets -= 1;
+  if (h->n_unsplit_buckets == 0)
+    {
+      clib_bitmap_free (h->split_bitmap);
+      h->split_sweep_bucket = 0;
+    }
 
-  hash_keys = h->hash_keys;
-  k = search_keys;
-  r = result_indices;
-  n_left = n_search_keys;
-  n_elts = h->n_elts;
+  lk = h->log2_keys_per_bucket;
+  half = 1 << (h->log2_hash_size - 1);
+  lo = b << lk;
+  hi = lo + half;
+  all_valid = pow2_mask (1 << lk);
 
-  while (n_left >= 2)
+  valid[0] = h->hash_key_valid_bitmap[lo >> lk];
+  valid[1] = h->hash_key_valid_bitmap[hi >> lk];
+  ASSERT (valid[1] == 0);
+
+  m = valid[0];
+  while (m != 0)
+    {
+      i = log2_first_set (m);
+      m ^= 1 << i;
+      key = h->hash_keys[lo + i];
+      if (! (qhash_hash_mix (h, key) & half))
+	continue;
+      j = log2_first_set (~valid[1] & all_valid);
+      h->hash_keys[hi + j] = key;
+      clib_memswap (v + (lo + i)*elt_bytes, v + (hi + j)*elt_bytes, elt_bytes);
+      valid[0] ^= 1 << i;
+      valid[1] |= 1 << j;
+    }
+
+  for (i = 0; i < n_overflow_keys; i++)
     {
-      u32 a0, b0, c0, bi0, match0, valid0;
-      u32 a1, b1, c1, bi1, match1, valid1;
-      uword k0, * h0;
-      uword k1, * h1;
-
-      k0 = k[0];
-      k1 = k[1];
-
-      /* Keys must be unique. */
-      ASSERT (k0 != k1);
-
-      n_left -= 2;
-      k += 2;
-      
-      a0 = a1 = h->hash_seeds[0];
-      b0 = b1 = h->hash_seeds[1];
-      c0 = c1 = h->hash_seeds[2];
-      a0 ^= k0;
-      a1 ^= k1;
-#if uword_bits == 64
-      b0 ^= k0 >> 32;
-      b1 ^= k1 >> 32;
-#endif
-
-      hash_mix32_step_1 (a0, b0, c0);
-      hash_mix32_step_1 (a1, b1, c1);
-      hash_mix32_step_2 (a0, b0, c0);
-      hash_mix32_step_2 (a1, b1, c1);
-      hash_mix32_step_3 (a0, b0, c0);
-      hash_mix32_step_3 (a1, b1, c1);
-
-      bi0 = c0 & bucket_mask;
-      bi1 = c1 & bucket_mask;
-
-      h0 = hash_keys + bi0;
-      h1 = hash_keys + bi1;
-
-      /* Search two buckets. */
-      valid0 = qhash_get_valid_elt_mask (h, bi0);
-      valid1 = qhash_get_valid_elt_mask (h, bi1);
-
-      match0 = qhash_search_bucket (h0, k0, valid0);
-      match1 = qhash_search_bucket (h1, k1, valid1);
-
-      n_elts -= (match0 != 0) + (match1 != 0);
-
-      if (PREDICT_FALSE (valid0 == QHASH_ALL_VALID
-			 || valid1 == QHASH_ALL_VALID))
-	goto slow_path2;
-
-      valid0 ^= match0;
-      qhash_set_valid_elt_mask (h, bi0, valid0);
-
-      valid1 = bi0 == bi1 ? valid0 : valid1;
-      valid1 ^= match1;
-
-      qhash_set_valid_elt_mask (h, bi1, valid1);
-
-      r[0] = match0 ? bi0 + qhash_min_log2 (match0) : ~0;
-      r[1] = match1 ? bi1 + qhash_min_log2 (match1) : ~0;
-      r += 2;
-      continue;
-
-    slow_path2:
-      r[0] = unset_slow_path (v, elt_bytes, k0, bi0, valid0, match0,
-			      &n_elts);
-      if (bi0 == bi1)
+      uword * p, f;
+
+      key = overflow_keys[i];
+      p = hash_get (h->overflow_hash, key);
+      ASSERT (p != 0);
+      d = (qhash_hash_mix (h, key) & half) != 0;
+      f = ~valid[d] & all_valid;
+
+      h->overflow_counts[b] -= 1;
+      if (f)
 	{
-	  /* Search again in same bucket to test new overflow element. */
-	  valid1 = qhash_get_valid_elt_mask (h, bi0);
-	  if (! match1)
-	    {
-	      match1 = qhash_search_bucket (h1, k1, valid1);
-	      n_elts -= (match1 != 0);
-	    }
+	  j = (d ? hi : lo) + log2_first_set (f);
+	  h->hash_keys[j] = key;
+	  clib_memswap (v + j*elt_bytes, v + p[0]*elt_bytes, elt_bytes);
+	  vec_add1 (h->overflow_free_indices, p[0]);
+	  hash_unset (h->overflow_hash, key);
+	  valid[d] |= first_set (f);
+	}
+      else
+	{
+	  j = (d ? hi : lo) >> lk;
+	  vec_validate (h->overflow_counts, j);
+	  h->overflow_counts[j] += 1;
 	}
-      r[1] = unset_slow_path (v, elt_bytes, k1, bi1, valid1, match1,
-			      &n_elts);
-      r += 2;
     }
 
-  while (n_left >= 1)
+  h->hash_key_valid_bitmap[lo >> lk] = valid[0];
+  h->hash_key_valid_bitmap[hi >> lk] = valid[1];
+
+  vec_free (found_keys);
+}
+
+/* Splits up to N_SPLIT more buckets in order. */
+static void
+qhash_resize_step (void * v, uword elt_bytes, uword n_split)
+{
+  qhash_t * h = qhash_header (v);
+  uword b;
+
+  while (n_split > 0 && h->n_unsplit_buckets > 0)
+    {
+      b = h->split_sweep_bucket++;
+      if (clib_bitmap_get_no_check (h->split_bitmap, b))
+	continue;
+      qhash_split_bucket (v, elt_bytes, b, 0, 0);
+      n_split--;
+    }
+}
+
+always_inline uword
+qhash_should_grow (qhash_t * h)
+{
+  uword n = hash_elts (h->overflow_hash);
+  return (n >= QHASH_MIN_OVERFLOW_TO_GROW
+	  && (n << QHASH_LOG2_MAX_OVERFLOW_FRACTION) > h->n_elts);
+}
+
+typedef struct {
+  uword key;
+  uword bucket;
+} qhash_overflow_elt_t;
+
+/* Doubles table size and starts incremental resize.  Buckets with
+   overflow elements are split right away using a single pass over
+   overflow hash; only buckets which overflow during resize need to
+   search overflow hash when split. */
+static void *
+qhash_grow (void * v, uword elt_bytes)
+{
+  qhash_t * h = qhash_header (v);
+  uword l, lk, n, n_buckets, len, i, j, * keys;
+  uword * hash_keys;
+  hash_pair_t * p;
+  qhash_overflow_elt_t * es;
+
+  ASSERT (h->n_unsplit_buckets == 0);
+
+  l = h->log2_hash_size;
+  lk = h->log2_keys_per_bucket;
+  n = 1 << l;
+  n_buckets = n >> lk;
+  len = vec_len (v);
+
+  /* Overflow elements move up by N to make room for upper half. */
+  v = _vec_resize (v, n, (len + n) * elt_bytes, sizeof (h[0]),
+		   /* align */ sizeof (uword));
+  h = qhash_header (v);
+  memmove (v + 2*n*elt_bytes, v + n*elt_bytes, (len - n) * elt_bytes);
+  memset (v + n*elt_bytes, ~0, n * elt_bytes);
+  hash_foreach_pair (p, h->overflow_hash, ({ p->value[0] += n; }));
+  for (i = 0; i < vec_len (h->overflow_free_indices); i++)
+    h->overflow_free_indices[i] += n;
+
+  hash_keys = clib_mem_alloc_aligned_no_fail (sizeof (hash_keys[0]) << (l + 1),
+					      CLIB_CACHE_LINE_BYTES);
+  memcpy (hash_keys, h->hash_keys, sizeof (hash_keys[0]) << l);
+  clib_mem_free (h->hash_keys);
+  h->hash_keys = hash_keys;
+
+  vec_resize (h->hash_key_valid_bitmap, n_buckets);
+  memset (h->hash_key_valid_bitmap + n_buckets, 0,
+	  n_buckets * sizeof (h->hash_key_valid_bitmap[0]));
+
+  clib_bitmap_validate (h->split_bitmap, n_buckets);
+  clib_bitmap_zero (h->split_bitmap);
+  h->n_unsplit_buckets = n_buckets;
+  h->split_sweep_bucket = 0;
+  h->log2_hash_size = l + 1;
+  h->n_resizes += 1;
+
+  /* Collect overflow keys by bucket; all buckets are still unsplit. */
+  es = 0;
+  hash_foreach_pair (p, h->overflow_hash, ({
+    qhash_overflow_elt_t * e;
+    vec_add2 (es, e, 1);
+    e->key = p->key;
+    e->bucket = qhash_bucket_index (h, p->key);
+  }));
+  vec_sort (es, e0, e1, (word) e0->bucket - (word) e1->bucket);
+
+  keys = 0;
+  for (i = 0; i < vec_len (es); i = j)
     {
-      u32 a0, b0, c0, bi0, match0, valid0;
-      uword k0, * h0;
+      vec_reset_length (keys);
+      for (j = i; j < vec_len (es) && es[j].bucket == es[i].bucket; j++)
+	vec_add1 (keys, es[j].key);
+      qhash_split_bucket (v, elt_bytes, es[i].bucket, keys, vec_len (keys));
+    }
 
-      k0 = k[0];
-      n_left -= 1;
-      k += 1;
-      
-      a0 = h->hash_seeds[0];
-      b0 = h->hash_seeds[1];
-      c0 = h->hash_seeds[2];
-      a0 ^= k0;
-#if uword_bits == 64
-      b0 ^= k0 >> 32;
-#endif
+  vec_free (keys);
+  vec_free (es);
 
-      hash_mix32 (a0, b0, c0);
+  return v;
+}
+
+/* Batch kernels: keys are hashed a vector at a time and each bucket
+   is searched with vector compares of all its keys. */
+#ifdef HASH_MEMORY_X86_KERNELS
+
+typedef u64 qhash_u64x2 __attribute__ ((vector_size (16)));
+typedef f64 qhash_f64x2 __attribute__ ((vector_size (16)));
+typedef u64 qhash_u64x4 __attribute__ ((vector_size (32)));
+typedef f64 qhash_f64x4 __attribute__ ((vector_size (32)));
+
+/* SSE2 is always present on x86_64. */
+#define QHASH_FN(f) f##_sse2
+#define QHASH_N_LANES 4
+#define QHASH_VECTOR_BYTES 16
+#include <clib/qhash_template.c>
+
+#pragma GCC push_options
+#pragma GCC target ("avx2")
+#define QHASH_FN(f) f##_avx2
+#define QHASH_N_LANES 8
+#define QHASH_VECTOR_BYTES 32
+#include <clib/qhash_template.c>
+#pragma GCC pop_options
+
+static int qhash_have_avx2 = -1;
+
+static_always_inline uword
+qhash_use_avx2 (void)
+{
+  if (PREDICT_FALSE (qhash_have_avx2 < 0))
+    {
+      __builtin_cpu_init ();
+      qhash_have_avx2 = __builtin_cpu_supports ("avx2") != 0;
+    }
+  return qhash_have_avx2;
+}
 
-      bi0 = c0 & bucket_mask;
+#define qhash_kernel(f) (qhash_use_avx2 () ? f##_avx2 : f##_sse2)
 
-      h0 = hash_keys + bi0;
+#else /* HASH_MEMORY_X86_KERNELS */
 
-      valid0 = qhash_get_valid_elt_mask (h, bi0);
+#define QHASH_FN(f) f##_generic
+#define QHASH_N_LANES 4
+#define QHASH_VECTOR_BYTES 0
+#include <clib/qhash_template.c>
 
-      match0 = qhash_search_bucket (h0, k0, valid0);
-      n_elts -= (match0 != 0);
-      qhash_set_valid_elt_mask (h, bi0, valid0 ^ match0);
+#define qhash_kernel(f) f##_generic
 
-      r[0] = match0 ? bi0 + qhash_min_log2 (match0) : ~0;
-      r += 1;
+#endif /* HASH_MEMORY_X86_KERNELS */
 
-      if (PREDICT_FALSE (valid0 == QHASH_ALL_VALID))
-	r[-1] = unset_slow_path (v, elt_bytes, k0, bi0, valid0, match0,
-				 &n_elts);
+/* Lookup multiple keys in the same hash table. */
+void
+qhash_get_multiple (void * v,
+		    uword * search_keys,
+		    uword n_search_keys,
+		    u32 * result_indices)
+{
+  if (! v)
+    {
+      memset (result_indices, ~0, sizeof (result_indices[0]) * n_search_keys);
+      return;
+    }
+
+  qhash_kernel (qhash_get_multiple) (qhash_header (v), search_keys,
+				     n_search_keys, result_indices);
+}
+
+/* Lookup multiple keys in the same hash table.
+   Returns index of first matching key. */
+u32
+qhash_get_first_match (void * v,
+		       uword * search_keys,
+		       uword n_search_keys,
+		       uword * matching_key)
+{
+  if (! v)
+    return ~0;
+
+  return qhash_kernel (qhash_get_first_match) (qhash_header (v), search_keys,
+					       n_search_keys, matching_key);
+}
+
+void *
+_qhash_set_multiple (void * v,
+		     uword elt_bytes,
+		     uword * search_keys,
+		     uword n_search_keys,
+		     u32 * result_indices)
+{
+  qhash_t * h;
+
+  if (! v)
+    v = _qhash_resize (v, n_search_keys, elt_bytes);
+
+  /* Continue resize in progress or start a new one when too many
+     elements have overflowed.  Done before any key is set so that
+     result indices stay valid. */
+  h = qhash_header (v);
+  if (h->n_unsplit_buckets > 0)
+    qhash_resize_step (v, elt_bytes, QHASH_SPLITS_PER_SET_KEY * n_search_keys);
+  else if (qhash_should_grow (h))
+    v = qhash_grow (v, elt_bytes);
+
+  return qhash_kernel (qhash_set_multiple) (v, elt_bytes, search_keys,
+					    n_search_keys, result_indices);
+}
+
+void
+_qhash_unset_multiple (void * v,
+		       uword elt_bytes,
+		       uword * search_keys,
+		       uword n_search_keys,
+		       u32 * result_indices)
+{
+  if (! v)
+    {
+      uword i;
+      for (i = 0; i < n_search_keys; i++)
+	result_indices[i] = ~0;
+      return;
+    }
+
+  qhash_kernel (qhash_unset_multiple) (v, elt_bytes, search_keys,
+				       n_search_keys, result_indices);
+}
+
+u8 * format_qhash (u8 * s, va_list * va)
+{
+  void * v = va_arg (*va, void *);
+  qhash_t * h = qhash_header (v);
+  uword indent = format_get_indent (s);
+  uword * fill_counts = 0, * overflow_counts = 0;
+  uword i, n_buckets, n_overflow_buckets, n_bytes;
+
+  if (! v)
+    return format (s, "empty qhash");
+
+  n_buckets = 1 << (h->log2_hash_size - h->log2_keys_per_bucket);
+  for (i = 0; i < n_buckets; i++)
+    {
+      uword n = count_set_bits (h->hash_key_valid_bitmap[i]);
+      vec_validate (fill_counts, n);
+      fill_counts[n] += 1;
+    }
+
+  n_overflow_buckets = 0;
+  for (i = 0; i < vec_len (h->overflow_counts); i++)
+    {
+      uword n = h->overflow_counts[i];
+      if (n == 0)
+	continue;
+      n_overflow_buckets += 1;
+      vec_validate (overflow_counts, n);
+      overflow_counts[n] += 1;
     }
 
-  h->n_elts = n_elts;
+  n_bytes = (vec_capacity (v, sizeof (h[0]))
+	     + (sizeof (h->hash_keys[0]) << h->log2_hash_size)
+	     + vec_capacity (h->hash_key_valid_bitmap, 0)
+	     + hash_bytes (h->overflow_hash)
+	     + vec_capacity (h->overflow_counts, 0)
+	     + vec_capacity (h->overflow_free_indices, 0)
+	     + vec_capacity (h->split_bitmap, 0));
+
+  s = format (s, "%d elts, %wd buckets of %d keys, %.2f bytes/elt",
+	      h->n_elts, n_buckets, qhash_keys_per_bucket (h),
+	      h->n_elts > 0 ? (f64) n_bytes / h->n_elts : 0.);
+  s = format (s, "\n%Ubucket fill: %U",
+	      format_white_space, indent,
+	      format_hash_counts, fill_counts);
+  s = format (s, "\n%Uoverflow: %wd elts from %wd buckets",
+	      format_white_space, indent,
+	      qhash_n_overflow (v), n_overflow_buckets);
+  if (n_overflow_buckets > 0)
+    s = format (s, ", overflow per bucket: %U",
+		format_hash_counts, overflow_counts);
+  s = format (s, "\n%U%d resizes", format_white_space, indent, h->n_resizes);
+  if (h->n_unsplit_buckets > 0)
+    s = format (s, ", resizing with %d of %d buckets left to split",
+		h->n_unsplit_buckets, n_buckets / 2);
+
+  vec_free (fill_counts);
+  vec_free (overflow_counts);
+  return s;
 }
@@ -24,6 +24,7 @@
 #ifndef included_qhash_h
 #define included_qhash_h
 
+#include <clib/bitmap.h>
 #include <clib/cache.h>
 #include <clib/hash.h>
 
@@ -34,17 +35,40 @@ typedef struct {
 
   u32 log2_hash_size;
 
+  /* Log2 number of keys in each bucket: 2, 3 or 4 (4, 8 or 16 keys).
+     Fixed when table is created. */
+  u32 log2_keys_per_bucket;
+
   /* Jenkins hash seeds. */
   u32 hash_seeds[3];
 
   /* Fall back CLIB hash for overflow in fixed sized buckets. */
   uword * overflow_hash;
 
-  u32 * overflow_counts, * overflow_free_indices;
+  /* Number of overflow hash elements for each bucket. */
+  u32 * overflow_counts;
+
+  u32 * overflow_free_indices;
 
-  u8 * hash_key_valid_bitmap;
+  /* Mask of valid keys for each bucket. */
+  u16 * hash_key_valid_bitmap;
 
   uword * hash_keys;
+
+  /* Incremental resize: table doubles when too many elements overflow.
+     Buckets of lower half are then split one by one into lower and upper
+     halves by subsequent set calls.  Keys of buckets not yet split are
+     still found using old table size. */
+  u32 n_unsplit_buckets;
+
+  /* Next lower half bucket to split. */
+  u32 split_sweep_bucket;
+
+  /* Bitmap of lower half buckets already split. */
+  uword * split_bitmap;
+
+  /* Number of times table has doubled. */
+  u32 n_resizes;
 } qhash_t;
 
 always_inline qhash_t *
@@ -59,8 +83,32 @@ always_inline uword
 qhash_n_overflow (void * v)
 { return v ? hash_elts (qhash_header (v)->overflow_hash) : 0; }
 
+/* Default and maximum bucket sizes. */
 #define QHASH_LOG2_KEYS_PER_BUCKET 2
 #define QHASH_KEYS_PER_BUCKET (1 << QHASH_LOG2_KEYS_PER_BUCKET)
+#define QHASH_MAX_LOG2_KEYS_PER_BUCKET 4
+
+always_inline uword
+qhash_keys_per_bucket (qhash_t * h)
+{ return 1 << h->log2_keys_per_bucket; }
+
+/* Maps hash value to table index.  Buckets not yet split by an
+   incremental resize are still at their lower half index. */
+always_inline uword
+qhash_hash_index (qhash_t * h, u32 c)
+{
+  uword i = c & pow2_mask (h->log2_hash_size);
+
+  if (PREDICT_FALSE (h->n_unsplit_buckets > 0))
+    {
+      uword lo = c & pow2_mask (h->log2_hash_size - 1);
+      if (! clib_bitmap_get_no_check (h->split_bitmap,
+				      lo >> h->log2_keys_per_bucket))
+	i = lo;
+    }
+
+  return i;
+}
 
 always_inline uword
 qhash_hash_mix (qhash_t * h, uword key)
@@ -78,11 +126,39 @@ qhash_hash_mix (qhash_t * h, uword key)
 
   hash_mix32 (a, b, c);
 
-  return c & pow2_mask (h->log2_hash_size);
+  return qhash_hash_index (h, c);
+}
+
+/* Bucket index for key; used to index overflow_counts. */
+always_inline uword
+qhash_bucket_index (qhash_t * h, uword key)
+{ return qhash_hash_mix (h, key) >> h->log2_keys_per_bucket; }
+
+/* Number of elements of given bucket in overflow hash. */
+always_inline uword
+qhash_bucket_n_overflow (void * v, uword bucket_index)
+{
+  qhash_t * h = qhash_header (v);
+  return (v && bucket_index < vec_len (h->overflow_counts)
+	  ? h->overflow_counts[bucket_index] : 0);
 }
 
+/* Table doubles when more than 1 in 2^N elements are in overflow hash
+   (and at least QHASH_MIN_OVERFLOW_TO_GROW). */
+#define QHASH_LOG2_MAX_OVERFLOW_FRACTION 5
+#define QHASH_MIN_OVERFLOW_TO_GROW 8
+
+/* Number of buckets split per key by set calls during resize. */
+#define QHASH_SPLITS_PER_SET_KEY 4
+
+/* Keeps bucket size of existing table; default size for new tables. */
 #define qhash_resize(v,n) (v) = _qhash_resize ((v), (n), sizeof ((v)[0]))
 
+/* Creates table with given number of keys per bucket (4, 8 or 16).
+   Wider buckets overflow less often at the cost of longer bucket search. */
+#define qhash_resize_keys_per_bucket(v,n,k) \
+  (v) = _qhash_resize_keys_per_bucket ((v), (n), sizeof ((v)[0]), (k))
+
 /* FIXME */
 #define qhash_foreach(var,v,body)
 
@@ -115,6 +191,10 @@ qhash_hash_mix (qhash_t * h, uword key)
 void *
 _qhash_resize (void * v, uword length, uword elt_bytes);
 
+void *
+_qhash_resize_keys_per_bucket (void * v, uword length, uword elt_bytes,
+			       uword keys_per_bucket);
+
 /* Lookup multiple keys in the same hash table. */
 void
 qhash_get_multiple (void * v,
@@ -144,4 +224,7 @@ _qhash_unset_multiple (void * v,
 		       uword n_search_keys,
 		       u32 * result_indices);
 
+/* Bucket fill and overflow statistics. */
+u8 * format_qhash (u8 * s, va_list * va);
+
 #endif /* included_qhash_h */
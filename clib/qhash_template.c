@@ -0,0 +1,322 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/* Batch get/set/unset kernels for qhash.c.  Included once per
+   instruction set with QHASH_FN naming functions, QHASH_N_LANES keys
+   hashed per vector and QHASH_VECTOR_BYTES width of bucket compare
+   (0 for scalar compare). */
+
+#ifndef QHASH_FN
+#error QHASH_FN not defined
+#endif
+
+typedef u32 QHASH_FN (qhash_u32xn)
+  __attribute__ ((vector_size (QHASH_N_LANES * sizeof (u32))));
+
+/* Hashes up to QHASH_N_LANES keys at once with one lane of each of
+   a, b, c per key and prefetches their buckets.  Returns number of
+   keys hashed; BI is set to index of first key of each bucket. */
+static_always_inline uword
+QHASH_FN (qhash_hash_keys) (qhash_t * h, uword * keys, uword n_keys, u32 * bi)
+{
+  QHASH_FN (qhash_u32xn) a, b, c;
+  u32 x[3][QHASH_N_LANES];
+  uword i, n, l = h->log2_keys_per_bucket;
+
+  n = clib_min (n_keys, QHASH_N_LANES);
+
+  /* Unused lanes hash first key again. */
+  for (i = 0; i < QHASH_N_LANES; i++)
+    {
+      uword key = keys[i < n ? i : 0];
+      x[0][i] = h->hash_seeds[0] ^ key;
+#if uword_bits == 64
+      x[1][i] = h->hash_seeds[1] ^ (key >> 32);
+#else
+      x[1][i] = h->hash_seeds[1];
+#endif
+      x[2][i] = h->hash_seeds[2];
+    }
+
+  memcpy (&a, x[0], sizeof (a));
+  memcpy (&b, x[1], sizeof (b));
+  memcpy (&c, x[2], sizeof (c));
+
+  hash_mix32 (a, b, c);
+
+  memcpy (x[2], &c, sizeof (c));
+
+  for (i = 0; i < n; i++)
+    {
+      bi[i] = qhash_hash_index (h, x[2][i]) &~ pow2_mask (l);
+      CLIB_PREFETCH (h->hash_keys + bi[i], sizeof (h->hash_keys[0]) << l, LOAD);
+      CLIB_PREFETCH (h->hash_key_valid_bitmap + (bi[i] >> l),
+		     sizeof (h->hash_key_valid_bitmap[0]), LOAD);
+    }
+
+  return n;
+}
+
+/* Returns mask of keys in bucket equal to KEY (valid or not). */
+static_always_inline uword
+QHASH_FN (qhash_search_bucket) (uword * hash_keys, uword key,
+				uword log2_keys_per_bucket)
+{
+  uword i, t = 0;
+
+#if QHASH_VECTOR_BYTES == 32
+  qhash_u64x4 k = { key, key, key, key, }, * b = (qhash_u64x4 *) hash_keys;
+  for (i = 0; i < 1 << (log2_keys_per_bucket - 2); i++)
+    t |= ((uword) __builtin_ia32_movmskpd256 ((qhash_f64x4) (b[i] == k))
+	  << (4 * i));
+#elif QHASH_VECTOR_BYTES == 16
+  qhash_u64x2 k = { key, key, }, * b = (qhash_u64x2 *) hash_keys;
+  for (i = 0; i < 1 << (log2_keys_per_bucket - 1); i++)
+    t |= ((uword) __builtin_ia32_movmskpd ((qhash_f64x2) (b[i] == k))
+	  << (2 * i));
+#else
+  for (i = 0; i < 1 << log2_keys_per_bucket; i++)
+    t |= (uword) (hash_keys[i] == key) << i;
+#endif
+
+  return t;
+}
+
+static void
+QHASH_FN (qhash_get_multiple) (qhash_t * h,
+			       uword * search_keys,
+			       uword n_search_keys,
+			       u32 * result_indices)
+{
+  uword * k, * hash_keys;
+  uword i, n, n_left, l, all_valid;
+  u32 bi[QHASH_N_LANES], * r;
+
+  l = h->log2_keys_per_bucket;
+  all_valid = pow2_mask (1 << l);
+
+  k = search_keys;
+  n_left = n_search_keys;
+  hash_keys = h->hash_keys;
+  r = result_indices;
+
+  while (n_left > 0)
+    {
+      n = QHASH_FN (qhash_hash_keys) (h, k, n_left, bi);
+
+      for (i = 0; i < n; i++)
+	{
+	  uword valid, match;
+
+	  valid = h->hash_key_valid_bitmap[bi[i] >> l];
+	  match = valid & QHASH_FN (qhash_search_bucket) (hash_keys + bi[i], k[i], l);
+
+	  r[i] = match ? bi[i] + log2_first_set (match) : ~0;
+
+	  /* Full buckets trigger search of overflow hash. */
+	  if (PREDICT_FALSE (! match && valid == all_valid))
+	    {
+	      uword * p = hash_get (h->overflow_hash, k[i]);
+	      r[i] = p ? p[0] : ~0;
+	    }
+	}
+
+      k += n;
+      r += n;
+      n_left -= n;
+    }
+}
+
+static u32
+QHASH_FN (qhash_get_first_match) (qhash_t * h,
+				  uword * search_keys,
+				  uword n_search_keys,
+				  uword * matching_key)
+{
+  uword * k, * hash_keys;
+  uword i, n, n_left, l, all_valid;
+  u32 bi[QHASH_N_LANES];
+
+  l = h->log2_keys_per_bucket;
+  all_valid = pow2_mask (1 << l);
+
+  k = search_keys;
+  n_left = n_search_keys;
+  hash_keys = h->hash_keys;
+
+  while (n_left > 0)
+    {
+      n = QHASH_FN (qhash_hash_keys) (h, k, n_left, bi);
+
+      for (i = 0; i < n; i++)
+	{
+	  uword valid, match;
+
+	  valid = h->hash_key_valid_bitmap[bi[i] >> l];
+	  match = valid & QHASH_FN (qhash_search_bucket) (hash_keys + bi[i], k[i], l);
+
+	  if (match)
+	    {
+	      *matching_key = k + i - search_keys;
+	      return bi[i] + log2_first_set (match);
+	    }
+
+	  /* Full buckets trigger search of overflow hash. */
+	  if (PREDICT_FALSE (valid == all_valid))
+	    {
+	      uword * p = hash_get (h->overflow_hash, k[i]);
+	      if (p)
+		{
+		  *matching_key = k + i - search_keys;
+		  return p[0];
+		}
+	    }
+	}
+
+      k += n;
+      n_left -= n;
+    }
+
+  return ~0;
+}
+
+static void *
+QHASH_FN (qhash_set_multiple) (void * v,
+			       uword elt_bytes,
+			       uword * search_keys,
+			       uword n_search_keys,
+			       u32 * result_indices)
+{
+  qhash_t * h = qhash_header (v);
+  uword * k, * hash_keys;
+  uword i, n, n_left, n_elts, l, all_valid;
+  u32 bi[QHASH_N_LANES], * r;
+
+  l = h->log2_keys_per_bucket;
+  all_valid = pow2_mask (1 << l);
+
+  hash_keys = h->hash_keys;
+  k = search_keys;
+  r = result_indices;
+  n_left = n_search_keys;
+  n_elts = h->n_elts;
+
+  while (n_left > 0)
+    {
+      n = QHASH_FN (qhash_hash_keys) (h, k, n_left, bi);
+
+      for (i = 0; i < n; i++)
+	{
+	  uword valid, match, j;
+
+	  valid = h->hash_key_valid_bitmap[bi[i] >> l];
+	  match = valid & QHASH_FN (qhash_search_bucket) (hash_keys + bi[i], k[i], l);
+
+	  /* Find first free element in bucket. */
+	  if (! match)
+	    {
+	      match = first_set (~valid & all_valid);
+	      n_elts += match != 0;
+	    }
+
+	  if (PREDICT_FALSE (! match))
+	    {
+	      /* Vector header may move when overflow elements are added. */
+	      v = qhash_set_overflow (v, elt_bytes, k[i], bi[i], &n_elts, &r[i]);
+	      h = qhash_header (v);
+	      continue;
+	    }
+
+	  j = bi[i] + log2_first_set (match);
+	  hash_keys[j] = k[i];
+	  r[i] = j;
+	  h->hash_key_valid_bitmap[bi[i] >> l] = valid | match;
+	}
+
+      k += n;
+      r += n;
+      n_left -= n;
+    }
+
+  h->n_elts = n_elts;
+
+  return v;
+}
+
+static void
+QHASH_FN (qhash_unset_multiple) (void * v,
+				 uword elt_bytes,
+				 uword * search_keys,
+				 uword n_search_keys,
+				 u32 * result_indices)
+{
+  qhash_t * h = qhash_header (v);
+  uword * k, * hash_keys;
+  uword i, n, n_left, n_elts, l, all_valid;
+  u32 bi[QHASH_N_LANES], * r;
+
+  l = h->log2_keys_per_bucket;
+  all_valid = pow2_mask (1 << l);
+
+  hash_keys = h->hash_keys;
+  k = search_keys;
+  r = result_indices;
+  n_left = n_search_keys;
+  n_elts = h->n_elts;
+
+  while (n_left > 0)
+    {
+      n = QHASH_FN (qhash_hash_keys) (h, k, n_left, bi);
+
+      for (i = 0; i < n; i++)
+	{
+	  uword valid, match;
+
+	  valid = h->hash_key_valid_bitmap[bi[i] >> l];
+	  match = valid & QHASH_FN (qhash_search_bucket) (hash_keys + bi[i], k[i], l);
+
+	  n_elts -= match != 0;
+
+	  /* Full buckets may have elements in overflow hash. */
+	  if (PREDICT_FALSE (valid == all_valid))
+	    {
+	      r[i] = unset_slow_path (v, elt_bytes, k[i], bi[i], valid, match,
+				      &n_elts);
+	      continue;
+	    }
+
+	  h->hash_key_valid_bitmap[bi[i] >> l] = valid ^ match;
+	  r[i] = match ? bi[i] + log2_first_set (match) : ~0;
+	}
+
+      k += n;
+      r += n;
+      n_left -= n;
+    }
+
+  h->n_elts = n_elts;
+}
+
+#undef QHASH_FN
+#undef QHASH_N_LANES
+#undef QHASH_VECTOR_BYTES
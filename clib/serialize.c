@@ -23,6 +23,7 @@
 
 /* Turn data structures into byte streams for saving or transport. */
 
+#include <clib/hash.h>
 #include <clib/heap.h>
 #include <clib/pool.h>
 #include <clib/serialize.h>
@@ -557,6 +558,91 @@ void unserialize_heap (serialize_main_t * m, va_list * va)
   }
 }
 
+/* Flags which describe table layout or policy as opposed to state. */
+#define SERIALIZE_HASH_FLAGS (HASH_FLAG_NO_AUTO_GROW		\
+			      | HASH_FLAG_NO_AUTO_SHRINK	\
+			      | HASH_FLAG_OPEN_ADDRESSING	\
+			      | HASH_FLAG_INCREMENTAL_RESIZE	\
+			      | HASH_FLAG_STATS			\
+			      | HASH_FLAG_COMPACT_U32)
+
+void serialize_hash (serialize_main_t * m, va_list * va)
+{
+  void * v = va_arg (*va, void *);
+  hash_t * h = hash_header (v);
+  hash_pair_t * p;
+  uword i, n_value_words;
+
+  /* Zero for null table; else 1 + number of elements. */
+  serialize_likely_small_unsigned_integer (m, v ? 1 + hash_elts (v) : 0);
+  if (! v)
+    return;
+
+  ASSERT (pointer_to_uword (h->key_sum) == KEY_FUNC_NONE);
+
+  /* Values are sent a u32 or word at a time. */
+  n_value_words = hash_is_compact (h) ? 1 : hash_value_bytes (h) / sizeof (uword);
+  serialize_integer (m, h->flags & SERIALIZE_HASH_FLAGS, sizeof (u32));
+  serialize_likely_small_unsigned_integer (m, n_value_words);
+
+  hash_foreach_pair (p, v, ({
+    serialize_likely_small_unsigned_integer (m, hash_pair_key (h, p));
+    if (hash_is_compact (h))
+      serialize_likely_small_unsigned_integer (m, hash_pair_value0 (h, p));
+    else
+      for (i = 0; i < n_value_words; i++)
+	serialize_likely_small_unsigned_integer (m, p->value[i]);
+  }));
+}
+
+void unserialize_hash (serialize_main_t * m, va_list * va)
+{
+  void ** result = va_arg (*va, void **);
+  void * v;
+  uword * value = 0;
+  uword i, n_elts, n_value_words, value_bytes, key;
+  u32 flags, value_u32;
+
+  n_elts = unserialize_likely_small_unsigned_integer (m);
+  if (n_elts == 0)
+    {
+      *result = 0;
+      return;
+    }
+  n_elts -= 1;
+
+  unserialize_integer (m, &flags, sizeof (flags));
+  n_value_words = unserialize_likely_small_unsigned_integer (m);
+
+  if (flags & HASH_FLAG_COMPACT_U32)
+    value_bytes = sizeof (u32);
+  else
+    value_bytes = n_value_words * sizeof (uword);
+
+  v = hash_create3 (n_elts, 0, value_bytes,
+		    (hash_key_sum_function_t *) KEY_FUNC_NONE,
+		    (hash_key_equal_function_t *) KEY_FUNC_NONE,
+		    0, 0, flags);
+
+  vec_resize (value, n_value_words);
+  while (n_elts-- > 0)
+    {
+      key = unserialize_likely_small_unsigned_integer (m);
+      for (i = 0; i < n_value_words; i++)
+	value[i] = unserialize_likely_small_unsigned_integer (m);
+      if (flags & HASH_FLAG_COMPACT_U32)
+	{
+	  value_u32 = value[0];
+	  v = _hash_set3 (v, key, &value_u32, 0);
+	}
+      else
+	v = _hash_set3 (v, key, value, 0);
+    }
+
+  vec_free (value);
+  *result = v;
+}
+
 void serialize_magic (serialize_main_t * m, void * magic, u32 magic_bytes)
 {
   void * p;
@@ -671,6 +757,8 @@ static void * serialize_write_not_inline (serialize_main_header_t * m,
   if (n_left_o > 0 || n_left_b < n_bytes_to_write)
     {
       u8 * r;
+      /* Keep overflow bytes already moved to buffer. */
+      s->current_buffer_index = cur_bi;
       vec_add2 (s->overflow_buffer, r, n_bytes_to_write);
       return r;
     }
@@ -264,7 +264,7 @@ unserialize_likely_small_signed_integer (serialize_main_t * m)
 {
   u64 u = unserialize_likely_small_unsigned_integer (m);
   i64 s = u / 2;
-  return (u & 1) ? -s : s;
+  return (u & 1) ? -s - 1 : s;
 }
 
 void
@@ -374,6 +374,14 @@ serialize_function_t serialize_pool, unserialize_pool, unserialize_aligned_pool;
 /* Serialize heaps. */
 serialize_function_t serialize_heap, unserialize_heap;
 
+/* Serialize hash tables with word keys (e.g. KEY_FUNC_NONE): keys are
+   sent as integers so pointer keyed tables cannot be serialized.
+   Unserialized table has same flags and value size. */
+serialize_function_t serialize_hash, unserialize_hash;
+
+#define hash_serialize(m,h) serialize ((m), serialize_hash, (h))
+#define hash_unserialize(m,h) unserialize ((m), unserialize_hash, (h))
+
 void serialize_bitmap (serialize_main_t * m, uword * b);
 uword * unserialize_bitmap (serialize_main_t * m);
 
@@ -0,0 +1,284 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef included_clib_summary_bitmap_h
+#define included_clib_summary_bitmap_h
+
+/* Bitmaps with summary levels for fast searching of huge sparse bitmaps.
+
+   Level 0 is a normal clib bitmap.  Above it we keep two trees of
+   summary bitmaps.  In the set tree bit i of level l + 1 is set
+   iff word i of level l is non-zero.  In the clear tree bit i of level 1
+   is set iff word i of the bitmap has a clear bit (e.g. is not ~0);
+   higher levels again mark non-zero words.
+
+   next_set/next_clear then cost one word access per level instead of
+   a scan linear in the distance to the next set (clear) bit. */
+
+#include <clib/bitmap.h>
+
+/* 64^5 words of 64 bits is plenty. */
+#define CLIB_SUMMARY_BITMAP_MAX_LEVELS 5
+
+typedef struct {
+  /* Bitmap proper. */
+  uword * bitmap;
+
+  /* Summary bitmaps.  summary[0] is the set tree; summary[1] is the
+     clear tree.  summary[*][l] summarizes level l (level 0 is bitmap). */
+  uword * summary[2][CLIB_SUMMARY_BITMAP_MAX_LEVELS];
+
+  /* Number of summary levels above bitmap.  Top level is always
+     a single word. */
+  u32 n_summary_levels;
+} clib_summary_bitmap_t;
+
+always_inline uword *
+clib_summary_bitmap_level (clib_summary_bitmap_t * b, uword is_clear, uword l)
+{ return l == 0 ? b->bitmap : b->summary[is_clear][l - 1]; }
+
+/* Set/clear bit I at summary level L and propagate change upwards. */
+always_inline void
+_clib_summary_bitmap_propagate (clib_summary_bitmap_t * b, uword is_clear,
+				uword l, uword i, uword is_non_zero)
+{
+  for (; l < b->n_summary_levels; l++)
+    {
+      uword * s = b->summary[is_clear][l];
+      uword i0 = i / BITS (uword);
+      uword i1 = i % BITS (uword);
+      uword old, new;
+
+      old = s[i0];
+      new = (old &~ ((uword) 1 << i1)) | ((uword) is_non_zero << i1);
+      s[i0] = new;
+
+      /* Stop when summary word stays (non-)zero. */
+      if ((old != 0) == (new != 0))
+	break;
+
+      i = i0;
+      is_non_zero = new != 0;
+    }
+}
+
+/* Rebuild all summary levels from bitmap. */
+always_inline void
+_clib_summary_bitmap_rebuild (clib_summary_bitmap_t * b)
+{
+  uword is_clear, l, i, n;
+
+  for (is_clear = 0; is_clear < 2; is_clear++)
+    for (l = 0; l < b->n_summary_levels; l++)
+      {
+	uword * below = clib_summary_bitmap_level (b, is_clear, l);
+	uword * s = b->summary[is_clear][l];
+
+	n = vec_len (below);
+	memset (s, 0, vec_bytes (s));
+	for (i = 0; i < n; i++)
+	  {
+	    uword x = below[i];
+	    if (is_clear && l == 0)
+	      x = ~x;
+	    s[i / BITS (uword)] |= (uword) (x != 0) << (i % BITS (uword));
+	  }
+      }
+}
+
+/* Make sure bitmap holds at least N_BITS bits. */
+always_inline void
+clib_summary_bitmap_validate (clib_summary_bitmap_t * b, uword n_bits)
+{
+  uword n_words, old_n_words, n_levels, is_clear, l, i, n;
+
+  n_words = (n_bits + BITS (uword) - 1) / BITS (uword);
+  old_n_words = vec_len (b->bitmap);
+  if (n_words <= old_n_words && b->bitmap)
+    return;
+
+  if (n_words < 1)
+    n_words = 1;
+  clib_bitmap_vec_validate (b->bitmap, n_words - 1);
+
+  n_levels = 0;
+  n = n_words;
+  do {
+    n = (n + BITS (uword) - 1) / BITS (uword);
+    n_levels++;
+  } while (n > 1);
+
+  ASSERT (n_levels <= CLIB_SUMMARY_BITMAP_MAX_LEVELS);
+
+  n = n_words;
+  for (l = 0; l < n_levels; l++)
+    {
+      n = (n + BITS (uword) - 1) / BITS (uword);
+      for (is_clear = 0; is_clear < 2; is_clear++)
+	clib_bitmap_vec_validate (b->summary[is_clear][l], n - 1);
+    }
+
+  if (n_levels != b->n_summary_levels)
+    {
+      b->n_summary_levels = n_levels;
+      _clib_summary_bitmap_rebuild (b);
+    }
+  else
+    {
+      /* New words are all zero so they all have clear bits. */
+      for (i = old_n_words; i < n_words; i++)
+	_clib_summary_bitmap_propagate (b, /* is_clear */ 1, 0, i, 1);
+    }
+}
+
+always_inline void
+clib_summary_bitmap_free (clib_summary_bitmap_t * b)
+{
+  uword is_clear, l;
+  clib_bitmap_free (b->bitmap);
+  for (is_clear = 0; is_clear < 2; is_clear++)
+    for (l = 0; l < ARRAY_LEN (b->summary[is_clear]); l++)
+      vec_free (b->summary[is_clear][l]);
+  b->n_summary_levels = 0;
+}
+
+always_inline uword
+clib_summary_bitmap_get (clib_summary_bitmap_t * b, uword i)
+{ return clib_bitmap_get (b->bitmap, i); }
+
+/* Sets bit I to given value, growing bitmap as needed.  Returns old value. */
+always_inline uword
+clib_summary_bitmap_set (clib_summary_bitmap_t * b, uword i, uword value)
+{
+  uword i0 = i / BITS (uword);
+  uword i1 = i % BITS (uword);
+  uword old, new;
+
+  if (i0 >= vec_len (b->bitmap))
+    {
+      /* Writing zero beyond end of bitmap is a no-op. */
+      if (! value)
+	return 0;
+      clib_summary_bitmap_validate (b, i + 1);
+    }
+
+  old = b->bitmap[i0];
+  new = (old &~ ((uword) 1 << i1)) | ((uword) (value != 0) << i1);
+  b->bitmap[i0] = new;
+
+  if ((old != 0) != (new != 0))
+    _clib_summary_bitmap_propagate (b, /* is_clear */ 0, 0, i0, new != 0);
+  if ((old != ~(uword)0) != (new != ~(uword)0))
+    _clib_summary_bitmap_propagate (b, /* is_clear */ 1, 0, i0, new != ~(uword)0);
+
+  return (old >> i1) & 1;
+}
+
+/* Search for next set (or clear) bit at position >= I.
+   Returns ~0 if not found. */
+always_inline uword
+_clib_summary_bitmap_next (clib_summary_bitmap_t * b, uword i, uword is_clear)
+{
+  uword l, i0, i1, x, * v;
+
+  l = 0;
+  while (1)
+    {
+      v = clib_summary_bitmap_level (b, is_clear, l);
+      i0 = i / BITS (uword);
+      i1 = i % BITS (uword);
+
+      if (i0 >= vec_len (v))
+	return ~0;
+
+      x = v[i0];
+      if (is_clear && l == 0)
+	x = ~x;
+      x = (x >> i1) << i1;
+
+      if (x != 0)
+	break;
+
+      /* Top level is a single word: nothing left. */
+      if (l >= b->n_summary_levels)
+	return ~0;
+
+      /* Nothing left in this word: move up one level and skip it. */
+      i = i0 + 1;
+      l++;
+    }
+
+  /* Found a non-zero word: walk down to the bitmap. */
+  i = i0 * BITS (uword) + log2_first_set (x);
+  while (l > 0)
+    {
+      l--;
+      v = clib_summary_bitmap_level (b, is_clear, l);
+      x = v[i];
+      if (is_clear && l == 0)
+	x = ~x;
+      ASSERT (x != 0);
+      i = i * BITS (uword) + log2_first_set (x);
+    }
+
+  return i;
+}
+
+/* Returns next set bit starting at bit i (~0 if not found). */
+always_inline uword
+clib_summary_bitmap_next_set (clib_summary_bitmap_t * b, uword i)
+{ return _clib_summary_bitmap_next (b, i, /* is_clear */ 0); }
+
+/* Returns next clear bit at position >= i.  Bits past end of bitmap
+   are implicitly clear so this always succeeds. */
+always_inline uword
+clib_summary_bitmap_next_clear (clib_summary_bitmap_t * b, uword i)
+{
+  uword r = _clib_summary_bitmap_next (b, i, /* is_clear */ 1);
+  if (r == ~0)
+    r = clib_max (i, vec_len (b->bitmap) * BITS (uword));
+  return r;
+}
+
+always_inline uword
+clib_summary_bitmap_first_set (clib_summary_bitmap_t * b)
+{ return clib_summary_bitmap_next_set (b, 0); }
+
+always_inline uword
+clib_summary_bitmap_first_clear (clib_summary_bitmap_t * b)
+{ return clib_summary_bitmap_next_clear (b, 0); }
+
+/* Iterate through set bits. */
+#define clib_summary_bitmap_foreach(i,b,body)				\
+do {									\
+  uword __summary_bitmap_i = clib_summary_bitmap_first_set (b);		\
+  while (__summary_bitmap_i != ~0)					\
+    {									\
+      (i) = __summary_bitmap_i;						\
+      do { body; } while (0);						\
+      __summary_bitmap_i							\
+	= clib_summary_bitmap_next_set ((b), __summary_bitmap_i + 1);	\
+    }									\
+} while (0)
+
+#endif /* included_clib_summary_bitmap_h */
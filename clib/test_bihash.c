@@ -0,0 +1,477 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/* Bounded-index hash tests: sequential add/replace/delete checks for
+   each key size, reader grace periods on faked cpus and a multi-CPU
+   test where every CPU updates its own keys while looking up keys of
+   all CPUs. */
+
+#include <clib/bihash_8_8.h>
+#include <clib/bihash_16_8.h>
+#include <clib/bihash_40_8.h>
+#include <clib/bitmap.h>
+#include <clib/format.h>
+#include <clib/random.h>
+#include <clib/smp.h>
+#include <clib/time.h>
+
+typedef struct {
+  u32 seed, verbose, n_cpu;
+
+  /* Keys owned by each CPU. */
+  u32 n_keys;
+
+  /* Number of operations per CPU. */
+  u32 n_iter;
+
+  /* Percentage of operations which add or delete. */
+  u32 write_percent;
+
+  u32 n_buckets;
+
+  uword arena_n_bytes;
+
+  clib_bihash_8_8_t hash;
+
+  /* Simple barrier. */
+  volatile u32 n_at_barrier, barrier_generation;
+
+  /* Per CPU key/value pairs in table at end of test. */
+  volatile u32 n_elts;
+
+  volatile u32 n_errors;
+
+  volatile u64 n_lookups, n_updates, n_clocks;
+
+  clib_time_t time;
+} test_bihash_main_t;
+
+/* Value stored for key: key in high bits so readers can check it; low
+   byte changes when value is replaced in place. */
+always_inline u64
+test_bihash_value (u64 key, u32 version)
+{ return (key << 8) | (version & 0xff); }
+
+always_inline u64
+test_bihash_key_word (uword i, uword j)
+{ return i + ((u64) j << 40) + j * 0x9e3779b97f4a7c13ULL; }
+
+#define test_bihash_sequential_template(T)				\
+static clib_error_t *							\
+test_bihash_sequential##T (test_bihash_main_t * tm)			\
+{									\
+  clib_bihash##T##_t _h, * h = &_h;					\
+  clib_bihash_kv##T##_t kv, result;					\
+  clib_error_t * error = 0;						\
+  uword * present = 0, i, j, iter, is_add;				\
+  u64 * values = 0;							\
+									\
+  clib_bihash_init##T (h, "test" #T, tm->n_keys / 4, tm->arena_n_bytes); \
+  vec_validate (values, tm->n_keys - 1);				\
+									\
+  for (iter = 0; iter < tm->n_iter; iter++)				\
+    {									\
+      i = random_u32 (&tm->seed) % tm->n_keys;				\
+      for (j = 0; j < ARRAY_LEN (kv.key); j++)				\
+	kv.key[j] = test_bihash_key_word (i, j);			\
+									\
+      /* Present keys are deleted or get new value. */			\
+      is_add = ! clib_bitmap_get (present, i) || (random_u32 (&tm->seed) & 1); \
+      kv.value = test_bihash_value (i, random_u32 (&tm->seed));	\
+      if (clib_bihash_add_del##T (h, &kv, is_add))			\
+	{								\
+	  error = clib_error_return (0, "add_del key %wd failed", i);	\
+	  goto done;							\
+	}								\
+      present = clib_bitmap_set (present, i, is_add);			\
+      values[i] = kv.value;						\
+									\
+      if (iter % (tm->n_iter / 8 + 1) == 0				\
+	  && (error = clib_bihash_validate##T (h)))			\
+	goto done;							\
+    }									\
+									\
+  for (i = 0; i < tm->n_keys; i++)					\
+    {									\
+      for (j = 0; j < ARRAY_LEN (kv.key); j++)				\
+	kv.key[j] = test_bihash_key_word (i, j);			\
+      if (clib_bihash_search##T (h, &kv, &result) == 0)		\
+	{								\
+	  if (! clib_bitmap_get (present, i) || result.value != values[i]) \
+	    {								\
+	      error = clib_error_return (0, "key %wd bad search result", i); \
+	      goto done;						\
+	    }								\
+	}								\
+      else if (clib_bitmap_get (present, i))				\
+	{								\
+	  error = clib_error_return (0, "key %wd not found", i);	\
+	  goto done;							\
+	}								\
+    }									\
+									\
+  if (h->n_elts != clib_bitmap_count_set_bits (present))		\
+    error = clib_error_return (0, "%d elts expected %d", h->n_elts,	\
+			       clib_bitmap_count_set_bits (present));	\
+  else									\
+    error = clib_bihash_validate##T (h);				\
+									\
+  if (tm->verbose)							\
+    fformat (stderr, "%U\n", format_clib_bihash##T, h, tm->verbose);	\
+									\
+ done:									\
+  clib_bihash_free##T (h);						\
+  clib_bitmap_free (present);						\
+  vec_free (values);							\
+  return error;								\
+}
+
+test_bihash_sequential_template (_8_8)
+test_bihash_sequential_template (_16_8)
+test_bihash_sequential_template (_40_8)
+
+static void
+test_bihash_barrier (test_bihash_main_t * tm)
+{
+  u32 generation = tm->barrier_generation;
+
+  if (clib_smp_atomic_add (&tm->n_at_barrier, 1) == tm->n_cpu - 1)
+    {
+      tm->n_at_barrier = 0;
+      CLIB_MEMORY_BARRIER ();
+      tm->barrier_generation = generation + 1;
+    }
+  else
+    while (tm->barrier_generation == generation)
+      clib_smp_pause ();
+}
+
+/* Key I of given CPU.  Zero is a valid key but use 1 + ... anyway to
+   catch empty slots matching. */
+always_inline u64
+test_bihash_cpu_key (uword cpu, uword i)
+{ return 1 + (((u64) cpu << 32) | i); }
+
+/* Makes os_get_cpu_number return CPU for callers on this stack. */
+static void
+test_bihash_fake_cpu (uword cpu)
+{
+  clib_smp_main_t * m = &clib_smp_main;
+  uword sp = pointer_to_uword (&cpu);
+
+  /* Middle of cpu's vm region so nearby stack frames agree. */
+  sp -= (cpu << m->log2_n_per_cpu_vm_bytes)
+    + ((uword) 1 << (m->log2_n_per_cpu_vm_bytes - 1));
+  m->vm_base = uword_to_pointer (sp, void *);
+}
+
+/* Reader/writer grace period on 2 faked cpus from one thread: pages a
+   writer replaces must not be recycled until reader cpu passes a
+   quiescent point or goes offline. */
+static clib_error_t *
+test_bihash_grace_period (test_bihash_main_t * tm)
+{
+  clib_smp_main_t save = clib_smp_main;
+  clib_bihash_8_8_t _h, * h = &_h;
+  clib_bihash_kv_8_8_t kv, result;
+  clib_error_t * error = 0;
+  u32 i, n_keys, n_retired;
+  u64 reader_epoch;
+
+  clib_smp_main.n_cpus = 2;
+  clib_smp_main.log2_n_per_cpu_vm_bytes = 30;
+  test_bihash_fake_cpu (0);
+
+  clib_bihash_init_8_8 (h, "grace", 1, tm->arena_n_bytes);
+
+  /* Reader starts reading. */
+  test_bihash_fake_cpu (1);
+  clib_bihash_quiescent_8_8 (h);
+  reader_epoch = h->epoch;
+
+  /* Writer grows single bucket: each add replaces its page. */
+  test_bihash_fake_cpu (0);
+  n_keys = clib_min (BIHASH_MAX_RETIRED / 2, 4 * BIHASH_KVP_PER_PAGE);
+  for (i = 0; i < n_keys; i++)
+    {
+      kv.key[0] = test_bihash_cpu_key (0, i);
+      kv.value = test_bihash_value (kv.key[0], 0);
+      if (clib_bihash_add_del_8_8 (h, &kv, /* is_add */ 1))
+	{
+	  error = clib_error_return (0, "grace: add key %d failed", i);
+	  goto done;
+	}
+    }
+  /* Every page retired since reader's quiescent point is held back. */
+  n_retired = h->n_retired;
+  if (n_retired < 2 || n_retired != h->epoch - reader_epoch)
+    {
+      error = clib_error_return (0, "grace: %d pages retired, %Ld retirements",
+				 n_retired, h->epoch - reader_epoch);
+      goto done;
+    }
+
+  /* Reader still sees every key. */
+  test_bihash_fake_cpu (1);
+  for (i = 0; i < n_keys; i++)
+    {
+      kv.key[0] = test_bihash_cpu_key (0, i);
+      if (clib_bihash_search_8_8 (h, &kv, &result)
+	  || result.value != test_bihash_value (kv.key[0], 0))
+	{
+	  error = clib_error_return (0, "grace: reader lost key %d", i);
+	  goto done;
+	}
+    }
+
+  /* Reader passes quiescent point: next page allocation recycles
+     old pages. */
+  clib_bihash_quiescent_8_8 (h);
+  test_bihash_fake_cpu (0);
+  kv.key[0] = test_bihash_cpu_key (0, n_keys);
+  kv.value = test_bihash_value (kv.key[0], 0);
+  clib_bihash_add_del_8_8 (h, &kv, /* is_add */ 1);
+  if (h->n_retired > 1)
+    {
+      error = clib_error_return (0, "grace: %d of %d pages still retired after quiescent",
+				 h->n_retired, n_retired);
+      goto done;
+    }
+
+  /* Offline reader holds nothing back either. */
+  test_bihash_fake_cpu (1);
+  clib_bihash_offline_8_8 (h);
+  test_bihash_fake_cpu (0);
+  for (i = 0; i <= n_keys; i++)
+    {
+      kv.key[0] = test_bihash_cpu_key (0, i);
+      clib_bihash_add_del_8_8 (h, &kv, /* is_add */ 0);
+    }
+  if (h->n_retired > 1 || h->n_elts != 0)
+    error = clib_error_return (0, "grace: %d retired, %d elts after offline delete",
+			       h->n_retired, h->n_elts);
+  else
+    error = clib_bihash_validate_8_8 (h);
+
+ done:
+  test_bihash_fake_cpu (0);
+  clib_bihash_free_8_8 (h);
+  clib_smp_main = save;
+  return error;
+}
+
+static uword
+test_bihash_per_cpu_main (test_bihash_main_t * tm)
+{
+  uword my_cpu = os_get_cpu_number ();
+  clib_bihash_8_8_t * h = &tm->hash;
+  clib_bihash_kv_8_8_t kv, result;
+  u32 seed = tm->seed + my_cpu;
+  uword * present = 0, iter, i, cpu, n_errors, n_lookups, n_updates;
+  u32 version = 0;
+  u64 t[2];
+
+  if (my_cpu == 0)
+    clib_bihash_init_8_8 (h, "test", tm->n_buckets, tm->arena_n_bytes);
+
+  test_bihash_barrier (tm);
+
+  clib_bihash_quiescent_8_8 (h);
+
+  n_errors = n_lookups = n_updates = 0;
+  t[0] = clib_cpu_time_now ();
+  for (iter = 0; iter < tm->n_iter; iter++)
+    {
+      if (random_u32 (&seed) % 100 < tm->write_percent)
+	{
+	  /* Add, replace or delete one of our own keys. */
+	  i = random_u32 (&seed) % tm->n_keys;
+	  kv.key[0] = test_bihash_cpu_key (my_cpu, i);
+	  kv.value = test_bihash_value (kv.key[0], ++version);
+	  if (clib_bitmap_get (present, i) && (random_u32 (&seed) & 1))
+	    {
+	      n_errors += clib_bihash_add_del_8_8 (h, &kv, /* is_add */ 0) != 0;
+	      present = clib_bitmap_set (present, i, 0);
+	    }
+	  else
+	    {
+	      n_errors += clib_bihash_add_del_8_8 (h, &kv, /* is_add */ 1) != 0;
+	      present = clib_bitmap_set (present, i, 1);
+	    }
+	  n_updates++;
+	}
+      else
+	{
+	  /* Lookup key of random CPU.  Only own keys are known
+	     to be present or not. */
+	  cpu = random_u32 (&seed) % tm->n_cpu;
+	  i = random_u32 (&seed) % tm->n_keys;
+	  kv.key[0] = test_bihash_cpu_key (cpu, i);
+	  if (clib_bihash_search_8_8 (h, &kv, &result) == 0)
+	    n_errors += (result.key[0] != kv.key[0]
+			 || (result.value >> 8) != (kv.key[0] & pow2_mask (56))
+			 || (cpu == my_cpu && ! clib_bitmap_get (present, i)));
+	  else
+	    n_errors += cpu == my_cpu && clib_bitmap_get (present, i);
+	  n_lookups++;
+	}
+
+      if (iter % 16 == 0)
+	clib_bihash_quiescent_8_8 (h);
+    }
+  t[1] = clib_cpu_time_now ();
+
+  clib_bihash_offline_8_8 (h);
+
+  clib_smp_atomic_add (&tm->n_errors, n_errors);
+  clib_smp_atomic_add (&tm->n_elts, clib_bitmap_count_set_bits (present));
+  clib_smp_atomic_add (&tm->n_lookups, n_lookups);
+  clib_smp_atomic_add (&tm->n_updates, n_updates);
+  clib_smp_atomic_add (&tm->n_clocks, t[1] - t[0]);
+
+  clib_bitmap_free (present);
+
+  test_bihash_barrier (tm);
+
+  if (my_cpu == 0)
+    {
+      clib_error_t * error = clib_bihash_validate_8_8 (h);
+
+      if (error)
+	{
+	  clib_error_report (error);
+	  tm->n_errors += 1;
+	}
+      if (h->n_elts != tm->n_elts)
+	{
+	  clib_warning ("%d elts expected %d", h->n_elts, tm->n_elts);
+	  tm->n_errors += 1;
+	}
+      if (tm->verbose)
+	fformat (stderr, "%U\n", format_clib_bihash_8_8, h, tm->verbose);
+      clib_bihash_free_8_8 (h);
+    }
+
+  return 0;
+}
+
+clib_error_t *
+test_bihash_main (unformat_input_t * input)
+{
+  test_bihash_main_t _tm, * tm = &_tm;
+  clib_error_t * error = 0;
+  void * heap;
+  f64 dt;
+
+  memset (tm, 0, sizeof (tm[0]));
+  tm->seed = 1;
+  tm->n_cpu = 1;
+  tm->n_keys = 10000;
+  tm->n_iter = 100000;
+  tm->write_percent = 10;
+  tm->arena_n_bytes = 8 << 20;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "iter %d", &tm->n_iter))
+	;
+      else if (unformat (input, "keys %d", &tm->n_keys))
+	;
+      else if (unformat (input, "buckets %d", &tm->n_buckets))
+	;
+      else if (unformat (input, "write-percent %d", &tm->write_percent))
+	;
+      else if (unformat (input, "arena %U", unformat_memory_size, &tm->arena_n_bytes))
+	;
+      else if (unformat (input, "n-cpu %d", &tm->n_cpu))
+	;
+      else if (unformat (input, "seed %d", &tm->seed))
+	;
+      else if (unformat (input, "verbose"))
+	tm->verbose = 1;
+      else
+	{
+	  error = clib_error_create ("unknown input `%U'\n",
+				     format_unformat_error, input);
+	  goto done;
+	}
+    }
+
+  if (! tm->seed)
+    tm->seed = random_default_seed ();
+
+  if (! tm->n_buckets)
+    tm->n_buckets = clib_max (tm->n_cpu * tm->n_keys / BIHASH_KVP_PER_PAGE, 1);
+
+  clib_time_init (&tm->time);
+
+  if ((error = test_bihash_sequential_8_8 (tm)))
+    goto done;
+  if ((error = test_bihash_sequential_16_8 (tm)))
+    goto done;
+  if ((error = test_bihash_sequential_40_8 (tm)))
+    goto done;
+
+  /* Real readers and writers run only with n-cpu N > 1 (not run by
+     make check); grace periods are also checked on faked cpus. */
+  if ((error = test_bihash_grace_period (tm)))
+    goto done;
+
+  /* Bootstrap leaves us on CPU 0's heap. */
+  heap = clib_mem_get_heap ();
+  os_smp_bootstrap (tm->n_cpu, test_bihash_per_cpu_main, pointer_to_uword (tm));
+  clib_mem_set_heap (heap);
+
+  if (tm->n_errors > 0)
+    {
+      error = clib_error_return (0, "%d errors in %d cpu test", tm->n_errors, tm->n_cpu);
+      goto done;
+    }
+
+  dt = tm->n_clocks * tm->time.seconds_per_clock / tm->n_cpu;
+  if (tm->verbose)
+    fformat (stderr, "%d cpus: %.4e lookups/sec %.4e updates/sec, %d%% writes\n",
+	     tm->n_cpu, tm->n_lookups / dt, tm->n_updates / dt, tm->write_percent);
+
+ done:
+  return error;
+}
+
+#ifdef CLIB_UNIX
+int main (int argc, char * argv[])
+{
+  unformat_input_t i;
+  clib_error_t * error;
+
+  unformat_init_command_line (&i, argv);
+  error = test_bihash_main (&i);
+  unformat_free (&i);
+  if (error)
+    {
+      clib_error_report (error);
+      return 1;
+    }
+  else
+    return 0;
+}
+#endif /* CLIB_UNIX */
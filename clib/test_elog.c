@@ -26,8 +26,207 @@
 #include <clib/format.h>
 #include <clib/random.h>
 #include <clib/serialize.h>
+#include <clib/smp.h>
 #include <clib/unix.h>
 
+#ifdef CLIB_UNIX
+/* Streams events through a tiny ring, flushing whenever a half is
+   complete.  Flush must hold back newest event of a completed half
+   (it may still be being written) and stream must get every event. */
+static clib_error_t *
+test_elog_stream_small_ring (u32 ring_size, u32 n_events)
+{
+  elog_main_t _em, * em = &_em, _em2, * em2 = &_em2;
+  clib_error_t * error = 0;
+  u64 half;
+  u8 * file;
+  u32 i;
+  /* Not static: registered anew with each elog_main_t. */
+  elog_event_type_t type = {
+    .format = "stream %d",
+    .format_args = "i4",
+  };
+
+  file = format (0, "/tmp/test_elog_stream.%d%c", getpid (), 0);
+
+  elog_init (em, ring_size);
+  elog_enable_disable (em, 1);
+  half = em->event_ring_size / 2;
+  if ((error = elog_stream_file (em, (char *) file)))
+    goto done;
+
+  for (i = 0; i < n_events; i++)
+    {
+      /* Disable, enable and reset mid stream: no event may be lost and
+	 event logged while disabled must not appear. */
+      if (i == n_events / 2)
+	{
+	  elog_enable_disable (em, 0);
+	  elog (em, &type, ~0);
+	  elog_enable_disable (em, 1);
+	  elog_reset_buffer (em);
+	}
+
+      elog (em, &type, i);
+      if (elog_stream_flush_is_needed (em))
+	{
+	  if ((error = elog_stream_flush (em)))
+	    goto done;
+	  if (em->n_total_events % half == 0
+	      && em->stream->n_events_written[0] >= em->n_total_events)
+	    {
+	      error = clib_error_create ("ring %d: flush wrote newest event %Ld",
+					 em->event_ring_size, em->n_total_events - 1);
+	      goto done;
+	    }
+	}
+    }
+
+  elog_disable_after_events (em, 0);
+  if (em->stream->n_events_lost != 0)
+    {
+      error = clib_error_create ("ring %d: %Ld events lost",
+				 em->event_ring_size, em->stream->n_events_lost);
+      goto done;
+    }
+  if ((error = elog_stream_close (em)))
+    goto done;
+
+  if ((error = elog_read_stream_file (em2, (char *) file)))
+    goto done;
+  if (vec_len (em2->events) != n_events)
+    {
+      error = clib_error_create ("ring %d: stream has %d of %d events",
+				 em->event_ring_size, vec_len (em2->events), n_events);
+      goto done;
+    }
+  for (i = 0; i < n_events; i++)
+    {
+      u32 * d = (u32 *) em2->events[i].data;
+      if (d[0] != i)
+	{
+	  error = clib_error_create ("ring %d: stream event %d is %d",
+				     em->event_ring_size, i, d[0]);
+	  goto done;
+	}
+    }
+
+ done:
+  unlink ((char *) file);
+  vec_free (file);
+  return error;
+}
+#endif /* CLIB_UNIX */
+
+/* Makes os_get_cpu_number return CPU for callers on this stack. */
+static void test_elog_fake_cpu (uword cpu)
+{
+  clib_smp_main_t * m = &clib_smp_main;
+  uword sp = pointer_to_uword (&cpu);
+
+  /* Middle of cpu's vm region so nearby stack frames agree. */
+  sp -= (cpu << m->log2_n_per_cpu_vm_bytes)
+    + ((uword) 1 << (m->log2_n_per_cpu_vm_bytes - 1));
+  m->vm_base = uword_to_pointer (sp, void *);
+}
+
+/* Logs round robin on faked cpus so each cpu gets its own ring.  Peek
+   must merge rings in time order with default track events on "cpu N"
+   tracks, and merging into per cpu log must give single ring. */
+static clib_error_t *
+test_elog_per_cpu (u32 n_cpus, u32 ring_size, u32 n_events)
+{
+  clib_smp_main_t save = clib_smp_main;
+  elog_main_t _em, * em = &_em, _em2, * em2 = &_em2;
+  elog_event_t * es, * e;
+  clib_error_t * error = 0;
+  u32 i, n_expect, first;
+  /* Not static: registered anew with each elog_main_t. */
+  elog_track_t other = { .name = "other" };
+  elog_event_type_t type = {
+    .format = "cpu event %d",
+    .format_args = "i4",
+  }, type2 = type;
+
+  clib_smp_main.n_cpus = n_cpus;
+  clib_smp_main.log2_n_per_cpu_vm_bytes = 30;
+  test_elog_fake_cpu (0);
+
+  memset (em2, 0, sizeof (em2[0]));
+  elog_init (em, ring_size);
+  elog_enable_disable (em, 1);
+  if (vec_len (em->per_cpu) != n_cpus)
+    {
+      error = clib_error_create ("%d cpus have %d rings", n_cpus, vec_len (em->per_cpu));
+      goto done;
+    }
+
+  /* Every 5th event on its own track; it must stay there. */
+  for (i = 0; i < n_events; i++)
+    {
+      u32 * d;
+      test_elog_fake_cpu (i % n_cpus);
+      if (i % 5 == 0)
+	d = elog_event_data (em, &type, &other, clib_cpu_time_now ());
+      else
+	d = elog_event_data (em, &type, &em->default_track, clib_cpu_time_now ());
+      d[0] = i;
+    }
+  test_elog_fake_cpu (0);
+
+  /* Each ring keeps its newest events: all but oldest events survive. */
+  n_expect = clib_min (n_events, n_cpus * em->event_ring_size);
+  first = n_events - n_expect;
+  es = elog_peek_events (em);
+  if (vec_len (es) != n_expect)
+    {
+      error = clib_error_create ("peek %d events, expected %d", vec_len (es), n_expect);
+      goto done;
+    }
+  vec_foreach (e, es)
+    {
+      u32 d = ((u32 *) e->data)[0];
+      elog_track_t * t = vec_elt_at_index (em->tracks, e->track);
+      u8 * name;
+
+      if (d != first + (e - es) || (e > es && e->time < e[-1].time))
+	{
+	  error = clib_error_create ("event %d is %d, not time ordered", e - es, d);
+	  goto done;
+	}
+      if (d % 5 == 0)
+	name = format (0, "other%c", 0);
+      else
+	name = format (0, "cpu %d%c", d % n_cpus, 0);
+      if (strcmp (t->name, (char *) name))
+	error = clib_error_create ("event %d on track `%s', expected `%s'",
+				   d, t->name, name);
+      vec_free (name);
+      if (error)
+	goto done;
+    }
+  vec_free (es);
+
+  /* Merge rebuilds destination as single ring. */
+  elog_init (em2, ring_size);
+  elog_enable_disable (em2, 1);
+  elog (em2, &type2, 1234);
+  elog_merge (em, 0, em2, (u8 *) "src");
+  if (em->per_cpu
+      || vec_len (em->events) != n_expect + 1
+      || em->n_total_events != n_expect + 1
+      || vec_len (em->event_ring) < n_expect + 1)
+    error = clib_error_create ("merge into per cpu log: %d events, %d ring",
+			       vec_len (em->events), vec_len (em->event_ring));
+
+ done:
+  /* Merged types and tracks are copies: each log frees its own. */
+  elog_free (em);
+  elog_free (em2);
+  clib_smp_main = save;
+  return error;
+}
+
 int test_elog_main (unformat_input_t * input)
 {
   clib_error_t * error = 0;
@@ -35,7 +234,8 @@ int test_elog_main (unformat_input_t * input)
   elog_main_t _em, * em = &_em;
   u32 verbose;
   f64 min_sample_time;
-  char * dump_file, * load_file, * merge_file, ** merge_files;
+  char * dump_file, * load_file, * merge_file, ** merge_files, * merge_to_file;
+  char * stream_file, * load_stream_file, * chrome_file;
   u8 * tag, ** tags;
 
   n_iter = 100;
@@ -44,7 +244,9 @@ int test_elog_main (unformat_input_t * input)
   verbose = 0;
   dump_file = 0;
   load_file = 0;
+  stream_file = load_stream_file = chrome_file = 0;
   merge_files = 0;
+  merge_to_file = 0;
   tags = 0;
   min_sample_time = 2;
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
@@ -55,10 +257,18 @@ int test_elog_main (unformat_input_t * input)
 	;
       else if (unformat (input, "dump %s", &dump_file))
 	;
+      else if (unformat (input, "load-stream %s", &load_stream_file))
+	;
       else if (unformat (input, "load %s", &load_file))
 	;
+      else if (unformat (input, "stream %s", &stream_file))
+	;
+      else if (unformat (input, "chrome %s", &chrome_file))
+	;
       else if (unformat (input, "tag %s", &tag))
         vec_add1 (tags, tag);
+      else if (unformat (input, "merge-to %s", &merge_to_file))
+	;
       else if (unformat (input, "merge %s", &merge_file))
 	vec_add1 (merge_files, merge_file);
 
@@ -83,6 +293,19 @@ int test_elog_main (unformat_input_t * input)
 	goto done;
     }
 
+  else if (load_stream_file)
+    {
+      if ((error = elog_read_stream_file (em, load_stream_file)))
+	goto done;
+    }
+
+  else if (merge_files && merge_to_file)
+    {
+      if ((error = elog_merge_files (merge_to_file, merge_files, tags))
+	  || (error = elog_read_file (em, merge_to_file)))
+	goto done;
+    }
+
   else if (merge_files)
     {
       uword i;
@@ -108,18 +331,51 @@ int test_elog_main (unformat_input_t * input)
     {
       f64 t[2];
 
+#ifdef CLIB_UNIX
+      /* Smallest rings flush at every half boundary. */
+      for (i = 2; i <= 4; i *= 2)
+	if ((error = test_elog_stream_small_ring (i, 100)))
+	  goto done;
+#endif
+
+      /* 3 cpus: no wrap, wrap. */
+      if ((error = test_elog_per_cpu (3, 16, 20))
+	  || (error = test_elog_per_cpu (3, 8, 100)))
+	goto done;
+
       elog_init (em, max_events);
       elog_enable_disable (em, 1);
       t[0] = unix_time_now ();
 
+#ifdef CLIB_UNIX
+      if (stream_file && (error = elog_stream_file (em, stream_file)))
+	goto done;
+#endif
+
       for (i = 0; i < n_iter; i++)
 	{
 	  u32 j, n, sum;
+	  ELOG_TRACK (spans);
+
+	  {
+	    ELOG_TYPE_SPAN_BEGIN (e, "iteration %d");
+	    u32 * d = ELOG_TRACK_DATA (em, e, spans);
+	    d[0] = i;
+	  }
 
 	  n = 1 + (random_u32 (&seed) % 128);
 	  sum = 0;
+	  {
+	    ELOG_TYPE_SPAN_BEGIN (e, "sum %d");
+	    u32 * d = ELOG_TRACK_DATA (em, e, spans);
+	    d[0] = n;
+	  }
 	  for (j = 0; j < n; j++)
 	    sum += random_u32 (&seed);
+	  {
+	    ELOG_TYPE_SPAN_END (e, "sum done");
+	    (void) ELOG_TRACK_DATA (em, e, spans);
+	  }
 
 	  {
 	    ELOG_TYPE_XF (e);
@@ -187,19 +443,130 @@ int test_elog_main (unformat_input_t * input)
 	    d = ELOG_DATA (em, e);
 	    d->offset = elog_string (em, "string table %d", i);
 	  }
+
+	  {
+	    ELOG_TYPE_SPAN_END (e, "iteration done");
+	    (void) ELOG_TRACK_DATA (em, e, spans);
+	  }
+
+	  if (elog_stream_flush_is_needed (em)
+	      && (error = elog_stream_flush (em)))
+	    goto done;
 	}
 
       do {
 	t[1] = unix_time_now ();
       } while (t[1] - t[0] < min_sample_time);
+
+      /* Each iteration has a sum span nested in an iteration span. */
+      {
+	elog_event_t * es = elog_get_events (em);
+	elog_span_t * spans = elog_get_spans (em, es), * s;
+
+	vec_foreach (s, spans)
+	  {
+	    elog_event_type_t * b = em->event_types + es[s->begin].type;
+	    elog_event_type_t * e = em->event_types + es[s->end].type;
+	    if (! (b->flags & ELOG_EVENT_TYPE_FLAG_SPAN_BEGIN)
+		|| ! (e->flags & ELOG_EVENT_TYPE_FLAG_SPAN_END)
+		|| es[s->begin].track != es[s->end].track
+		|| es[s->begin].time > es[s->end].time
+		|| s->depth > 1)
+	      {
+		error = clib_error_create ("bad span %d", s - spans);
+		goto done;
+	      }
+	  }
+	if (em->n_total_events <= em->event_ring_size
+	    && vec_len (spans) != 2 * n_iter)
+	  {
+	    error = clib_error_create ("%d spans for %d iterations",
+				       vec_len (spans), n_iter);
+	    goto done;
+	  }
+	vec_free (spans);
+      }
+
+#ifdef CLIB_UNIX
+      /* Stream must have all events logged. */
+      if (stream_file)
+	{
+	  elog_main_t _em2, * em2 = &_em2;
+	  u64 n_lost = em->stream->n_events_lost;
+
+	  if ((error = elog_stream_close (em)))
+	    goto done;
+	  if ((error = elog_read_stream_file (em2, stream_file)))
+	    goto done;
+	  if (n_lost != 0 || vec_len (em2->events) != em->n_total_events)
+	    {
+	      error = clib_error_create ("stream has %d events, %Ld logged, %Ld lost",
+					 vec_len (em2->events), em->n_total_events, n_lost);
+	      goto done;
+	    }
+	}
+#endif
     }
 
+  /* Compact encoding must give back same events. */
+  {
+    elog_main_t _em2, * em2 = &_em2;
+    serialize_main_t m;
+    elog_event_t * es, * es2;
+    u8 * v, * s = 0, * s2 = 0;
+
+    serialize_open_vector (&m, 0);
+    if ((error = serialize (&m, serialize_elog_main, em)))
+      goto done;
+    v = serialize_close_vector (&m);
+
+    unserialize_open_data (&m, v, vec_len (v));
+    if ((error = unserialize (&m, unserialize_elog_main, em2)))
+      goto done;
+
+    es = elog_get_events (em);
+    es2 = elog_get_events (em2);
+    if (vec_len (es) != vec_len (es2))
+      {
+	error = clib_error_create ("serialize: %d events, read back %d",
+				   vec_len (es), vec_len (es2));
+	goto done;
+      }
+    for (i = 0; i < vec_len (es); i++)
+      {
+	vec_reset_length (s);
+	vec_reset_length (s2);
+	s = format (s, "%.9f %U %U", es[i].time,
+		    format_elog_track, em, es + i, format_elog_event, em, es + i);
+	s2 = format (s2, "%.9f %U %U", es2[i].time,
+		     format_elog_track, em2, es2 + i, format_elog_event, em2, es2 + i);
+	if (vec_len (s) != vec_len (s2) || memcmp (s, s2, vec_len (s)))
+	  {
+	    error = clib_error_create ("serialize: event %d `%v' read back as `%v'",
+				       i, s, s2);
+	    goto done;
+	  }
+      }
+
+    if (verbose)
+      clib_warning ("%d events serialize to %d bytes", vec_len (es), vec_len (v));
+    vec_free (s);
+    vec_free (s2);
+    vec_free (v);
+  }
+
 #ifdef CLIB_UNIX
   if (dump_file)
     {
       if ((error = elog_write_file (em, dump_file)))
 	goto done;
     }
+
+  if (chrome_file)
+    {
+      if ((error = elog_write_chrome_trace_file (em, chrome_file)))
+	goto done;
+    }
 #endif
 
   if (verbose)
@@ -216,7 +583,10 @@ int test_elog_main (unformat_input_t * input)
 
  done:
   if (error)
-    clib_error_report (error);
+    {
+      clib_error_report (error);
+      return 1;
+    }
   return 0;
 }
 
@@ -38,6 +38,8 @@
 #include <clib/error.h>
 #include <clib/format.h>
 #include <clib/bitmap.h>
+#include <clib/filter.h>
+#include <clib/serialize.h>
 
 static int verbose;
 #define if_verbose(format,args...) \
@@ -60,6 +62,12 @@ typedef struct {
   /* Verbosity level for hash formats. */
   int verbose;
 
+  /* Flags for hash create (e.g. HASH_FLAG_OPEN_ADDRESSING). */
+  u32 hash_flags;
+
+  /* Non-zero to put filter in front of tables. */
+  u32 use_filter;
+
   /* Random number seed. */
   u32 seed;
 } hash_test_t;
@@ -83,6 +91,321 @@ static clib_error_t * hash_next_test (word * h)
   return error;
 }
 
+/* Check that batch lookup agrees with hash_get. */
+static clib_error_t * test_get_multiple (void * h, uword * keys, uword n_keys)
+{
+  uword ** results = 0;
+  clib_error_t * error = 0;
+  uword i;
+
+  vec_resize (results, n_keys);
+  hash_get_multiple (h, keys, n_keys, results);
+  for (i = 0; i < n_keys; i++)
+    if ((error = CLIB_ERROR_ASSERT (results[i] == _hash_get (h, keys[i]))))
+      break;
+  vec_free (results);
+  return error;
+}
+
+/* Grow and shrink table with incremental resize, checking lookups
+   while pairs are split between old and new tables. */
+static clib_error_t * test_incremental_resize (hash_test_t * ht)
+{
+  word * h;
+  uword * keys = 0, * p;
+  uword i, j, n_keys, saw_resize;
+  clib_error_t * error = 0;
+
+  n_keys = clib_max (ht->n_pairs, 4096);
+  for (i = 0; i < n_keys; i++)
+    vec_add1 (keys, i + 1);
+
+  h = hash_create3 (0, 0, sizeof (uword),
+		    (hash_key_sum_function_t *) KEY_FUNC_NONE,
+		    (hash_key_equal_function_t *) KEY_FUNC_NONE,
+		    0, 0, ht->hash_flags | HASH_FLAG_INCREMENTAL_RESIZE);
+  if (ht->use_filter)
+    hash_enable_filter (h);
+
+  saw_resize = 0;
+  for (i = 0; i < n_keys; i++)
+    {
+      hash_set (h, keys[i], i);
+      saw_resize |= hash_header (h)->resize_old != 0;
+
+      j = random_u32 (&ht->seed) % (i + 1);
+      p = hash_get (h, keys[j]);
+      if ((error = CLIB_ERROR_ASSERT (p && p[0] == j)))
+	goto done;
+
+      if ((i % 256) == 0)
+	{
+	  if ((error = hash_validate (h)))
+	    goto done;
+	  if ((error = hash_next_test (h)))
+	    goto done;
+	  if ((error = test_get_multiple (h, keys, n_keys)))
+	    goto done;
+	}
+    }
+
+  if ((error = CLIB_ERROR_ASSERT (saw_resize && hash_elts (h) == n_keys)))
+    goto done;
+
+  for (i = 0; i < n_keys; i++)
+    {
+      hash_unset (h, keys[i]);
+
+      if (i + 1 < n_keys)
+	{
+	  j = i + 1 + random_u32 (&ht->seed) % (n_keys - i - 1);
+	  p = hash_get (h, keys[j]);
+	  if ((error = CLIB_ERROR_ASSERT (p && p[0] == j)))
+	    goto done;
+	}
+
+      if ((i % 256) == 0)
+	{
+	  if ((error = hash_validate (h)))
+	    goto done;
+	  if ((error = test_get_multiple (h, keys, n_keys)))
+	    goto done;
+	}
+    }
+
+  error = CLIB_ERROR_ASSERT (hash_elts (h) == 0);
+
+ done:
+  hash_free (h);
+  vec_free (keys);
+  return error;
+}
+
+/* Filter must accept every added key, reject most others and return
+   to all zero counters when keys are deleted. */
+static clib_error_t * test_filter (hash_test_t * ht)
+{
+  clib_filter_t _f, * f = &_f;
+  uword * hashes = 0, i, j, n, n_false_positive, may_contain;
+  clib_error_t * error = 0;
+  f64 rate;
+
+  n = clib_max (ht->n_pairs, 4096);
+  for (i = 0; i < 2 * n; i++)
+    vec_add1 (hashes, random_u32 (&ht->seed) ^ ((uword) random_u32 (&ht->seed) << 16));
+
+  clib_filter_init (f, n);
+  for (i = 0; i < n; i++)
+    clib_filter_add (f, hashes[i]);
+
+  n_false_positive = 0;
+  for (i = 0; i < 2 * n; i += j)
+    {
+      j = clib_min (2 * n - i, BITS (uword));
+      may_contain = clib_filter_may_contain_multiple (f, hashes + i, j);
+      for (j = 0; j < BITS (uword) && i + j < 2 * n; j++)
+	{
+	  if (((may_contain >> j) & 1) != (clib_filter_may_contain (f, hashes[i + j]) != 0))
+	    {
+	      error = clib_error_return (0, "batch and single probe differ for key %wd", i + j);
+	      goto done;
+	    }
+	  if (i + j < n && ! ((may_contain >> j) & 1))
+	    {
+	      error = clib_error_return (0, "key %wd rejected", i + j);
+	      goto done;
+	    }
+	  n_false_positive += i + j >= n && ((may_contain >> j) & 1);
+	}
+    }
+
+  rate = (f64) n_false_positive / n;
+  if_verbose ("%U, measured false positives %.2f%%", format_clib_filter, f, 100 * rate);
+  if (rate > .05)
+    {
+      error = clib_error_return (0, "false positive rate %.4f too high", rate);
+      goto done;
+    }
+
+  for (i = 0; i < n; i++)
+    clib_filter_del (f, hashes[i]);
+  for (i = 0; i < vec_len (f->counters); i++)
+    if (f->counters[i] != 0 && f->n_saturated == 0)
+      {
+	error = clib_error_return (0, "counters not zero after deleting all keys");
+	goto done;
+      }
+
+ done:
+  clib_filter_free (f);
+  vec_free (hashes);
+  return error;
+}
+
+/* Lookup counters must see every get; stats pass must account for
+   every pair. */
+static clib_error_t * test_stats (hash_test_t * ht)
+{
+  word * h;
+  uword * keys = 0, ** results = 0;
+  uword i, n_keys, n_pairs, n_probed;
+  hash_stats_t stats;
+  clib_error_t * error = 0;
+
+  memset (&stats, 0, sizeof (stats));
+  n_keys = clib_max (ht->n_pairs, 1024);
+  for (i = 0; i < 2 * n_keys; i++)
+    vec_add1 (keys, i + 1);
+
+  h = hash_create3 (0, 0, sizeof (uword),
+		    (hash_key_sum_function_t *) KEY_FUNC_NONE,
+		    (hash_key_equal_function_t *) KEY_FUNC_NONE,
+		    0, 0, ht->hash_flags | HASH_FLAG_STATS);
+  if (ht->use_filter)
+    hash_enable_filter (h);
+
+  for (i = 0; i < n_keys; i++)
+    hash_set (h, keys[i], i);
+
+  /* First half of keys are present; second half absent. */
+  for (i = 0; i < 2 * n_keys; i++)
+    (void) hash_get (h, keys[i]);
+  vec_resize (results, 2 * n_keys);
+  hash_get_multiple (h, keys, 2 * n_keys, results);
+
+  hash_get_stats (h, &stats);
+  if_verbose ("%U", format_hash_stats, &stats);
+
+  if ((error = CLIB_ERROR_ASSERT (stats.n_get_hits == 2 * n_keys
+				  && stats.n_get_misses == 2 * n_keys
+				  && stats.n_get_hit_compares >= stats.n_get_hits
+				  && stats.n_resizes > 0)))
+    goto done;
+
+  n_pairs = n_probed = 0;
+  for (i = 0; i < vec_len (stats.bucket_length_counts); i++)
+    n_pairs += i * stats.bucket_length_counts[i];
+  for (i = 0; i < vec_len (stats.probe_length_counts); i++)
+    n_probed += stats.probe_length_counts[i];
+  if ((error = CLIB_ERROR_ASSERT (n_pairs == n_keys
+				  && n_probed == n_keys
+				  && stats.n_user_buckets + stats.n_indirect_buckets
+				     + stats.n_empty_buckets + stats.n_deleted_buckets
+				     == stats.n_buckets
+				  && stats.average_hit_probes >= 1)))
+    goto done;
+
+  hash_clear_stats (h);
+  error = CLIB_ERROR_ASSERT (hash_header (h)->n_get_hits == 0);
+
+ done:
+  hash_free_stats (&stats);
+  hash_free (h);
+  vec_free (keys);
+  vec_free (results);
+  return error;
+}
+
+/* u32 -> u32 table: compare against word table, iterate and
+   round trip through serialize. */
+static clib_error_t * test_compact (hash_test_t * ht)
+{
+  uword * h = 0, * w = 0, * h1 = 0, * p;
+  u32 * keys = 0, * q, k, v;
+  uword i, n_keys, n_found;
+  serialize_main_t m;
+  u8 * data;
+  clib_error_t * error = 0;
+
+  n_keys = clib_max (ht->n_pairs, 4096);
+  for (i = 0; i < n_keys; i++)
+    vec_add1 (keys, 1 + random_u32 (&ht->seed));
+
+  h = hash_create_compact_u32 (0);
+  w = hash_create (0, sizeof (uword));
+  if (ht->use_filter)
+    hash_enable_filter (h);
+
+  /* Word sets store low order half of value. */
+  for (i = 0; i < n_keys; i++)
+    {
+      if (i % 2)
+	hash_set_u32 (h, keys[i], i);
+      else
+	hash_set (h, keys[i], i);
+      hash_set (w, keys[i], i);
+    }
+
+  if ((error = hash_validate (h)))
+    goto done;
+  if ((error = CLIB_ERROR_ASSERT (hash_elts (h) == hash_elts (w))))
+    goto done;
+
+  if_verbose ("compact %U", format_hash, h, 0);
+  if_verbose ("word %U", format_hash, w, 0);
+  if (uword_bits == 64
+      && (error = CLIB_ERROR_ASSERT (hash_bytes (h) < hash_bytes (w))))
+    goto done;
+
+  for (i = 0; i < n_keys; i++)
+    {
+      q = hash_get_u32 (h, keys[i]);
+      p = hash_get (w, keys[i]);
+      if ((error = CLIB_ERROR_ASSERT (q && q[0] == p[0])))
+	goto done;
+    }
+
+  n_found = 0;
+  hash_foreach (k, v, h, ({
+    p = hash_get (w, k);
+    n_found += p && p[0] == v;
+  }));
+  if ((error = CLIB_ERROR_ASSERT (n_found == hash_elts (w))))
+    goto done;
+
+  serialize_open_vector (&m, 0);
+  hash_serialize (&m, h);
+  data = serialize_close_vector (&m);
+  unserialize_open_data (&m, data, vec_len (data));
+  hash_unserialize (&m, &h1);
+  unserialize_close (&m);
+  vec_free (data);
+
+  if ((error = CLIB_ERROR_ASSERT (h1 && hash_elts (h1) == hash_elts (h)
+				  && hash_is_compact (hash_header (h1))
+				     == hash_is_compact (hash_header (h)))))
+    goto done;
+  hash_foreach (k, v, h, ({
+    q = hash_get_u32 (h1, k);
+    if ((error = CLIB_ERROR_ASSERT (q && q[0] == v)))
+      break;
+  }));
+  if (error)
+    goto done;
+
+  for (i = 0; i < n_keys; i += 2)
+    {
+      hash_unset (h, keys[i]);
+      hash_unset (w, keys[i]);
+    }
+  if ((error = hash_validate (h)))
+    goto done;
+  for (i = 0; i < n_keys; i++)
+    {
+      q = hash_get_u32 (h, keys[i]);
+      p = hash_get (w, keys[i]);
+      if ((error = CLIB_ERROR_ASSERT ((q != 0) == (p != 0) && (! q || q[0] == p[0]))))
+	goto done;
+    }
+
+ done:
+  hash_free (h);
+  hash_free (h1);
+  hash_free (w);
+  vec_free (keys);
+  return error;
+}
+
 static u8 * test1_format (u8 * s, va_list * args)
 {
   void * CLIB_UNUSED (user_arg) = va_arg (*args, void *);
@@ -108,11 +431,16 @@ static clib_error_t * test_word_key (hash_test_t * ht)
   vec_resize (keys, ht->n_pairs);
   vec_resize (vals, vec_len (keys));
 
-  h = hash_create (ht->fixed_hash_size, sizeof (vals[0]));
+  h = hash_create3 (ht->fixed_hash_size, 0, sizeof (vals[0]),
+		    (hash_key_sum_function_t *) KEY_FUNC_NONE,
+		    (hash_key_equal_function_t *) KEY_FUNC_NONE,
+		    0, 0, ht->hash_flags);
 
   hash_set_pair_format (h, test1_format, 0);
   if (ht->fixed_hash_size)
     hash_set_flags (h, HASH_FLAG_NO_AUTO_GROW | HASH_FLAG_NO_AUTO_SHRINK);
+  if (ht->use_filter)
+    hash_enable_filter (h);
 
   {
     uword * unique = 0;
@@ -176,6 +504,9 @@ static clib_error_t * test_word_key (hash_test_t * ht)
 	      goto done;
 	  }
 	}
+
+      if ((error = test_get_multiple (h, (uword *) keys, vec_len (keys))))
+	goto done;
     }
 
   if ((error = hash_next_test (h)))
@@ -211,6 +542,9 @@ static clib_error_t * test_word_key (hash_test_t * ht)
 	      goto done;
 	  }
 	}
+
+      if ((error = test_get_multiple (h, (uword *) keys, vec_len (keys))))
+	goto done;
     }
 
  done:
@@ -251,10 +585,14 @@ static clib_error_t * test_string_key (hash_test_t * ht)
   vec_resize (keys, ht->n_pairs);
   vec_resize (vals, vec_len (keys));
 
-  h = hash_create_vec (ht->fixed_hash_size, sizeof (keys[0][0]), sizeof (uword));
+  h = hash_create3 (ht->fixed_hash_size, sizeof (keys[0][0]), sizeof (uword),
+		    vec_key_sum, vec_key_equal, vec_key_format_pair, 0,
+		    ht->hash_flags);
   hash_set_pair_format (h, test2_format, 0);
   if (ht->fixed_hash_size)
     hash_set_flags (h, HASH_FLAG_NO_AUTO_SHRINK | HASH_FLAG_NO_AUTO_GROW);
+  if (ht->use_filter)
+    hash_enable_filter (h);
 
   for (i = 0; i < vec_len (keys); i++)
     {
@@ -299,6 +637,9 @@ static clib_error_t * test_string_key (hash_test_t * ht)
 	      goto done;
 	  }
 	}
+
+      if ((error = test_get_multiple (h, (uword *) keys, vec_len (keys))))
+	goto done;
     }
 
   if ((error = hash_next_test (h)))
@@ -334,6 +675,9 @@ static clib_error_t * test_string_key (hash_test_t * ht)
 	      goto done;
 	  }
 	}
+
+      if ((error = test_get_multiple (h, (uword *) keys, vec_len (keys))))
+	goto done;
     }
 
  done:
@@ -380,13 +724,39 @@ int test_hash_main (unformat_input_t * input)
   if_verbose   ("testing %d iterations, seed %d",
 		ht->n_iterations, ht->seed);
 
-  error = test_word_key (ht);
+  error = test_filter (ht);
   if (error)
     clib_error_report (error);
 
-  error = test_string_key (ht);
-  if (error)
-    clib_error_report (error);
+  /* Test both chained and open addressed tables, with and without filter. */
+  for (ht->hash_flags = 0;
+       ht->hash_flags <= HASH_FLAG_OPEN_ADDRESSING;
+       ht->hash_flags += HASH_FLAG_OPEN_ADDRESSING)
+    for (ht->use_filter = 0; ht->use_filter <= 1; ht->use_filter++)
+      {
+	error = test_word_key (ht);
+	if (error)
+	  clib_error_report (error);
+
+	error = test_string_key (ht);
+	if (error)
+	  clib_error_report (error);
+
+	error = test_incremental_resize (ht);
+	if (error)
+	  clib_error_report (error);
+
+	error = test_stats (ht);
+	if (error)
+	  clib_error_report (error);
+      }
+
+  for (ht->use_filter = 0; ht->use_filter <= 1; ht->use_filter++)
+    {
+      error = test_compact (ht);
+      if (error)
+	clib_error_report (error);
+    }
 
   return 0;
 }
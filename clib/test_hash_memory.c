@@ -0,0 +1,383 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/* Compares hash_memory kernels: speed in bytes/clock and distribution
+   of hash values over power of 2 sized tables. */
+
+#include <clib/hash.h>
+#include <clib/format.h>
+#include <clib/random.h>
+#include <clib/time.h>
+
+typedef struct {
+  char * name;
+  hash_memory_function_t * function;
+} test_hash_memory_kernel_t;
+
+typedef struct {
+  u32 seed, n_keys, n_iter, verbose;
+
+  test_hash_memory_kernel_t * kernels;
+
+  /* Sum of benchmark hashes. */
+  uword sum;
+
+  clib_time_t time;
+} test_hash_memory_main_t;
+
+static void add_kernels (test_hash_memory_main_t * tm)
+{
+  test_hash_memory_kernel_t * k;
+
+  vec_add2 (tm->kernels, k, 1);
+  k->name = "jenkins";
+#if uword_bits == 64
+  k->function = hash_memory64;
+#else
+  k->function = hash_memory32;
+#endif
+
+#ifdef HASH_MEMORY_X86_KERNELS
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse4.2"))
+    {
+      vec_add2 (tm->kernels, k, 1);
+      k->name = "crc32c";
+      k->function = hash_memory64_crc32c;
+    }
+  if (__builtin_cpu_supports ("sse4.2") && __builtin_cpu_supports ("avx2"))
+    {
+      vec_add2 (tm->kernels, k, 1);
+      k->name = "avx2";
+      k->function = hash_memory64_avx2;
+    }
+#endif
+}
+
+#ifdef HASH_MEMORY_X86_KERNELS
+/* Scalar version of one 32 byte block of avx2 kernel. */
+static void
+hash_memory64_avx2_reference_block (u64 * acc, u8 * q)
+{
+  static u64 k[4] = { 0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL,
+		      0x94d049bb133111ebULL, 0xc2b2ae3d27d4eb4fULL, };
+  u64 x[4], y;
+  uword l;
+
+  memcpy (x, q, sizeof (x));
+  for (l = 0; l < 4; l++)
+    {
+      acc[l] += x[l ^ 1];
+      y = x[l] ^ k[l];
+      acc[l] += (y & 0xffffffff) * (y >> 32);
+    }
+}
+
+static u64 hash_memory64_avx2_reference (void * p, word n_bytes, u64 state)
+{
+  u8 * q = p;
+  u64 acc[4][4], a, b, c;
+  word i, l, n;
+
+  if (n_bytes < 2048)
+    return hash_memory64_crc32c (p, n_bytes, state);
+
+  for (i = 0; i < 4; i++)
+    for (l = 0; l < 4; l++)
+      acc[i][l] = state;
+
+  for (n = n_bytes; n >= sizeof (acc); n -= sizeof (acc))
+    for (i = 0; i < 4; i++)
+      {
+	hash_memory64_avx2_reference_block (acc[i], q);
+	q += sizeof (acc[i]);
+      }
+
+  for (; n >= sizeof (acc[0]); n -= sizeof (acc[0]))
+    {
+      hash_memory64_avx2_reference_block (acc[0], q);
+      q += sizeof (acc[0]);
+    }
+
+  a = b = 0x9e3779b97f4a7c13LL;
+  c = state + n_bytes;
+  for (i = 0; i < 4; i++)
+    {
+      a += acc[i][0] ^ acc[i][2];
+      b += acc[i][1] ^ acc[i][3];
+      hash_mix64 (a, b, c);
+    }
+
+  return hash_memory64_crc32c (q, n, c);
+}
+#endif
+
+/* Hash must only depend on key bytes: not on alignment and not on
+   bytes following key.  Lengths cover short keys and long keys
+   (vector kernels start at 2k bytes) including partial 32 byte blocks. */
+static clib_error_t *
+test_kernel_consistency (test_hash_memory_main_t * tm,
+			 test_hash_memory_kernel_t * k)
+{
+  u8 * buf = 0, * copy = 0;
+  uword i, n, o, h0, h1;
+  uword * lengths = 0;
+  clib_error_t * error = 0;
+
+  for (n = 0; n <= 512; n++)
+    vec_add1 (lengths, n);
+  for (n = 2048 - 64; n <= 2048 + 192; n++)
+    vec_add1 (lengths, n);
+  for (n = 4096 - 33; n <= 4096 + 161; n += 7)
+    vec_add1 (lengths, n);
+
+  vec_resize (buf, 4096 + 256 + 16);
+  vec_resize (copy, vec_len (buf));
+  for (n = 0; n < vec_len (buf); n++)
+    buf[n] = random_u32 (&tm->seed) >> 24;
+
+  for (i = 0; i < vec_len (lengths); i++)
+    {
+      n = lengths[i];
+      h0 = k->function (buf, n, 0);
+
+#ifdef HASH_MEMORY_X86_KERNELS
+      if (k->function == hash_memory64_avx2
+	  && h0 != hash_memory64_avx2_reference (buf, n, 0))
+	{
+	  error = clib_error_return (0, "%s: length %wd differs from scalar reference",
+				     k->name, n);
+	  goto done;
+	}
+#endif
+
+      for (o = 1; o < 8; o++)
+	{
+	  memset (copy, ~buf[n], vec_len (copy));
+	  memcpy (copy + o, buf, n);
+	  h1 = k->function (copy + o, n, 0);
+	  if (h0 != h1)
+	    {
+	      error = clib_error_return (0, "%s: length %wd offset %wd hash mismatch",
+					 k->name, n, o);
+	      goto done;
+	    }
+	}
+    }
+
+ done:
+  vec_free (lengths);
+  vec_free (buf);
+  vec_free (copy);
+  return error;
+}
+
+/* Chi-squared statistic per bucket (expected value 1) for N keys
+   hashed into N buckets. */
+static f64
+key_distribution (test_hash_memory_kernel_t * k, u8 ** keys)
+{
+  u32 * counts = 0;
+  uword i, n_buckets;
+  f64 e, d, sum;
+
+  n_buckets = max_pow2 (vec_len (keys));
+  vec_validate (counts, n_buckets - 1);
+  for (i = 0; i < vec_len (keys); i++)
+    counts[k->function (keys[i], vec_len (keys[i]), 0) & (n_buckets - 1)] += 1;
+
+  e = (f64) vec_len (keys) / n_buckets;
+  sum = 0;
+  for (i = 0; i < n_buckets; i++)
+    {
+      d = counts[i] - e;
+      sum += d * d / e;
+    }
+
+  vec_free (counts);
+  return sum / n_buckets;
+}
+
+static f64
+bytes_per_clock (test_hash_memory_main_t * tm,
+		 test_hash_memory_kernel_t * k,
+		 u8 * data, uword n_bytes)
+{
+  uword i, sum = 0;
+  u64 t[2];
+
+  t[0] = clib_cpu_time_now ();
+  for (i = 0; i < tm->n_iter; i++)
+    sum += k->function (data, n_bytes, sum);
+  t[1] = clib_cpu_time_now ();
+
+  /* Keep loop from being optimized away. */
+  tm->sum += sum;
+
+  return (f64) n_bytes * tm->n_iter / (t[1] - t[0]);
+}
+
+clib_error_t *
+test_hash_memory_main (unformat_input_t * input)
+{
+  test_hash_memory_main_t _tm, * tm = &_tm;
+  clib_error_t * error = 0;
+  u8 ** key_sets[4], * data = 0;
+  char * key_set_names[4] = { "decimal", "counter", "random", "long", };
+  uword sizes[] = { 8, 16, 32, 64, 256, 1024, 4096, 16384, };
+  uword i, j, s;
+  f64 chi;
+
+  memset (tm, 0, sizeof (tm[0]));
+  memset (key_sets, 0, sizeof (key_sets));
+  tm->seed = 1;
+  tm->n_keys = 1 << 16;
+  tm->n_iter = 1000;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "iter %d", &tm->n_iter))
+	;
+      else if (unformat (input, "seed %d", &tm->seed))
+	;
+      else if (unformat (input, "keys %d", &tm->n_keys))
+	;
+      else if (unformat (input, "verbose"))
+	tm->verbose = 1;
+      else
+	{
+	  error = clib_error_create ("unknown input `%U'\n",
+				     format_unformat_error, input);
+	  goto done;
+	}
+    }
+
+  if (! tm->seed)
+    tm->seed = random_default_seed ();
+
+  clib_time_init (&tm->time);
+  add_kernels (tm);
+
+  /* Decimal strings, 16 byte little endian counters, random 40 byte keys
+     and (fewer) 2k byte keys differing only in a counter. */
+  for (i = 0; i < tm->n_keys; i++)
+    {
+      u8 * k;
+
+      vec_add1 (key_sets[0], format (0, "%d", i));
+
+      k = 0;
+      vec_resize (k, 16);
+      memcpy (k, &i, sizeof (i));
+      vec_add1 (key_sets[1], k);
+
+      k = 0;
+      vec_resize (k, 40);
+      for (j = 0; j < vec_len (k); j += sizeof (u32))
+	clib_mem_unaligned (k + j, u32) = random_u32 (&tm->seed);
+      vec_add1 (key_sets[2], k);
+
+      if (i % 8)
+	continue;
+      k = 0;
+      vec_resize (k, 2048);
+      memcpy (k + 1000, &i, sizeof (i));
+      vec_add1 (key_sets[3], k);
+    }
+
+  vec_resize (data, sizes[ARRAY_LEN (sizes) - 1]);
+  for (i = 0; i < vec_len (data); i++)
+    data[i] = random_u32 (&tm->seed) >> 24;
+
+  for (i = 0; i < vec_len (tm->kernels); i++)
+    {
+      test_hash_memory_kernel_t * k = tm->kernels + i;
+
+      if ((error = test_kernel_consistency (tm, k)))
+	goto done;
+
+      for (s = 0; s < ARRAY_LEN (key_sets); s++)
+	{
+	  chi = key_distribution (k, key_sets[s]);
+	  if (tm->verbose)
+	    fformat (stderr, "%-8s %-8s keys: chi-squared/bucket %.3f\n",
+		     k->name, key_set_names[s], chi);
+
+	  /* Uniform hash gives 1; be generous. */
+	  if (chi > 1.5)
+	    {
+	      error = clib_error_return (0, "%s: poor distribution of %s keys %.3f",
+					 k->name, key_set_names[s], chi);
+	      goto done;
+	    }
+	}
+
+      if (tm->verbose)
+	{
+	  fformat (stderr, "%-8s bytes/clock", k->name);
+	  for (s = 0; s < ARRAY_LEN (sizes); s++)
+	    fformat (stderr, " %wd: %.2f", sizes[s],
+		     bytes_per_clock (tm, k, data, sizes[s]));
+	  fformat (stderr, "\n");
+	}
+    }
+
+  if (tm->verbose)
+    {
+      /* Selector runs on first hash_memory call. */
+      hash_memory (data, 1, 0);
+      for (i = 0; i < vec_len (tm->kernels); i++)
+	if (tm->kernels[i].function == hash_memory_function)
+	  fformat (stderr, "hash_memory uses %s\n", tm->kernels[i].name);
+    }
+
+ done:
+  for (s = 0; s < ARRAY_LEN (key_sets); s++)
+    {
+      for (i = 0; i < vec_len (key_sets[s]); i++)
+	vec_free (key_sets[s][i]);
+      vec_free (key_sets[s]);
+    }
+  vec_free (data);
+  vec_free (tm->kernels);
+  return error;
+}
+
+#ifdef CLIB_UNIX
+int main (int argc, char * argv[])
+{
+  unformat_input_t i;
+  clib_error_t * error;
+
+  unformat_init_command_line (&i, argv);
+  error = test_hash_memory_main (&i);
+  unformat_free (&i);
+  if (error)
+    {
+      clib_error_report (error);
+      return 1;
+    }
+  else
+    return 0;
+}
+#endif /* CLIB_UNIX */
@@ -0,0 +1,149 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <clib/intern.h>
+#include <clib/random.h>
+
+static int verbose;
+#define if_verbose(format,args...) \
+  if (verbose) { clib_warning(format, ## args); }
+
+int test_intern_main (unformat_input_t * input)
+{
+  clib_intern_t _ci = {0}, * ci = &_ci;
+  clib_intern_t _ci2 = {0}, * ci2 = &_ci2;
+  uword i, n_strings, n_unique;
+  u8 ** strings = 0, ** more_strings = 0;
+  u32 * ids = 0, * batch_ids = 0;
+  uword n_wrong = 0;
+  u32 seed;
+
+  n_strings = 10000;
+  n_unique = 1000;
+  seed = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (0 == unformat (input, "strings %d", &n_strings)
+	  && 0 == unformat (input, "unique %d", &n_unique)
+	  && 0 == unformat (input, "seed %d", &seed)
+	  && 0 == unformat (input, "verbose"))
+	clib_error ("unknown input `%U'", format_unformat_error, input);
+    }
+
+  if (! seed)
+    seed = random_default_seed ();
+
+  if_verbose ("%d strings, %d unique, seed %d", n_strings, n_unique, seed);
+
+  /* Unique strings 0 .. n_unique-1; string 0 is empty. */
+  for (i = 0; i < n_strings; i++)
+    {
+      uword r = random_u32 (&seed) % n_unique;
+      vec_add1 (strings, r == 0 ? 0 : format (0, "s%d", r));
+      vec_add1 (ids, clib_intern_vec (ci, strings[i]));
+    }
+
+  ASSERT (clib_intern_elts (ci) <= n_unique);
+
+  for (i = 0; i < n_strings; i++)
+    {
+      u32 id = ids[i];
+      ASSERT (clib_intern_length (ci, id) == vec_len (strings[i]));
+      ASSERT (! memcmp (clib_intern_string (ci, id), strings[i], vec_len (strings[i])));
+      ASSERT (clib_intern_string (ci, id)[vec_len (strings[i])] == 0);
+      ASSERT (clib_intern_find (ci, strings[i], vec_len (strings[i])) == id);
+      ASSERT (clib_intern_id_for_offset (ci, clib_intern_offset (ci, id)) == id);
+    }
+
+  ASSERT (clib_intern_find (ci, "not there", 9) == CLIB_INTERN_ID_INVALID);
+
+  /* Batch intern into fresh table must agree with itself and
+     with single interns. */
+  vec_resize (batch_ids, n_strings);
+  clib_intern_multiple (ci2, strings, n_strings, batch_ids);
+  ASSERT (clib_intern_elts (ci2) == clib_intern_elts (ci));
+  for (i = 0; i < n_strings; i++)
+    {
+      ASSERT (clib_intern_length (ci2, batch_ids[i]) == vec_len (strings[i]));
+      ASSERT (clib_intern_vec (ci2, strings[i]) == batch_ids[i]);
+    }
+
+  /* Rebuild from arena alone gives same ids. */
+  clib_intern_rebuild (ci2);
+  ASSERT (clib_intern_elts (ci2) == clib_intern_elts (ci));
+  for (i = 0; i < n_strings; i++)
+    ASSERT (clib_intern_vec (ci2, strings[i]) == batch_ids[i]);
+
+  /* Batch into populated table: hits mixed with enough new strings
+     to resize hash while batch is being added. */
+  for (i = 0; i < n_strings; i++)
+    vec_add1 (more_strings, (i % 2
+			     ? vec_dup (strings[i])
+			     : format (0, "new%d", i)));
+  clib_intern_multiple (ci, more_strings, n_strings, batch_ids);
+  for (i = 0; i < n_strings; i++)
+    {
+      u32 id = batch_ids[i];
+      if (clib_intern_length (ci, id) != vec_len (more_strings[i])
+	  || memcmp (clib_intern_string (ci, id), more_strings[i],
+		     vec_len (more_strings[i]))
+	  || (i % 2 && id != ids[i]))
+	n_wrong++;
+    }
+  if (n_wrong > 0)
+    {
+      clib_warning ("%d of %d batch ids wrong", n_wrong, n_strings);
+      return 1;
+    }
+
+  if_verbose ("%U", format_clib_intern, ci);
+
+  for (i = 0; i < n_strings; i++)
+    vec_free (strings[i]);
+  vec_free (strings);
+  for (i = 0; i < vec_len (more_strings); i++)
+    vec_free (more_strings[i]);
+  vec_free (more_strings);
+  vec_free (ids);
+  vec_free (batch_ids);
+  clib_intern_free (ci);
+  clib_intern_free (ci2);
+
+  return 0;
+}
+
+#ifdef CLIB_UNIX
+int main (int argc, char * argv[])
+{
+  unformat_input_t i;
+  int ret;
+
+  verbose = (argc > 1);
+  unformat_init_command_line (&i, argv);
+  ret = test_intern_main (&i);
+  unformat_free (&i);
+
+  return ret;
+}
+#endif /* CLIB_UNIX */
@@ -0,0 +1,343 @@
+/*
+  Copyright (c) 2010 by cisco systems, inc.
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/* Feeds canned trace_pipe_raw pages through kelog_raw_decode_page. */
+
+#include <clib/kelog.h>
+#include <clib/error.h>
+#include <clib/format.h>
+
+static int verbose;
+#define if_verbose(format,args...) \
+  if (verbose) { clib_warning(format, ## args); }
+
+/* Page header: 64 bit time stamp, 64 bit commit, data. */
+#define TEST_PAGE_BYTES 4096
+#define TEST_COMMIT_OFFSET 8
+#define TEST_DATA_OFFSET 16
+
+/* Canned record formats: switch has pid and name; wakeup also has
+   target cpu. */
+#define TEST_SWITCH_ID 300
+#define TEST_SWITCH_BYTES 28
+#define TEST_WAKEUP_ID 301
+#define TEST_WAKEUP_BYTES 32
+
+typedef struct {
+  u8 * page;
+
+  /* Next byte to write in page. */
+  u8 * d;
+} test_page_t;
+
+static void
+test_page_init (test_page_t * p, u64 time)
+{
+  vec_validate (p->page, TEST_PAGE_BYTES - 1);
+  memset (p->page, 0, vec_len (p->page));
+  clib_mem_unaligned (p->page, u64) = time;
+  p->d = p->page + TEST_DATA_OFFSET;
+}
+
+/* Commit is number of data bytes plus missed event flags. */
+static void
+test_page_commit (test_page_t * p, u64 flags)
+{
+  u64 n = p->d - (p->page + TEST_DATA_OFFSET);
+  clib_mem_unaligned (p->page + TEST_COMMIT_OFFSET, u64) = n | flags;
+}
+
+static void
+test_page_u32 (test_page_t * p, u32 x)
+{
+  clib_mem_unaligned (p->d, u32) = x;
+  p->d += sizeof (u32);
+}
+
+always_inline u32
+test_header (u32 type_len, u32 time_delta)
+{ return type_len | (time_delta << 5); }
+
+/* Record payload: u16 id, pid, name and (for wakeup) target cpu. */
+static void
+test_page_payload (test_page_t * p, u32 id, u32 pid, char * comm, u32 cpu)
+{
+  u32 n_bytes = id == TEST_WAKEUP_ID ? TEST_WAKEUP_BYTES : TEST_SWITCH_BYTES;
+  u8 * r = p->d;
+
+  memset (r, 0, n_bytes);
+  clib_mem_unaligned (r, u16) = id;
+  if (id == TEST_WAKEUP_ID)
+    {
+      strncpy ((char *) r + 8, comm, 16);
+      clib_mem_unaligned (r + 24, u32) = pid;
+      clib_mem_unaligned (r + 28, u32) = cpu;
+    }
+  else
+    {
+      clib_mem_unaligned (r + 8, u32) = pid;
+      strncpy ((char *) r + 12, comm, 16);
+    }
+  p->d += n_bytes;
+}
+
+/* Small record: length in 4 byte words in type_len. */
+static void
+test_page_record (test_page_t * p, u32 time_delta, u32 id, u32 pid, char * comm, u32 cpu)
+{
+  u32 n_bytes = id == TEST_WAKEUP_ID ? TEST_WAKEUP_BYTES : TEST_SWITCH_BYTES;
+  test_page_u32 (p, test_header (n_bytes / 4, time_delta));
+  test_page_payload (p, id, pid, comm, cpu);
+}
+
+/* Type_len 0 record: length (including length word) follows header. */
+static void
+test_page_record_len (test_page_t * p, u32 time_delta, u32 id, u32 pid, char * comm, u32 cpu)
+{
+  u32 n_bytes = id == TEST_WAKEUP_ID ? TEST_WAKEUP_BYTES : TEST_SWITCH_BYTES;
+  test_page_u32 (p, test_header (0, time_delta));
+  test_page_u32 (p, n_bytes + sizeof (u32));
+  test_page_payload (p, id, pid, comm, cpu);
+}
+
+static void
+test_kelog_init (kelog_raw_main_t * km)
+{
+  kelog_raw_event_format_t * f;
+
+  memset (km, 0, sizeof (km[0]));
+  km->commit_offset = TEST_COMMIT_OFFSET;
+  km->commit_bytes = sizeof (u64);
+  km->data_offset = TEST_DATA_OFFSET;
+
+  vec_add2 (km->event_formats, f, 1);
+  f->id = TEST_SWITCH_ID;
+  f->pid_offset = 8;
+  f->comm_offset = 12;
+  f->comm_bytes = 16;
+  f->cpu_offset = ~0;
+  f->min_bytes = TEST_SWITCH_BYTES;
+  f->type = KELOG_SCHED_RUNNING;
+
+  vec_add2 (km->event_formats, f, 1);
+  f->id = TEST_WAKEUP_ID;
+  f->comm_offset = 8;
+  f->comm_bytes = 16;
+  f->pid_offset = 24;
+  f->cpu_offset = 28;
+  f->min_bytes = TEST_WAKEUP_BYTES;
+  f->type = KELOG_SCHED_WAKEUP;
+}
+
+typedef struct {
+  u64 time;
+  u32 task_cpu;
+  kelog_sched_event_type_t type;
+  char * task;
+} test_event_t;
+
+static clib_error_t *
+test_kelog_check (elog_main_t * em, kelog_raw_main_t * km, u32 cpu,
+		  test_event_t * expect, uword n_expect)
+{
+  kelog_raw_event_t * e;
+  uword i;
+
+  if (vec_len (km->pending_events) != n_expect)
+    return clib_error_create ("decoded %d events, expected %d",
+			      vec_len (km->pending_events), n_expect);
+
+  for (i = 0; i < n_expect; i++)
+    {
+      clib_intern_t * ci = &em->string_table;
+      u8 * task;
+
+      e = km->pending_events + i;
+      task = clib_intern_string (ci, clib_intern_id_for_offset (ci, e->string_table_offset));
+      if_verbose ("%d: time 0x%Lx cpu %d task cpu %d %s %s",
+		  i, e->time, e->cpu, e->task_cpu,
+		  e->type == KELOG_SCHED_WAKEUP ? "wakeup" : "running", task);
+
+      if (e->time != expect[i].time
+	  || e->cpu != cpu
+	  || e->task_cpu != expect[i].task_cpu
+	  || e->type != expect[i].type
+	  || strcmp ((char *) task, expect[i].task))
+	return clib_error_create ("event %d: time 0x%Lx task cpu %d type %d `%s', "
+				  "expected 0x%Lx %d %d `%s'",
+				  i, e->time, e->task_cpu, e->type, task,
+				  expect[i].time, expect[i].task_cpu, expect[i].type,
+				  expect[i].task);
+    }
+
+  return 0;
+}
+
+/* Records of every header type on one page. */
+static clib_error_t *
+test_kelog_records (elog_main_t * em, kelog_raw_main_t * km)
+{
+  test_page_t _p = {0}, * p = &_p;
+  clib_error_t * error;
+  u64 t0 = 1000, t1, t2;
+  u32 cpu = 1;
+
+  test_page_init (p, t0);
+
+  test_page_record (p, 5, TEST_SWITCH_ID, 11, "a", 0);
+
+  /* Time extend adds high bits to delta. */
+  test_page_u32 (p, test_header (KELOG_RAW_TYPE_TIME_EXTEND, 3));
+  test_page_u32 (p, 2);
+  test_page_record (p, 1, TEST_SWITCH_ID, 12, "a", 0);
+  t1 = t0 + 5 + ((u64) 2 << KELOG_RAW_TIME_SHIFT) + 3 + 1;
+
+  /* Padding with non-zero delta is skipped; contents look like record.
+     Length counts itself but not header. */
+  test_page_u32 (p, test_header (KELOG_RAW_TYPE_PADDING, 1));
+  test_page_u32 (p, 3 * sizeof (u32));
+  test_page_u32 (p, test_header (TEST_SWITCH_BYTES / 4, 1));
+  test_page_u32 (p, TEST_SWITCH_ID);
+
+  /* Unknown event id is ignored but still advances time. */
+  test_page_u32 (p, test_header (2, 7));
+  test_page_u32 (p, 999);
+  test_page_u32 (p, 0);
+
+  /* Long form record with target cpu. */
+  test_page_record_len (p, 2, TEST_WAKEUP_ID, 13, "b", 3);
+  t2 = t1 + 7 + 2;
+
+  /* Absolute time stamp replaces time. */
+  test_page_u32 (p, test_header (KELOG_RAW_TYPE_TIME_STAMP, 0x10));
+  test_page_u32 (p, 5);
+  test_page_record (p, 0, TEST_SWITCH_ID, 14, "c", 0);
+
+  /* Padding with zero delta ends page: following record is not read. */
+  test_page_u32 (p, test_header (KELOG_RAW_TYPE_PADDING, 0));
+  test_page_record (p, 1, TEST_SWITCH_ID, 99, "junk", 0);
+
+  test_page_commit (p, 0);
+  kelog_raw_decode_page (em, km, cpu, p->page, vec_len (p->page));
+
+  {
+    test_event_t expect[] = {
+      { .time = t0 + 5, .task_cpu = cpu, .type = KELOG_SCHED_RUNNING, .task = "a(11)", },
+      { .time = t1, .task_cpu = cpu, .type = KELOG_SCHED_RUNNING, .task = "a(12)", },
+      { .time = t2, .task_cpu = 3, .type = KELOG_SCHED_WAKEUP, .task = "b(13)", },
+      { .time = ((u64) 5 << KELOG_RAW_TIME_SHIFT) | 0x10,
+	.task_cpu = cpu, .type = KELOG_SCHED_RUNNING, .task = "c(14)", },
+    };
+    error = test_kelog_check (em, km, cpu, expect, ARRAY_LEN (expect));
+  }
+  if (! error && km->n_events_lost != 0)
+    error = clib_error_create ("%Ld events lost, expected none", km->n_events_lost);
+
+  vec_free (p->page);
+  return error;
+}
+
+/* Missed events flags: count stored after data, or only flag. */
+static clib_error_t *
+test_kelog_missed (elog_main_t * em, kelog_raw_main_t * km)
+{
+  test_page_t _p = {0}, * p = &_p;
+  clib_error_t * error = 0;
+  u32 cpu = 2;
+
+  test_page_init (p, 50);
+  test_page_record (p, 1, TEST_SWITCH_ID, 21, "m", 0);
+  test_page_commit (p, KELOG_RAW_MISSED_EVENTS | KELOG_RAW_MISSED_STORED);
+  clib_mem_unaligned (p->d, u64) = 7;
+  kelog_raw_decode_page (em, km, cpu, p->page, vec_len (p->page));
+
+  /* Record longer than committed data stops decode. */
+  test_page_init (p, 60);
+  test_page_u32 (p, test_header (0, 1));
+  test_page_u32 (p, 1000);
+  test_page_commit (p, KELOG_RAW_MISSED_EVENTS);
+  kelog_raw_decode_page (em, km, cpu, p->page, vec_len (p->page));
+
+  {
+    test_event_t expect[] = {
+      { .time = 51, .task_cpu = cpu, .type = KELOG_SCHED_RUNNING, .task = "m(21)", },
+    };
+    error = test_kelog_check (em, km, cpu, expect, ARRAY_LEN (expect));
+  }
+  if (! error && km->n_events_lost != 7 + 1)
+    error = clib_error_create ("%Ld events lost, expected %d", km->n_events_lost, 7 + 1);
+
+  vec_free (p->page);
+  return error;
+}
+
+int test_kelog_main (unformat_input_t * input)
+{
+  elog_main_t _em, * em = &_em;
+  kelog_raw_main_t _km, * km = &_km;
+  clib_error_t * error = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (0 == unformat (input, "verbose %=", &verbose, 1))
+	{
+	  clib_warning ("unknown input `%U'", format_unformat_error, input);
+	  return 1;
+	}
+    }
+
+  elog_init (em, 16);
+
+  test_kelog_init (km);
+  if ((error = test_kelog_records (em, km)))
+    goto done;
+
+  vec_free (km->event_formats);
+  vec_free (km->pending_events);
+  test_kelog_init (km);
+  error = test_kelog_missed (em, km);
+
+ done:
+  vec_free (km->event_formats);
+  vec_free (km->pending_events);
+  if (error)
+    {
+      clib_error_report (error);
+      return 1;
+    }
+  return 0;
+}
+
+#ifdef CLIB_UNIX
+int main (int argc, char * argv[])
+{
+  unformat_input_t i;
+  int ret;
+
+  unformat_init_command_line (&i, argv);
+  ret = test_kelog_main (&i);
+  unformat_free (&i);
+
+  return ret;
+}
+#endif /* CLIB_UNIX */
@@ -0,0 +1,320 @@
+/*
+  Copyright (c) 2001, 2002, 2003, 2005 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <clib/mhash.h>
+#include <clib/error.h>
+#include <clib/random.h>
+
+static int verbose;
+#define if_verbose(format,args...) \
+  if (verbose) { clib_warning(format, ## args); }
+
+typedef struct {
+  u32 n_keys;
+  u32 seed;
+} mhash_test_t;
+
+/* Vector of N_KEYS distinct keys.  Fixed size keys are N_KEY_BYTES
+   random bytes; string keys have random length. */
+static u8 **
+make_keys (mhash_test_t * mt, uword n_key_bytes)
+{
+  uword * seen = hash_create_vec (0, sizeof (u8), sizeof (uword));
+  u8 ** keys = 0, * k;
+  uword i, n;
+
+  while (vec_len (keys) < mt->n_keys)
+    {
+      n = n_key_bytes;
+      if (n_key_bytes == MHASH_VEC_STRING_KEY)
+	n = 1 + random_u32 (&mt->seed) % 32;
+      k = 0;
+      /* High bits: low bits of random_u32 have short period. */
+      for (i = 0; i < n; i++)
+	vec_add1 (k, random_u32 (&mt->seed) >> 24);
+      if (hash_get_mem (seen, k))
+	{
+	  vec_free (k);
+	  continue;
+	}
+      hash_set_mem (seen, k, 0);
+      vec_add1 (keys, k);
+    }
+
+  hash_free (seen);
+  return keys;
+}
+
+static void
+free_keys (u8 ** keys)
+{
+  uword i;
+  for (i = 0; i < vec_len (keys); i++)
+    vec_free (keys[i]);
+  vec_free (keys);
+}
+
+static uword
+key_equal (mhash_t * h, void * k, u8 * key)
+{
+  if (h->n_key_bytes == MHASH_VEC_STRING_KEY)
+    return vec_len (k) == vec_len (key) && ! memcmp (k, key, vec_len (key));
+  return ! memcmp (k, key, h->n_key_bytes);
+}
+
+/* Checks that key I maps to value I when IS_SET[i] and is absent
+   otherwise, via get, get_multiple and foreach. */
+static clib_error_t *
+check_keys (mhash_t * h, u8 ** keys, uword * is_set)
+{
+  uword i, n_set, n_found, * p, ** results = 0;
+  void * k, ** key_ptrs = 0;
+  clib_error_t * error = 0;
+
+  n_set = 0;
+  for (i = 0; i < vec_len (keys); i++)
+    {
+      p = mhash_get (h, keys[i]);
+      if ((error = CLIB_ERROR_ASSERT (is_set[i]
+				      ? p && p[0] == i
+				      : p == 0)))
+	goto done;
+      n_set += is_set[i];
+    }
+  if ((error = CLIB_ERROR_ASSERT (mhash_elts (h) == n_set)))
+    goto done;
+
+  for (i = 0; i < vec_len (keys); i++)
+    vec_add1 (key_ptrs, keys[i]);
+  vec_validate (results, vec_len (keys) - 1);
+  mhash_get_multiple (h, key_ptrs, vec_len (keys), results);
+  for (i = 0; i < vec_len (keys); i++)
+    if ((error = CLIB_ERROR_ASSERT (is_set[i]
+				    ? results[i] && results[i][0] == i
+				    : results[i] == 0)))
+      goto done;
+
+  n_found = 0;
+  mhash_foreach (k, p, h, ({
+    i = p[0];
+    n_found += (i < vec_len (keys) && is_set[i] && key_equal (h, k, keys[i]));
+  }));
+  error = CLIB_ERROR_ASSERT (n_found == n_set);
+
+ done:
+  vec_free (key_ptrs);
+  vec_free (results);
+  return error;
+}
+
+/* Keys of at most a word live in hash pairs; includes all ones key. */
+static clib_error_t *
+test_inline_keys (mhash_test_t * mt, uword n_key_bytes)
+{
+  mhash_t _h = {0}, * h = &_h;
+  u8 ** keys, * s = 0, * t = 0;
+  uword i, hk, * is_set = 0;
+  clib_error_t * error = 0;
+
+  keys = make_keys (mt, n_key_bytes);
+  vec_validate_init_empty (t, n_key_bytes - 1, 0xff);
+  for (i = 0; i < vec_len (keys); i++)
+    if (! memcmp (keys[i], t, n_key_bytes))
+      break;
+  if (i == vec_len (keys))
+    memset (keys[0], 0xff, n_key_bytes);
+
+  mhash_init (h, sizeof (uword), n_key_bytes);
+  if ((error = CLIB_ERROR_ASSERT (mhash_key_is_inline (h))))
+    goto done;
+
+  vec_validate (is_set, vec_len (keys) - 1);
+  for (i = 0; i < vec_len (keys); i++)
+    {
+      hk = mhash_set (h, keys[i], i, 0);
+      is_set[i] = 1;
+
+      /* Format takes hash key as a uword. */
+      vec_reset_length (s);
+      vec_reset_length (t);
+      s = format (s, "%U", format_mhash_key, h, hk);
+      t = format (t, "%U", format_hex_bytes, keys[i], n_key_bytes);
+      if ((error = CLIB_ERROR_ASSERT (vec_len (s) == vec_len (t)
+				      && ! memcmp (s, t, vec_len (s)))))
+	goto done;
+    }
+  if ((error = check_keys (h, keys, is_set)))
+    goto done;
+
+  for (i = 0; i < vec_len (keys); i += 2)
+    {
+      if ((error = CLIB_ERROR_ASSERT (mhash_unset (h, keys[i], 0))))
+	goto done;
+      is_set[i] = 0;
+    }
+  if ((error = CLIB_ERROR_ASSERT (! mhash_unset (h, keys[0], 0))))
+    goto done;
+  error = check_keys (h, keys, is_set);
+
+ done:
+  if_verbose ("inline %d byte keys: %d elts", n_key_bytes, mhash_elts (h));
+  mhash_free (h);
+  free_keys (keys);
+  vec_free (is_set);
+  vec_free (s);
+  vec_free (t);
+  return error;
+}
+
+/* Unset only frees key space; explicit compaction reclaims it. */
+static clib_error_t *
+test_compact_keys (mhash_test_t * mt, uword n_key_bytes)
+{
+  mhash_t _h = {0}, * h = &_h;
+  u8 ** keys, * k;
+  uword i, n_bytes, * hash_keys = 0, * is_set = 0;
+  clib_error_t * error = 0;
+
+  keys = make_keys (mt, n_key_bytes);
+  mhash_init (h, sizeof (uword), n_key_bytes);
+  if ((error = CLIB_ERROR_ASSERT (! mhash_key_is_inline (h))))
+    goto done;
+
+  vec_validate (is_set, vec_len (keys) - 1);
+  for (i = 0; i < vec_len (keys); i++)
+    {
+      vec_add1 (hash_keys, mhash_set (h, keys[i], i, 0));
+      is_set[i] = 1;
+    }
+
+  /* Unset 3 of every 4 keys. */
+  for (i = 0; i < vec_len (keys); i++)
+    if (i % 4)
+      {
+	mhash_unset (h, keys[i], 0);
+	is_set[i] = 0;
+      }
+
+  /* Keys returned by set are still valid. */
+  n_bytes = vec_len (h->key_vector_or_heap);
+  for (i = 0; i < vec_len (keys); i += 4)
+    {
+      k = mhash_key_to_mem (h, hash_keys[i]);
+      if ((error = CLIB_ERROR_ASSERT (key_equal (h, k, keys[i]))))
+	goto done;
+    }
+  if ((error = check_keys (h, keys, is_set)))
+    goto done;
+
+  if ((error = CLIB_ERROR_ASSERT (mhash_key_space_is_mostly_free (h))))
+    goto done;
+  mhash_compact_keys (h);
+  if ((error = CLIB_ERROR_ASSERT (vec_len (h->key_vector_or_heap) < n_bytes)))
+    goto done;
+  if ((error = CLIB_ERROR_ASSERT (! mhash_key_space_is_mostly_free (h))))
+    goto done;
+  if ((error = check_keys (h, keys, is_set)))
+    goto done;
+
+  /* Table keeps working after compaction. */
+  for (i = 0; i < vec_len (keys); i++)
+    if (i % 4 == 1)
+      {
+	mhash_set (h, keys[i], i, 0);
+	is_set[i] = 1;
+      }
+    else if (i % 4 == 0 && i % 8)
+      {
+	mhash_unset (h, keys[i], 0);
+	is_set[i] = 0;
+      }
+  error = check_keys (h, keys, is_set);
+
+ done:
+  if_verbose ("%s keys: %d elts, %d key bytes",
+	      mhash_key_vector_is_heap (h) ? "heap" : "vector",
+	      mhash_elts (h), vec_len (h->key_vector_or_heap));
+  mhash_free (h);
+  free_keys (keys);
+  vec_free (hash_keys);
+  vec_free (is_set);
+  return error;
+}
+
+int test_mhash_main (unformat_input_t * input)
+{
+  mhash_test_t _mt = {0}, * mt = &_mt;
+  clib_error_t * error = 0;
+
+  mt->n_keys = 4096;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (0 == unformat (input, "keys %d", &mt->n_keys)
+	  && 0 == unformat (input, "seed %d", &mt->seed)
+	  && 0 == unformat (input, "verbose"))
+	{
+	  clib_warning ("unknown input `%U'", format_unformat_error, input);
+	  return 1;
+	}
+    }
+
+  if (! mt->seed)
+    mt->seed = random_default_seed ();
+
+  if_verbose ("%d keys, seed %d", mt->n_keys, mt->seed);
+
+  if ((error = test_inline_keys (mt, 4)))
+    goto done;
+  if ((error = test_inline_keys (mt, sizeof (uword))))
+    goto done;
+
+  /* Key vector and key heap. */
+  if ((error = test_compact_keys (mt, 16)))
+    goto done;
+  if ((error = test_compact_keys (mt, MHASH_VEC_STRING_KEY)))
+    goto done;
+
+ done:
+  if (error)
+    {
+      clib_error_report (error);
+      return 1;
+    }
+  return 0;
+}
+
+#ifdef CLIB_UNIX
+int main (int argc, char * argv[])
+{
+  unformat_input_t i;
+  int ret;
+
+  verbose = (argc > 1);
+  unformat_init_command_line (&i, argv);
+  ret = test_mhash_main (&i);
+  unformat_free (&i);
+
+  return ret;
+}
+#endif /* CLIB_UNIX */
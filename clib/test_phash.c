@@ -24,16 +24,198 @@
 #include <clib/phash.h>
 #include <clib/format.h>
 #include <clib/random.h>
+#include <clib/time.h>
 
 static int verbose;
 #define if_verbose(format,args...) \
   if (verbose) { clib_warning(format, ## args); }
 
+/* Never called: only marks table as having indirect keys. */
+static void
+test_phash_key_seed1 (void * private, uword key, void * seed)
+{ }
+
+/* Checks batch hashing against phash_hash_slow. */
+static clib_error_t *
+test_phash_multiple (phash_main_t * pm)
+{
+  clib_error_t * error = 0;
+  phash_key_t * k;
+  u64 * keys = 0;
+  u32 * hashes = 0;
+  u64 t[3];
+  uword i, sum = 0;
+
+  vec_foreach (k, pm->keys)
+    vec_add1 (keys, k->key);
+  vec_resize (hashes, vec_len (keys));
+
+  t[0] = clib_cpu_time_now ();
+  for (i = 0; i < vec_len (keys); i++)
+    sum += phash_hash_slow (pm, keys[i]);
+  t[1] = clib_cpu_time_now ();
+  if ((error = phash_hash_multiple (pm, keys, hashes, vec_len (keys))))
+    goto done;
+  t[2] = clib_cpu_time_now ();
+
+  for (i = 0; i < vec_len (keys); i++)
+    if (hashes[i] != phash_hash_slow (pm, keys[i]))
+      {
+	error = clib_error_return (0, "multiple hash mismatch key 0x%Lx", keys[i]);
+	break;
+      }
+
+  /* Indirect keys have no batch hash: must fail, not assert. */
+  if (! error)
+    {
+      pm->key_seed1 = test_phash_key_seed1;
+      error = phash_hash_multiple (pm, keys, hashes, vec_len (keys));
+      pm->key_seed1 = 0;
+      if (error)
+	clib_error_free (error);
+      else
+	error = clib_error_return (0, "multiple hash accepted key_seed1");
+    }
+
+  if (vec_len (keys) > 0)
+    if_verbose ("%.2f clocks/key single, %.2f multiple",
+		(f64) (t[1] - t[0]) / vec_len (keys),
+		(f64) (t[2] - t[1]) / vec_len (keys));
+
+ done:
+  vec_free (keys);
+  vec_free (hashes);
+  return error;
+}
+
+/* Corrupted copies of good image must fail validation. */
+static clib_error_t *
+test_phash_image_corrupt (u8 * image)
+{
+  clib_error_t * error = 0, * e;
+  phash_image_t * im;
+  u8 * copy = 0;
+  uword i;
+
+  for (i = 0; i < 4 && ! error; i++)
+    {
+      vec_free (copy);
+      copy = vec_dup (image);
+      im = (phash_image_t *) copy;
+      switch (i)
+	{
+	case 0:
+	  im->b_bits = 32;
+	  break;
+	case 1:
+	  /* Offset plus size wraps around. */
+	  im->keys_offset = ~0ULL - 7;
+	  break;
+	case 2:
+	  im->hash_max = ~0;
+	  break;
+	case 3:
+	  /* Tab value past end of scramble. */
+	  if (! (im->flags & PHASH_FLAG_USE_SCRAMBLE))
+	    continue;
+	  ((u32 *) phash_image_data (im, im->tab_offset))[0] = im->n_scramble;
+	  break;
+	}
+      e = phash_image_validate (im, vec_len (copy));
+      if (e)
+	clib_error_free (e);
+      else
+	error = clib_error_return (0, "corrupt image %d passed validation", i);
+    }
+
+  vec_free (copy);
+  return error;
+}
+
+/* Checks lookups in image against phash_hash_slow.  Image is mmap'ed
+   from file when given, otherwise built in memory. */
+static clib_error_t *
+test_phash_image (phash_main_t * pm, char * file_name)
+{
+  clib_error_t * error = 0;
+  phash_image_t * im;
+  phash_key_t * k;
+  u8 * image = 0;
+  u32 * values = 0, * slots = 0;
+  u64 * keys = 0;
+  uword i;
+
+  vec_foreach (k, pm->keys)
+    {
+      vec_add1 (values, k - pm->keys);
+      vec_add1 (keys, k->key);
+    }
+
+  if (file_name)
+    {
+      error = phash_image_write (pm, values, sizeof (values[0]), file_name);
+      if (! error)
+	error = phash_image_map (file_name, &im);
+      if (error)
+	goto done;
+    }
+  else
+    {
+      image = phash_image_create (pm, values, sizeof (values[0]));
+      im = (phash_image_t *) image;
+      error = phash_image_validate (im, vec_len (image));
+      if (! error)
+	error = test_phash_image_corrupt (image);
+      if (error)
+	goto done;
+    }
+
+  vec_foreach (k, pm->keys)
+    {
+      uword h = phash_image_get (im, k->key);
+      u32 * v;
+
+      if (h != phash_hash_slow (pm, k->key))
+	{
+	  error = clib_error_return (0, "image hash mismatch key 0x%Lx", (u64) k->key);
+	  break;
+	}
+
+      v = phash_image_value (im, h);
+      if (v[0] != k - pm->keys)
+	{
+	  error = clib_error_return (0, "image value mismatch key 0x%Lx", (u64) k->key);
+	  break;
+	}
+    }
+
+  /* Batch lookup; flip low bit for keys that should mostly miss. */
+  vec_resize (slots, vec_len (keys));
+  for (i = 0; i < vec_len (keys); i++)
+    keys[i] ^= i & 1;
+  phash_image_get_multiple (im, keys, slots, vec_len (keys));
+  for (i = 0; ! error && i < vec_len (keys); i++)
+    if (slots[i] != (u32) phash_image_get (im, keys[i]))
+      error = clib_error_return (0, "image multiple mismatch key 0x%Lx", keys[i]);
+
+  if (file_name)
+    phash_image_unmap (im);
+
+ done:
+  vec_free (image);
+  vec_free (values);
+  vec_free (keys);
+  vec_free (slots);
+  return error;
+}
+
 int test_phash_main (unformat_input_t * input)
 {
   phash_main_t _pm = {0}, * pm = &_pm;
   int n_keys, random_keys;
   u32 seed;
+  u64 t[2];
+  char * image_file = 0;
   clib_error_t * error;
 
   random_keys = 1;
@@ -50,7 +232,10 @@ int test_phash_main (unformat_input_t * input)
 	  && 0 == unformat (input, "fast %|", &pm->flags, PHASH_FLAG_FAST_MODE)
 	  && 0 == unformat (input, "slow %|", &pm->flags, PHASH_FLAG_SLOW_MODE)
 	  && 0 == unformat (input, "minimal %|", &pm->flags, PHASH_FLAG_MINIMAL)
-	  && 0 == unformat (input, "non-minimal %|", &pm->flags, PHASH_FLAG_NON_MINIMAL))
+	  && 0 == unformat (input, "non-minimal %|", &pm->flags, PHASH_FLAG_NON_MINIMAL)
+	  && 0 == unformat (input, "displace %|", &pm->flags, PHASH_FLAG_HASH_AND_DISPLACE)
+	  && 0 == unformat (input, "cpus %d", &pm->n_cpus)
+	  && 0 == unformat (input, "image %s", &image_file))
 	clib_error ("unknown input `%U'", format_unformat_error, input);
     }
 
@@ -61,7 +246,8 @@ int test_phash_main (unformat_input_t * input)
 		n_keys,
 		(pm->flags & PHASH_FLAG_MIX64) ? 64 : 32,
 		pm->random_seed,
-		(pm->flags & PHASH_FLAG_FAST_MODE) ? "fast" : "slow",
+		((pm->flags & PHASH_FLAG_HASH_AND_DISPLACE) ? "hash and displace"
+		 : (pm->flags & PHASH_FLAG_FAST_MODE) ? "fast" : "slow"),
 		(pm->flags & PHASH_FLAG_MINIMAL) ? "" : "non-");
 
   seed = pm->random_seed;
@@ -84,7 +270,9 @@ int test_phash_main (unformat_input_t * input)
       }
   }
 
+  t[0] = clib_cpu_time_now ();
   error = phash_find_perfect_hash (pm);
+  t[1] = clib_cpu_time_now ();
   if (error)
     {
       clib_error_report (error);
@@ -92,11 +280,16 @@ int test_phash_main (unformat_input_t * input)
     }
   else
     {
-      if_verbose   ("(%d,%d) (a,b) bits, %d seeds tried, %d tree walks",
+      if_verbose   ("(%d,%d) (a,b) bits, %d seeds tried, %d tree walks, %Ld displace trials, %.4e clocks",
 		    pm->a_bits, pm->b_bits,
-		    pm->n_seed_trials, pm->n_perfect_calls);
+		    pm->n_seed_trials, pm->n_perfect_calls,
+		    pm->n_displace_trials, (f64) (t[1] - t[0]));
 
       error = phash_validate (pm);
+      if (! error && ! pm->key_seed1)
+	error = test_phash_multiple (pm);
+      if (! error)
+	error = test_phash_image (pm, image_file);
       if (error)
 	{
 	  clib_error_report (error);
@@ -7,6 +7,8 @@
 typedef struct {
   u32 n_iter, seed, n_keys, n_hash_keys, verbose;
 
+  u32 keys_per_bucket;
+
   u32 max_vector;
 
   uword * hash;
@@ -37,13 +39,14 @@ test_qhash_main (unformat_input_t * input)
 {
   clib_error_t * error = 0;
   test_qhash_main_t _tm, * tm = &_tm;
-  uword i, iter;
+  uword i, iter, expect_growth = 0;
 
   memset (tm, 0, sizeof (tm[0]));
-  tm->n_iter = 10;
+  tm->n_iter = 100;
   tm->seed = 1;
-  tm->n_keys = 10;
-  tm->max_vector = 1;
+  tm->n_keys = 1000;
+  tm->max_vector = 16;
+  tm->keys_per_bucket = QHASH_KEYS_PER_BUCKET;
 
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
     {
@@ -55,6 +58,8 @@ test_qhash_main (unformat_input_t * input)
 	;
       else if (unformat (input, "size %d", &tm->n_hash_keys))
 	;
+      else if (unformat (input, "bucket %d", &tm->keys_per_bucket))
+	;
       else if (unformat (input, "vector %d", &tm->max_vector))
 	;
       else if (unformat (input, "verbose"))
@@ -72,18 +77,25 @@ test_qhash_main (unformat_input_t * input)
 
   clib_time_init (&tm->time);
 
-  clib_warning ("iter %d, seed %u, keys %d, max vector %d, ",
-		tm->n_iter, tm->seed, tm->n_keys, tm->max_vector);
+  clib_warning ("iter %d, seed %u, keys %d, max vector %d, %d keys per bucket",
+		tm->n_iter, tm->seed, tm->n_keys, tm->max_vector,
+		tm->keys_per_bucket);
 
   vec_resize (tm->keys, tm->n_keys);
   vec_resize (tm->get_multiple_results, tm->n_keys);
   for (i = 0; i < vec_len (tm->keys); i++)
     tm->keys[i] = random_uword (&tm->seed);
 
+  /* Smaller sizes test growth of table.  Default is well below number
+     of keys in table so that overflow forces table to double and
+     buckets to be split incrementally. */
   if (! tm->n_hash_keys)
-    tm->n_hash_keys = 2 * max_pow2 (tm->n_keys);
-  tm->n_hash_keys = clib_max (tm->n_keys, tm->n_hash_keys);
-  qhash_resize (tm->qhash, tm->n_hash_keys);
+    {
+      tm->n_hash_keys = max_pow2 (tm->n_keys) / 16;
+      expect_growth = 1;
+    }
+  qhash_resize_keys_per_bucket (tm->qhash, tm->n_hash_keys,
+				tm->keys_per_bucket);
 
   {
     qhash_t * h = qhash_header (tm->qhash);
@@ -199,7 +211,7 @@ test_qhash_main (unformat_input_t * input)
 	  u32 * tmp = 0;
 
 	  hash_foreach (k, l, h->overflow_hash, ({
-	    j = qhash_hash_mix (h, k) / QHASH_KEYS_PER_BUCKET;
+	    j = qhash_bucket_index (h, k);
 	    vec_validate (tmp, j);
 	    tmp[j] += 1;
 	  }));
@@ -265,6 +277,16 @@ test_qhash_main (unformat_input_t * input)
 	   tm->overflow_fraction / tm->n_iter,
 	   tm->ave_elts / tm->n_iter);
 
+  if (tm->verbose)
+    fformat (stderr, "%U\n", format_qhash, tm->qhash);
+
+  if (expect_growth && qhash_header (tm->qhash)->n_resizes == 0)
+    {
+      error = clib_error_create ("table of %d keys never grew",
+				 tm->n_hash_keys);
+      goto done;
+    }
+
   tm->get_time /= tm->n_iter * vec_len (tm->keys);
   tm->hash_get_time /= tm->n_iter * vec_len (tm->keys);
 
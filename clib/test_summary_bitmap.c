@@ -0,0 +1,160 @@
+/*
+  Copyright (c) 2012 Eliot Dresselhaus
+
+  Permission is hereby granted, free of charge, to any person obtaining
+  a copy of this software and associated documentation files (the
+  "Software"), to deal in the Software without restriction, including
+  without limitation the rights to use, copy, modify, merge, publish,
+  distribute, sublicense, and/or sell copies of the Software, and to
+  permit persons to whom the Software is furnished to do so, subject to
+  the following conditions:
+
+  The above copyright notice and this permission notice shall be
+  included in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+  NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+  LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+  OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+  WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <clib/summary_bitmap.h>
+#include <clib/format.h>
+#include <clib/random.h>
+
+static int verbose;
+#define if_verbose(format,args...) \
+  if (verbose) { clib_warning(format, ## args); }
+
+/* Check that summary levels agree with bitmap. */
+static void
+check_summary (clib_summary_bitmap_t * b)
+{
+  uword is_clear, l, i;
+
+  for (is_clear = 0; is_clear < 2; is_clear++)
+    for (l = 0; l < b->n_summary_levels; l++)
+      {
+	uword * below = clib_summary_bitmap_level (b, is_clear, l);
+	uword * s = clib_summary_bitmap_level (b, is_clear, l + 1);
+	for (i = 0; i < vec_len (below); i++)
+	  {
+	    uword x = below[i];
+	    if (is_clear && l == 0)
+	      x = ~x;
+	    ASSERT (clib_bitmap_get (s, i) == (x != 0));
+	  }
+	ASSERT (vec_len (s) * BITS (uword) >= vec_len (below));
+      }
+  ASSERT (vec_len (clib_summary_bitmap_level (b, 0, b->n_summary_levels)) == 1);
+}
+
+int test_summary_bitmap_main (unformat_input_t * input)
+{
+  clib_summary_bitmap_t _b = {0}, * b = &_b;
+  uword * ref = 0;
+  uword n_iterations, n_bits, iter, i, j, k;
+  u32 seed;
+
+  n_iterations = 10000;
+  n_bits = 1 << 20;
+  seed = 0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (0 == unformat (input, "iter %d", &n_iterations)
+	  && 0 == unformat (input, "bits %d", &n_bits)
+	  && 0 == unformat (input, "seed %d", &seed))
+	clib_error ("unknown input `%U'", format_unformat_error, input);
+    }
+
+  if (! seed)
+    seed = random_default_seed ();
+
+  if_verbose ("%d iterations, %d bits, seed %d\n", n_iterations, n_bits, seed);
+
+  /* Start small so that bitmap must grow and add levels. */
+  clib_summary_bitmap_validate (b, 1);
+  check_summary (b);
+
+  for (iter = 0; iter < n_iterations; iter++)
+    {
+      uword value;
+
+      i = random_u32 (&seed) % n_bits;
+
+      /* Mostly sparse sets; occasionally fill a full word so that
+	 clear tree sees ~0 words. */
+      if ((iter % 64) == 0)
+	{
+	  i &= ~(BITS (uword) - 1);
+	  value = random_u32 (&seed) & 1;
+	  for (j = 0; j < BITS (uword); j++)
+	    {
+	      clib_summary_bitmap_set (b, i + j, value);
+	      ref = clib_bitmap_set (ref, i + j, value);
+	    }
+	}
+      else
+	{
+	  value = (random_u32 (&seed) % 4) != 0;
+	  j = clib_summary_bitmap_set (b, i, value);
+	  ASSERT (j == clib_bitmap_get (ref, i));
+	  ref = clib_bitmap_set (ref, i, value);
+	}
+
+      ASSERT (clib_summary_bitmap_get (b, i) == clib_bitmap_get (ref, i));
+
+      i = random_u32 (&seed) % n_bits;
+      j = clib_summary_bitmap_next_set (b, i);
+      k = clib_bitmap_next_set (ref, i);
+      ASSERT (j == k);
+
+      /* clib_bitmap_next_clear returns I when nothing is found inside
+	 the vector; summary version continues into implied zero bits. */
+      j = clib_summary_bitmap_next_clear (b, i);
+      k = clib_bitmap_next_clear (ref, i);
+      ASSERT (j == k
+	      || (j >= vec_len (ref) * BITS (uword) && ! clib_bitmap_get (ref, j)));
+
+      if ((iter % 1024) == 0)
+	check_summary (b);
+    }
+
+  check_summary (b);
+
+  k = 0;
+  j = clib_bitmap_first_set (ref);
+  clib_summary_bitmap_foreach (i, b, ({
+    ASSERT (i == j);
+    j = clib_bitmap_next_set (ref, i + 1);
+    k++;
+  }));
+  ASSERT (j == ~0);
+  ASSERT (k == clib_bitmap_count_set_bits (ref));
+
+  if_verbose ("%d bits set, %d summary levels", k, b->n_summary_levels);
+
+  clib_summary_bitmap_free (b);
+  clib_bitmap_free (ref);
+
+  return 0;
+}
+
+#ifdef CLIB_UNIX
+int main (int argc, char * argv[])
+{
+  unformat_input_t i;
+  int ret;
+
+  verbose = (argc > 1);
+  unformat_init_command_line (&i, argv);
+  ret = test_summary_bitmap_main (&i);
+  unformat_free (&i);
+
+  return ret;
+}
+#endif /* CLIB_UNIX */
@@ -44,6 +44,19 @@ typedef struct {
   u32 log2_size;
   u32 n_key_u32;
 
+  /* 4 or 8 (0 means 4). */
+  u32 keys_per_bucket;
+
+  /* Compare get throughput of 4 and 8 key buckets. */
+  u32 compare;
+
+  /* Test automatic resize of vhash_main_set starting from small table. */
+  u32 auto_resize;
+
+  /* Test fingerprint mode (any number of key words) instead of vhash. */
+  u32 fingerprint;
+  u32 fingerprint_mask;
+
   u32 n_vectors_div_4;
   u32 n_vectors_mod_4;
 
@@ -58,6 +71,9 @@ typedef struct {
 
   vhash_t vhash;
 
+  /* For vhash_main_* calls: 8 key bucket tables and compare. */
+  vhash_main_t vhash_main;
+
   uword ** key_hash;
 
   struct {
@@ -254,12 +270,8 @@ test_vhash_unset_result (void * _tm, u32 i, u32 old_result, u32 n_key_u32s)
 			tm, N_KEY_U32);					\
    })
 
-_ (1);
-_ (2);
-_ (3);
-_ (4);
-_ (5);
-_ (6);
+foreach_vhash_short_n_key_u32
+foreach_vhash_long_n_key_u32
 
 #undef _
 
@@ -278,9 +290,7 @@ _ (6);
      vhash_mix_stage (&tm->vhash, tm->n_vectors_div_4, N_KEY_U32);	\
    })
 
-_ (4);
-_ (5);
-_ (6);
+foreach_vhash_long_n_key_u32
 
 #undef _
 
@@ -288,6 +298,53 @@ typedef enum {
   GET, SET, UNSET,
 } test_vhash_op_t;
 
+#ifdef VHASH_HAVE_8_LANES
+
+/* Tables with 8 keys per bucket go through vhash_main_get/set/unset.
+   Any resize started by a set is run to completion so later direct
+   vhash_resize and vhash_free calls see a single table. */
+static void
+test_vhash8_op (test_vhash_main_t * tm,
+		u32 * key_indices,
+		u32 * results,
+		uword n_keys,
+		test_vhash_op_t op)
+{
+  vhash_main_t * vm = &tm->vhash_main;
+  uword i, n_key_u32 = tm->n_key_u32;
+
+  vm->vhash = &tm->vhash;
+
+  vec_reset_length (vm->keys);
+  for (i = 0; i < n_keys; i++)
+    vec_add (vm->keys, tm->keys + key_indices[i] * n_key_u32, n_key_u32);
+
+  /* Get writes results 4 at a time. */
+  vec_validate_aligned (vm->results, n_keys + 3, CLIB_CACHE_LINE_BYTES);
+  _vec_len (vm->results) = n_keys;
+  memcpy (vm->results, results, n_keys * sizeof (results[0]));
+
+  if (op == GET)
+    vhash_main_get (vm);
+  else if (op == SET)
+    {
+      vhash_main_set (vm);
+      memcpy (results, vm->results, n_keys * sizeof (results[0]));
+      while (vm->resize)
+	{
+	  _vec_len (vm->results) = 0;
+	  vhash_main_set (vm);
+	}
+      return;
+    }
+  else
+    vhash_main_unset (vm);
+
+  memcpy (results, vm->results, n_keys * sizeof (results[0]));
+}
+
+#endif /* VHASH_HAVE_8_LANES */
+
 static void
 test_vhash_op (test_vhash_main_t * tm,
 	       u32 * key_indices,
@@ -299,6 +356,15 @@ test_vhash_op (test_vhash_main_t * tm,
 
   tm->vhash_results = results;
   tm->vhash_key_indices = key_indices;
+
+#ifdef VHASH_HAVE_8_LANES
+  if (tm->vhash.log2_keys_per_bucket == 3)
+    {
+      test_vhash8_op (tm, key_indices, results, n_keys, op);
+      return;
+    }
+#endif
+
   tm->n_vectors_div_4 = n_keys / 4;
   tm->n_vectors_mod_4 = n_keys % 4;
 
@@ -335,9 +401,7 @@ test_vhash_op (test_vhash_main_t * tm,
 	       test_vhash_unset_stage_##N_KEY_U32);		\
 	  break;
 
-	      _ (1);
-	      _ (2);
-	      _ (3);
+	      foreach_vhash_short_n_key_u32
 
 #undef _
 
@@ -369,9 +433,7 @@ test_vhash_op (test_vhash_main_t * tm,
 	       test_vhash_unset_stage_##N_KEY_U32);		\
 	  break;
 
-	      _ (4);
-	      _ (5);
-	      _ (6);
+	      foreach_vhash_long_n_key_u32
 
 #undef _
 	}
@@ -411,9 +473,7 @@ test_vhash_op (test_vhash_main_t * tm,
 	       test_vhash_unset_mod_stage_##N_KEY_U32);		\
 	break;
 
-      _ (1);
-      _ (2);
-      _ (3);
+      foreach_vhash_short_n_key_u32
 
 #undef _
 
@@ -445,15 +505,300 @@ test_vhash_op (test_vhash_main_t * tm,
 	       test_vhash_unset_mod_stage_##N_KEY_U32);		\
 	  break;
 
-	      _ (4);
-	      _ (5);
-	      _ (6);
+	      foreach_vhash_long_n_key_u32
 
 #undef _
 	}
     }
 }
 
+/* Times gets of all keys from tables with 4 and 8 keys per bucket. */
+static void
+test_vhash_compare (test_vhash_main_t * tm)
+{
+  u32 keys_per_bucket[] = { 4, 8, };
+  f64 clocks_per_get[ARRAY_LEN (keys_per_bucket)];
+  vhash_main_t * vm = &tm->vhash_main;
+  u32 seeds[3], * results = 0;
+  uword i, j, n_keys = vec_len (tm->vhash_get_key_indices);
+  u64 t[2], min_clocks;
+
+  seeds[0] = seeds[1] = seeds[2] = 0xdeadbeef;
+
+  for (i = 0; i < ARRAY_LEN (keys_per_bucket); i++)
+    {
+      vhash_free (&tm->vhash);
+      vhash_init_keys_per_bucket (&tm->vhash, tm->log2_size, tm->n_key_u32,
+				  seeds, keys_per_bucket[i]);
+      if (vhash_keys_per_bucket (&tm->vhash) != keys_per_bucket[i])
+	{
+	  clib_warning ("%d keys per bucket not supported by cpu",
+			keys_per_bucket[i]);
+	  goto done;
+	}
+
+      vec_reset_length (results);
+      vec_add (results, tm->results, n_keys);
+      test_vhash_op (tm, tm->vhash_get_key_indices, results, n_keys, SET);
+
+      /* Both bucket sizes are timed via vhash_main_get. */
+      vm->vhash = &tm->vhash;
+      vec_reset_length (vm->keys);
+      vec_add (vm->keys, tm->keys, n_keys * tm->n_key_u32);
+
+      /* Best of n_iter calls to filter out noise. */
+      min_clocks = ~0ULL;
+      for (j = 0; j < tm->n_iter; j++)
+	{
+	  vec_validate_aligned (vm->results, n_keys + 3, CLIB_CACHE_LINE_BYTES);
+	  _vec_len (vm->results) = n_keys;
+	  t[0] = clib_cpu_time_now ();
+	  vhash_main_get (vm);
+	  t[1] = clib_cpu_time_now ();
+	  min_clocks = clib_min (min_clocks, t[1] - t[0]);
+	}
+      clocks_per_get[i] = (f64) min_clocks / n_keys;
+
+      for (j = 0; j < n_keys; j++)
+	if (vm->results[j] != tm->results[j])
+	  os_panic ();
+
+      if (tm->verbose)
+	clib_warning ("%U", format_vhash, &tm->vhash);
+    }
+
+  clib_warning ("%.4e clocks/get 4 keys/bucket, %.4e clocks/get 8 keys/bucket, speedup %.2f",
+		clocks_per_get[0], clocks_per_get[1],
+		clocks_per_get[0] / clocks_per_get[1]);
+
+ done:
+  vec_free (results);
+}
+
+static void
+test_vhash_auto_resize_get (test_vhash_main_t * tm, vhash_main_t * vm,
+			    uword * is_set_bitmap)
+{
+  uword i, n_keys = tm->n_keys;
+
+  vec_reset_length (vm->keys);
+  vec_add (vm->keys, tm->keys, n_keys * tm->n_key_u32);
+
+  /* Get writes results 4 at a time. */
+  vec_validate_aligned (vm->results, n_keys + 3, CLIB_CACHE_LINE_BYTES);
+  _vec_len (vm->results) = n_keys;
+
+  vhash_main_get (vm);
+
+  for (i = 0; i < n_keys; i++)
+    {
+      u32 r = clib_bitmap_get (is_set_bitmap, i) ? tm->results[i] : ~0;
+      if (vm->results[i] != r)
+	os_panic ();
+    }
+
+  if (vm->vhash->n_elts != clib_bitmap_count_set_bits (is_set_bitmap))
+    os_panic ();
+}
+
+/* Sets keys a few at a time into a small table via vhash_main_set and
+   checks all keys after each set, including while table is resizing. */
+static void
+test_vhash_auto_resize (test_vhash_main_t * tm)
+{
+  vhash_main_t _vm, * vm = &_vm;
+  vhash_t h;
+  uword * is_set_bitmap = 0;
+  u32 seeds[3], log2_n_keys, n_resizes, n_steps_resizing;
+  uword i, j, n, n_per_call = 16;
+  u32 n_key_u32 = tm->n_key_u32;
+
+  seeds[0] = seeds[1] = seeds[2] = 0xdeadbeef;
+  log2_n_keys = 4;
+  memset (&h, 0, sizeof (h));
+  vhash_init_keys_per_bucket (&h, log2_n_keys, n_key_u32, seeds,
+			      tm->keys_per_bucket);
+
+  memset (vm, 0, sizeof (vm[0]));
+  vm->vhash = &h;
+
+  n_resizes = n_steps_resizing = 0;
+  for (i = 0; i < tm->n_keys; i += n)
+    {
+      n = clib_min (n_per_call, tm->n_keys - i);
+
+      vec_reset_length (vm->keys);
+      vec_add (vm->keys, tm->keys + i * n_key_u32, n * n_key_u32);
+      vec_reset_length (vm->results);
+      vec_add (vm->results, tm->results + i, n);
+
+      vhash_main_set (vm);
+
+      for (j = 0; j < n; j++)
+	{
+	  is_set_bitmap = clib_bitmap_set (is_set_bitmap, i + j, 1);
+	  /* Old result of new key. */
+	  if (vm->results[j] != ~0)
+	    os_panic ();
+	}
+
+      n_steps_resizing += vm->resize != 0;
+      if (h.log2_n_keys != log2_n_keys)
+	{
+	  log2_n_keys = h.log2_n_keys;
+	  n_resizes++;
+	}
+
+      test_vhash_auto_resize_get (tm, vm, is_set_bitmap);
+    }
+
+  /* Unset every other chunk; resize may still be in progress. */
+  for (i = 0; i < tm->n_keys; i += 2 * n_per_call)
+    {
+      n = clib_min (n_per_call, tm->n_keys - i);
+
+      vec_reset_length (vm->keys);
+      vec_add (vm->keys, tm->keys + i * n_key_u32, n * n_key_u32);
+      vec_validate (vm->results, n - 1);
+      _vec_len (vm->results) = n;
+
+      vhash_main_unset (vm);
+
+      for (j = 0; j < n; j++)
+	{
+	  if (vm->results[j] != tm->results[i + j])
+	    os_panic ();
+	  is_set_bitmap = clib_bitmap_set (is_set_bitmap, i + j, 0);
+	}
+
+      test_vhash_auto_resize_get (tm, vm, is_set_bitmap);
+    }
+
+  clib_warning ("auto resize: %d resizes to log2 size %d, %d set calls while resizing",
+		n_resizes, h.log2_n_keys, n_steps_resizing);
+
+  if (tm->verbose)
+    clib_warning ("%U", format_vhash, &h);
+
+  if (tm->n_keys > (2 << 4) && n_resizes == 0)
+    os_panic ();
+
+  vhash_free (&h);
+  vec_free (vm->keys);
+  vec_free (vm->results);
+  clib_bitmap_free (is_set_bitmap);
+}
+
+static void
+test_vhash_fingerprint_validate (test_vhash_main_t * tm,
+				 vhash_fingerprint_t * f,
+				 uword * is_set_bitmap,
+				 u32 * results)
+{
+  uword i;
+
+  vhash_fingerprint_get (f, tm->keys, tm->n_keys, results);
+
+  for (i = 0; i < tm->n_keys; i++)
+    {
+      u32 r = clib_bitmap_get (is_set_bitmap, i) ? tm->results[i] : ~0;
+      if (results[i] != r)
+	os_panic ();
+    }
+
+  if (vhash_fingerprint_elts (f) != clib_bitmap_count_set_bits (is_set_bitmap))
+    os_panic ();
+}
+
+/* Sets and unsets keys a few at a time; each call also repeats its
+   first key.  Small fingerprint masks force long fingerprint chains. */
+static void
+test_vhash_fingerprint (test_vhash_main_t * tm)
+{
+  vhash_fingerprint_t _f, * f = &_f;
+  uword * is_set_bitmap = 0;
+  u32 seeds[3], * keys = 0, * results = 0, * get_results = 0;
+  uword i, j, n, n_per_call = 16;
+  u32 n_key_u32 = tm->n_key_u32;
+  u64 t[2], n_clocks = 0, n_gets = 0;
+
+  seeds[0] = seeds[1] = seeds[2] = 0xdeadbeef;
+  vhash_fingerprint_init (f, 4, n_key_u32, seeds);
+  if (tm->fingerprint_mask)
+    f->fingerprint_mask = tm->fingerprint_mask;
+
+  clib_warning ("fingerprint table log2-size %d keys-per-bucket %d fingerprint-mask 0x%x",
+		f->vhash.log2_n_keys, vhash_keys_per_bucket (&f->vhash),
+		f->fingerprint_mask);
+
+  vec_resize (get_results, tm->n_keys);
+
+  for (i = 0; i < tm->n_keys; i += n)
+    {
+      n = clib_min (n_per_call, tm->n_keys - i);
+
+      vec_reset_length (keys);
+      vec_add (keys, tm->keys + i * n_key_u32, n * n_key_u32);
+      vec_add (keys, tm->keys + i * n_key_u32, n_key_u32);
+      vec_reset_length (results);
+      vec_add (results, tm->results + i, n);
+      vec_add1 (results, tm->results[i]);
+
+      vhash_fingerprint_set (f, keys, n + 1, results);
+
+      for (j = 0; j < n; j++)
+	{
+	  if (results[j] != ~0)
+	    os_panic ();
+	  is_set_bitmap = clib_bitmap_set (is_set_bitmap, i + j, 1);
+	}
+      if (results[n] != tm->results[i])
+	os_panic ();
+
+      t[0] = clib_cpu_time_now ();
+      test_vhash_fingerprint_validate (tm, f, is_set_bitmap, get_results);
+      t[1] = clib_cpu_time_now ();
+      n_clocks += t[1] - t[0];
+      n_gets += tm->n_keys;
+    }
+
+  /* Unset every other call's worth of keys. */
+  for (i = 0; i < tm->n_keys; i += 2 * n_per_call)
+    {
+      n = clib_min (n_per_call, tm->n_keys - i);
+
+      vec_reset_length (keys);
+      vec_add (keys, tm->keys + i * n_key_u32, n * n_key_u32);
+      vec_add (keys, tm->keys + i * n_key_u32, n_key_u32);
+      vec_validate (results, n);
+      _vec_len (results) = n + 1;
+
+      vhash_fingerprint_unset (f, keys, n + 1, results);
+
+      for (j = 0; j < n; j++)
+	{
+	  if (results[j] != tm->results[i + j])
+	    os_panic ();
+	  is_set_bitmap = clib_bitmap_set (is_set_bitmap, i + j, 0);
+	}
+      if (results[n] != ~0)
+	os_panic ();
+
+      test_vhash_fingerprint_validate (tm, f, is_set_bitmap, get_results);
+    }
+
+  clib_warning ("fingerprint: %d keys of %d words, %.4e clocks/get, fingerprint table %U",
+		vhash_fingerprint_elts (f), n_key_u32,
+		n_gets > 0 ? (f64) n_clocks / n_gets : 0.,
+		format_vhash, &f->vhash);
+
+  vhash_fingerprint_free (f);
+  vec_free (keys);
+  vec_free (results);
+  vec_free (get_results);
+  clib_bitmap_free (is_set_bitmap);
+}
+
 int test_vhash_main (unformat_input_t * input)
 {
   clib_error_t * error = 0;
@@ -481,6 +826,16 @@ int test_vhash_main (unformat_input_t * input)
 	;
       else if (unformat (input, "key-words %d", &tm->n_key_u32))
 	;
+      else if (unformat (input, "keys-per-bucket %d", &tm->keys_per_bucket))
+	;
+      else if (unformat (input, "compare %=", &tm->compare, 1))
+	;
+      else if (unformat (input, "auto-resize %=", &tm->auto_resize, 1))
+	;
+      else if (unformat (input, "fingerprint-mask %x", &tm->fingerprint_mask))
+	tm->fingerprint = 1;
+      else if (unformat (input, "fingerprint %=", &tm->fingerprint, 1))
+	;
       else if (unformat (input, "verbose %=", &tm->verbose, 1))
 	;
       else
@@ -494,14 +849,20 @@ int test_vhash_main (unformat_input_t * input)
   if (tm->seed == 0)
     tm->seed = random_default_seed ();
 
-  clib_warning ("iter %d seed %d n-keys %d log2-size %d key-words %d",
-		tm->n_iter, tm->seed, tm->n_keys, tm->log2_size, tm->n_key_u32);
-
-  {
-    u32 seeds[3];
-    seeds[0] = seeds[1] = seeds[2] = 0xdeadbeef;
-    vhash_init (vh, tm->log2_size, tm->n_key_u32, seeds);
-  }
+  if (! tm->fingerprint)
+    {
+      u32 seeds[3];
+      seeds[0] = seeds[1] = seeds[2] = 0xdeadbeef;
+      vhash_init_keys_per_bucket (vh, tm->log2_size, tm->n_key_u32, seeds,
+				  tm->keys_per_bucket);
+      clib_warning ("iter %d seed %d n-keys %d log2-size %d key-words %d keys-per-bucket %d",
+		    tm->n_iter, tm->seed, tm->n_keys, tm->log2_size, tm->n_key_u32,
+		    vhash_keys_per_bucket (vh));
+    }
+  else
+    /* Fingerprint table parameters are printed by test_vhash_fingerprint. */
+    clib_warning ("seed %d n-keys %d key-words %d fingerprint",
+		  tm->seed, tm->n_keys, tm->n_key_u32);
 
   /* Choose unique keys. */
   vec_resize (tm->keys, tm->n_keys * tm->n_key_u32);
@@ -523,6 +884,12 @@ int test_vhash_main (unformat_input_t * input)
       } while (tm->results[i] == ~0);
     }
 
+  if (tm->fingerprint)
+    {
+      test_vhash_fingerprint (tm);
+      goto done;
+    }
+
   vec_resize_aligned (tm->vhash_get_results, tm->n_keys, CLIB_CACHE_LINE_BYTES);
   vec_clone (tm->vhash_get_key_indices, tm->results);
   for (i = 0; i < vec_len (tm->vhash_get_key_indices); i++)
@@ -671,6 +1038,9 @@ int test_vhash_main (unformat_input_t * input)
       os_panic ();
   }
 
+  if (tm->verbose)
+    clib_warning ("%U", format_vhash, vh);
+
   {
     clib_time_t ct;
 
@@ -692,6 +1062,12 @@ int test_vhash_main (unformat_input_t * input)
 		    (f64) tm->unset_stats.n_vectors / (f64) (tm->unset_stats.n_clocks * ct.seconds_per_clock));
   }
 
+  if (tm->compare)
+    test_vhash_compare (tm);
+
+  if (tm->auto_resize)
+    test_vhash_auto_resize (tm);
+
  done:
   if (error)
     clib_error_report (error);
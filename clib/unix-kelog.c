@@ -24,6 +24,7 @@
 #include <clib/error.h>
 #include <clib/unix.h>
 #include <clib/elog.h>
+#include <clib/kelog.h>
 #include <clib/format.h>
 #include <clib/os.h>
 
@@ -31,12 +32,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
-
-typedef enum
-  {
-    RUNNING = 0,
-    WAKEUP,
-  } sched_event_type_t;
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 typedef struct 
 {
@@ -44,19 +42,17 @@ typedef struct
   u8 *task;
   u32 pid;
   f64 timestamp;
-  sched_event_type_t type;
+  kelog_sched_event_type_t type;
 } sched_event_t;
 
 void kelog_init (elog_main_t * em, char * kernel_tracer, u32 n_events)
 {
   int enable_fd, current_tracer_fd, data_fd;
   int len;
-  struct timespec ts, ts2;
+  struct timespec ts;
   char *trace_enable = "/debug/tracing/tracing_enabled";
   char *current_tracer = "/debug/tracing/current_tracer";
   char *trace_data = "/debug/tracing/trace";
-  f64 realtime, monotonic;
-  f64 freq, secs_per_clock;
 
   ASSERT (kernel_tracer);
 
@@ -150,7 +146,6 @@ sched_event_t *parse_sched_switch_trace (u8 *tdata, u32 *index)
 {
   u8 *cp = tdata + *index;
   u8 *limit = tdata + vec_len(tdata);
-  int colons;
   static sched_event_t event;
   sched_event_t *e = &event;
   static u8 *task_name;
@@ -199,7 +194,7 @@ sched_event_t *parse_sched_switch_trace (u8 *tdata, u32 *index)
       return 0;
     }
       
-  secs = atoi(cp);
+  secs = atoi((char *) cp);
 
   while (cp < limit && (*cp != '.'))
     cp++;
@@ -212,7 +207,7 @@ sched_event_t *parse_sched_switch_trace (u8 *tdata, u32 *index)
       
   cp++;
 
-  usecs = atoi (cp);
+  usecs = atoi ((char *) cp);
 
   e->timestamp = ((f64)secs) + ((f64)usecs)*1e-6;
       
@@ -237,9 +232,9 @@ sched_event_t *parse_sched_switch_trace (u8 *tdata, u32 *index)
       return 0;
     }
   if (*cp == '>')
-    e->type = RUNNING;
+    e->type = KELOG_SCHED_RUNNING;
   else if (*cp == '+')
-    e->type = WAKEUP;
+    e->type = KELOG_SCHED_WAKEUP;
   else
     {
       clib_warning ("bugger 3");
@@ -253,7 +248,7 @@ sched_event_t *parse_sched_switch_trace (u8 *tdata, u32 *index)
       return 0;
     }
             
-  e->cpu = atoi (cp);
+  e->cpu = atoi ((char *) cp);
   cp += 4;
           
   if (cp >= limit) 
@@ -264,7 +259,7 @@ sched_event_t *parse_sched_switch_trace (u8 *tdata, u32 *index)
   while (cp < limit && (*cp == ' ' || *cp == '\t'))
     cp++;
 
-  e->pid = atoi (cp);
+  e->pid = atoi ((char *) cp);
           
   for (i = 0; i < 2; i++)
     {
@@ -301,20 +296,26 @@ sched_event_t *parse_sched_switch_trace (u8 *tdata, u32 *index)
   return e;
 }
 
+/* String table dedups so same task always gives same string. */
 static u32 elog_id_for_pid (elog_main_t *em, u8 *name, u32 pid)
-{
-  uword * p, r;
-  mhash_t * h = &em->string_table_hash;
+{ return elog_string (em, "%s(%d)", name, pid); }
 
-  if (! em->string_table_hash.hash)
-    mhash_init (h, sizeof (uword), sizeof (pid));
-  
-  p = mhash_get (h, &pid);
-  if (p)
-    return p[0];
-  r = elog_string (em, "%s(%d)", name, pid);
-  mhash_set (h, &pid, r, /* old_value */ 0);
-  return r;
+static void kelog_add_sched_event (elog_main_t * em, elog_track_t * track, u64 cpu_time,
+                                   u32 cpu, u32 string_table_offset, kelog_sched_event_type_t which)
+{
+  ELOG_TYPE_DECLARE (e) = 
+    {
+      .format = "%d: %s %s",
+      .format_args = "i4T4t4",
+      .n_enum_strings = 2,
+      .enum_strings = { "running", "wakeup", },
+    };
+  struct { u32 cpu, string_table_offset, which; } * ed;
+
+  ed = elog_event_data_not_inline (em, &__ELOG_TYPE_VAR(e), track, cpu_time);
+  ed->cpu = cpu;
+  ed->string_table_offset = string_table_offset;
+  ed->which = which;
 }
 
 void kelog_collect_sched_switch_trace (elog_main_t *em)
@@ -323,13 +324,10 @@ void kelog_collect_sched_switch_trace (elog_main_t *em)
   char *trace_enable = "/debug/tracing/tracing_enabled";
   char *trace_data = "/debug/tracing/trace";
   u8 *data = 0;
-  u8 *dp;
   int bytes, total_bytes;
   u32 pos;
   sched_event_t *evt;
-  u64 nsec_to_add;
   u32 index;
-  f64 clocks_per_sec;
   
   enable_fd = open (trace_enable, O_RDWR);
   if (enable_fd < 0)
@@ -376,7 +374,7 @@ void kelog_collect_sched_switch_trace (elog_main_t *em)
   vec_add1(data, 0);
 
   /* Synthesize events */
-  em->is_enabled = 1;
+  elog_enable_disable (em, 1);
 
   index = 0;
   while ((evt = parse_sched_switch_trace (data, &index)))
@@ -384,24 +382,490 @@ void kelog_collect_sched_switch_trace (elog_main_t *em)
       u64 fake_cpu_clock;
 
       fake_cpu_clock = evt->timestamp * em->cpu_timer.clocks_per_second;
-      {
-        ELOG_TYPE_DECLARE (e) = 
-          {
-            .format = "%d: %s %s",
-            .format_args = "i4T4t4",
-            .n_enum_strings = 2,
-            .enum_strings = { "running", "wakeup", },
-          };
-        struct { u32 cpu, string_table_offset, which; } * ed;
-        
-        ed = elog_event_data_not_inline (em, &__ELOG_TYPE_VAR(e),
-                                         &em->default_track, 
-                                         fake_cpu_clock);
-        ed->cpu = evt->cpu;
-        ed->string_table_offset = elog_id_for_pid (em, evt->task, evt->pid);
-        ed->which = evt->type;
-      }
+      kelog_add_sched_event (em, &em->default_track, fake_cpu_clock,
+                             evt->cpu, elog_id_for_pid (em, evt->task, evt->pid),
+                             evt->type);
       _vec_len(evt->task) = 0;
     }
-  em->is_enabled = 0;
+  elog_disable_after_events (em, 0);
+}
+
+/*
+ * Binary ingestion: reads the kernel's per cpu ring buffer pages
+ * (per_cpu/cpuN/trace_pipe_raw) and decodes sched_switch and
+ * sched_wakeup records directly.  Nothing is formatted by the kernel
+ * or parsed here so collection keeps up with full event rate as long
+ * as kelog_raw_collect is called before kernel buffers fill.
+ *
+ * Kernel events go into their own elog (one track per cpu) with time
+ * stamps in cpu clocks; combine with application events using elog_merge.
+ */
+
+static kelog_raw_main_t kelog_raw_main;
+
+static clib_error_t *
+kelog_raw_write (kelog_raw_main_t * km, char * file, char * value)
+{
+  u8 * path = format (0, "%v/%s%c", km->tracing_dir, file, 0);
+  clib_error_t * error = 0;
+  int fd, n = strlen (value);
+
+  fd = open ((char *) path, O_WRONLY | O_TRUNC);
+  if (fd < 0)
+    error = clib_error_return_unix (0, "open `%s'", path);
+  else if (write (fd, value, n) != n)
+    error = clib_error_return_unix (0, "write `%s' to `%s'", value, path);
+  if (fd >= 0)
+    close (fd);
+  vec_free (path);
+  return error;
+}
+
+static clib_error_t *
+kelog_raw_read_file (kelog_raw_main_t * km, char * file, u8 ** result)
+{
+  u8 * path = format (0, "%v/%s%c", km->tracing_dir, file, 0);
+  clib_error_t * error = unix_proc_file_contents ((char *) path, result);
+  vec_free (path);
+  return error;
+}
+
+/* Trace clock file lists all clocks with current one in brackets. */
+static clib_error_t *
+kelog_raw_save_trace_clock (kelog_raw_main_t * km)
+{
+  clib_error_t * error;
+  u8 * clocks, * l, * r;
+
+  if ((error = kelog_raw_read_file (km, "trace_clock", &clocks)))
+    return error;
+
+  l = memchr (clocks, '[', vec_len (clocks));
+  r = l ? memchr (l, ']', vec_end (clocks) - l) : 0;
+  if (r)
+    {
+      vec_add (km->saved_trace_clock, l + 1, r - (l + 1));
+      vec_add1 (km->saved_trace_clock, 0);
+    }
+  else
+    error = clib_error_return (0, "no current trace clock in `%v'", clocks);
+
+  vec_free (clocks);
+  return error;
+}
+
+static void
+kelog_raw_restore_trace_clock (kelog_raw_main_t * km)
+{
+  if (km->saved_trace_clock)
+    clib_error_free_vector (kelog_raw_write (km, "trace_clock",
+					     (char *) km->saved_trace_clock));
+  vec_free (km->saved_trace_clock);
+}
+
+/* Finds offset and size of given field in kernel format file.
+   Lines look like "field:char prev_comm[16];	offset:8;	size:16;	signed:0;" */
+static int
+kelog_raw_format_field (u8 * format_file, char * name, u32 * offset, u32 * size)
+{
+  unformat_input_t input, line;
+  u8 * decl;
+  int found = 0;
+
+  unformat_init_string (&input, (char *) format_file, vec_len (format_file));
+  while (! found && unformat_check_input (&input) != UNFORMAT_END_OF_INPUT)
+    {
+      unformat_user (&input, unformat_line_input, &line);
+      if (unformat (&line, "field:%U", unformat_token, "a-zA-Z0-9_ []", &decl))
+	{
+	  word i = vec_len (decl), n = strlen (name);
+
+	  /* Skip array dimension; name ends declaration. */
+	  if (i > 0 && decl[i - 1] == ']')
+	    while (i > 0 && decl[i - 1] != '[')
+	      i--;
+	  if (i > 0 && decl[i - 1] == '[')
+	    i--;
+
+	  found = (i >= n
+		   && ! memcmp (decl + i - n, name, n)
+		   && (i == n || decl[i - n - 1] == ' ')
+		   && unformat (&line, "; offset:%d; size:%d;", offset, size));
+	  vec_free (decl);
+	}
+      unformat_free (&line);
+    }
+  unformat_free (&input);
+  return found;
+}
+
+static clib_error_t *
+kelog_raw_event_format (kelog_raw_main_t * km, char * event, kelog_sched_event_type_t type,
+			char * pid_field, char * comm_field, char * cpu_field)
+{
+  kelog_raw_event_format_t * f;
+  clib_error_t * error;
+  unformat_input_t input;
+  u8 * path, * format_file;
+  u32 size, pid_size, cpu_size;
+  int ok;
+
+  path = format (0, "events/sched/%s/format%c", event, 0);
+  error = kelog_raw_read_file (km, (char *) path, &format_file);
+  vec_free (path);
+  if (error)
+    return error;
+
+  vec_add2 (km->event_formats, f, 1);
+  f->type = type;
+  f->id = ~0;
+
+  unformat_init_string (&input, (char *) format_file, vec_len (format_file));
+  while (unformat_check_input (&input) != UNFORMAT_END_OF_INPUT)
+    {
+      unformat_input_t line;
+      unformat_user (&input, unformat_line_input, &line);
+      unformat (&line, "ID: %d", &f->id);
+      unformat_free (&line);
+    }
+  unformat_free (&input);
+
+  ok = (f->id != ~0
+	&& kelog_raw_format_field (format_file, pid_field, &f->pid_offset, &pid_size)
+	&& kelog_raw_format_field (format_file, comm_field, &f->comm_offset, &f->comm_bytes)
+	&& pid_size == sizeof (u32));
+  if (! cpu_field
+      || ! kelog_raw_format_field (format_file, cpu_field, &f->cpu_offset, &cpu_size)
+      || cpu_size != sizeof (u32))
+    f->cpu_offset = ~0;
+  vec_free (format_file);
+
+  if (! ok)
+    {
+      _vec_len (km->event_formats) -= 1;
+      return clib_error_return (0, "unknown format for event `%s'", event);
+    }
+
+  size = clib_max (f->pid_offset + pid_size, f->comm_offset + f->comm_bytes);
+  if (f->cpu_offset != ~0)
+    size = clib_max (size, f->cpu_offset + cpu_size);
+  f->min_bytes = size;
+
+  return 0;
+}
+
+/* Current time of trace clock. */
+static u64 kelog_raw_trace_time_now (kelog_raw_main_t * km)
+{
+  struct timespec ts;
+
+  if (km->trace_clock_is_cpu_clock)
+    return clib_cpu_time_now ();
+  syscall (SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+  return (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+always_inline u64
+kelog_raw_cpu_time (elog_main_t * em, kelog_raw_main_t * km, u64 trace_time)
+{
+  if (km->trace_clock_is_cpu_clock)
+    return trace_time;
+  return km->init_cpu_time
+    + (i64) ((f64) (i64) (trace_time - km->init_trace_time)
+	     * 1e-9 * em->cpu_timer.clocks_per_second);
+}
+
+static void
+kelog_raw_decode_record (elog_main_t * em, kelog_raw_main_t * km,
+			 u32 cpu, u64 time, u8 * d, u32 n_bytes)
+{
+  kelog_raw_event_format_t * f;
+  kelog_raw_event_t * e;
+  u8 comm[16 + 1];
+  u32 id, pid;
+
+  if (n_bytes < sizeof (u16))
+    return;
+  id = clib_mem_unaligned (d, u16);
+
+  vec_foreach (f, km->event_formats)
+    if (f->id == id)
+      break;
+  if (f >= vec_end (km->event_formats) || n_bytes < f->min_bytes)
+    return;
+
+  pid = clib_mem_unaligned (d + f->pid_offset, u32);
+  memset (comm, 0, sizeof (comm));
+  memcpy (comm, d + f->comm_offset, clib_min (f->comm_bytes, sizeof (comm) - 1));
+
+  vec_add2 (km->pending_events, e, 1);
+  e->time = time;
+  e->cpu = cpu;
+  e->task_cpu = f->cpu_offset != ~0 ? clib_mem_unaligned (d + f->cpu_offset, u32) : cpu;
+  e->string_table_offset = elog_id_for_pid (em, comm, pid);
+  e->type = f->type;
+}
+
+/* Decodes one ring buffer page: header (time stamp, commit) followed by
+   records each with 32 bit header of 5 bit type/length and 27 bit time delta. */
+void
+kelog_raw_decode_page (elog_main_t * em, kelog_raw_main_t * km,
+		       u32 cpu, u8 * page, uword n_page_bytes)
+{
+  u8 * d, * end;
+  u64 time, commit;
+
+  if (n_page_bytes < km->data_offset)
+    return;
+
+  time = clib_mem_unaligned (page, u64);
+  commit = (km->commit_bytes == sizeof (u64)
+	    ? clib_mem_unaligned (page + km->commit_offset, u64)
+	    : clib_mem_unaligned (page + km->commit_offset, u32));
+
+  d = page + km->data_offset;
+  end = d + (commit & ~(KELOG_RAW_MISSED_EVENTS | KELOG_RAW_MISSED_STORED));
+  end = clib_min (end, page + n_page_bytes);
+
+  if (commit & KELOG_RAW_MISSED_EVENTS)
+    {
+      /* Count follows data when stored; otherwise at least one. */
+      if ((commit & KELOG_RAW_MISSED_STORED)
+	  && end + km->commit_bytes <= page + n_page_bytes)
+	km->n_events_lost += (km->commit_bytes == sizeof (u64)
+			      ? clib_mem_unaligned (end, u64)
+			      : clib_mem_unaligned (end, u32));
+      else
+	km->n_events_lost += 1;
+    }
+
+  while (d + sizeof (u32) <= end)
+    {
+      u32 h = clib_mem_unaligned (d, u32);
+      u32 type_len = h & 0x1f;
+      u32 time_delta = h >> 5;
+      u32 array0 = d + 2 * sizeof (u32) <= end ? clib_mem_unaligned (d + 4, u32) : 0;
+
+      switch (type_len)
+	{
+	case KELOG_RAW_TYPE_PADDING:
+	  /* Zero delta means rest of page is empty. */
+	  if (time_delta == 0)
+	    return;
+	  d += sizeof (u32) + array0;
+	  break;
+
+	case KELOG_RAW_TYPE_TIME_EXTEND:
+	  time += ((u64) array0 << KELOG_RAW_TIME_SHIFT) + time_delta;
+	  d += 2 * sizeof (u32);
+	  break;
+
+	case KELOG_RAW_TYPE_TIME_STAMP:
+	  /* Absolute time stamp; keeps high bits of current time. */
+	  time = ((time >> 59) << 59) | ((u64) array0 << KELOG_RAW_TIME_SHIFT) | time_delta;
+	  d += 2 * sizeof (u32);
+	  break;
+
+	case 0:
+	  /* Length (including length word) follows header. */
+	  time += time_delta;
+	  if (array0 < sizeof (u32) || d + sizeof (u32) + array0 > end)
+	    return;
+	  kelog_raw_decode_record (em, km, cpu, time, d + 2 * sizeof (u32), array0 - sizeof (u32));
+	  d += sizeof (u32) + array0;
+	  break;
+
+	default:
+	  time += time_delta;
+	  if (d + sizeof (u32) + 4 * type_len > end)
+	    return;
+	  kelog_raw_decode_record (em, km, cpu, time, d + sizeof (u32), 4 * type_len);
+	  d += sizeof (u32) + 4 * type_len;
+	  break;
+	}
+    }
+}
+
+/* Adds pending events older than given trace time to log in time order. */
+static void
+kelog_raw_add_events (elog_main_t * em, kelog_raw_main_t * km, u64 before_time)
+{
+  kelog_raw_event_t * e;
+  uword n;
+
+  vec_sort (km->pending_events, e0, e1,
+	    e0->time < e1->time ? -1 : (e0->time > e1->time ? +1 : 0));
+
+  n = 0;
+  vec_foreach (e, km->pending_events)
+    {
+      if (e->time >= before_time)
+	break;
+      kelog_add_sched_event (em, vec_elt_at_index (km->track_by_cpu, e->cpu),
+			     kelog_raw_cpu_time (em, km, e->time),
+			     e->task_cpu, e->string_table_offset, e->type);
+      n++;
+    }
+
+  vec_delete (km->pending_events, n, 0);
+}
+
+clib_error_t * kelog_raw_collect (elog_main_t * em)
+{
+  kelog_raw_main_t * km = &kelog_raw_main;
+  u64 now = kelog_raw_trace_time_now (km);
+  uword cpu;
+
+  for (cpu = 0; cpu < vec_len (km->fd_by_cpu); cpu++)
+    {
+      int fd = km->fd_by_cpu[cpu];
+
+      if (fd < 0)
+	continue;
+
+      while (1)
+	{
+	  int n = read (fd, km->page, vec_len (km->page));
+	  if (n < 0 && errno != EAGAIN)
+	    return clib_error_return_unix (0, "read cpu %d trace pipe", cpu);
+	  if (n <= 0)
+	    break;
+	  kelog_raw_decode_page (em, km, cpu, km->page, n);
+	}
+    }
+
+  /* Events older than start of read are in pages already read.
+     Newer events wait for next collect to be ordered with other cpus. */
+  kelog_raw_add_events (em, km, now);
+
+  return 0;
+}
+
+clib_error_t * kelog_raw_init (elog_main_t * em, u32 n_events)
+{
+  kelog_raw_main_t * km = &kelog_raw_main;
+  char * dirs[] = { "/sys/kernel/tracing", "/sys/kernel/debug/tracing", "/debug/tracing", };
+  clib_error_t * error = 0;
+  u8 * header_page = 0;
+  u32 i, n_cpus, size;
+
+  memset (km, 0, sizeof (km[0]));
+
+  /* init first so we won't hurt ourselves if we bail */
+  elog_init (em, n_events);
+
+  for (i = 0; i < ARRAY_LEN (dirs); i++)
+    {
+      u8 * path = format (0, "%s/per_cpu%c", dirs[i], 0);
+      struct stat s;
+      int found = stat ((char *) path, &s) == 0;
+      vec_free (path);
+      if (found)
+	break;
+    }
+  if (i >= ARRAY_LEN (dirs))
+    {
+      error = clib_error_return (0, "no kernel tracing directory");
+      goto done;
+    }
+  km->tracing_dir = format (0, "%s", dirs[i]);
+
+  if ((error = kelog_raw_write (km, "tracing_on", "0")))
+    goto done;
+
+  if ((error = kelog_raw_read_file (km, "events/header_page", &header_page)))
+    goto done;
+  if (! kelog_raw_format_field (header_page, "commit", &km->commit_offset, &km->commit_bytes)
+      || ! kelog_raw_format_field (header_page, "data", &km->data_offset, &size)
+      || (km->commit_bytes != sizeof (u32) && km->commit_bytes != sizeof (u64)))
+    {
+      error = clib_error_return (0, "unknown ring buffer page header format");
+      goto done;
+    }
+  vec_resize (km->page, km->data_offset + size);
+
+  if ((error = kelog_raw_event_format (km, "sched_switch", KELOG_SCHED_RUNNING,
+				       "next_pid", "next_comm", /* cpu */ 0))
+      || (error = kelog_raw_event_format (km, "sched_wakeup", KELOG_SCHED_WAKEUP,
+					  "pid", "comm", "target_cpu"))
+      || (error = kelog_raw_event_format (km, "sched_wakeup_new", KELOG_SCHED_WAKEUP,
+					  "pid", "comm", "target_cpu")))
+    goto done;
+
+  /* Cpu clock time stamps need no conversion. */
+  if ((error = kelog_raw_save_trace_clock (km)))
+    goto done;
+#if defined (__x86_64__) || defined (__i386__)
+  km->trace_clock_is_cpu_clock = ! kelog_raw_write (km, "trace_clock", "x86-tsc");
+#endif
+  if (! km->trace_clock_is_cpu_clock
+      && (error = kelog_raw_write (km, "trace_clock", "mono")))
+    goto done;
+  km->init_cpu_time = clib_cpu_time_now ();
+  km->init_trace_time = kelog_raw_trace_time_now (km);
+
+  /* Clear kernel buffers. */
+  if ((error = kelog_raw_write (km, "trace", "")))
+    goto done;
+
+  n_cpus = sysconf (_SC_NPROCESSORS_CONF);
+  for (i = 0; i < n_cpus; i++)
+    {
+      u8 * path = format (0, "%v/per_cpu/cpu%d/trace_pipe_raw%c", km->tracing_dir, i, 0);
+      elog_track_t * t;
+
+      vec_add1 (km->fd_by_cpu, open ((char *) path, O_RDONLY | O_NONBLOCK));
+      vec_free (path);
+
+      vec_add2 (km->track_by_cpu, t, 1);
+      t->name = (char *) format (0, "kernel cpu %d%c", i, 0);
+      elog_track_register (em, t);
+    }
+
+  if ((error = kelog_raw_write (km, "events/sched/sched_switch/enable", "1"))
+      || (error = kelog_raw_write (km, "events/sched/sched_wakeup/enable", "1"))
+      || (error = kelog_raw_write (km, "events/sched/sched_wakeup_new/enable", "1"))
+      || (error = kelog_raw_write (km, "tracing_on", "1")))
+    goto done;
+
+ done:
+  if (error)
+    kelog_raw_restore_trace_clock (km);
+  vec_free (header_page);
+  return error;
+}
+
+clib_error_t * kelog_raw_close (elog_main_t * em)
+{
+  kelog_raw_main_t * km = &kelog_raw_main;
+  clib_error_t * error;
+  uword i;
+
+  error = kelog_raw_write (km, "tracing_on", "0");
+  if (! error)
+    error = kelog_raw_collect (em);
+  kelog_raw_add_events (em, km, ~0ULL);
+
+  if (km->n_events_lost > 0)
+    clib_warning ("kernel lost %Ld events", km->n_events_lost);
+
+  clib_error_free_vector (kelog_raw_write (km, "events/sched/sched_switch/enable", "0"));
+  clib_error_free_vector (kelog_raw_write (km, "events/sched/sched_wakeup/enable", "0"));
+  clib_error_free_vector (kelog_raw_write (km, "events/sched/sched_wakeup_new/enable", "0"));
+  kelog_raw_restore_trace_clock (km);
+
+  for (i = 0; i < vec_len (km->fd_by_cpu); i++)
+    if (km->fd_by_cpu[i] >= 0)
+      close (km->fd_by_cpu[i]);
+  for (i = 0; i < vec_len (km->track_by_cpu); i++)
+    vec_free (km->track_by_cpu[i].name);
+
+  vec_free (km->fd_by_cpu);
+  vec_free (km->track_by_cpu);
+  vec_free (km->page);
+  vec_free (km->event_formats);
+  vec_free (km->pending_events);
+  vec_free (km->tracing_dir);
+
+  return error;
 }
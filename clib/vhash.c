@@ -156,6 +156,7 @@ vhash_set_overflow (vhash_t * h,
     b->key[i].as_u32[i_set] = vhash_get_key_word (h, i, vi);
 
   ob->n_overflow++;
+  h->n_overflow++;
   h->n_elts++;
 
   return /* old result was invalid */ 0;
@@ -193,6 +194,7 @@ vhash_unset_overflow (vhash_t * h,
 
 	  ASSERT (ob->n_overflow > 0);
 	  ob->n_overflow--;
+	  h->n_overflow--;
 	  h->n_elts--;
 	  return old_result;
 	}
@@ -204,13 +206,15 @@ vhash_unset_overflow (vhash_t * h,
 
 void
 vhash_unset_refill_from_overflow (vhash_t * h,
-				  vhash_search_bucket_t * sb,
+				  void * _sb,
 				  u32 key_hash,
 				  u32 n_key_u32s)
 {
   vhash_overflow_buckets_t * obs = vhash_get_overflow_buckets (h, key_hash);
   vhash_overflow_search_bucket_t * ob;
+  u32 * sb = _sb;
   u32 i, j, i_refill, bucket_mask = h->bucket_mask.as_u32[0];
+  u32 l = h->log2_keys_per_bucket;
 
   /* Find overflow element with matching key hash. */
   foreach_vhash_overflow_bucket (ob, obs, n_key_u32s)
@@ -223,35 +227,71 @@ vhash_unset_refill_from_overflow (vhash_t * h,
 	      != (key_hash & bucket_mask))
 	    continue;
 
-	  i_refill = vhash_empty_result_index (sb->result.as_u32x4);
-	  sb->result.as_u32[i_refill] = ob->result.as_u32[i];
+	  for (i_refill = 0; sb[i_refill] != 0; i_refill++)
+	    ;
+	  ASSERT (i_refill < (1 << l));
+	  sb[i_refill] = ob->result.as_u32[i];
 	  for (j = 0; j < n_key_u32s; j++)
-	    sb->key[j].as_u32[i_refill] = ob->key[j].as_u32[i];
+	    sb[((1 + j) << l) + i_refill] = ob->key[j].as_u32[i];
 	  set_overflow_result (ob, i, 0, ~key_hash);
 	  free_overflow_bucket (obs, ob, i);
+	  ASSERT (obs->n_overflow > 0);
+	  obs->n_overflow--;
+	  h->n_overflow--;
 	  return;
 	}
     }
 }
 
-void vhash_init (vhash_t * h, u32 log2_n_keys, u32 n_key_u32, u32 * hash_seeds)
+#ifdef VHASH_HAVE_8_LANES
+
+static int vhash_have_avx2 = -1;
+
+static uword
+vhash_use_8_lanes (void)
+{
+  if (PREDICT_FALSE (vhash_have_avx2 < 0))
+    {
+      __builtin_cpu_init ();
+      vhash_have_avx2 = __builtin_cpu_supports ("avx2") != 0;
+    }
+  return vhash_have_avx2;
+}
+
+#else /* VHASH_HAVE_8_LANES */
+
+#define vhash_use_8_lanes() 0
+
+#endif /* VHASH_HAVE_8_LANES */
+
+void vhash_init_keys_per_bucket (vhash_t * h, u32 log2_n_keys, u32 n_key_u32,
+				 u32 * hash_seeds, u32 keys_per_bucket)
 {
   uword i, j, m;
-  vhash_search_bucket_t * b;
 
   memset (h, 0, sizeof (h[0]));
 
-  /* Must have at least 4 keys (e.g. one search bucket). */
-  log2_n_keys = clib_max (log2_n_keys, 2);
+  /* Longer keys need fingerprint mode. */
+  ASSERT (n_key_u32 >= 1 && n_key_u32 <= VHASH_MAX_N_KEY_U32);
+
+  /* 8 key buckets only when asked for and cpu supports them: they are
+     not faster than 4 for small tables. */
+  if (keys_per_bucket != 8 || ! vhash_use_8_lanes ())
+    keys_per_bucket = 4;
+  ASSERT (keys_per_bucket == 4 || keys_per_bucket == 8);
+  h->log2_keys_per_bucket = min_log2 (keys_per_bucket);
+
+  /* Must have at least one search bucket. */
+  log2_n_keys = clib_max (log2_n_keys, h->log2_keys_per_bucket);
 
   h->log2_n_keys = log2_n_keys;
   h->n_key_u32 = n_key_u32;
-  m = pow2_mask (h->log2_n_keys) &~ 3;
+  m = pow2_mask (h->log2_n_keys) &~ pow2_mask (h->log2_keys_per_bucket);
   for (i = 0; i < CLIB_VECTOR_WORD_LEN (u32); i++)
     h->bucket_mask.as_u32[i] = m;
 
-  /* Allocate and zero search buckets. */
-  i = (sizeof (b[0]) / sizeof (u32x4) + n_key_u32) << (log2_n_keys - 2);
+  /* Allocate and zero search buckets: a result plus key for each key. */
+  i = (1 + n_key_u32) << (log2_n_keys - 2);
   vec_validate_aligned (h->search_buckets, i - 1, CLIB_CACHE_LINE_BYTES);
 
   /* Inialize find first zero lookup table. */
@@ -264,6 +304,9 @@ void vhash_init (vhash_t * h, u32 log2_n_keys, u32 n_key_u32, u32 * hash_seeds)
       h->hash_seeds[i].as_u32[j] = hash_seeds[i];
 }
 
+void vhash_init (vhash_t * h, u32 log2_n_keys, u32 n_key_u32, u32 * hash_seeds)
+{ vhash_init_keys_per_bucket (h, log2_n_keys, n_key_u32, hash_seeds, 4); }
+
 static_always_inline u32
 vhash_main_key_gather (void * _vm, u32 vi, u32 wi, u32 n_key_u32)
 {
@@ -427,12 +470,8 @@ vhash_main_get_4result (void * _vm, u32 vi, u32x4 old_result, u32 n_key_u32)
 		      vm, N_KEY_U32);					\
    })
 
-_ (1);
-_ (2);
-_ (3);
-_ (4);
-_ (5);
-_ (6);
+foreach_vhash_short_n_key_u32
+foreach_vhash_long_n_key_u32
 
 #undef _
 
@@ -451,9 +490,7 @@ _ (6);
      vhash_mix_stage (vm->vhash, vm->n_vectors_div_4, N_KEY_U32);	\
    })
 
-_ (4);
-_ (5);
-_ (6);
+foreach_vhash_long_n_key_u32
 
 #undef _
 
@@ -461,6 +498,297 @@ typedef enum {
   GET, SET, UNSET,
 } vhash_main_op_t;
 
+#ifdef VHASH_HAVE_8_LANES
+
+/* Same pipelines for 8 lane stages and search buckets of 8 keys. */
+#pragma GCC push_options
+#pragma GCC target ("avx2")
+
+#define _(N_KEY_U32)							\
+  clib_pipeline_stage_static						\
+  (vhash8_main_gather_keys_stage_##N_KEY_U32,				\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_gather_8key_stage					\
+       (vm->vhash,							\
+	/* vector_index */ i,						\
+	vhash_main_4key_gather_##N_KEY_U32,				\
+	vm,								\
+	N_KEY_U32);							\
+   })									\
+									\
+  clib_pipeline_stage_no_inline						\
+  (vhash8_main_gather_keys_mod_stage_##N_KEY_U32,			\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_gather_key_stage					\
+       (vm->vhash,							\
+	/* vector_index */ vm->n_vectors_div_8,				\
+	/* n_vectors */ vm->n_vectors_mod_8,				\
+	vhash_main_key_gather_##N_KEY_U32,				\
+	vm,								\
+	N_KEY_U32);							\
+   })									\
+									\
+  clib_pipeline_stage							\
+  (vhash8_main_hash_finalize_stage_##N_KEY_U32,				\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_finalize_stage (vm->vhash, i, N_KEY_U32);			\
+   })									\
+									\
+  clib_pipeline_stage_no_inline						\
+  (vhash8_main_hash_finalize_mod_stage_##N_KEY_U32,			\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_finalize_stage (vm->vhash, vm->n_vectors_div_8, N_KEY_U32);	\
+   })									\
+									\
+  clib_pipeline_stage_static						\
+  (vhash8_main_get_stage_##N_KEY_U32,					\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_get_8_stage (vm->vhash,					\
+			/* vector_index */ i,				\
+			vhash_main_get_4result,				\
+			vm, N_KEY_U32);					\
+   })									\
+									\
+  clib_pipeline_stage_no_inline						\
+  (vhash8_main_get_mod_stage_##N_KEY_U32,				\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_get_stage (vm->vhash,					\
+		      /* vector_index */ vm->n_vectors_div_8,		\
+		      /* n_vectors */ vm->n_vectors_mod_8,		\
+		      vhash_main_get_result,				\
+		      vm, N_KEY_U32);					\
+   })									\
+									\
+  clib_pipeline_stage_static						\
+  (vhash8_main_set_stage_##N_KEY_U32,					\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_set_stage (vm->vhash,					\
+		      /* vector_index */ i,				\
+		      /* n_vectors */ 8,	\
+		      vhash_main_set_result,				\
+		      vm, N_KEY_U32);					\
+   })									\
+									\
+  clib_pipeline_stage_no_inline						\
+  (vhash8_main_set_mod_stage_##N_KEY_U32,				\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_set_stage (vm->vhash,					\
+		      /* vector_index */ vm->n_vectors_div_8,		\
+		      /* n_vectors */ vm->n_vectors_mod_8,		\
+		      vhash_main_set_result,				\
+		      vm, N_KEY_U32);					\
+   })									\
+									\
+  clib_pipeline_stage_static						\
+  (vhash8_main_unset_stage_##N_KEY_U32,					\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_unset_stage (vm->vhash,					\
+		      /* vector_index */ i,				\
+		      /* n_vectors */ 8,	\
+		      vhash_main_get_result,				\
+		      vm, N_KEY_U32);					\
+   })									\
+									\
+  clib_pipeline_stage_no_inline						\
+  (vhash8_main_unset_mod_stage_##N_KEY_U32,				\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_unset_stage (vm->vhash,					\
+		      /* vector_index */ vm->n_vectors_div_8,		\
+		      /* n_vectors */ vm->n_vectors_mod_8,		\
+		      vhash_main_get_result,				\
+		      vm, N_KEY_U32);					\
+   })
+
+foreach_vhash_short_n_key_u32
+foreach_vhash_long_n_key_u32
+
+#undef _
+
+#define _(N_KEY_U32)							\
+  clib_pipeline_stage							\
+  (vhash8_main_hash_mix_stage_##N_KEY_U32,				\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_mix_stage (vm->vhash, i, N_KEY_U32);				\
+   })									\
+									\
+  clib_pipeline_stage_no_inline						\
+  (vhash8_main_hash_mix_mod_stage_##N_KEY_U32,				\
+   vhash_main_t *, vm, i,						\
+   {									\
+     vhash8_mix_stage (vm->vhash, vm->n_vectors_div_8, N_KEY_U32);	\
+   })
+
+foreach_vhash_long_n_key_u32
+
+#undef _
+
+static void
+vhash8_main_op (vhash_main_t * vm, vhash_main_op_t op)
+{
+  u32 n_keys = vec_len (vm->results);
+
+  vm->n_vectors_div_8 = n_keys / 8;
+  vm->n_vectors_mod_8 = n_keys % 8;
+
+  if (vm->n_vectors_div_8 > 0)
+    {
+      switch (vm->n_key_u32)
+	{
+	default:
+	  ASSERT (0);
+	  break;
+
+#define _(N_KEY_U32)						\
+	case N_KEY_U32:						\
+	  if (op == GET)					\
+	    clib_pipeline_run_3_stage				\
+	      (vm->n_vectors_div_8,				\
+	       vm,						\
+	       vhash8_main_gather_keys_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_stage_##N_KEY_U32,	\
+	       vhash8_main_get_stage_##N_KEY_U32);		\
+	  else if (op == SET)					\
+	    clib_pipeline_run_3_stage				\
+	      (vm->n_vectors_div_8,				\
+	       vm,						\
+	       vhash8_main_gather_keys_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_stage_##N_KEY_U32,	\
+	       vhash8_main_set_stage_##N_KEY_U32);		\
+	  else							\
+	    clib_pipeline_run_3_stage				\
+	      (vm->n_vectors_div_8,				\
+	       vm,						\
+	       vhash8_main_gather_keys_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_stage_##N_KEY_U32,	\
+	       vhash8_main_unset_stage_##N_KEY_U32);		\
+	  break;
+
+	      foreach_vhash_short_n_key_u32
+
+#undef _
+
+#define _(N_KEY_U32)						\
+	case N_KEY_U32:						\
+	  if (op == GET)					\
+	    clib_pipeline_run_4_stage				\
+	      (vm->n_vectors_div_8,				\
+	       vm,						\
+	       vhash8_main_gather_keys_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_mix_stage_##N_KEY_U32,		\
+	       vhash8_main_hash_finalize_stage_##N_KEY_U32,	\
+	       vhash8_main_get_stage_##N_KEY_U32);		\
+	  else if (op == SET)					\
+	    clib_pipeline_run_4_stage				\
+	      (vm->n_vectors_div_8,				\
+	       vm,						\
+	       vhash8_main_gather_keys_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_mix_stage_##N_KEY_U32,		\
+	       vhash8_main_hash_finalize_stage_##N_KEY_U32,	\
+	       vhash8_main_set_stage_##N_KEY_U32);		\
+	  else							\
+	    clib_pipeline_run_4_stage				\
+	      (vm->n_vectors_div_8,				\
+	       vm,						\
+	       vhash8_main_gather_keys_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_mix_stage_##N_KEY_U32,		\
+	       vhash8_main_hash_finalize_stage_##N_KEY_U32,	\
+	       vhash8_main_unset_stage_##N_KEY_U32);		\
+	  break;
+
+	      foreach_vhash_long_n_key_u32
+
+#undef _
+	}
+    }
+
+
+  if (vm->n_vectors_mod_8 > 0)
+    {
+      switch (vm->n_key_u32)
+	{
+	default:
+	  ASSERT (0);
+	  break;
+
+#define _(N_KEY_U32)						\
+	case N_KEY_U32:						\
+	  if (op == GET)					\
+	    clib_pipeline_run_3_stage				\
+	      (1,						\
+	       vm,						\
+	       vhash8_main_gather_keys_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_get_mod_stage_##N_KEY_U32);		\
+	  else if (op == SET)					\
+	    clib_pipeline_run_3_stage				\
+	      (1,						\
+	       vm,						\
+	       vhash8_main_gather_keys_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_set_mod_stage_##N_KEY_U32);		\
+	  else							\
+	    clib_pipeline_run_3_stage				\
+	      (1,						\
+	       vm,						\
+	       vhash8_main_gather_keys_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_unset_mod_stage_##N_KEY_U32);		\
+	break;
+
+      foreach_vhash_short_n_key_u32
+
+#undef _
+
+#define _(N_KEY_U32)						\
+	case N_KEY_U32:						\
+	  if (op == GET)					\
+	    clib_pipeline_run_4_stage				\
+	      (1,						\
+	       vm,						\
+	       vhash8_main_gather_keys_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_mix_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_get_mod_stage_##N_KEY_U32);		\
+	  else if (op == SET)					\
+	    clib_pipeline_run_4_stage				\
+	      (1,						\
+	       vm,						\
+	       vhash8_main_gather_keys_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_mix_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_set_mod_stage_##N_KEY_U32);		\
+	  else							\
+	    clib_pipeline_run_4_stage				\
+	      (1,						\
+	       vm,						\
+	       vhash8_main_gather_keys_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_mix_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_hash_finalize_mod_stage_##N_KEY_U32,	\
+	       vhash8_main_unset_mod_stage_##N_KEY_U32);		\
+	  break;
+
+	      foreach_vhash_long_n_key_u32
+
+#undef _
+	}
+    }
+}
+
+#pragma GCC pop_options
+
+#endif /* VHASH_HAVE_8_LANES */
+
 static void
 vhash_main_op (vhash_main_t * vm, vhash_main_op_t op)
 {
@@ -470,6 +798,14 @@ vhash_main_op (vhash_main_t * vm, vhash_main_op_t op)
 
   vhash_validate_sizes (vm->vhash, vm->n_key_u32, n_keys);
 
+#ifdef VHASH_HAVE_8_LANES
+  if (vm->vhash->log2_keys_per_bucket == 3)
+    {
+      vhash8_main_op (vm, op);
+      return;
+    }
+#endif
+
   vm->n_vectors_div_4 = n_keys / 4;
   vm->n_vectors_mod_4 = n_keys % 4;
 
@@ -506,9 +842,7 @@ vhash_main_op (vhash_main_t * vm, vhash_main_op_t op)
 	       vhash_main_unset_stage_##N_KEY_U32);		\
 	  break;
 
-	      _ (1);
-	      _ (2);
-	      _ (3);
+	      foreach_vhash_short_n_key_u32
 
 #undef _
 
@@ -540,9 +874,7 @@ vhash_main_op (vhash_main_t * vm, vhash_main_op_t op)
 	       vhash_main_unset_stage_##N_KEY_U32);		\
 	  break;
 
-	      _ (4);
-	      _ (5);
-	      _ (6);
+	      foreach_vhash_long_n_key_u32
 
 #undef _
 	}
@@ -582,9 +914,7 @@ vhash_main_op (vhash_main_t * vm, vhash_main_op_t op)
 	       vhash_main_unset_mod_stage_##N_KEY_U32);		\
 	break;
 
-      _ (1);
-      _ (2);
-      _ (3);
+      foreach_vhash_short_n_key_u32
 
 #undef _
 
@@ -616,32 +946,22 @@ vhash_main_op (vhash_main_t * vm, vhash_main_op_t op)
 	       vhash_main_unset_mod_stage_##N_KEY_U32);		\
 	  break;
 
-	      _ (4);
-	      _ (5);
-	      _ (6);
+	      foreach_vhash_long_n_key_u32
 
 #undef _
 	}
     }
 }
 
-void vhash_main_get (vhash_main_t * vm)
-{ vhash_main_op (vm, GET); }
-
-void vhash_main_set (vhash_main_t * vm)
-{ vhash_main_op (vm, SET); }
-
-void vhash_main_unset (vhash_main_t * vm)
-{ vhash_main_op (vm, UNSET); }
-
 u32 vhash_resize_incremental (vhash_resize_t * vr, u32 vector_index, u32 n_keys_this_call)
 {
   vhash_t * old = vr->old;
   vhash_main_t * vm = &vr->new;
   vhash_t * new = vm->vhash;
-  uword i, j, n_key_u32;
+  uword i, j, l, n_key_u32;
 
   n_key_u32 = old->n_key_u32;
+  l = old->log2_keys_per_bucket;
 
   if (vector_index == 0)
     {
@@ -649,7 +969,8 @@ u32 vhash_resize_incremental (vhash_resize_t * vr, u32 vector_index, u32 n_keys_
       hash_seeds[0] = old->hash_seeds[0].as_u32[0];
       hash_seeds[1] = old->hash_seeds[1].as_u32[0];
       hash_seeds[2] = old->hash_seeds[2].as_u32[0];
-      vhash_init (new, old->log2_n_keys + 1, n_key_u32, hash_seeds);
+      vhash_init_keys_per_bucket (new, old->log2_n_keys + 1, n_key_u32, hash_seeds,
+				  vhash_keys_per_bucket (old));
     }
 
   vec_reset_length (vm->keys);
@@ -657,31 +978,24 @@ u32 vhash_resize_incremental (vhash_resize_t * vr, u32 vector_index, u32 n_keys_
 
   if (0 == (vector_index >> old->log2_n_keys))
     {
-      for (i = vector_index; 0 == (i >> (old->log2_n_keys - 2)); i++)
+      for (i = vector_index; 0 == (i >> (old->log2_n_keys - l)); i++)
 	{
-	  vhash_search_bucket_t * b = vhash_get_search_bucket_with_index (old, 4 * i, n_key_u32);
-	  u32 r, * k;
-
-#define _(I)					\
-  if ((r = b->result.as_u32[I]) != 0)		\
-    {						\
-      vec_add1 (vm->results, r - 1);		\
-      vec_add2 (vm->keys, k, n_key_u32);	\
-      for (j = 0; j < n_key_u32; j++)		\
-	k[j] = b->key[j].as_u32[I];		\
-    }
-
-	  _ (0);
-	  _ (1);
-	  _ (2);
-	  _ (3);
-
-#undef _
+	  u32 * b = vhash_search_bucket_u32 (old, i << l, n_key_u32);
+	  u32 r, s, * k;
+
+	  for (s = 0; s < (1 << l); s++)
+	    if ((r = b[s]) != 0)
+	      {
+		vec_add1 (vm->results, r - 1);
+		vec_add2 (vm->keys, k, n_key_u32);
+		for (j = 0; j < n_key_u32; j++)
+		  k[j] = b[((1 + j) << l) + s];
+	      }
 
 	  if (vec_len (vm->results) >= n_keys_this_call)
 	    {
 	      vhash_main_op (vm, SET);
-	      return i;
+	      return i + 1;
 	    }
 	}
     }
@@ -744,4 +1058,495 @@ void vhash_resize (vhash_t * old, u32 log2_n_keys)
   *old = new;
 }
 
+static void
+vhash_main_resize_free (vhash_resize_t * vr)
+{
+  vec_free (vr->new.keys);
+  vec_free (vr->new.results);
+  vec_free (vr->old_get.keys);
+  vec_free (vr->old_get.results);
+  vec_free (vr->old_get_indices);
+  vec_free (vr->results);
+  clib_mem_free (vr->new.vhash);
+  clib_mem_free (vr);
+}
+
+/* Starts resize when too many keys overflow; moves some keys from old
+   to new table and swaps tables when all have been moved. */
+static void
+vhash_main_resize_step (vhash_main_t * vm, u32 n_keys_set)
+{
+  vhash_resize_t * vr = vm->resize;
+  u32 n;
+
+  if (! vr)
+    {
+      if (! vhash_should_resize (vm->vhash))
+	return;
+      vr = clib_mem_alloc_aligned (sizeof (vr[0]), CLIB_CACHE_LINE_BYTES);
+      memset (vr, 0, sizeof (vr[0]));
+      vr->new.vhash = clib_mem_alloc_aligned (sizeof (vr->new.vhash[0]),
+					      CLIB_CACHE_LINE_BYTES);
+      vr->old = vm->vhash;
+      vm->resize = vr;
+    }
+
+  n = clib_max (n_keys_set * VHASH_RESIZE_KEYS_PER_SET_KEY,
+		VHASH_RESIZE_MIN_KEYS_PER_STEP);
+  vr->vector_index = vhash_resize_incremental (vr, vr->vector_index, n);
+
+  if (vr->vector_index == ~0)
+    {
+      vhash_free (vr->old);
+      *vr->old = vr->new.vhash[0];
+      vm->resize = 0;
+      vhash_main_resize_free (vr);
+    }
+}
+
+/* Applies set or unset to both tables during resize.  Old table stays
+   complete until resize finishes; its old results are returned. */
+static void
+vhash_main_op_both (vhash_main_t * vm, vhash_main_op_t op)
+{
+  vhash_resize_t * vr = vm->resize;
+  vhash_t * h = vm->vhash;
+  u32 * results = vm->results;
+
+  vec_reset_length (vr->results);
+  vec_add (vr->results, results, vec_len (results));
+
+  vhash_main_op (vm, op);
+
+  vm->vhash = vr->new.vhash;
+  vm->results = vr->results;
+  vhash_main_op (vm, op);
+
+  vr->results = vm->results;
+  vm->vhash = h;
+  vm->results = results;
+}
+
+void vhash_main_get (vhash_main_t * vm)
+{
+  vhash_resize_t * vr = vm->resize;
+  vhash_main_t * og;
+  u32 i, n_key_u32;
+
+  if (! vr)
+    {
+      vhash_main_op (vm, GET);
+      return;
+    }
+
+  /* Keys already moved or set since resize began are in new table. */
+  vm->vhash = vr->new.vhash;
+  vhash_main_op (vm, GET);
+  vm->vhash = vr->old;
+
+  /* Look up the rest in old table. */
+  og = &vr->old_get;
+  og->vhash = vr->old;
+  n_key_u32 = vr->old->n_key_u32;
+  vec_reset_length (og->keys);
+  vec_reset_length (vr->old_get_indices);
+  for (i = 0; i < vec_len (vm->results); i++)
+    if (vm->results[i] == ~0)
+      {
+	vec_add1 (vr->old_get_indices, i);
+	vec_add (og->keys, vm->keys + i * n_key_u32, n_key_u32);
+      }
+
+  if (vec_len (vr->old_get_indices) == 0)
+    return;
+
+  /* Get writes results 4 at a time. */
+  vec_validate_aligned (og->results, vec_len (vr->old_get_indices) + 3,
+			CLIB_CACHE_LINE_BYTES);
+  _vec_len (og->results) = vec_len (vr->old_get_indices);
+  vhash_main_op (og, GET);
+
+  for (i = 0; i < vec_len (vr->old_get_indices); i++)
+    vm->results[vr->old_get_indices[i]] = og->results[i];
+}
+
+void vhash_main_set (vhash_main_t * vm)
+{
+  u32 n_keys = vec_len (vm->results);
+
+  if (vm->resize)
+    vhash_main_op_both (vm, SET);
+  else
+    vhash_main_op (vm, SET);
+
+  vhash_main_resize_step (vm, n_keys);
+}
+
+void vhash_main_unset (vhash_main_t * vm)
+{
+  if (vm->resize)
+    vhash_main_op_both (vm, UNSET);
+  else
+    vhash_main_op (vm, UNSET);
+}
+
+u8 * format_vhash (u8 * s, va_list * va)
+{
+  vhash_t * h = va_arg (*va, vhash_t *);
+  uword indent = format_get_indent (s);
+  uword * fill_counts = 0, * overflow_counts = 0;
+  uword i, j, n, n_buckets, n_overflow, n_overflow_slots, n_bytes;
+  u32 * b, l = h->log2_keys_per_bucket;
+
+  n_buckets = 1 << (h->log2_n_keys - l);
+  for (i = 0; i < n_buckets; i++)
+    {
+      b = vhash_search_bucket_u32 (h, i << l, h->n_key_u32);
+      for (j = n = 0; j < (1 << l); j++)
+	n += b[j] != 0;
+      vec_validate (fill_counts, n);
+      fill_counts[n] += 1;
+    }
+
+  n_bytes = vec_capacity (h->search_buckets, 0);
+  n_overflow = n_overflow_slots = 0;
+  vec_validate (overflow_counts, ARRAY_LEN (h->overflow_buckets) - 1);
+  for (i = 0; i < ARRAY_LEN (h->overflow_buckets); i++)
+    {
+      vhash_overflow_buckets_t * ob = &h->overflow_buckets[i];
+      overflow_counts[i] = ob->n_overflow;
+      n_overflow += ob->n_overflow;
+      n_overflow_slots += (4 * vec_len (ob->search_buckets)
+			   / (sizeof (vhash_overflow_search_bucket_t) / sizeof (u32x4)
+			      + h->n_key_u32));
+      n_bytes += (vec_capacity (ob->search_buckets, 0)
+		  + vec_capacity (ob->free_indices, 0));
+    }
+
+  s = format (s, "%d elts, %wd buckets of %d keys, %.2f bytes/elt",
+	      h->n_elts, n_buckets, 1 << l,
+	      h->n_elts > 0 ? (f64) n_bytes / h->n_elts : 0.);
+  s = format (s, "\n%Ubucket fill: %U",
+	      format_white_space, indent,
+	      format_hash_counts, fill_counts);
+  s = format (s, "\n%Uoverflow: %wd elts in %wd slots",
+	      format_white_space, indent,
+	      n_overflow, n_overflow_slots);
+  if (n_overflow > 0)
+    s = format (s, ", per overflow bucket: %U",
+		format_hash_counts, overflow_counts);
+
+  vec_free (fill_counts);
+  vec_free (overflow_counts);
+  return s;
+}
+
+void vhash_fingerprint_init (vhash_fingerprint_t * f, u32 log2_n_keys,
+			     u32 n_key_u32, u32 * hash_seeds)
+{
+  u32 i;
+
+  memset (f, 0, sizeof (f[0]));
+  f->n_key_u32 = n_key_u32;
+  f->fingerprint_mask = ~0;
+
+  /* Fingerprints use different seeds than hash of fingerprints. */
+  for (i = 0; i < ARRAY_LEN (f->hash_seeds); i++)
+    f->hash_seeds[i] = hash_seeds[i] ^ 0x9e3779b9;
+
+  vhash_init (&f->vhash, log2_n_keys, /* n_key_u32 */ 1, hash_seeds);
+  f->vm.vhash = &f->vhash;
+}
+
+void vhash_fingerprint_free (vhash_fingerprint_t * f)
+{
+  /* Empty sets finish resize in progress and free its memory. */
+  while (f->vm.resize)
+    {
+      vec_reset_length (f->vm.keys);
+      vec_reset_length (f->vm.results);
+      vhash_main_set (&f->vm);
+    }
+  vhash_free (&f->vhash);
+  vec_free (f->vm.keys);
+  vec_free (f->vm.results);
+  pool_free (f->entries);
+  vec_free (f->keys);
+  vec_free (f->key_indices);
+  vec_free (f->entry_indices);
+}
+
+/* Jenkins hash 4 keys at a time; fingerprints go to f->vm.keys. */
+static void
+vhash_fingerprint_keys (vhash_fingerprint_t * f, u32 * keys, u32 n_keys)
+{
+  u32 n = f->n_key_u32;
+  u32 i, j, l, * k[4];
+  u32x4 a, b, c;
+  u32x4_union_t fp;
+
+  vec_reset_length (f->vm.keys);
+  vec_resize (f->vm.keys, n_keys);
+
+  for (i = 0; i < n_keys; i += 4)
+    {
+      /* Last vector may hash last key more than once to fill all lanes. */
+      for (l = 0; l < 4; l++)
+	k[l] = keys + clib_min (i + l, n_keys - 1) * n;
+
+#define _(w) ((u32x4) { k[0][w], k[1][w], k[2][w], k[3][w] })
+
+      a = (u32x4) { f->hash_seeds[0], f->hash_seeds[0],
+		    f->hash_seeds[0], f->hash_seeds[0] };
+      b = (u32x4) { f->hash_seeds[1], f->hash_seeds[1],
+		    f->hash_seeds[1], f->hash_seeds[1] };
+      c = (u32x4) { f->hash_seeds[2], f->hash_seeds[2],
+		    f->hash_seeds[2], f->hash_seeds[2] };
+
+      for (j = 0; j + 3 < n; j += 3)
+	{
+	  a ^= _ (j + 0);
+	  b ^= _ (j + 1);
+	  c ^= _ (j + 2);
+	  hash_v3_mix_u32x (a, b, c);
+	}
+
+      /* Tail of 1 to 3 words. */
+      a ^= _ (j + 0);
+      if (j + 1 < n)
+	b ^= _ (j + 1);
+      if (j + 2 < n)
+	c ^= _ (j + 2);
+      hash_v3_finalize_u32x (a, b, c);
+
+#undef _
+
+      fp.as_u32x4 = c;
+      for (l = 0; l < 4 && i + l < n_keys; l++)
+	f->vm.keys[i + l] = fp.as_u32[l] & f->fingerprint_mask;
+    }
+}
+
+/* Looks up fingerprints of keys: f->vm.results gets first entry of
+   chain for each key or ~0. */
+static void
+vhash_fingerprint_lookup (vhash_fingerprint_t * f, u32 * keys, u32 n_keys)
+{
+  vhash_main_t * vm = &f->vm;
+
+  vhash_fingerprint_keys (f, keys, n_keys);
+
+  /* Get writes results 4 at a time. */
+  vec_validate_aligned (vm->results, n_keys + 3, CLIB_CACHE_LINE_BYTES);
+  _vec_len (vm->results) = n_keys;
+
+  vhash_main_get (vm);
+}
+
+always_inline u32 *
+vhash_fingerprint_key (vhash_fingerprint_t * f, u32 ei)
+{ return vec_elt_at_index (f->keys, ei * f->n_key_u32); }
+
+/* Returns index of entry with given key in chain starting at EI or ~0. */
+static u32
+vhash_fingerprint_find (vhash_fingerprint_t * f, u32 ei, u32 * key)
+{
+  u32 n_bytes = f->n_key_u32 * sizeof (key[0]);
+
+  while (ei != ~0)
+    {
+      if (! memcmp (vhash_fingerprint_key (f, ei), key, n_bytes))
+	break;
+      ei = f->entries[ei].next;
+    }
+
+  return ei;
+}
+
+static u32
+vhash_fingerprint_new_entry (vhash_fingerprint_t * f, u32 * key, u32 result,
+			     u32 next)
+{
+  vhash_fingerprint_entry_t * e;
+  u32 ei;
+
+  pool_get (f->entries, e);
+  ei = e - f->entries;
+  e->result = result;
+  e->next = next;
+
+  vec_validate (f->keys, (ei + 1) * f->n_key_u32 - 1);
+  memcpy (vhash_fingerprint_key (f, ei), key, f->n_key_u32 * sizeof (key[0]));
+
+  f->n_elts++;
+  return ei;
+}
+
+always_inline void
+vhash_fingerprint_free_entry (vhash_fingerprint_t * f, u32 ei)
+{
+  pool_put_index (f->entries, ei);
+  f->n_elts--;
+}
+
+/* Removes entry EI which follows entry PREV in chain. */
+static void
+vhash_fingerprint_unlink (vhash_fingerprint_t * f, u32 prev, u32 ei)
+{
+  while (f->entries[prev].next != ei)
+    prev = f->entries[prev].next;
+  f->entries[prev].next = f->entries[ei].next;
+  vhash_fingerprint_free_entry (f, ei);
+}
+
+void vhash_fingerprint_get (vhash_fingerprint_t * f, u32 * keys, u32 n_keys,
+			    u32 * results)
+{
+  vhash_main_t * vm = &f->vm;
+  u32 i, ei;
+
+  vhash_fingerprint_lookup (f, keys, n_keys);
+
+  for (i = 0; i < n_keys; i++)
+    {
+      ei = vhash_fingerprint_find (f, vm->results[i], keys + i * f->n_key_u32);
+      results[i] = ei != ~0 ? f->entries[ei].result : ~0;
+    }
+}
+
+void vhash_fingerprint_set (vhash_fingerprint_t * f, u32 * keys, u32 n_keys,
+			    u32 * results)
+{
+  vhash_main_t * vm = &f->vm;
+  u32 i, j, ei, head, n_new, * key;
+
+  vhash_fingerprint_lookup (f, keys, n_keys);
+
+  vec_reset_length (f->key_indices);
+  vec_reset_length (f->entry_indices);
+  for (i = n_new = 0; i < n_keys; i++)
+    {
+      key = keys + i * f->n_key_u32;
+      head = vm->results[i];
+
+      ei = vhash_fingerprint_find (f, head, key);
+      if (ei != ~0)
+	{
+	  u32 old = f->entries[ei].result;
+	  f->entries[ei].result = results[i];
+	  results[i] = old;
+	  continue;
+	}
+
+      if (head != ~0)
+	{
+	  /* New key with existing fingerprint goes after first entry
+	     so that fingerprint still maps to same entry. */
+	  ei = vhash_fingerprint_new_entry (f, key, results[i],
+					    f->entries[head].next);
+	  f->entries[head].next = ei;
+	}
+      else
+	{
+	  /* New fingerprint: compact fingerprints to set in place
+	     (n_new <= i so nothing not yet read is over-written). */
+	  ei = vhash_fingerprint_new_entry (f, key, results[i], ~0);
+	  vm->keys[n_new] = vm->keys[i];
+	  vm->results[n_new] = ei;
+	  vec_add1 (f->key_indices, i);
+	  vec_add1 (f->entry_indices, ei);
+	  n_new++;
+	}
+      results[i] = ~0;
+    }
+
+  if (n_new == 0)
+    return;
+
+  _vec_len (vm->keys) = n_new;
+  _vec_len (vm->results) = n_new;
+  vhash_main_set (vm);
+
+  /* Old result means fingerprint was set earlier in this call: chain
+     earlier entries after new one. */
+  for (j = 0; j < n_new; j++)
+    {
+      u32 old_head = vm->results[j];
+
+      if (old_head == ~0)
+	continue;
+
+      i = f->key_indices[j];
+      ei = vhash_fingerprint_find (f, old_head, keys + i * f->n_key_u32);
+
+      /* Same key set twice in this call: last set wins. */
+      if (ei != ~0)
+	{
+	  results[i] = f->entries[ei].result;
+	  if (ei == old_head)
+	    {
+	      old_head = f->entries[ei].next;
+	      vhash_fingerprint_free_entry (f, ei);
+	    }
+	  else
+	    vhash_fingerprint_unlink (f, old_head, ei);
+	}
+
+      f->entries[f->entry_indices[j]].next = old_head;
+    }
+}
+
+void vhash_fingerprint_unset (vhash_fingerprint_t * f, u32 * keys, u32 n_keys,
+			      u32 * results)
+{
+  vhash_main_t * vm = &f->vm;
+  u32 i, ei, head, next, n_unset;
+
+  vhash_fingerprint_lookup (f, keys, n_keys);
+
+  for (i = n_unset = 0; i < n_keys; i++)
+    {
+      head = vm->results[i];
+      results[i] = ~0;
+
+      /* First entry may have been freed by earlier key in this call. */
+      if (head == ~0 || pool_is_free_index (f->entries, head))
+	continue;
+
+      ei = vhash_fingerprint_find (f, head, keys + i * f->n_key_u32);
+      if (ei == ~0)
+	continue;
+
+      results[i] = f->entries[ei].result;
+
+      if (ei != head)
+	vhash_fingerprint_unlink (f, head, ei);
+
+      else if ((next = f->entries[head].next) != ~0)
+	{
+	  /* Move second entry into first so fingerprint still maps to
+	     first entry. */
+	  f->entries[head] = f->entries[next];
+	  memcpy (vhash_fingerprint_key (f, head),
+		  vhash_fingerprint_key (f, next),
+		  f->n_key_u32 * sizeof (keys[0]));
+	  vhash_fingerprint_free_entry (f, next);
+	}
+
+      else
+	{
+	  /* Chain is now empty: unset fingerprint. */
+	  vhash_fingerprint_free_entry (f, head);
+	  vm->keys[n_unset++] = vm->keys[i];
+	}
+    }
+
+  if (n_unset == 0)
+    return;
+
+  _vec_len (vm->keys) = n_unset;
+  _vec_len (vm->results) = n_unset;
+  vhash_main_unset (vm);
+}
+
 #endif /* CLIB_VECTOR_WORD_BITS > 0 */
@@ -32,6 +32,18 @@
 #include <clib/cache.h>
 #include <clib/hash.h>
 #include <clib/pipeline.h>
+#include <clib/pool.h>
+
+/* Key sizes in 32 bit words with pipeline stages instantiated by
+   vhash_main_* in vhash.c.  Keys of up to 3 words are hashed by the
+   finalize stage alone; longer keys need a mix stage.  Keys longer than
+   VHASH_MAX_N_KEY_U32 words can use fingerprint mode (see
+   vhash_fingerprint_t below). */
+#define foreach_vhash_short_n_key_u32 _ (1) _ (2) _ (3)
+#define foreach_vhash_long_n_key_u32		\
+  _ (4) _ (5) _ (6) _ (7) _ (8) _ (9) _ (10)	\
+  _ (11) _ (12) _ (13) _ (14) _ (15) _ (16)
+#define VHASH_MAX_N_KEY_U32 16
 
 /* Gathers 32 bits worth of key with given index. */
 typedef u32 (vhash_key_function_t) (void * state, u32 vector_index, u32 key_word_index);
@@ -68,12 +80,12 @@ typedef struct {
 } vhash_overflow_buckets_t;
 
 typedef struct {
-  /* 2^log2_n_keys keys grouped in groups of 4.
+  /* 2^log2_n_keys keys grouped in groups of 4 (or 8).
      Each bucket contains 4 results plus 4 keys for a
-     total of (1 + n_key_u32) u32x4s. */
+     total of (1 + n_key_u32) u32x4s (twice that for buckets of 8). */
   u32x4_union_t * search_buckets;
 
-  /* When a bucket of 4 results/keys are full we search
+  /* When a bucket of results/keys is full we search
      the overflow.  hash_key is used to select which overflow
      bucket. */
   vhash_overflow_buckets_t overflow_buckets[16];
@@ -81,12 +93,20 @@ typedef struct {
   /* Total count of occupied elements in hash table. */
   u32 n_elts;
 
+  /* Number of elements in overflow buckets. */
+  u32 n_overflow;
+
   /* Table has 2^log2_n_keys results/keys. */
   u32 log2_n_keys;
 
   /* Number of 32 bit words in a hash key. */
   u32 n_key_u32;
 
+  /* Log2 number of keys in each search bucket: 2 for u32x4 pipeline
+     stages or 3 for 8 lane stages (see vhash8_* below).  Fixed by
+     vhash_init_keys_per_bucket; vhash_init always uses 4. */
+  u32 log2_keys_per_bucket;
+
   u32x4_union_t bucket_mask;
 
   /* table[i] = min_log2 (first_set (~i)). */
@@ -107,10 +127,26 @@ typedef struct {
   vhash_hashed_key_t * hash_work_space;
 } vhash_t;
 
+always_inline uword
+vhash_keys_per_bucket (vhash_t * h)
+{ return 1 << h->log2_keys_per_bucket; }
+
+/* Table should double when more than 1 in 2^N elements are in
+   overflow buckets (and at least VHASH_MIN_OVERFLOW_TO_RESIZE). */
+#define VHASH_LOG2_MAX_OVERFLOW_FRACTION 4
+#define VHASH_MIN_OVERFLOW_TO_RESIZE 16
+
+always_inline uword
+vhash_should_resize (vhash_t * h)
+{
+  return (h->n_overflow >= VHASH_MIN_OVERFLOW_TO_RESIZE
+	  && h->n_overflow > (h->n_elts >> VHASH_LOG2_MAX_OVERFLOW_FRACTION));
+}
+
 always_inline vhash_overflow_buckets_t *
 vhash_get_overflow_buckets (vhash_t * h, u32 key)
 {
-  u32 i = (((key & h->bucket_mask.as_u32[0]) >> 2) & 0xf);
+  u32 i = (((key & h->bucket_mask.as_u32[0]) >> h->log2_keys_per_bucket) & 0xf);
   ASSERT (i < ARRAY_LEN (h->overflow_buckets));
   return h->overflow_buckets + i;
 }
@@ -118,7 +154,7 @@ vhash_get_overflow_buckets (vhash_t * h, u32 key)
 always_inline uword
 vhash_is_non_empty_overflow_bucket (vhash_t * h, u32 key)
 {
-  u32 i = (((key & h->bucket_mask.as_u32[0]) >> 2) & 0xf);
+  u32 i = (((key & h->bucket_mask.as_u32[0]) >> h->log2_keys_per_bucket) & 0xf);
   ASSERT (i < ARRAY_LEN (h->overflow_buckets));
   return h->overflow_buckets[i].n_overflow > 0;
 }
@@ -254,6 +290,7 @@ vhash_mix_stage (vhash_t * h,
 always_inline vhash_search_bucket_t *
 vhash_get_search_bucket_with_index (vhash_t * h, u32 i, u32 n_key_u32s)
 {
+  ASSERT (h->log2_keys_per_bucket == 2);
   return ((vhash_search_bucket_t *)
 	  vec_elt_at_index (h->search_buckets,
 			    (i / 4) * ((sizeof (vhash_search_bucket_t) / sizeof (u32x4)) + n_key_u32s)));
@@ -266,6 +303,18 @@ vhash_get_search_bucket (vhash_t * h, u32 key_hash, u32 n_key_u32s)
   return vhash_get_search_bucket_with_index (h, i, n_key_u32s);
 }
 
+/* Search bucket containing key index I for either bucket size as u32s:
+   results for all keys in bucket followed by key word 0 for all keys,
+   key word 1, etc. */
+always_inline u32 *
+vhash_search_bucket_u32 (vhash_t * h, u32 i, u32 n_key_u32s)
+{
+  u32 l = h->log2_keys_per_bucket;
+  u32 o = ((i >> l) << l) * (1 + n_key_u32s);
+  ASSERT (o / 4 < vec_len (h->search_buckets));
+  return (u32 *) h->search_buckets + o;
+}
+
 always_inline u32x4
 vhash_get_4_search_bucket_byte_offsets (vhash_t * h, u32x4 key_hash, u32 n_key_u32s)
 {
@@ -273,6 +322,8 @@ vhash_get_4_search_bucket_byte_offsets (vhash_t * h, u32x4 key_hash, u32 n_key_u
   u32 n_bytes_per_bucket = sizeof (b[0]) + n_key_u32s * sizeof (b->key[0]);
   u32x4 r = key_hash & h->bucket_mask.as_u32x4;
 
+  ASSERT (h->log2_keys_per_bucket == 2);
+
   /* Multiply with shifts and adds to get bucket byte offset. */
 #define _(x) u32x4_ishift_left (r, (x) - 2)
   if (n_bytes_per_bucket == (1 << 5))
@@ -288,7 +339,12 @@ vhash_get_4_search_bucket_byte_offsets (vhash_t * h, u32x4 key_hash, u32 n_key_u
   else if (n_bytes_per_bucket == ((1 << 6) + (1 << 5) + (1 << 4)))
     r = _ (6) + _ (5) + _ (4);
   else
-    ASSERT (0);
+    {
+      /* Longer keys: compiler turns constant multiply into shifts and adds. */
+      u32 m = n_bytes_per_bucket / 4;
+      u32x4 mv = {m, m, m, m};
+      r = r * mv;
+    }
 #undef _
   return r;
 }
@@ -449,6 +505,8 @@ vhash_get_4_stage (vhash_t * h,
   u32x4 r0, r1, r2, r3, r0_before, r1_before, r2_before, r3_before;
   u32x4_union_t kh;
 
+  ASSERT (h->log2_keys_per_bucket == 2);
+
   /* Byte offsets of 4 buckets. */
   kh.as_u32x4 = hk->hashed_key[1].as_u32x4;
 
@@ -547,7 +605,7 @@ vhash_set_stage (vhash_t * h,
       u32 vi = vector_index * 4 + i;
       u32 key_hash = hk->hashed_key[2].as_u32[i];
       u32 old_result, new_result;
-      u32 i_set;
+      u32 i_set, in_overflow;
       u32x4 r, r0, cmp;
 
       b = vhash_get_search_bucket (h, key_hash, n_key_u32s);
@@ -563,7 +621,9 @@ vhash_set_stage (vhash_t * h,
 	 So we can or all 4 together and get the valid result (if there is one). */
       old_result = vhash_merge_results (r);
 
-      if (! old_result && vhash_search_bucket_is_full (r0))
+      /* Key may only be in overflow buckets when search bucket is full. */
+      in_overflow = ! old_result && vhash_search_bucket_is_full (r0);
+      if (in_overflow)
 	old_result = vhash_get_overflow (h, key_hash, vi, n_key_u32s);
 
       /* Get new result; possibly do something with old result. */
@@ -575,11 +635,14 @@ vhash_set_stage (vhash_t * h,
       new_result += 1;
 
       /* Set over-writes existing result. */
-      if (old_result)
+      if (old_result && ! in_overflow)
 	{
 	  i_set = vhash_non_empty_result_index (r);
 	  b->result.as_u32[i_set] = new_result;
 	}
+      /* Over-writes existing overflow result or adds new one. */
+      else if (in_overflow)
+	vhash_set_overflow (h, key_hash, vi, new_result, n_key_u32s);
       else
 	{
 	  /* Set allocates new result. */
@@ -621,9 +684,10 @@ vhash_unset_overflow (vhash_t * h,
 		      u32 vi,
 		      u32 n_key_u32s);
 
+/* B is search bucket of either size. */
 void
 vhash_unset_refill_from_overflow (vhash_t * h,
-				  vhash_search_bucket_t * b,
+				  void * b,
 				  u32 key_hash,
 				  u32 n_key_u32s);
 
@@ -678,11 +742,524 @@ vhash_unset_stage (vhash_t * h,
   h->n_elts -= n_elts_unset;
 }
 
+#ifdef HASH_MEMORY_X86_KERNELS
+
+/* 8 lane pipeline stages using 256 bit vectors and search buckets of
+   8 keys.  Same hash function and key work space layout as u32x4 stages
+   with vector_index counting groups of 8 keys.  Stages are compiled
+   for AVX2 so callers must be as well (e.g. inside
+   #pragma GCC target ("avx2")).  8 key buckets are opt-in via
+   vhash_init_keys_per_bucket and only selected when cpu supports AVX2. */
+#define VHASH_HAVE_8_LANES
+
+#pragma GCC push_options
+#pragma GCC target ("avx2")
+
+typedef u32 vhash_u32x8 __attribute__ ((vector_size (32)));
+typedef f32 vhash_f32x8 __attribute__ ((vector_size (32)));
+
+typedef union {
+  vhash_u32x8 as_u32x8;
+  u32x4 as_u32x4[2];
+  u32 as_u32[8];
+} vhash_u32x8_union_t;
+
+/* Search bucket of 8 results plus 8 keys. */
+typedef struct {
+  vhash_u32x8_union_t result;
+
+  /* n_key_u32s u32x8s of key data follow. */
+  vhash_u32x8_union_t key[0];
+} vhash_search_bucket_8_t;
+
+always_inline vhash_u32x8
+vhash8_splat (u32 x)
+{
+  vhash_u32x8 r = {x, x, x, x, x, x, x, x};
+  return r;
+}
+
+/* Bit I set when lane I is zero. */
+always_inline u32
+vhash8_zero_mask (vhash_u32x8 x)
+{ return __builtin_ia32_movmskps256 ((vhash_f32x8) (x == vhash8_splat (0))); }
+
+always_inline u32
+vhash8_search_bucket_is_full (vhash_u32x8 r)
+{ return vhash8_zero_mask (r) == 0; }
+
+/* At most one lane of R is non-zero.  Avoids vhash_merge_results since
+   its non-VEX inline asm stalls when mixed with 256 bit code. */
+always_inline u32
+vhash8_merge_results (vhash_u32x8 r)
+{
+  vhash_u32x8_union_t x;
+  u32x4 y, m0 = {2, 3, 0, 1}, m1 = {1, 0, 3, 2};
+  x.as_u32x8 = r;
+  y = x.as_u32x4[0] | x.as_u32x4[1];
+  y |= __builtin_shuffle (y, m0);
+  y |= __builtin_shuffle (y, m1);
+  return y[0];
+}
+
+always_inline vhash_u32x8
+vhash8_rotate_left (vhash_u32x8 x, u32 i)
+{ return (x << i) | (x >> (BITS (i) - i)); }
+
+#define vhash8_v3_mix(a,b,c)					\
+do {								\
+  (a) -= (c); (a) ^= vhash8_rotate_left ((c), 4); (c) += (b);	\
+  (b) -= (a); (b) ^= vhash8_rotate_left ((a), 6); (a) += (c);	\
+  (c) -= (b); (c) ^= vhash8_rotate_left ((b), 8); (b) += (a);	\
+  (a) -= (c); (a) ^= vhash8_rotate_left ((c),16); (c) += (b);	\
+  (b) -= (a); (b) ^= vhash8_rotate_left ((a),19); (a) += (c);	\
+  (c) -= (b); (c) ^= vhash8_rotate_left ((b), 4); (b) += (a);	\
+} while (0)
+
+#define vhash8_v3_finalize(a,b,c)			\
+do {							\
+  (c) ^= (b); (c) -= vhash8_rotate_left ((b), 14);	\
+  (a) ^= (c); (a) -= vhash8_rotate_left ((c), 11);	\
+  (b) ^= (a); (b) -= vhash8_rotate_left ((a), 25);	\
+  (c) ^= (b); (c) -= vhash8_rotate_left ((b), 16);	\
+  (a) ^= (c); (a) -= vhash8_rotate_left ((c),  4);	\
+  (b) ^= (a); (b) -= vhash8_rotate_left ((a), 14);	\
+  (c) ^= (b); (c) -= vhash8_rotate_left ((b), 24);	\
+} while (0)
+
+/* Key words for 8 keys are 2 adjacent u32x4s of key work space. */
+always_inline vhash_u32x8
+vhash8_get_key_word_u32x8 (vhash_t * h, u32 wi, u32 vector_index)
+{
+  u32 i0 = (wi << h->log2_n_key_word_len_u32x) + 2 * vector_index;
+  ASSERT (i0 + 1 < vec_len (h->key_work_space));
+  return *(vhash_u32x8 *) (h->key_work_space + i0);
+}
+
+/* Hashed keys for 8 keys are 3 u32x8s in place of 2 adjacent hash
+   work space entries. */
+always_inline vhash_u32x8 *
+vhash8_hashed_key (vhash_t * h, u32 vector_index)
+{
+  ASSERT (2 * vector_index + 1 < vec_len (h->hash_work_space));
+  return (vhash_u32x8 *) (h->hash_work_space + 2 * vector_index);
+}
+
+always_inline u32
+vhash8_get_key_hash (vhash_t * h, u32 vi)
+{
+  vhash_u32x8_union_t * hk = (void *) vhash8_hashed_key (h, vi / 8);
+  return hk[2].as_u32[vi % 8];
+}
+
+always_inline vhash_search_bucket_8_t *
+vhash8_get_search_bucket (vhash_t * h, u32 key_hash, u32 n_key_u32s)
+{
+  ASSERT (h->log2_keys_per_bucket == 3);
+  return ((vhash_search_bucket_8_t *)
+	  vhash_search_bucket_u32 (h, key_hash & h->bucket_mask.as_u32[0],
+				   n_key_u32s));
+}
+
+/* Lanes of bucket with keys matching key VI are all ones. */
+always_inline vhash_u32x8
+vhash8_bucket_compare (vhash_t * h,
+		       vhash_search_bucket_8_t * b,
+		       u32 vi,
+		       u32 n_key_u32s)
+{
+  vhash_u32x8 cmp;
+  u32 j;
+
+  cmp = (vhash_u32x8) (b->key[0].as_u32x8 == vhash8_splat (vhash_get_key_word (h, 0, vi)));
+  for (j = 1; j < n_key_u32s; j++)
+    cmp &= (vhash_u32x8) (b->key[j].as_u32x8 == vhash8_splat (vhash_get_key_word (h, j, vi)));
+  return cmp;
+}
+
+always_inline void
+vhash8_gather_key_stage (vhash_t * h,
+			 u32 vector_index,
+			 u32 n_vectors,
+			 vhash_key_function_t key_function,
+			 void * state,
+			 u32 n_key_u32s)
+{
+  u32 i, j, vi;
+
+  for (i = 0; i < n_vectors; i++)
+    {
+      vi = vector_index * 8 + i;
+      for (j = 0; j < n_key_u32s; j++)
+	vhash_set_key_word (h, j, vi,
+			    key_function (state, vi, j));
+    }
+}
+
+always_inline void
+vhash8_gather_8key_stage (vhash_t * h,
+			  u32 vector_index,
+			  vhash_4key_function_t key_function,
+			  void * state,
+			  u32 n_key_u32s)
+{
+  u32 j, vi;
+  vi = vector_index * 8;
+  for (j = 0; j < n_key_u32s; j++)
+    {
+      vhash_set_key_word_u32x4 (h, j, vi + 0, key_function (state, vi + 0, j));
+      vhash_set_key_word_u32x4 (h, j, vi + 4, key_function (state, vi + 4, j));
+    }
+}
+
+always_inline void
+vhash8_mix_stage (vhash_t * h,
+		  u32 vector_index,
+		  u32 n_key_u32s)
+{
+  i32 i, n_left;
+  vhash_u32x8 a, b, c;
+
+  /* Only need to do this for keys longer than 12 bytes. */
+  ASSERT (n_key_u32s > 3);
+
+  a = vhash8_splat (h->hash_seeds[0].as_u32[0]);
+  b = vhash8_splat (h->hash_seeds[1].as_u32[0]);
+  c = vhash8_splat (h->hash_seeds[2].as_u32[0]);
+  for (i = 0, n_left = n_key_u32s - 3; n_left > 0; n_left -= 3, i += 3)
+    {
+      a ^= vhash8_get_key_word_u32x8 (h, n_key_u32s - 1 - (i + 0), vector_index);
+      if (n_left > 1)
+	b ^= vhash8_get_key_word_u32x8 (h, n_key_u32s - 1 - (i + 1), vector_index);
+      if (n_left > 2)
+	c ^= vhash8_get_key_word_u32x8 (h, n_key_u32s - 1 - (i + 2), vector_index);
+
+      vhash8_v3_mix (a, b, c);
+    }
+
+  /* Save away a, b, c for later finalize. */
+  {
+    vhash_u32x8 * hk = vhash8_hashed_key (h, vector_index);
+    hk[0] = a;
+    hk[1] = b;
+    hk[2] = c;
+  }
+}
+
+always_inline void
+vhash8_finalize_stage (vhash_t * h,
+		       u32 vector_index,
+		       u32 n_key_u32s)
+{
+  i32 n_left;
+  vhash_u32x8 a, b, c;
+  vhash_u32x8 * hk = vhash8_hashed_key (h, vector_index);
+
+  if (n_key_u32s <= 3)
+    {
+      a = vhash8_splat (h->hash_seeds[0].as_u32[0]);
+      b = vhash8_splat (h->hash_seeds[1].as_u32[0]);
+      c = vhash8_splat (h->hash_seeds[2].as_u32[0]);
+      n_left = n_key_u32s;
+    }
+  else
+    {
+      a = hk[0];
+      b = hk[1];
+      c = hk[2];
+      n_left = 3;
+    }
+
+  if (n_left > 0)
+    a ^= vhash8_get_key_word_u32x8 (h, 0, vector_index);
+  if (n_left > 1)
+    b ^= vhash8_get_key_word_u32x8 (h, 1, vector_index);
+  if (n_left > 2)
+    c ^= vhash8_get_key_word_u32x8 (h, 2, vector_index);
+
+  vhash8_v3_finalize (a, b, c);
+
+  /* Only save away last 32 bits of hash code. */
+  hk[2] = c;
+
+  /* Index 1 of hashed key gets bucket byte offsets: each key in bucket
+     takes (1 + n_key_u32s) u32s. */
+  c &= vhash8_splat (h->bucket_mask.as_u32[0]);
+  hk[1] = c * vhash8_splat (sizeof (u32) * (1 + n_key_u32s));
+}
+
+/* Given 8 vectors each with at most one non-zero lane returns
+   vector with lane I set to non-zero lane of vector I. */
+always_inline vhash_u32x8
+vhash8_merge_8_results (vhash_u32x8 r0, vhash_u32x8 r1,
+			vhash_u32x8 r2, vhash_u32x8 r3,
+			vhash_u32x8 r4, vhash_u32x8 r5,
+			vhash_u32x8 r6, vhash_u32x8 r7)
+{
+  vhash_u32x8 e = {0, 8, 2, 10, 4, 12, 6, 14};
+  vhash_u32x8 o = {1, 9, 3, 11, 5, 13, 7, 15};
+  vhash_u32x8 lo = {0, 1, 8, 9, 4, 5, 12, 13};
+  vhash_u32x8 hi = {2, 3, 10, 11, 6, 7, 14, 15};
+  vhash_u32x8 l = {0, 1, 2, 3, 8, 9, 10, 11};
+  vhash_u32x8 u = {4, 5, 6, 7, 12, 13, 14, 15};
+
+#define _(x,y,m0,m1) (__builtin_shuffle ((x), (y), (m0)) | __builtin_shuffle ((x), (y), (m1)))
+  /* Or adjacent lanes pairwise: lane 2*i + 0 from r0, 2*i + 1 from r1. */
+  r0 = _ (r0, r1, e, o);
+  r2 = _ (r2, r3, e, o);
+  r4 = _ (r4, r5, e, o);
+  r6 = _ (r6, r7, e, o);
+
+  /* Then pairs of pairs: lane 4*i + j from rj. */
+  r0 = _ (r0, r2, lo, hi);
+  r4 = _ (r4, r6, lo, hi);
+
+  /* Finally 128 bit halves. */
+  return _ (r0, r4, l, u);
+#undef _
+}
+
+always_inline void
+vhash8_get_stage (vhash_t * h,
+		  u32 vector_index,
+		  u32 n_vectors,
+		  vhash_result_function_t result_function,
+		  void * state,
+		  u32 n_key_u32s)
+{
+  u32 i;
+  vhash_search_bucket_8_t * b;
+
+  for (i = 0; i < n_vectors; i++)
+    {
+      u32 vi = vector_index * 8 + i;
+      u32 key_hash = vhash8_get_key_hash (h, vi);
+      u32 result;
+      vhash_u32x8 r0;
+
+      b = vhash8_get_search_bucket (h, key_hash, n_key_u32s);
+
+      r0 = b->result.as_u32x8;
+      result = vhash8_merge_results (r0 & vhash8_bucket_compare (h, b, vi, n_key_u32s));
+
+      if (! result && vhash8_search_bucket_is_full (r0))
+	result = vhash_get_overflow (h, key_hash, vi, n_key_u32s);
+
+      result_function (state, vi, result - 1, n_key_u32s);
+    }
+}
+
+always_inline void
+vhash8_get_8_stage (vhash_t * h,
+		    u32 vector_index,
+		    vhash_4result_function_t result_function,
+		    void * state,
+		    u32 n_key_u32s)
+{
+  u32 i, vi;
+  vhash_search_bucket_8_t * b0, * b1, * b2, * b3, * b4, * b5, * b6, * b7;
+  vhash_u32x8 r0, r1, r2, r3, r4, r5, r6, r7;
+  vhash_u32x8_union_t kh, r;
+
+  vi = vector_index * 8;
+
+  /* Byte offsets of 8 buckets. */
+  kh.as_u32x8 = vhash8_hashed_key (h, vector_index)[1];
+
+#define _(j) b##j = (void *) h->search_buckets + kh.as_u32[j];
+  _ (0); _ (1); _ (2); _ (3); _ (4); _ (5); _ (6); _ (7);
+#undef _
+
+  /* Results for 8 bucket keys. */
+#define _(j) r##j = b##j->result.as_u32x8;
+  _ (0); _ (1); _ (2); _ (3); _ (4); _ (5); _ (6); _ (7);
+#undef _
+
+  /* Compare search key with bucket keys. */
+  for (i = 0; i < n_key_u32s; i++)
+    {
+#define _(j)								\
+      r##j &= (vhash_u32x8) (b##j->key[i].as_u32x8			\
+			     == vhash8_splat (vhash_get_key_word (h, i, vi + j)));
+      _ (0); _ (1); _ (2); _ (3); _ (4); _ (5); _ (6); _ (7);
+#undef _
+    }
+
+  /* 8 results (at most 1 matching) for each of 8 keys. */
+  r.as_u32x8 = vhash8_merge_8_results (r0, r1, r2, r3, r4, r5, r6, r7);
+
+  {
+    u32 not_found_mask = vhash8_zero_mask (r.as_u32x8);
+    u32x4 ones = {1,1,1,1};
+
+    /* Slow path: one of the buckets may have been full and we need to search overflow. */
+    if (not_found_mask)
+      {
+	vhash_u32x8_union_t key_hash;
+
+	key_hash.as_u32x8 = (vhash8_hashed_key (h, vector_index)[2]
+			     & vhash8_splat (h->bucket_mask.as_u32[0]));
+
+	for (i = 0; i < 8; i++)
+	  {
+	    vhash_search_bucket_8_t * b;
+
+	    if (! (not_found_mask & (1 << i)))
+	      continue;
+	    b = (void *) h->search_buckets + kh.as_u32[i];
+	    if (vhash8_search_bucket_is_full (b->result.as_u32x8))
+	      r.as_u32[i] = vhash_get_overflow (h, key_hash.as_u32[i],
+						vi + i, n_key_u32s);
+	  }
+      }
+
+    result_function (state, vi + 0, r.as_u32x4[0] - ones, n_key_u32s);
+    result_function (state, vi + 4, r.as_u32x4[1] - ones, n_key_u32s);
+  }
+}
+
+always_inline void
+vhash8_set_stage (vhash_t * h,
+		  u32 vector_index,
+		  u32 n_vectors,
+		  vhash_result_function_t result_function,
+		  void * state,
+		  u32 n_key_u32s)
+{
+  u32 i, j, n_new_elts = 0;
+  vhash_search_bucket_8_t * b;
+
+  for (i = 0; i < n_vectors; i++)
+    {
+      u32 vi = vector_index * 8 + i;
+      u32 key_hash = vhash8_get_key_hash (h, vi);
+      u32 old_result, new_result;
+      u32 i_set, in_overflow;
+      vhash_u32x8 r, r0;
+
+      b = vhash8_get_search_bucket (h, key_hash, n_key_u32s);
+
+      r0 = b->result.as_u32x8;
+      r = r0 & vhash8_bucket_compare (h, b, vi, n_key_u32s);
+
+      old_result = vhash8_merge_results (r);
+
+      /* Key may only be in overflow buckets when search bucket is full. */
+      in_overflow = ! old_result && vhash8_search_bucket_is_full (r0);
+      if (in_overflow)
+	old_result = vhash_get_overflow (h, key_hash, vi, n_key_u32s);
+
+      /* Get new result; possibly do something with old result. */
+      new_result = result_function (state, vi, old_result - 1, n_key_u32s);
+
+      /* User cannot use ~0 as a hash result since a result of 0 is
+	 used to mark unused bucket entries. */
+      ASSERT (new_result + 1 != 0);
+      new_result += 1;
+
+      /* Set over-writes existing result. */
+      if (old_result && ! in_overflow)
+	{
+	  i_set = min_log2 (0xff &~ vhash8_zero_mask (r));
+	  b->result.as_u32[i_set] = new_result;
+	}
+      /* Over-writes existing overflow result or adds new one. */
+      else if (in_overflow)
+	vhash_set_overflow (h, key_hash, vi, new_result, n_key_u32s);
+      else
+	{
+	  /* Set allocates new result. */
+	  u32 valid_mask = 0xff &~ vhash8_zero_mask (r0);
+
+	  /* Rotate 8 bit valid mask so that key_hash corresponds to bit 0. */
+	  i_set = key_hash & 7;
+	  valid_mask = ((valid_mask >> i_set) | (valid_mask << (8 - i_set))) & 0xff;
+
+	  if (valid_mask != 0xff)
+	    {
+	      /* Insert into first empty position in bucket after key_hash. */
+	      i_set = (i_set + min_log2 (first_set (~valid_mask))) & 7;
+
+	      n_new_elts += 1;
+
+	      b->result.as_u32[i_set] = new_result;
+
+	      /* Insert new key into search bucket. */
+	      for (j = 0; j < n_key_u32s; j++)
+		b->key[j].as_u32[i_set] = vhash_get_key_word (h, j, vi);
+	    }
+	  else
+	    vhash_set_overflow (h, key_hash, vi, new_result, n_key_u32s);
+	}
+    }
+
+  h->n_elts += n_new_elts;
+}
+
+always_inline void
+vhash8_unset_stage (vhash_t * h,
+		    u32 vector_index,
+		    u32 n_vectors,
+		    vhash_result_function_t result_function,
+		    void * state,
+		    u32 n_key_u32s)
+{
+  u32 i, n_elts_unset = 0;
+  vhash_search_bucket_8_t * b;
+
+  for (i = 0; i < n_vectors; i++)
+    {
+      u32 vi = vector_index * 8 + i;
+      u32 key_hash = vhash8_get_key_hash (h, vi);
+      u32 old_result;
+      vhash_u32x8 cmp, r0;
+
+      b = vhash8_get_search_bucket (h, key_hash, n_key_u32s);
+
+      cmp = vhash8_bucket_compare (h, b, vi, n_key_u32s);
+      r0 = b->result.as_u32x8;
+
+      /* Invalidate result for matching key (if any). */
+      b->result.as_u32x8 = r0 & ~cmp;
+
+      old_result = vhash8_merge_results (r0 & cmp);
+
+      n_elts_unset += old_result != 0;
+
+      if (vhash8_search_bucket_is_full (r0))
+	{
+	  if (old_result)
+	    vhash_unset_refill_from_overflow (h, b, key_hash, n_key_u32s);
+	  else
+	    old_result = vhash_unset_overflow (h, key_hash, vi, n_key_u32s);
+	}
+
+      result_function (state, vi, old_result - 1, n_key_u32s);
+    }
+  ASSERT (h->n_elts >= n_elts_unset);
+  h->n_elts -= n_elts_unset;
+}
+
+#pragma GCC pop_options
+
+#endif /* HASH_MEMORY_X86_KERNELS */
+
+/* Search buckets of 4 keys for u32x4 stages. */
 void vhash_init (vhash_t * h, u32 log2_n_keys, u32 n_key_u32,
 		 u32 * hash_seeds);
 
+/* As above with given number of keys per search bucket: 4 or 8
+   (0 means 4).  8 falls back to 4 unless cpu supports 8 lane stages.
+   Tables with 8 keys per bucket must only be used via vhash8_* stages
+   or vhash_main_*. */
+void vhash_init_keys_per_bucket (vhash_t * h, u32 log2_n_keys, u32 n_key_u32,
+				 u32 * hash_seeds, u32 keys_per_bucket);
+
 void vhash_resize (vhash_t * old, u32 log2_n_keys);
 
+/* Bucket fill and overflow bucket statistics. */
+u8 * format_vhash (u8 * s, va_list * va);
+
 typedef struct {
   vhash_t * vhash;
 
@@ -702,9 +1279,17 @@ typedef struct {
   u32 n_vectors_div_4;
   u32 n_vectors_mod_4;
 
+  /* Same for 8 lane stages. */
+  u32 n_vectors_div_8;
+  u32 n_vectors_mod_8;
+
   u32 n_key_u32;
 
   u32 n_keys;
+
+  /* Incremental resize started by vhash_main_set when too many keys
+     overflow.  Zero when not resizing. */
+  struct vhash_resize_t * resize;
 } vhash_main_t;
 
 always_inline u32
@@ -799,14 +1384,91 @@ vhash_unset_fetch_old_result (vhash_main_t * vm, u32 vi)
 
 void vhash_main_unset (vhash_main_t * vm);
 
-typedef struct {
+typedef struct vhash_resize_t {
   vhash_main_t new;
 
   vhash_t * old;
+
+  /* Next old table vector index to move to new table. */
+  u32 vector_index;
+
+  /* Keys not found in new table during resize are looked up in old. */
+  vhash_main_t old_get;
+  u32 * old_get_indices;
+
+  /* Results saved for applying set/unset to both tables. */
+  u32 * results;
 } vhash_resize_t;
 
 u32 vhash_resize_incremental (vhash_resize_t * vr, u32 vector_index, u32 n_vectors);
 
+/* While automatic resize is in progress sets and unsets are applied to
+   both tables and each set moves this many old table keys per key set
+   (at least VHASH_RESIZE_MIN_KEYS_PER_STEP).  Gets try new table
+   first. */
+#define VHASH_RESIZE_KEYS_PER_SET_KEY 4
+#define VHASH_RESIZE_MIN_KEYS_PER_STEP 256
+
+/* Fingerprint mode for long keys: search buckets hold only a 32 bit
+   hash (fingerprint) of each key so lookups stay on the vector fast
+   path for keys of any length.  Full keys are kept out of line and
+   verified after lookup.  Keys with equal fingerprints are chained. */
+typedef struct {
+  /* User result for this key. */
+  u32 result;
+
+  /* Next entry with same fingerprint or ~0 for end of chain. */
+  u32 next;
+} vhash_fingerprint_entry_t;
+
+typedef struct {
+  /* Maps fingerprint to index of first entry of chain.  First entry
+     keeps its index until chain becomes empty. */
+  vhash_t vhash;
+
+  /* Lookup of fingerprints in vhash. */
+  vhash_main_t vm;
+
+  /* Pool of entries.  Key for entry I starts at keys[I * n_key_u32]. */
+  vhash_fingerprint_entry_t * entries;
+  u32 * keys;
+
+  /* Number of 32 bit words in a key. */
+  u32 n_key_u32;
+
+  /* Number of keys in table. */
+  u32 n_elts;
+
+  /* Jenkins hash seeds for fingerprints. */
+  u32 hash_seeds[3];
+
+  /* Normally ~0; tests use small masks to force long chains. */
+  u32 fingerprint_mask;
+
+  /* Keys whose fingerprints are set in vhash and their new entries. */
+  u32 * key_indices;
+  u32 * entry_indices;
+} vhash_fingerprint_t;
+
+always_inline uword
+vhash_fingerprint_elts (vhash_fingerprint_t * f)
+{ return f->n_elts; }
+
+void vhash_fingerprint_init (vhash_fingerprint_t * f, u32 log2_n_keys,
+			     u32 n_key_u32, u32 * hash_seeds);
+void vhash_fingerprint_free (vhash_fingerprint_t * f);
+
+/* Keys are N_KEYS keys of n_key_u32 words each.  Results are as for
+   vhash_main_get/set/unset: get returns results (~0 when not found);
+   set takes new results and returns old ones; unset returns old
+   results. */
+void vhash_fingerprint_get (vhash_fingerprint_t * f, u32 * keys, u32 n_keys,
+			    u32 * results);
+void vhash_fingerprint_set (vhash_fingerprint_t * f, u32 * keys, u32 n_keys,
+			    u32 * results);
+void vhash_fingerprint_unset (vhash_fingerprint_t * f, u32 * keys, u32 n_keys,
+			      u32 * results);
+
 #endif /* CLIB_VECTOR_WORD_BITS > 0 */
 
 #endif /* included_clib_vhash_h */